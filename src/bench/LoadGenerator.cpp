@@ -0,0 +1,520 @@
+// Load generator implementation
+
+#include "LoadGenerator.h"
+#include "common/Protocol.h"
+#include "common/LocalTransport.h"
+#include "server/Server.h"
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace {
+    // How long the server may take to start listening before the run is abandoned
+    constexpr int kConnectAttempts = 200;
+    constexpr int kConnectRetryMs = 10;
+
+    // After the last scheduled send, receivers keep reading this long for messages still in flight
+    constexpr uint64_t kDrainNs = 1000000000;
+
+    // Maximum events handled per epoll_wait() call of a driver thread
+    constexpr int kMaxEvents = 256;
+
+    // Size of the send time embedded at the start of every message text
+    constexpr size_t kTimestampSize = 8;
+
+    /**
+     * Reads the monotonic clock shared by every thread of the process
+     * @return Nanoseconds since an arbitrary fixed point
+     */
+    uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * Reads the host-wide number of TCP segments sent (OutSegs in /proc/net/snmp)
+     * @return Segment count, or 0 if it cannot be read
+     */
+    uint64_t tcp_segments_sent() {
+        std::ifstream snmp("/proc/net/snmp");
+        std::string header;
+        std::string values;
+        while (std::getline(snmp, header) && std::getline(snmp, values)) {
+            if (header.compare(0, 4, "Tcp:") != 0) {
+                continue;
+            }
+            // The first line names the columns, the second holds their values in the same order
+            std::istringstream names(header);
+            std::istringstream numbers(values);
+            std::string name;
+            std::string number;
+            while (names >> name && numbers >> number) {
+                if (name == "OutSegs") {
+                    return std::strtoull(number.c_str(), nullptr, 10);
+                }
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Stores a 64-bit integer in big-endian byte order
+     */
+    void write_u64(char* out, uint64_t value) {
+        for (int i = 7; i >= 0; --i) {
+            out[i] = static_cast<char>(value & 0xFF);
+            value >>= 8;
+        }
+    }
+}
+
+/**
+ * One simulated chat client
+ * Its outgoing frame is encoded once up front; every send only patches in the timestamp
+ */
+struct LoadGenerator::SimulatedClient {
+    // Non-blocking socket connected to the server (for an in-process client, its endpoint's fd)
+    int socket;
+
+    // Client end of an in-process connection, used instead of the socket (nullptr over TCP)
+    std::unique_ptr<LocalEndpoint> local;
+
+    // Incoming bytes and the parser splitting them into frames
+    RingBuffer inbound;
+    FrameParser parser;
+
+    // Complete frame this client sends over and over
+    std::string frame;
+
+    // Position of the embedded timestamp inside frame
+    size_t timestamp_offset;
+
+    // Other clients in the same room, i.e. how many copies the server should deliver per message
+    uint64_t recipients;
+
+    // Bytes the socket did not accept yet, starting at pending_offset
+    std::string pending;
+    size_t pending_offset;
+
+    // Whether EPOLLOUT is currently requested for the socket (in-process: whether output is stuck)
+    bool waiting_writable;
+
+    // Scheduled time (ns) of the next message
+    uint64_t next_send;
+
+    // Time by which held-back messages must be sent when batching (0 = nothing held back)
+    uint64_t batch_due;
+
+    explicit SimulatedClient(int socket)
+        : socket(socket), inbound(kReceiveBufferSize), timestamp_offset(0), recipients(0),
+          pending_offset(0), waiting_writable(false), next_send(0), batch_due(0) {}
+
+    /**
+     * Sends without blocking over whichever transport the client uses
+     */
+    ssize_t send_bytes(const char* data, size_t length) {
+        return local ? local->write(data, length) : send(socket, data, length, MSG_NOSIGNAL);
+    }
+
+    /**
+     * Reads without blocking over whichever transport the client uses
+     */
+    ssize_t receive(const struct iovec* segments, int count) {
+        return local ? local->readv(segments, count) : readv(socket, segments, count);
+    }
+
+    /**
+     * Closes the connection; the server sees the client disconnect
+     */
+    void close_connection() {
+        if (local) {
+            local.reset();
+        } else if (socket >= 0) {
+            close(socket);
+        }
+        socket = -1;
+    }
+};
+
+/**
+ * Constructor: Only stores the configuration; sockets are opened by run()
+ */
+LoadGenerator::LoadGenerator(const LoadConfig& config) : config(config) {}
+
+/**
+ * Destructor: Closes every client so the server sees them disconnect
+ */
+LoadGenerator::~LoadGenerator() {
+    for (auto& client : clients) {
+        client->close_connection();
+    }
+}
+
+/**
+ * ECONNREFUSED is retried because the server under test may be started right before the run
+ */
+int LoadGenerator::connect_client() {
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.host.c_str(), &server_addr.sin_addr) <= 0) {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < kConnectAttempts; ++attempt) {
+        int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (client_socket < 0) {
+            return -1;
+        }
+        if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == 0) {
+            return client_socket;
+        }
+        int error = errno;
+        close(client_socket);
+        if (error != ECONNREFUSED) {
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kConnectRetryMs));
+    }
+    return -1;
+}
+
+/**
+ * Connects and prepares every client, then splits them evenly over the driver threads
+ */
+LoadResult LoadGenerator::run() {
+    size_t room_count = config.rooms > 0 ? config.rooms : 1;
+    size_t text_size = config.message_size > kTimestampSize ? config.message_size : kTimestampSize;
+
+    for (size_t i = 0; i < config.clients; ++i) {
+        std::unique_ptr<LocalEndpoint> endpoint;
+        int client_socket;
+        if (config.server) {
+            endpoint = config.server->connect_local();
+            client_socket = endpoint->fd();
+        } else {
+            client_socket = connect_client();
+            if (client_socket < 0) {
+                throw std::runtime_error("Failed to connect simulated client to " + config.host + ":" +
+                                         std::to_string(config.port));
+            }
+            // Small frames must leave immediately, otherwise Nagle's algorithm dominates the latency
+            int enable = 1;
+            setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+        clients.push_back(std::make_unique<SimulatedClient>(client_socket));
+        SimulatedClient& client = *clients.back();
+        client.local = std::move(endpoint);
+
+        // Room members are i, i + room_count, i + 2 * room_count, ...
+        size_t room = i % room_count;
+        uint64_t members = config.clients / room_count + (room < config.clients % room_count ? 1 : 0);
+        client.recipients = members - 1;
+
+        std::string text(text_size, 'x');
+        if (room_count == 1) {
+            append_frame(client.frame, MessageType::Chat, 0, 0, text.data(), text.size());
+            client.timestamp_offset = kFrameHeaderSize;
+        } else {
+            // Joined while the socket is still blocking (or the in-process ring still empty), so the
+            // request is fully sent
+            std::string name = "bench-" + std::to_string(room);
+            append_frame(client.pending, MessageType::Join, 0, 0, name.data(), name.size());
+            if (client.send_bytes(client.pending.data(), client.pending.size()) !=
+                static_cast<ssize_t>(client.pending.size())) {
+                throw std::runtime_error("Failed to join benchmark room");
+            }
+            client.pending.clear();
+
+            std::string payload = encode_room_payload(name, text);
+            append_frame(client.frame, MessageType::RoomMessage, 0, 0, payload.data(), payload.size());
+            client.timestamp_offset = kFrameHeaderSize + payload.size() - text.size();
+        }
+
+        if (!client.local) {
+            fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL, 0) | O_NONBLOCK);
+        }
+    }
+
+    // Every thread uses the same start time so the schedule is identical no matter how it is split
+    size_t thread_count = config.threads > 0 ? config.threads : 1;
+    if (thread_count > clients.size()) {
+        thread_count = clients.size() > 0 ? clients.size() : 1;
+    }
+    std::vector<LoadResult> partial(thread_count);
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns();
+    for (size_t t = 0; t < thread_count; ++t) {
+        size_t first = clients.size() * t / thread_count;
+        size_t last = clients.size() * (t + 1) / thread_count;
+        threads.emplace_back(&LoadGenerator::drive, this, first, last, start, std::ref(partial[t]));
+    }
+
+    // Count the segments sent while the measured messages are being sent
+    uint64_t measure_start = start + static_cast<uint64_t>(config.warmup * 1e9);
+    uint64_t send_end = measure_start + static_cast<uint64_t>(config.duration * 1e9);
+    auto sleep_until = [](uint64_t time) {
+        uint64_t now = now_ns();
+        if (now < time) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(time - now));
+        }
+    };
+    sleep_until(measure_start);
+    uint64_t segments_before = tcp_segments_sent();
+    sleep_until(send_end);
+    uint64_t segments_after = tcp_segments_sent();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LoadResult result;
+    result.seconds = config.duration;
+    for (const LoadResult& part : partial) {
+        result.sent += part.sent;
+        result.expected += part.expected;
+        result.delivered += part.delivered;
+        result.notices += part.notices;
+        result.disconnects += part.disconnects;
+        result.latency.merge(part.latency);
+    }
+    if (!config.server && segments_before > 0 && segments_after > segments_before) {
+        result.segments = segments_after - segments_before;
+    }
+    return result;
+}
+
+/**
+ * Event loop of one driver thread
+ *
+ * Each iteration sends every message that has come due, then sleeps in epoll_wait() until the next
+ * one is due or a socket has something to read. Clients start at evenly staggered offsets so the
+ * load arrives as a steady stream rather than in bursts. Only messages scheduled inside the measured
+ * interval are counted; the warmup and the final drain just keep the pipeline realistic.
+ */
+void LoadGenerator::drive(size_t first, size_t last, uint64_t start, LoadResult& result) {
+    uint64_t interval = static_cast<uint64_t>(1e9 / config.rate);
+    if (interval == 0) {
+        interval = 1;
+    }
+    uint64_t measure_start = start + static_cast<uint64_t>(config.warmup * 1e9);
+    uint64_t send_end = measure_start + static_cast<uint64_t>(config.duration * 1e9);
+    uint64_t drain_end = send_end + kDrainNs;
+    uint64_t batch_delay = static_cast<uint64_t>(config.batch_delay_us) * 1000;
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        return;
+    }
+    size_t open_clients = 0;
+    for (size_t i = first; i < last; ++i) {
+        SimulatedClient& client = *clients[i];
+        client.next_send = start + interval * i / clients.size();
+        struct epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = &client;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.socket, &event) == 0) {
+            ++open_clients;
+        }
+    }
+
+    // Writes as much of a client's pending bytes as the socket takes; false if the connection failed
+    auto flush = [epoll_fd](SimulatedClient& client) {
+        while (client.pending_offset < client.pending.size()) {
+            ssize_t bytes_sent = client.send_bytes(client.pending.data() + client.pending_offset,
+                                                   client.pending.size() - client.pending_offset);
+            if (bytes_sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return false;
+                }
+                break;
+            }
+            client.pending_offset += bytes_sent;
+        }
+        if (client.pending_offset == client.pending.size()) {
+            client.pending.clear();
+            client.pending_offset = 0;
+        }
+
+        // Only ask for writability while something is actually stuck
+        // (an in-process connection reports room in its ring through the same EPOLLIN)
+        bool blocked = !client.pending.empty();
+        if (blocked != client.waiting_writable) {
+            if (!client.local) {
+                struct epoll_event event{};
+                event.events = EPOLLIN | (blocked ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+                event.data.ptr = &client;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.socket, &event);
+            }
+            client.waiting_writable = blocked;
+        }
+        return true;
+    };
+
+    auto disconnect = [&](SimulatedClient& client) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client.socket, nullptr);
+        client.close_connection();
+        ++result.disconnects;
+        --open_clients;
+    };
+
+    struct epoll_event events[kMaxEvents];
+    while (open_clients > 0) {
+        uint64_t now = now_ns();
+        if (now >= drain_end) {
+            break;
+        }
+
+        // Send everything that has come due; a client that fell behind catches up in one batch
+        uint64_t next_due = drain_end;
+        uint64_t next_batch_due = drain_end;
+        if (now < send_end + batch_delay) {
+            for (size_t i = first; i < last; ++i) {
+                SimulatedClient& client = *clients[i];
+                if (client.socket < 0) {
+                    continue;
+                }
+                bool queued = false;
+                while (client.next_send <= now && client.next_send < send_end) {
+                    if (batch_delay > 0 && client.batch_due == 0) {
+                        client.batch_due = client.next_send + batch_delay;
+                    }
+                    write_u64(&client.frame[client.timestamp_offset], client.next_send);
+                    client.pending.append(client.frame);
+                    if (client.next_send >= measure_start) {
+                        ++result.sent;
+                        result.expected += client.recipients;
+                    }
+                    client.next_send += interval;
+                    queued = true;
+                }
+                if (client.batch_due != 0) {
+                    // Held back until the batch is full, its delay ran out or no more messages follow
+                    if (now < client.batch_due && client.next_send < send_end &&
+                        client.pending.size() - client.pending_offset < config.batch_bytes) {
+                        queued = false;
+                        if (client.batch_due < next_batch_due) {
+                            next_batch_due = client.batch_due;
+                        }
+                    } else {
+                        client.batch_due = 0;
+                        queued = true;
+                    }
+                }
+                if (queued && !flush(client)) {
+                    disconnect(client);
+                    continue;
+                }
+                if (client.next_send < next_due) {
+                    next_due = client.next_send;
+                }
+            }
+        }
+
+        // Sleep until the next message is due; sub-millisecond waits become a quick poll
+        // Held-back batches may leave a little late instead, so waiting for them never busy-polls
+        // Both deadlines may already have passed (a client past send_end, an overdue batch), so
+        // they are clamped to now before the unsigned subtraction
+        uint64_t wait = next_due > now ? next_due - now : 0;
+        uint64_t batch_wait = next_batch_due > now ? next_batch_due - now : 0;
+        int timeout_ms = static_cast<int>(std::min(wait / 1000000, (batch_wait + 999999) / 1000000));
+        int event_count = epoll_wait(epoll_fd, events, kMaxEvents, timeout_ms);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int e = 0; e < event_count; ++e) {
+            SimulatedClient& client = *static_cast<SimulatedClient*>(events[e].data.ptr);
+            if (client.socket < 0) {
+                continue;
+            }
+            if (client.local) {
+                // Acknowledged before draining; stuck output may fit now that the server read some
+                client.local->rearm();
+                if (client.waiting_writable && !flush(client)) {
+                    disconnect(client);
+                    continue;
+                }
+            } else if ((events[e].events & EPOLLOUT) && !flush(client)) {
+                disconnect(client);
+                continue;
+            }
+            if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                continue;
+            }
+
+            // Drain the socket, parsing frames as the ring fills
+            bool closed = false;
+            while (true) {
+                struct iovec segments[2];
+                int segment_count = client.inbound.free_segments(segments);
+                ssize_t bytes_read = client.receive(segments, segment_count);
+                if (bytes_read < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if (bytes_read <= 0) {
+                    closed = true;
+                    break;
+                }
+                client.inbound.commit(bytes_read);
+
+                uint64_t received = now_ns();
+                Frame frame;
+                ParseStatus status;
+                while ((status = client.parser.next(client.inbound, frame)) == ParseStatus::Ready) {
+                    // Chat texts start right away, room texts after the [u8 length][name] prefix
+                    size_t offset = 0;
+                    if (frame.header.type == MessageType::RoomMessage && frame.payload_size() > 0) {
+                        char name_length;
+                        frame.read(0, &name_length, 1);
+                        offset = 1 + static_cast<unsigned char>(name_length);
+                    }
+                    if (frame.header.type == MessageType::Notice) {
+                        ++result.notices;
+                    } else if ((frame.header.type == MessageType::Chat ||
+                                frame.header.type == MessageType::RoomMessage) &&
+                               frame.payload_size() >= offset + kTimestampSize) {
+                        char stamp[kTimestampSize];
+                        frame.read(offset, stamp, kTimestampSize);
+                        uint64_t scheduled = read_u64(stamp);
+                        if (scheduled >= measure_start && scheduled < send_end) {
+                            ++result.delivered;
+                            result.latency.record(received > scheduled ? received - scheduled : 0);
+                        }
+                    }
+                    client.parser.release(client.inbound, frame);
+                }
+                if (status == ParseStatus::Invalid) {
+                    closed = true;
+                    break;
+                }
+            }
+            if (closed) {
+                disconnect(client);
+            }
+        }
+    }
+    close(epoll_fd);
+}
@@ -0,0 +1,144 @@
+// Load generator used by the quickchat_bench executable
+// Simulates many chat clients from a few threads and measures end-to-end delivery latency
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "common/Histogram.h"
+
+class Server;
+
+/**
+ * Shape of the load applied to a server
+ */
+struct LoadConfig {
+    // Address of the server under test
+    std::string host = "127.0.0.1";
+    int port = 9090;
+
+    // In-process server to connect to with Server::connect_local() instead of TCP (nullptr = use
+    // host and port); takes the kernel out of the measurement, leaving the server's routing cost
+    Server* server = nullptr;
+
+    // Number of simulated clients, all connected for the whole run
+    size_t clients = 100;
+
+    // Clients are spread round-robin over this many rooms; with 1 everyone talks in the default room
+    size_t rooms = 1;
+
+    // Messages per second sent by every client
+    double rate = 10.0;
+
+    // Payload size of every message in bytes (at least room for the embedded timestamp)
+    size_t message_size = 64;
+
+    // Seconds of traffic before measuring starts (lets connections and joins settle)
+    double warmup = 1.0;
+
+    // Seconds of measured traffic
+    double duration = 10.0;
+
+    // Threads driving the simulated clients
+    size_t threads = 2;
+
+    // Client-side write coalescing: a client's due messages are held back for up to this long so
+    // that later ones join the same send() (0 = send every message as soon as it is due)
+    int batch_delay_us = 0;
+
+    // Held-back bytes that make a client send without waiting for batch_delay_us
+    size_t batch_bytes = 16 * 1024;
+};
+
+/**
+ * Outcome of one run; counts only cover messages sent during the measured interval
+ */
+struct LoadResult {
+    // Messages sent by all clients together
+    uint64_t sent = 0;
+
+    // Copies the server should have delivered (each message goes to every other member of its room)
+    uint64_t expected = 0;
+
+    // Copies actually received by the simulated clients
+    uint64_t delivered = 0;
+
+    // Notice frames received (e.g. complaints about invalid requests)
+    uint64_t notices = 0;
+
+    // Connections the server closed during the run
+    uint64_t disconnects = 0;
+
+    // Length of the measured interval in seconds
+    double seconds = 0.0;
+
+    // TCP segments sent by the whole host during the measured interval (0 if /proc is unavailable,
+    // or with in-process connections); covers both directions on loopback, and divided by
+    // delivered it shows how well writes coalesce
+    uint64_t segments = 0;
+
+    // Time from the moment a message was due to be sent until a recipient had parsed it, in nanoseconds
+    Histogram latency;
+};
+
+/**
+ * Open-loop load generator built on non-blocking sockets (or in-process connections) and one epoll
+ * loop per thread
+ *
+ * Every client sends on a fixed schedule regardless of how fast the server answers, and each
+ * message carries the time it was scheduled for. Latency is measured against that scheduled time,
+ * so a server (or driver thread) that falls behind shows up as higher latency instead of silently
+ * lowering the offered load.
+ */
+class LoadGenerator {
+    private:
+        // State of one simulated client; defined in LoadGenerator.cpp
+        struct SimulatedClient;
+
+        // Settings of the run
+        LoadConfig config;
+
+        // Every connected client; the driver threads split them by index
+        std::vector<std::unique_ptr<SimulatedClient>> clients;
+
+        /**
+         * Opens one connection, retrying briefly while the server is still starting up
+         * @return Connected blocking socket, or -1 if the server cannot be reached
+         */
+        int connect_client();
+
+        /**
+         * Runs the event loop of one driver thread until the run is over
+         * @param first Index of the first client driven by this thread
+         * @param last One past the index of the last client driven by this thread
+         * @param start Steady clock time (ns) at which every client starts sending
+         * @param result Receives this thread's counters and latencies
+         */
+        void drive(size_t first, size_t last, uint64_t start, LoadResult& result);
+
+    public:
+        /**
+         * Stores the configuration; nothing is connected until run() is called
+         * @param config Load to apply
+         */
+        explicit LoadGenerator(const LoadConfig& config);
+
+        /**
+         * Closes every simulated client
+         */
+        ~LoadGenerator();
+
+        LoadGenerator(const LoadGenerator&) = delete;
+        LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+        /**
+         * Connects the clients, applies the load for warmup + duration seconds and collects the results
+         * Blocks for the whole run
+         * @return Combined counters and latency histogram of every driver thread
+         * @throws std::runtime_error if the clients cannot connect to the server (or config.server
+         *         does not support in-process connections)
+         */
+        LoadResult run();
+};
@@ -0,0 +1,300 @@
+// Benchmark entry point: applies a synthetic chat load to the server and reports throughput and latency
+// By default an in-process server is started for each requested engine so the modes can be compared
+// Usage: ./quickchat_bench [threaded|epoll|sharded [threads] ...] [--option value ...]
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "bench/LoadGenerator.h"
+#include "server/Server.h"
+
+namespace {
+    /**
+     * One server configuration to measure
+     */
+    struct BenchTarget {
+        std::string label;
+        ServerConfig config;
+    };
+
+    /**
+     * Parses a strictly positive integer command-line value
+     * @param text Argument text
+     * @param value Receives the parsed number
+     * @return false if the text is not a positive integer
+     */
+    bool parse_count(const std::string& text, size_t& value) {
+        char* end = nullptr;
+        unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || parsed == 0) {
+            return false;
+        }
+        value = static_cast<size_t>(parsed);
+        return true;
+    }
+
+    /**
+     * Parses a non-negative decimal command-line value
+     * @param text Argument text
+     * @param value Receives the parsed number
+     * @return false if the text is not a number or is negative
+     */
+    bool parse_number(const std::string& text, double& value) {
+        char* end = nullptr;
+        double parsed = std::strtod(text.c_str(), &end);
+        if (text.empty() || *end != '\0' || parsed < 0) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    }
+
+    /**
+     * Fills the load and the list of servers to measure from the command line
+     * Engine names work like "./quickchat server"; several may be given to run them one after another
+     * @return true on success, false (after printing the problem) on invalid arguments
+     */
+    bool parse_arguments(int argc, char* argv[], LoadConfig& load, std::vector<BenchTarget>& targets,
+                         bool& external, bool& local) {
+        ServerConfig base;
+        base.port = load.port;
+        int index = 1;
+
+        std::vector<std::pair<ServerMode, size_t>> engines;
+        while (index < argc && argv[index][0] != '-') {
+            std::string engine = argv[index++];
+            size_t threads = 0;
+            if (engine == "threaded") {
+                engines.emplace_back(ServerMode::Threaded, 0);
+            } else if (engine == "epoll") {
+                engines.emplace_back(ServerMode::Epoll, 0);
+            } else if (engine == "sharded") {
+                if (index < argc && argv[index][0] != '-' && parse_count(argv[index], threads)) {
+                    ++index;
+                }
+                engines.emplace_back(ServerMode::Sharded, threads);
+            } else {
+                std::cerr << "Unknown server mode: " << engine << std::endl;
+                return false;
+            }
+        }
+
+        while (index < argc) {
+            std::string option = argv[index];
+            if (index + 1 >= argc) {
+                std::cerr << "Missing value for " << option << std::endl;
+                return false;
+            }
+            std::string value = argv[index + 1];
+            index += 2;
+
+            bool valid = true;
+            size_t number = 0;
+            if (option == "--clients") {
+                valid = parse_count(value, load.clients);
+            } else if (option == "--rooms") {
+                valid = parse_count(value, load.rooms);
+            } else if (option == "--rate") {
+                valid = parse_number(value, load.rate) && load.rate > 0;
+            } else if (option == "--size") {
+                valid = parse_count(value, load.message_size) && load.message_size <= kMaxPayloadSize - 1 - kMaxRoomNameLength;
+            } else if (option == "--duration") {
+                valid = parse_number(value, load.duration) && load.duration > 0;
+            } else if (option == "--warmup") {
+                valid = parse_number(value, load.warmup);
+            } else if (option == "--driver-threads") {
+                valid = parse_count(value, load.threads);
+            } else if (option == "--batch-delay-us") {
+                valid = parse_count(value, number) && number <= 1000 * 1000;
+                load.batch_delay_us = static_cast<int>(number);
+            } else if (option == "--batch-bytes") {
+                valid = parse_count(value, load.batch_bytes);
+            } else if (option == "--flush-delay-us") {
+                valid = parse_count(value, number) && number <= 1000 * 1000;
+                base.flush_delay_us = static_cast<int>(number);
+            } else if (option == "--flush-bytes") {
+                valid = parse_count(value, base.flush_bytes);
+            } else if (option == "--port") {
+                valid = parse_count(value, number) && number <= 65535;
+                load.port = static_cast<int>(number);
+                base.port = load.port;
+            } else if (option == "--connect") {
+                // Measure an already running server instead of starting one
+                load.host = value;
+                external = true;
+            } else if (option == "--transport") {
+                valid = value == "tcp" || value == "local";
+                local = value == "local";
+            } else if (option == "--io") {
+                if (value == "epoll") {
+                    base.io_backend = IoBackend::Epoll;
+                } else if (value == "uring") {
+                    base.io_backend = IoBackend::Uring;
+                } else {
+                    valid = false;
+                }
+            } else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return false;
+            }
+
+            if (!valid) {
+                std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+                return false;
+            }
+        }
+
+        if (engines.empty()) {
+            engines.emplace_back(ServerMode::Epoll, 0);
+        }
+        if (local) {
+            // In-process connections are served by the epoll reactors only
+            bool threaded = std::any_of(engines.begin(), engines.end(),
+                                        [](const auto& engine) { return engine.first == ServerMode::Threaded; });
+            if (external || threaded || base.io_backend == IoBackend::Uring) {
+                std::cerr << "--transport local needs in-process epoll or sharded servers with --io epoll" << std::endl;
+                return false;
+            }
+        }
+        for (const auto& engine : engines) {
+            BenchTarget target{"", base};
+            target.config.mode = engine.first;
+            target.config.threads = engine.second;
+            switch (engine.first) {
+                case ServerMode::Threaded: target.label = "threaded"; break;
+                case ServerMode::Epoll: target.label = "epoll"; break;
+                case ServerMode::Sharded:
+                    target.label = engine.second > 0 ? "sharded/" + std::to_string(engine.second) : "sharded";
+                    break;
+            }
+            if (engine.first != ServerMode::Threaded && base.io_backend == IoBackend::Uring) {
+                target.label += "+uring";
+            }
+            if (local) {
+                target.label += "+local";
+            }
+            targets.push_back(target);
+        }
+        return true;
+    }
+
+    /**
+     * Prints the column headings of the result table
+     */
+    void print_header() {
+        std::cout << std::left << std::setw(18) << "server" << std::right
+                  << std::setw(12) << "sent/s" << std::setw(14) << "delivered/s" << std::setw(10) << "loss %"
+                  << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p999 us"
+                  << std::setw(10) << "max us" << std::setw(10) << "segs/msg" << std::endl;
+    }
+
+    /**
+     * Prints one row of the result table
+     * @param label Name of the measured server configuration
+     * @param result Outcome of its run
+     */
+    void print_result(const std::string& label, const LoadResult& result) {
+        double loss = result.expected > 0
+            ? 100.0 * static_cast<double>(result.expected - std::min(result.delivered, result.expected)) / result.expected
+            : 0.0;
+        auto micros = [](uint64_t nanoseconds) { return nanoseconds / 1000.0; };
+
+        std::cout << std::left << std::setw(18) << label << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(12) << result.sent / result.seconds
+                  << std::setw(14) << result.delivered / result.seconds
+                  << std::setprecision(2) << std::setw(10) << loss
+                  << std::setprecision(1)
+                  << std::setw(10) << micros(result.latency.percentile(50))
+                  << std::setw(10) << micros(result.latency.percentile(99))
+                  << std::setw(10) << micros(result.latency.percentile(99.9))
+                  << std::setw(10) << micros(result.latency.max())
+                  << std::setprecision(2) << std::setw(10)
+                  << (result.delivered > 0 ? static_cast<double>(result.segments) / result.delivered : 0.0)
+                  << std::endl;
+        if (result.disconnects > 0 || result.notices > 0) {
+            std::cout << "  " << result.disconnects << " clients disconnected, "
+                      << result.notices << " notices received" << std::endl;
+        }
+    }
+}
+
+/**
+ * Runs the benchmark once per requested server engine and prints a table of the results
+ *
+ * @param argc Number of command-line arguments
+ * @param argv Engines to compare ("threaded", "epoll", "sharded [threads]"; default "epoll")
+ *             followed by optional "--option value" pairs:
+ *               --clients N          simulated clients (default 100)
+ *               --rooms N            spread the clients over N rooms (default 1: everyone in the lobby)
+ *               --rate N             messages per second per client (default 10)
+ *               --size N             message text size in bytes (default 64)
+ *               --duration N         measured seconds (default 10)
+ *               --warmup N           unmeasured seconds before that (default 1)
+ *               --driver-threads N   load generator threads (default 2)
+ *               --port N             server port (default 9090)
+ *               --io epoll|uring     I/O backend of the in-process event loop servers
+ *               --batch-delay-us N   hold each client's messages up to N us to send them together
+ *               --batch-bytes N      ...unless N bytes are held back (default 16384)
+ *               --flush-delay-us N   let the in-process server coalesce output for up to N us
+ *               --flush-bytes N      ...unless N bytes are queued for a client (default 16384)
+ *               --connect HOST       measure a server already running on HOST instead
+ *               --transport tcp|local  connect the clients over TCP (default) or in-process, which
+ *                                    leaves out the kernel and measures the server's own cost
+ * @return 0 on success, 1 on error
+ */
+int main(int argc, char* argv[]) {
+    LoadConfig load;
+    std::vector<BenchTarget> targets;
+    bool external = false;
+    bool local = false;
+    if (!parse_arguments(argc, argv, load, targets, external, local)) {
+        return 1;
+    }
+
+    std::cout << load.clients << " clients in " << load.rooms << " room(s), " << load.rate
+              << " msg/s each, " << load.message_size << " byte messages, "
+              << load.duration << " s measured after " << load.warmup << " s warmup" << std::endl;
+
+    try {
+        if (external) {
+            LoadResult result = LoadGenerator(load).run();
+            print_header();
+            print_result(load.host + ":" + std::to_string(load.port), result);
+            return 0;
+        }
+
+        std::vector<std::pair<std::string, LoadResult>> results;
+        for (const BenchTarget& target : targets) {
+            Server server(target.config);
+            std::thread server_thread(&Server::start, &server);
+
+            LoadResult result;
+            try {
+                // The generator is destroyed (closing every client) before the server stops
+                LoadConfig target_load = load;
+                target_load.server = local ? &server : nullptr;
+                result = LoadGenerator(target_load).run();
+            } catch (...) {
+                server.stop();
+                server_thread.join();
+                throw;
+            }
+            server.stop();
+            server_thread.join();
+            results.emplace_back(target.label, result);
+        }
+
+        print_header();
+        for (const auto& entry : results) {
+            print_result(entry.first, entry.second);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
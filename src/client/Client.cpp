@@ -1,16 +1,38 @@
 // Chat Client implementation
 
 #include "Client.h"
+#include "common/Protocol.h"
+#include "common/Compression.h"
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
+#include <cerrno>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+namespace {
+    /**
+     * Names a frame's sender the way /dm expects it; senders on another node of a federation
+     * cannot be messaged directly, so they are shown apart
+     */
+    std::string sender_name(uint32_t sender_id) {
+        if (sender_id & kRelayedSenderBit) {
+            return "remote user " + std::to_string(sender_id & ~kRelayedSenderBit);
+        }
+        return "user " + std::to_string(sender_id);
+    }
+}
 
 /**
  * Constructor: Creates a TCP socket for communication with the server
  * Initializes the client in a non-running state
  */
-Client::Client() : running(false) {
+Client::Client()
+    : local_wake(-1), running(false), next_sequence(0), batch_delay(0), batch_bytes(0), batch_failed(false),
+      batch_stopping(false), compression_requested(false), compress_sends(false) {
     // Create a TCP socket using IPv4 (AF_INET) and stream protocol (SOCK_STREAM)
     // This socket will be used to establish connection with the server
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -25,6 +47,9 @@ Client::Client() : running(false) {
 Client::~Client() {
     disconnect(); // Gracefully disconnect from server and stop threads
     close(client_socket); // Close the socket file descriptor to free system resources
+    if (local_wake >= 0) {
+        close(local_wake);
+    }
 }
 
 /**
@@ -49,13 +74,49 @@ bool Client::connect(const std::string& server_address, int port) {
         return false; // Connection failed (server might be down or unreachable)
     }
 
+    // Frames are written as soon as they are complete (or batched here), so Nagle's algorithm
+    // would only add delay
+    int enable = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
     // Connection successful - start the client's operations
+    start();
+    return true;
+}
+
+/**
+ * The endpoint stands in for the socket; its notification fd is only ever watched by the receive
+ * thread, which also finishes writes the ring had no room for
+ */
+bool Client::connect_local(std::unique_ptr<LocalEndpoint> endpoint) {
+    if (!endpoint) {
+        return false;
+    }
+    if (local_wake < 0) {
+        local_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (local_wake < 0) {
+            throw std::runtime_error("Failed to create client wake-up eventfd");
+        }
+    }
+    local = std::move(endpoint);
+    start();
+    return true;
+}
+
+void Client::start() {
     running = true;
     
     // Create a separate thread to handle incoming messages from the server
     // This allows simultaneous sending (main thread) and receiving (background thread)
     receive_thread = std::thread(&Client::receive_messages, this);
-    return true;
+    if (batch_bytes > 0) {
+        batch_stopping = false;
+        batch_thread = std::thread(&Client::run_batching, this);
+    }
+    if (compression_requested) {
+        char method = static_cast<char>(CompressionMethod::Deflate);
+        send_frame(MessageType::Compression, std::string_view(&method, 1));
+    }
 }
 
 /**
@@ -63,24 +124,227 @@ bool Client::connect(const std::string& server_address, int port) {
  * Ensures proper cleanup of threads and resources
  */
 void Client::disconnect() {
+    // Send what is still batched, then stop the batching thread
+    if (batch_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            send_batch();
+            batch_stopping = true;
+        }
+        batch_waiting.notify_one();
+        batch_thread.join();
+    }
+
     running = false; // Signal the receiving thread to stop
-    
+
     // Wait for the receiving thread to finish its current operation and terminate
     // joinable() checks if the thread is still active and can be joined
     if (receive_thread.joinable()) {
+        if (local) {
+            uint64_t one = 1;
+            ssize_t ignored = write(local_wake, &one, sizeof(one));
+            (void)ignored;
+        } else {
+            // Wake the thread from its blocking read; data already sent is still delivered before the FIN
+            shutdown(client_socket, SHUT_RDWR);
+        }
         receive_thread.join(); // Block until the thread completes
     }
+
+    // Closing the endpoint is the in-process FIN; output the ring still had no room for is lost
+    if (local) {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        flush_local();
+        local.reset();
+        local_output.clear();
+    }
+}
+
+void Client::set_batching(std::chrono::microseconds max_delay, size_t max_bytes) {
+    batch_delay = max_delay;
+    batch_bytes = max_delay.count() > 0 ? (max_bytes > 0 ? max_bytes : 1) : 0;
+}
+
+void Client::set_compression(bool enabled) {
+    compression_requested = enabled && compression_supported();
+}
+
+bool Client::flush() {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    return send_batch();
 }
 
 /**
  * Sends a text message to the server
- * The server will broadcast this message to all other connected clients
+ * The server will deliver this message to all other clients in the default room
  */
 bool Client::send_message(const std::string& message) {
-    // Send the message data over the TCP connection
-    // send() transmits the message bytes to the server
-    // Returns number of bytes sent, or -1 on error
-    return send(client_socket, message.c_str(), message.length(), 0) > 0;
+    return send_frame(MessageType::Chat, message);
+}
+
+/**
+ * Join and Leave frames carry the bare room name as their payload
+ */
+bool Client::join_room(const std::string& room) {
+    return is_valid_room_name(room) && send_frame(MessageType::Join, room);
+}
+
+bool Client::leave_room(const std::string& room) {
+    return is_valid_room_name(room) && send_frame(MessageType::Leave, room);
+}
+
+/**
+ * Prefixes the text with the room name so the server knows where to deliver it
+ */
+bool Client::send_room_message(const std::string& room, const std::string& message) {
+    return is_valid_room_name(room) && send_frame(MessageType::RoomMessage, encode_room_payload(room, message));
+}
+
+/**
+ * Prefixes the text with the recipient's id; the server relays the frame to that user only
+ */
+bool Client::send_direct_message(uint32_t recipient_id, const std::string& message) {
+    return send_frame(MessageType::Direct, encode_direct_payload(recipient_id, message));
+}
+
+/**
+ * The end of the replay is announced with a History frame carrying the last sequence number,
+ * which can be passed to the next request to continue from there
+ */
+bool Client::request_history(const std::string& room, uint64_t since) {
+    return is_valid_room_name(room) && send_frame(MessageType::History, encode_history_payload(room, since));
+}
+
+/**
+ * Frames the payload so the server receives it as exactly one message
+ */
+bool Client::send_frame(MessageType type, std::string_view payload) {
+    if (payload.size() > kMaxPayloadSize) {
+        return false; // The server would reject the frame and drop the connection
+    }
+
+    // The sender id is left at 0; the server fills in the id it assigned to this client
+    // The receive thread sends too (Pongs), so even unbatched frames are sent under batch_mutex
+    bool compress = compress_sends.load();
+    if (batch_bytes == 0) {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        std::string frame;
+        if (compress) {
+            append_compressed_frame(frame, type, 0, ++next_sequence, payload.data(), payload.size());
+        } else {
+            append_frame(frame, type, 0, ++next_sequence, payload.data(), payload.size());
+        }
+        return send_all(frame.data(), frame.size());
+    }
+
+    // Batched: the frame goes out with the batch once it is full or its delay has run out
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    if (batch_failed) {
+        return false;
+    }
+    bool first = batch.empty();
+    if (compress) {
+        append_compressed_frame(batch, type, 0, ++next_sequence, payload.data(), payload.size());
+    } else {
+        append_frame(batch, type, 0, ++next_sequence, payload.data(), payload.size());
+    }
+    if (batch.size() >= batch_bytes) {
+        return send_batch();
+    }
+    if (first) {
+        batch_deadline = std::chrono::steady_clock::now() + batch_delay;
+        batch_waiting.notify_one();
+    }
+    return true;
+}
+
+/**
+ * A failed send is remembered so later frames report the failure instead of vanishing
+ */
+bool Client::send_batch() {
+    if (batch.empty()) {
+        return !batch_failed;
+    }
+    if (!send_all(batch.data(), batch.size())) {
+        batch_failed = true;
+    }
+    batch.clear();
+    return !batch_failed;
+}
+
+/**
+ * Sleeps until a batch is started, then until its deadline; a batch that filled up (or was
+ * flushed) in the meantime has already been sent by the thread that filled it
+ */
+void Client::run_batching() {
+    std::unique_lock<std::mutex> lock(batch_mutex);
+    while (!batch_stopping) {
+        batch_waiting.wait(lock, [this] { return batch_stopping || !batch.empty(); });
+        if (batch_stopping) {
+            break;
+        }
+        std::chrono::steady_clock::time_point deadline = batch_deadline;
+        batch_waiting.wait_until(lock, deadline, [this] { return batch_stopping || batch.empty(); });
+        if (!batch.empty() && std::chrono::steady_clock::now() >= batch_deadline) {
+            send_batch();
+        }
+    }
+}
+
+/**
+ * Writes the whole buffer, looping over partial sends
+ * send() may accept fewer bytes than requested when the socket buffer is nearly full
+ */
+bool Client::send_all(const char* data, size_t length) {
+    if (local) {
+        local_output.append(data, length);
+        return flush_local();
+    }
+    while (length > 0) {
+        ssize_t bytes_sent = send(client_socket, data, length, MSG_NOSIGNAL);
+        if (bytes_sent <= 0) {
+            return false;
+        }
+        data += bytes_sent;
+        length -= bytes_sent;
+    }
+    return true;
+}
+
+/**
+ * The ring is never waited on here: what does not fit stays queued, so a sender (or the receive
+ * thread answering a ping) never blocks on the thread that would make room
+ */
+bool Client::flush_local() {
+    size_t written = 0;
+    while (written < local_output.size()) {
+        ssize_t bytes = local->write(local_output.data() + written, local_output.size() - written);
+        if (bytes < 0) {
+            break;
+        }
+        written += static_cast<size_t>(bytes);
+    }
+    local_output.erase(0, written);
+    return local_output.empty() || errno == EAGAIN;
+}
+
+ssize_t Client::receive_local(const struct iovec* segments, int count) {
+    while (true) {
+        ssize_t bytes = local->readv(segments, count);
+        if (bytes >= 0 || errno != EAGAIN) {
+            return bytes;
+        }
+        struct pollfd entries[2] = {{local->fd(), POLLIN, 0}, {local_wake, POLLIN, 0}};
+        if (poll(entries, 2, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (entries[1].revents & POLLIN) {
+            return -1; // disconnect() was called
+        }
+        local->rearm();
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        flush_local();
+    }
 }
 
 /**
@@ -89,24 +353,89 @@ bool Client::send_message(const std::string& message) {
  * while the main thread handles user input
  */
 void Client::receive_messages() {
-    char buffer[1024]; // Buffer to store incoming message data (up to 1024 bytes per message)
+    // Received bytes are collected in a ring buffer and split into frames in place,
+    // so messages arrive intact no matter how TCP segments the stream
+    RingBuffer inbound(kReceiveBufferSize);
+    FrameParser parser;
+    std::string inflated;
     
     // Keep receiving messages while the client is connected and running
     while (running) {
-        // Clear the buffer to ensure no leftover data from previous messages
-        memset(buffer, 0, sizeof(buffer));
-        
-        // Receive data from the server socket
-        // recv() blocks until data arrives or connection is closed
-        int bytes_read = recv(client_socket, buffer, sizeof(buffer), 0);
+        // Receive data from the server socket straight into the ring buffer
+        // readv() blocks until data arrives or connection is closed
+        struct iovec segments[2];
+        int segment_count = inbound.free_segments(segments);
+        ssize_t bytes_read = segment_count <= 0 ? -1
+                             : local ? receive_local(segments, segment_count)
+                             : readv(client_socket, segments, segment_count);
 
         // Check if connection was closed or an error occurred
         if (bytes_read <= 0) {
             break; // Exit the receiving loop
         }
+        inbound.commit(bytes_read);
 
-        // Display the received message to the user's console
-        // Convert buffer to string using exact number of bytes received
-        std::cout << "Received: " << std::string(buffer, bytes_read) << std::endl;
+        // Display every complete message to the user's console
+        Frame received;
+        Frame frame;
+        ParseStatus status;
+        while ((status = parser.next(inbound, received)) == ParseStatus::Ready) {
+            // Compressed payloads are inflated first; everything below reads plain frames
+            if (!expand_frame(received, inflated, frame)) {
+                status = ParseStatus::Invalid;
+                break;
+            }
+            std::string payload = frame.payload();
+            switch (frame.header.type) {
+                case MessageType::Chat:
+                    std::cout << "Received from " << sender_name(frame.header.sender_id) << ": " << payload << std::endl;
+                    break;
+                case MessageType::RoomMessage: {
+                    // [u8 name length][name][text], as validated by the server
+                    size_t name_length = payload.empty() ? 0 : static_cast<unsigned char>(payload[0]);
+                    if (1 + name_length <= payload.size()) {
+                        std::cout << "[" << payload.substr(1, name_length) << "] " << sender_name(frame.header.sender_id)
+                                  << ": " << payload.substr(1 + name_length) << std::endl;
+                    }
+                    break;
+                }
+                case MessageType::Direct:
+                    if (payload.size() >= kDirectPrefixSize) {
+                        std::cout << "[dm] user " << frame.header.sender_id << ": "
+                                  << payload.substr(kDirectPrefixSize) << std::endl;
+                    }
+                    break;
+                case MessageType::Notice:
+                    std::cout << "[server] " << payload << std::endl;
+                    break;
+                case MessageType::History: {
+                    // [u8 name length][name][u64 last sequence replayed]
+                    size_t name_length = payload.empty() ? 0 : static_cast<unsigned char>(payload[0]);
+                    if (1 + name_length + 8 == payload.size()) {
+                        std::cout << "[" << payload.substr(1, name_length) << "] end of history at sequence "
+                                  << read_u64(payload.data() + 1 + name_length) << std::endl;
+                    }
+                    break;
+                }
+                case MessageType::Ping:
+                    // The server checks this client is alive; answered here, never shown
+                    send_frame(MessageType::Pong, payload);
+                    break;
+                case MessageType::Compression:
+                    // The server's answer to our request; it only compresses if it accepted
+                    compress_sends = payload.size() == 1 &&
+                                     static_cast<CompressionMethod>(payload[0]) == CompressionMethod::Deflate;
+                    if (!compress_sends) {
+                        std::cout << "[server] compression declined" << std::endl;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            parser.release(inbound, received);
+        }
+        if (status == ParseStatus::Invalid) {
+            break; // The stream is corrupt and cannot be resynchronized
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,231 @@
+// Client for individual users to connect to the chat server
+// This client handles both sending messages to the server and receiving messages from other users
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <atomic>       // Provides atomic data types and operations for thread-safe concurrent programming
+#include <memory>
+#include <sys/socket.h> // Provides socket API functions for network communication (socket(), bind(), listen(), etc.)
+#include <netinet/in.h> // Defines Internet protocol/address structures like sockaddr_in for IPv4 networking
+#include "common/Protocol.h"
+#include "common/LocalTransport.h"
+
+/**
+ * Client class that connects to a chat server and handles two-way communication
+ * Uses a separate thread for receiving messages to allow simultaneous send/receive operations
+ */
+class Client {
+    private:
+        // Socket file descriptor for connection to the server
+        // This is the communication channel between client and server
+        int client_socket;
+
+        // In-process connection used instead of the socket (see connect_local), nullptr over TCP
+        std::unique_ptr<LocalEndpoint> local;
+
+        // Output the in-process ring had no room for yet, guarded by batch_mutex
+        // The receive thread writes the rest whenever the server made room
+        std::string local_output;
+
+        // Eventfd that wakes the receive thread of an in-process connection on disconnect
+        int local_wake;
+        
+        // Thread-safe boolean flag to control the client's running state
+        // Atomic ensures safe access from multiple threads without explicit locking
+        std::atomic<bool> running;
+        
+        // Dedicated thread for receiving messages from the server
+        // This allows the client to receive messages while the main thread handles user input
+        std::thread receive_thread;
+
+        // Sequence number of the last frame this client sent
+        uint64_t next_sequence;
+
+        // Write coalescing (see set_batching); batch_bytes == 0 sends every frame right away
+        std::chrono::microseconds batch_delay;
+        size_t batch_bytes;
+
+        // Encoded frames waiting to be sent together, and when the oldest of them is due
+        // Guarded by batch_mutex, which also keeps frames from different threads in order
+        std::string batch;
+        std::chrono::steady_clock::time_point batch_deadline;
+        bool batch_failed;
+        std::mutex batch_mutex;
+        std::condition_variable batch_waiting;
+
+        // Sends batches whose delay has run out; only started when batching is enabled
+        std::thread batch_thread;
+        bool batch_stopping;
+
+        // Whether to ask the server for compression on connect (see set_compression)
+        bool compression_requested;
+
+        // Set once the server accepted compression; large payloads are then sent compressed
+        std::atomic<bool> compress_sends;
+
+        /**
+         * Sends a complete buffer, retrying until every byte has been written
+         * @param data Pointer to the bytes to send
+         * @param length Number of bytes to send
+         * @return true if everything was sent, false on error
+         */
+        bool send_all(const char* data, size_t length);
+
+        /**
+         * Writes as much of local_output to the in-process connection as it takes (batch_mutex must be held)
+         * @return false if the server closed its end
+         */
+        bool flush_local();
+
+        /**
+         * Reads from the in-process connection, waiting for data like a blocking readv() would
+         * Also writes held-back output whenever the server made room in the ring
+         * @return Bytes read, 0 at end of stream, or -1 once disconnect() was called
+         */
+        ssize_t receive_local(const struct iovec* segments, int count);
+
+        /**
+         * Starts the receiving and batching threads and asks for compression, once connected
+         */
+        void start();
+
+        /**
+         * Wraps a payload in a frame of the given type and sends it
+         * @param type Message type of the frame
+         * @param payload Frame payload (at most kMaxPayloadSize bytes)
+         * @return true if the frame was sent, false if it is too large or the send failed
+         */
+        bool send_frame(MessageType type, std::string_view payload);
+
+        /**
+         * Sends the batched frames (batch_mutex must be held)
+         * @return false if the connection failed
+         */
+        bool send_batch();
+
+        /**
+         * Batching thread: sends each batch once its delay has run out
+         */
+        void run_batching();
+
+        /**
+         * Continuously receives messages from the server in a separate thread
+         * This function runs in a loop, reassembling frames from the server
+         * and displaying them to the user's console
+         */
+        void receive_messages();
+
+    public:
+        /**
+         * Constructor that creates a TCP socket for server communication
+         * Initializes the client socket but doesn't connect to any server yet
+         */
+        Client();
+        
+        /**
+         * Destructor that ensures proper cleanup of client resources
+         * Disconnects from server and closes the socket
+         */
+        ~Client();
+
+        /**
+         * Establishes connection to a chat server
+         * Creates a TCP connection to the specified server and starts the message receiving thread
+         * @param serverAddress IP address of the server (e.g., "127.0.0.1" for localhost)
+         * @param port Port number the server is listening on (e.g., 8080)
+         * @return true if connection successful, false otherwise
+         */
+        bool connect(const std::string& serverAddress, int port);
+
+        /**
+         * Connects over an in-process connection instead of TCP, e.g. to a hub embedded in the same
+         * process (see Server::connect_local()); otherwise the client behaves as after connect()
+         * @param endpoint Client end of the connection
+         * @return true if connection successful, false if endpoint is null
+         * @throws std::runtime_error if the wake-up eventfd cannot be created
+         */
+        bool connect_local(std::unique_ptr<LocalEndpoint> endpoint);
+        
+        /**
+         * Disconnects from the server and stops the receiving thread
+         * Gracefully closes the connection and cleans up resources
+         * Frames still waiting in a batch are sent first
+         */
+        void disconnect();
+
+        /**
+         * Coalesces outgoing frames into fewer, larger writes
+         * A frame is then held back for up to max_delay so that frames sent after it share its
+         * write; the batch leaves as soon as it reaches max_bytes. Must be called before connect()
+         * @param max_delay How long a frame may wait for others (zero turns batching off again)
+         * @param max_bytes Batch size that is sent without waiting
+         */
+        void set_batching(std::chrono::microseconds max_delay, size_t max_bytes);
+
+        /**
+         * Asks the server to compress large frames sent to this client, and compresses this client's
+         * own large frames once the server agreed. Must be called before connect(); has no effect
+         * when the build lacks compression support
+         * @param enabled Whether to negotiate compression
+         */
+        void set_compression(bool enabled);
+
+        /**
+         * Sends every batched frame now instead of waiting for the batching delay
+         * @return false if the connection failed
+         */
+        bool flush();
+        
+        /**
+         * Sends a text message to the server as a single chat frame
+         * The server will then deliver this message to everyone else in the default room
+         * @param message The text message to send to the server (at most kMaxPayloadSize bytes)
+         * @return true if message was sent successfully (or batched), false otherwise
+         */
+        bool send_message(const std::string& message);
+
+        /**
+         * Asks the server to add this client to a room, creating the room if needed
+         * @param room Room name (see is_valid_room_name)
+         * @return true if the request was sent, false if the name is invalid or the send failed
+         */
+        bool join_room(const std::string& room);
+
+        /**
+         * Asks the server to remove this client from a room
+         * @param room Room name
+         * @return true if the request was sent, false if the name is invalid or the send failed
+         */
+        bool leave_room(const std::string& room);
+
+        /**
+         * Sends a text message to every other member of a room this client has joined
+         * @param room Destination room
+         * @param message The text message to send
+         * @return true if the message was sent, false if it is invalid or the send failed
+         */
+        bool send_room_message(const std::string& room, const std::string& message);
+
+        /**
+         * Sends a private text message to a single user
+         * @param recipient_id Server-assigned id of the recipient (shown next to their messages)
+         * @param message The text message to send
+         * @return true if the message was sent, false if it is too large or the send failed
+         */
+        bool send_direct_message(uint32_t recipient_id, const std::string& message);
+
+        /**
+         * Asks the server to replay a room's logged messages
+         * They arrive like live messages, followed by a line telling where the replay ended
+         * @param room Room whose history to replay (joining it is not required)
+         * @param since Sequence number to replay after (0 for the whole history)
+         * @return true if the request was sent, false if the name is invalid or the send failed
+         */
+        bool request_history(const std::string& room, uint64_t since);
+};
\ No newline at end of file
@@ -0,0 +1,458 @@
+// Client engine implementation
+
+#include "ClientEngine.h"
+#include "common/Compression.h"
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace {
+    // Maximum events handled per epoll_wait() call
+    constexpr int kMaxEvents = 256;
+
+    // Output a session may have waiting for the socket before further sends are refused
+    constexpr size_t kMaxPendingOutput = 4 * 1024 * 1024;
+}
+
+/**
+ * Constructor: The session is handed to the engine by ClientEngine::connect()
+ */
+ClientSession::ClientSession(ClientEngine& engine, int socket, SessionHandlers handlers)
+    : engine(engine), socket(socket), handlers(std::move(handlers)), outbound_offset(0), next_sequence(0),
+      posted(false), close_requested(false), compress(false), state(State::Connecting), inbound(kReceiveBufferSize),
+      registered(false), closing(false), connect_failed(false) {}
+
+ClientSession::~ClientSession() {
+    if (socket >= 0 && !local) {
+        ::close(socket);
+    }
+}
+
+bool ClientSession::send_message(std::string_view message) {
+    return send_frame(MessageType::Chat, message);
+}
+
+bool ClientSession::join_room(std::string_view room) {
+    return is_valid_room_name(room) && send_frame(MessageType::Join, room);
+}
+
+bool ClientSession::leave_room(std::string_view room) {
+    return is_valid_room_name(room) && send_frame(MessageType::Leave, room);
+}
+
+bool ClientSession::send_room_message(std::string_view room, std::string_view message) {
+    return is_valid_room_name(room) && send_frame(MessageType::RoomMessage, encode_room_payload(room, message));
+}
+
+bool ClientSession::send_direct_message(uint32_t recipient_id, std::string_view message) {
+    return send_frame(MessageType::Direct, encode_direct_payload(recipient_id, message));
+}
+
+bool ClientSession::request_history(std::string_view room, uint64_t since) {
+    return is_valid_room_name(room) && send_frame(MessageType::History, encode_history_payload(room, since));
+}
+
+bool ClientSession::request_compression() {
+    char method = static_cast<char>(CompressionMethod::Deflate);
+    return compression_supported() && send_frame(MessageType::Compression, std::string_view(&method, 1));
+}
+
+/**
+ * Only the first send after the engine last looked at the session posts it; later ones just
+ * append to the buffer the engine is about to write anyway
+ */
+bool ClientSession::send_frame(MessageType type, std::string_view payload) {
+    if (payload.size() > kMaxPayloadSize) {
+        return false; // The server would reject the frame and drop the connection
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (close_requested || state.load() == State::Closed ||
+            outbound.size() - outbound_offset >= kMaxPendingOutput) {
+            return false;
+        }
+        // The sender id is left at 0; the server fills in the id it assigned to this session
+        if (compress) {
+            append_compressed_frame(outbound, type, 0, ++next_sequence, payload.data(), payload.size());
+        } else {
+            append_frame(outbound, type, 0, ++next_sequence, payload.data(), payload.size());
+        }
+        if (posted) {
+            return true;
+        }
+        posted = true;
+    }
+    engine.post(shared_from_this());
+    return true;
+}
+
+void ClientSession::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (close_requested) {
+            return;
+        }
+        close_requested = true;
+        if (posted) {
+            return;
+        }
+        posted = true;
+    }
+    engine.post(shared_from_this());
+}
+
+/**
+ * Constructor: Creates the epoll instance and registers the wake-up eventfd (with a null pointer,
+ * which no session can have)
+ */
+ClientEngine::ClientEngine() : wake_pending(false), running(false) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        ::close(epoll_fd);
+        throw std::runtime_error("Failed to create wake-up eventfd");
+    }
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+}
+
+ClientEngine::~ClientEngine() {
+    stop();
+    ::close(wake_fd);
+    ::close(epoll_fd);
+}
+
+void ClientEngine::start() {
+    running = true;
+    thread = std::thread(&ClientEngine::run, this);
+}
+
+/**
+ * From a callback (i.e. on the engine thread itself) this only asks the loop to end
+ */
+void ClientEngine::stop() {
+    running = false;
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+    if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) {
+        thread.join();
+    }
+}
+
+/**
+ * The socket connects in the background; an immediate failure is reported through on_connect
+ * like any other, so callers handle a single path
+ */
+std::shared_ptr<ClientSession> ClientEngine::connect(const std::string& server_address, int port,
+                                                     SessionHandlers handlers) {
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, server_address.c_str(), &server_addr.sin_addr) <= 0) {
+        return nullptr;
+    }
+
+    int client_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client_socket < 0) {
+        return nullptr;
+    }
+    int enable = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    auto session = std::make_shared<ClientSession>(*this, client_socket, std::move(handlers));
+    session->posted = true;
+    if (::connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        session->connect_failed = true;
+        session->close_requested = true;
+    }
+    post(session);
+    return session;
+}
+
+/**
+ * There is no handshake: the session opens as soon as the engine thread registers it
+ */
+std::shared_ptr<ClientSession> ClientEngine::connect_local(std::unique_ptr<LocalEndpoint> endpoint,
+                                                           SessionHandlers handlers) {
+    auto session = std::make_shared<ClientSession>(*this, endpoint->fd(), std::move(handlers));
+    session->local = std::move(endpoint);
+    session->posted = true;
+    post(session);
+    return session;
+}
+
+/**
+ * Writes the eventfd only if no wake-up is outstanding yet
+ */
+void ClientEngine::post(std::shared_ptr<ClientSession> session) {
+    inbox.push(std::move(session));
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+/**
+ * Sessions are closed only between batches of events (see schedule_close)
+ */
+void ClientEngine::run() {
+    struct epoll_event events[kMaxEvents];
+    while (running) {
+        int event_count = epoll_wait(epoll_fd, events, kMaxEvents, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < event_count; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t wakeups;
+                ssize_t ignored = read(wake_fd, &wakeups, sizeof(wakeups));
+                (void)ignored;
+                drain_inbox();
+                continue;
+            }
+            handle_events(*static_cast<ClientSession*>(events[i].data.ptr), events[i].events);
+        }
+        close_scheduled();
+    }
+
+    // Close everything, including sessions that were connected but never reached the loop
+    drain_inbox();
+    for (auto& entry : sessions) {
+        schedule_close(*entry.second);
+    }
+    close_scheduled();
+}
+
+/**
+ * The posted flag is cleared before looking at the session, so a send racing with the drain posts
+ * it again rather than being missed
+ */
+void ClientEngine::drain_inbox() {
+    wake_pending.store(false);
+
+    std::shared_ptr<ClientSession> session;
+    while (inbox.pop(session)) {
+        if (!session->registered) {
+            session->registered = true;
+            // An in-process connection reports all of its readiness as EPOLLIN of one eventfd
+            struct epoll_event event{};
+            event.events = session->local ? EPOLLIN | EPOLLET : EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = session.get();
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->socket, &event) < 0) {
+                session->state = ClientSession::State::Closed;
+                if (session->handlers.on_connect) {
+                    session->handlers.on_connect(*session, false);
+                }
+                continue;
+            }
+            sessions.emplace(session.get(), session);
+            if (session->local) {
+                session->state = ClientSession::State::Open;
+                if (session->handlers.on_connect) {
+                    session->handlers.on_connect(*session, true);
+                }
+            }
+        }
+
+        bool close_requested;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->posted = false;
+            close_requested = session->close_requested;
+        }
+        // A session closed while still connecting first connects and writes what it was sent
+        ClientSession::State state = session->state.load();
+        if (state == ClientSession::State::Open && !flush(*session)) {
+            schedule_close(*session);
+        } else if (close_requested && (state != ClientSession::State::Connecting || session->connect_failed)) {
+            schedule_close(*session);
+        }
+    }
+}
+
+/**
+ * A connecting socket becomes writable once the handshake finished, or reports an error
+ */
+void ClientEngine::handle_events(ClientSession& session, uint32_t events) {
+    if (session.closing) {
+        return;
+    }
+    if (session.local) {
+        // Data, room in a full ring and the server closing all arrive as the same notification
+        session.local->rearm();
+        events = EPOLLIN | EPOLLOUT;
+    }
+    bool connected = false;
+    if (session.state.load() == ClientSession::State::Connecting) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(session.socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            schedule_close(session);
+            return;
+        }
+        session.state = ClientSession::State::Open;
+        if (session.handlers.on_connect) {
+            session.handlers.on_connect(session, true);
+        }
+        // Write whatever was sent while connecting
+        events |= EPOLLOUT;
+        connected = true;
+    }
+
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !receive(session)) {
+        schedule_close(session);
+        return;
+    }
+    if ((events & EPOLLOUT) && !flush(session)) {
+        schedule_close(session);
+        return;
+    }
+    if (connected) {
+        // A close() that arrived while connecting was held back until this first write
+        std::lock_guard<std::mutex> lock(session.mutex);
+        if (session.close_requested) {
+            schedule_close(session);
+        }
+    }
+}
+
+/**
+ * Edge-triggered: reads until the socket is drained, delivering frames as they complete
+ * Compressed frames are inflated before they reach on_frame
+ */
+bool ClientEngine::receive(ClientSession& session) {
+    while (true) {
+        struct iovec segments[2];
+        int segment_count = session.inbound.free_segments(segments);
+        if (segment_count == 0) {
+            return false; // Every valid frame fits the ring, so a full ring means a corrupt stream
+        }
+        ssize_t bytes_read = session.local ? session.local->readv(segments, segment_count)
+                                           : readv(session.socket, segments, segment_count);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (bytes_read == 0) {
+            return false;
+        }
+        session.inbound.commit(bytes_read);
+
+        Frame received;
+        Frame frame;
+        ParseStatus status;
+        while ((status = session.parser.next(session.inbound, received)) == ParseStatus::Ready) {
+            if (!expand_frame(received, inflated, frame)) {
+                return false;
+            }
+            if (frame.header.type == MessageType::Ping) {
+                // Answered by the engine; heartbeats are not the application's business
+                session.send_frame(MessageType::Pong, frame.payload());
+                session.parser.release(session.inbound, received);
+                continue;
+            }
+            if (frame.header.type == MessageType::Compression) {
+                char method = 0;
+                if (frame.payload_size() == 1) {
+                    frame.read(0, &method, 1);
+                }
+                std::lock_guard<std::mutex> lock(session.mutex);
+                session.compress = static_cast<CompressionMethod>(method) == CompressionMethod::Deflate;
+            }
+            if (session.handlers.on_frame) {
+                session.handlers.on_frame(session, frame);
+            }
+            session.parser.release(session.inbound, received);
+        }
+        if (status == ParseStatus::Invalid) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Sends never block the engine: what the socket does not take stays queued until EPOLLOUT
+ */
+bool ClientEngine::flush(ClientSession& session) {
+    std::lock_guard<std::mutex> lock(session.mutex);
+    while (session.outbound_offset < session.outbound.size()) {
+        const char* data = session.outbound.data() + session.outbound_offset;
+        size_t length = session.outbound.size() - session.outbound_offset;
+        ssize_t bytes_sent = session.local ? session.local->write(data, length)
+                                           : send(session.socket, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            // Drop the written prefix once it dominates the buffer, so a slow connection does not
+            // keep every byte it was ever sent
+            if (session.outbound_offset > session.outbound.size() / 2) {
+                session.outbound.erase(0, session.outbound_offset);
+                session.outbound_offset = 0;
+            }
+            return true;
+        }
+        session.outbound_offset += bytes_sent;
+    }
+    session.outbound.clear();
+    session.outbound_offset = 0;
+    return true;
+}
+
+void ClientEngine::schedule_close(ClientSession& session) {
+    if (!session.closing) {
+        session.closing = true;
+        closing.push_back(&session);
+    }
+}
+
+/**
+ * A session that never connected gets on_connect(false), a connected one on_close; either way
+ * it is the last callback. The engine then drops its reference, which may free the session.
+ */
+void ClientEngine::close_scheduled() {
+    for (ClientSession* session : closing) {
+        ClientSession::State previous = session->state.exchange(ClientSession::State::Closed);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->socket, nullptr);
+        if (session->local) {
+            session->local.reset(); // The server reads end of stream
+        } else {
+            ::close(session->socket);
+        }
+        session->socket = -1;
+
+        if (previous == ClientSession::State::Connecting && session->handlers.on_connect) {
+            session->handlers.on_connect(*session, false);
+        } else if (previous == ClientSession::State::Open && session->handlers.on_close) {
+            session->handlers.on_close(*session);
+        }
+        sessions.erase(session);
+    }
+    closing.clear();
+}
@@ -0,0 +1,304 @@
+// Event-driven client engine for bots and test harnesses
+// One event loop thread hosts any number of client sessions; received frames are delivered to callbacks
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "common/Protocol.h"
+#include "common/RingBuffer.h"
+#include "common/LocalTransport.h"
+#include "server/MpscQueue.h"
+
+class ClientEngine;
+class ClientSession;
+
+/**
+ * Callbacks of one session
+ * Every callback runs on the engine thread, so it must not block; any of them may be left empty.
+ * Callbacks may call the session's send methods (and close()) directly.
+ */
+struct SessionHandlers {
+    // Connection attempt finished: true once connected, false if it failed (the session is then closed)
+    std::function<void(ClientSession& session, bool connected)> on_connect;
+
+    // A frame arrived; its payload pointers are only valid during the call
+    // (the server's heartbeat Pings are answered by the engine and never passed on)
+    std::function<void(ClientSession& session, const Frame& frame)> on_frame;
+
+    // A connected session was closed, by either side; no callback follows
+    std::function<void(ClientSession& session)> on_close;
+};
+
+/**
+ * One connection to a chat server, driven by a ClientEngine
+ *
+ * The send methods may be called from any thread. They only encode the frame into the session's
+ * output buffer and ask the engine thread to write it, so they never block on the network; frames
+ * sent before the connection is established go out once it is. Sessions are created with
+ * ClientEngine::connect() (or connect_local()) and must not be used after their engine has been destroyed.
+ */
+class ClientSession : public std::enable_shared_from_this<ClientSession> {
+    private:
+        // Lifecycle as seen by the engine thread
+        enum class State {
+            Connecting,
+            Open,
+            Closed
+        };
+
+        ClientEngine& engine;
+
+        // Non-blocking socket connected (or connecting) to the server
+        // (for an in-process session, the notification fd of its endpoint)
+        int socket;
+
+        // Client end of an in-process connection, used instead of the socket (nullptr over TCP)
+        std::unique_ptr<LocalEndpoint> local;
+
+        SessionHandlers handlers;
+
+        // Guards everything the sending threads touch: the output buffer, sequence numbers and flags
+        std::mutex mutex;
+
+        // Encoded frames not yet accepted by the socket, starting at outbound_offset
+        std::string outbound;
+        size_t outbound_offset;
+
+        // Sequence number of the last frame this session sent
+        uint64_t next_sequence;
+
+        // Set while the session sits in the engine's inbox, so a burst of sends wakes the engine once
+        bool posted;
+
+        // Set by close(); the engine closes the session once it sees it
+        bool close_requested;
+
+        // Set once the server accepted compression; large payloads are then sent compressed
+        bool compress;
+
+        // Written by the engine thread, readable from any thread
+        std::atomic<State> state;
+
+        // Engine thread only: received bytes, the parser splitting them into frames, and bookkeeping
+        RingBuffer inbound;
+        FrameParser parser;
+        bool registered;
+        bool closing;
+
+        // Set before the session is posted if connect() failed at once; close_requested is then set too
+        bool connect_failed;
+
+        friend class ClientEngine;
+
+        /**
+         * Encodes a frame into the output buffer and makes sure the engine will write it
+         * @param type Message type of the frame
+         * @param payload Frame payload
+         * @return false if the payload is too large, the session is closed or too much output is pending
+         */
+        bool send_frame(MessageType type, std::string_view payload);
+
+    public:
+        /**
+         * Creates a session for an already connecting socket; use ClientEngine::connect() instead
+         */
+        ClientSession(ClientEngine& engine, int socket, SessionHandlers handlers);
+
+        /**
+         * Closes the socket
+         */
+        ~ClientSession();
+
+        ClientSession(const ClientSession&) = delete;
+        ClientSession& operator=(const ClientSession&) = delete;
+
+        /**
+         * Whether the session is connected (false while connecting and after closing)
+         */
+        bool is_open() const { return state.load() == State::Open; }
+
+        /**
+         * Sends a text message to the default room
+         * @return true if the message was queued for sending
+         */
+        bool send_message(std::string_view message);
+
+        /**
+         * Asks the server to add this session to a room, creating the room if needed
+         * @return true if the request was queued, false if the name is invalid or it could not be queued
+         */
+        bool join_room(std::string_view room);
+
+        /**
+         * Asks the server to remove this session from a room
+         * @return true if the request was queued, false if the name is invalid or it could not be queued
+         */
+        bool leave_room(std::string_view room);
+
+        /**
+         * Sends a text message to every other member of a room this session has joined
+         * @return true if the message was queued, false if it is invalid or could not be queued
+         */
+        bool send_room_message(std::string_view room, std::string_view message);
+
+        /**
+         * Sends a private text message to a single user
+         * @return true if the message was queued, false if it is too large or could not be queued
+         */
+        bool send_direct_message(uint32_t recipient_id, std::string_view message);
+
+        /**
+         * Asks the server to replay a room's logged messages after a sequence number
+         * @return true if the request was queued, false if the name is invalid or it could not be queued
+         */
+        bool request_history(std::string_view room, uint64_t since);
+
+        /**
+         * Asks the server to compress large frames sent to this session
+         * The server's Compression answer is passed to on_frame like any other frame; once it
+         * accepted, this session's own large frames are compressed too. Received frames always
+         * reach on_frame inflated.
+         * @return true if the request was queued, false if the build lacks compression support or
+         *         it could not be queued
+         */
+        bool request_compression();
+
+        /**
+         * Closes the session once the output queued so far has been handed to the socket (as far as
+         * it takes it without blocking); on_close follows on the engine thread
+         * A session that is still connecting finishes connecting first
+         */
+        void close();
+};
+
+/**
+ * Event loop hosting many client sessions on one thread
+ *
+ * Sessions use non-blocking sockets registered edge-triggered with one epoll instance, like the
+ * server's reactor, so a single engine can drive thousands of connections without a thread each.
+ * Other threads hand work to the loop through a lock-free inbox and an eventfd wake-up.
+ */
+class ClientEngine {
+    private:
+        int epoll_fd;
+
+        // eventfd that wakes the loop when the inbox has work
+        int wake_fd;
+        std::atomic<bool> wake_pending;
+
+        // Sessions that were created, have output to write or asked to be closed
+        MpscQueue<std::shared_ptr<ClientSession>> inbox;
+
+        // Every registered session (engine thread only); keeps sessions alive while they are open
+        std::unordered_map<ClientSession*, std::shared_ptr<ClientSession>> sessions;
+
+        // Sessions to close at the end of the current iteration (engine thread only)
+        std::vector<ClientSession*> closing;
+
+        // Inflated payload of the compressed frame being delivered (engine thread only)
+        std::string inflated;
+
+        std::thread thread;
+        std::atomic<bool> running;
+
+        friend class ClientSession;
+
+        /**
+         * Hands a session to the engine thread and wakes it
+         */
+        void post(std::shared_ptr<ClientSession> session);
+
+        /**
+         * Event loop: runs until stop() and closes every session when it ends
+         */
+        void run();
+
+        /**
+         * Registers new sessions and writes or closes the ones that were posted
+         */
+        void drain_inbox();
+
+        /**
+         * Handles the readiness events of one session
+         */
+        void handle_events(ClientSession& session, uint32_t events);
+
+        /**
+         * Reads everything available and delivers every complete frame
+         * @return false if the connection was closed or broke
+         */
+        bool receive(ClientSession& session);
+
+        /**
+         * Writes as much pending output as the socket takes
+         * @return false if the connection broke
+         */
+        bool flush(ClientSession& session);
+
+        /**
+         * Marks a session for closing at the end of the iteration
+         * Deferred so events of the same batch never see a freed session
+         */
+        void schedule_close(ClientSession& session);
+
+        /**
+         * Closes the marked sessions, running their on_close callbacks
+         */
+        void close_scheduled();
+
+    public:
+        /**
+         * Creates the event loop; nothing runs until start()
+         * @throws std::runtime_error if the epoll instance or eventfd cannot be created
+         */
+        ClientEngine();
+
+        /**
+         * Stops the engine, closing every session
+         */
+        ~ClientEngine();
+
+        ClientEngine(const ClientEngine&) = delete;
+        ClientEngine& operator=(const ClientEngine&) = delete;
+
+        /**
+         * Starts the engine thread
+         */
+        void start();
+
+        /**
+         * Closes every session (running their on_close callbacks) and waits for the engine thread
+         * Safe to call more than once
+         */
+        void stop();
+
+        /**
+         * Starts connecting a new session to a server
+         * The outcome is reported to handlers.on_connect on the engine thread
+         * @param server_address IPv4 address of the server
+         * @param port Port the server listens on
+         * @param handlers Callbacks of the session
+         * @return The session, or nullptr if the address is invalid or no socket could be created
+         */
+        std::shared_ptr<ClientSession> connect(const std::string& server_address, int port,
+                                               SessionHandlers handlers);
+
+        /**
+         * Starts a session over an in-process connection, e.g. one opened with Server::connect_local()
+         * The session counts as connected right away: on_connect(true) follows on the engine thread
+         * @param endpoint Client end of the connection
+         * @param handlers Callbacks of the session
+         * @return The session
+         */
+        std::shared_ptr<ClientSession> connect_local(std::unique_ptr<LocalEndpoint> endpoint,
+                                                     SessionHandlers handlers);
+};
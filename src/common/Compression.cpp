@@ -0,0 +1,173 @@
+// Payload compression implementation
+
+#include "Compression.h"
+#ifdef QUICKCHAT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef QUICKCHAT_HAVE_ZLIB
+
+namespace {
+    // Negative window bits select raw deflate: no zlib header or checksum, the frame is already delimited
+    constexpr int kWindowBits = -15;
+
+    /**
+     * Deflate state of one thread, created on first use and reset for every payload
+     */
+    struct Deflater {
+        z_stream stream{};
+        bool ready;
+
+        // Compressed output, large enough for any payload that is worth sending compressed
+        std::string output;
+
+        Deflater() : output(kMaxPayloadSize, '\0') {
+            ready = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, kWindowBits, 8,
+                                 Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        ~Deflater() {
+            if (ready) {
+                deflateEnd(&stream);
+            }
+        }
+
+        /**
+         * Compresses a payload into output
+         * @return Compressed size, or 0 if it would not be smaller than the payload
+         */
+        size_t compress(const char* payload, size_t length) {
+            if (!ready || length < kCompressionThreshold) {
+                return 0;
+            }
+            deflateReset(&stream);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload));
+            stream.avail_in = static_cast<uInt>(length);
+            stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+            // A result that does not fit in length - 1 bytes is not worth it; deflate stops there
+            stream.avail_out = static_cast<uInt>(length - 1);
+            if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+                return 0;
+            }
+            return length - 1 - stream.avail_out;
+        }
+    };
+
+    /**
+     * Inflate state of one thread, reset for every payload
+     */
+    struct Inflater {
+        z_stream stream{};
+        bool ready;
+
+        Inflater() {
+            ready = inflateInit2(&stream, kWindowBits) == Z_OK;
+        }
+
+        ~Inflater() {
+            if (ready) {
+                inflateEnd(&stream);
+            }
+        }
+    };
+
+    thread_local Deflater deflater;
+    thread_local Inflater inflater;
+}
+
+bool compression_supported() {
+    return true;
+}
+
+/**
+ * The header is copied from the original frame, so sender id and sequence number stay the same
+ */
+MessageRef compress_frame(const MessageRef& frame) {
+    size_t compressed = deflater.compress(frame.data() + kFrameHeaderSize, frame.size() - kFrameHeaderSize);
+    if (compressed == 0) {
+        return frame;
+    }
+    FrameHeader header;
+    decode_frame_header(frame.data(), header);
+    header.flags |= kFlagCompressed;
+    return encode_frame(header, deflater.output.data(), compressed);
+}
+
+void append_compressed_frame(std::string& out, MessageType type, uint32_t sender_id, uint64_t sequence,
+                             const char* payload, size_t length) {
+    size_t compressed = deflater.compress(payload, length);
+    if (compressed == 0) {
+        append_frame(out, type, sender_id, sequence, payload, length);
+        return;
+    }
+    append_frame(out, type, sender_id, sequence, deflater.output.data(), compressed, kFlagCompressed);
+}
+
+/**
+ * The payload may wrap around the receive ring, so both pieces are fed to the same stream; the
+ * stream has to end exactly at the end of the second one
+ */
+bool expand_frame(const Frame& frame, std::string& scratch, Frame& expanded) {
+    if (!(frame.header.flags & kFlagCompressed)) {
+        expanded = frame;
+        return true;
+    }
+    if (!inflater.ready) {
+        return false;
+    }
+    scratch.resize(kMaxPayloadSize);
+    z_stream& stream = inflater.stream;
+    inflateReset(&stream);
+    stream.next_out = reinterpret_cast<Bytef*>(&scratch[0]);
+    stream.avail_out = static_cast<uInt>(scratch.size());
+
+    const char* pieces[2] = {frame.first, frame.second};
+    size_t lengths[2] = {frame.first_length, frame.second_length};
+    int status = Z_OK;
+    for (int i = 0; i < 2 && lengths[i] > 0; ++i) {
+        if (status == Z_STREAM_END) {
+            return false; // Bytes after the end of the stream
+        }
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pieces[i]));
+        stream.avail_in = static_cast<uInt>(lengths[i]);
+        status = inflate(&stream, Z_NO_FLUSH);
+        if ((status != Z_OK && status != Z_STREAM_END) || stream.avail_in != 0) {
+            return false; // Corrupt, or larger than any frame may be
+        }
+    }
+    if (status != Z_STREAM_END) {
+        return false;
+    }
+
+    expanded.header = frame.header;
+    expanded.header.flags &= ~kFlagCompressed;
+    expanded.header.length = static_cast<uint32_t>(scratch.size() - stream.avail_out);
+    expanded.first = scratch.data();
+    expanded.first_length = expanded.header.length;
+    expanded.second = nullptr;
+    expanded.second_length = 0;
+    return true;
+}
+
+#else
+
+bool compression_supported() {
+    return false;
+}
+
+MessageRef compress_frame(const MessageRef& frame) {
+    return frame;
+}
+
+void append_compressed_frame(std::string& out, MessageType type, uint32_t sender_id, uint64_t sequence,
+                             const char* payload, size_t length) {
+    append_frame(out, type, sender_id, sequence, payload, length);
+}
+
+bool expand_frame(const Frame& frame, std::string& scratch, Frame& expanded) {
+    (void)scratch;
+    expanded = frame;
+    return !(frame.header.flags & kFlagCompressed);
+}
+
+#endif
@@ -0,0 +1,59 @@
+// Optional payload compression for the wire protocol
+// Frames carrying kFlagCompressed hold a raw deflate stream instead of the plain payload
+
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "Protocol.h"
+#include "MessageBuffer.h"
+
+/**
+ * Compression a connection negotiated with a Compression frame
+ */
+enum class CompressionMethod : uint8_t {
+    None = 0,   // Frames are sent as they are
+    Deflate = 1 // Payloads from kCompressionThreshold bytes up are raw deflate streams (RFC 1951)
+};
+
+// Shorter payloads are always sent uncompressed; deflate's overhead would eat most of the saving
+constexpr size_t kCompressionThreshold = 128;
+
+/**
+ * Whether this build can compress (it was linked against zlib)
+ * Without it servers decline every Compression request and clients never ask
+ */
+bool compression_supported();
+
+/**
+ * Compresses a frame's payload for recipients that negotiated compression
+ *
+ * Every payload is compressed on its own (no dictionary shared between frames), so one compressed
+ * buffer can be queued for any number of recipients, on any shard, in any order. The deflate
+ * state is kept per thread and reset between frames, so nothing is allocated per call.
+ * @param frame Complete encoded frame
+ * @return A new frame with kFlagCompressed set, left untimed so the fan-out is measured once on
+ *         frame; or frame itself if its payload is below kCompressionThreshold, compression is
+ *         unsupported or would not make the frame smaller
+ */
+MessageRef compress_frame(const MessageRef& frame);
+
+/**
+ * Appends a complete frame to a string, compressing the payload when that makes it smaller
+ * Same parameters as append_frame(); the flag is set only on frames that were compressed
+ */
+void append_compressed_frame(std::string& out, MessageType type, uint32_t sender_id, uint64_t sequence,
+                             const char* payload, size_t length);
+
+/**
+ * Makes a received frame's payload readable
+ * Frames without kFlagCompressed are passed through; compressed payloads are inflated into scratch
+ * and expanded views them with the flag cleared and the length updated. The original frame is
+ * still the one to release from its parser.
+ * @param frame Frame returned by FrameParser::next()
+ * @param scratch Buffer reused across calls; must outlive any use of expanded
+ * @param expanded Receives the readable frame
+ * @return false if the payload is corrupt, inflates beyond kMaxPayloadSize or cannot be inflated
+ *         by this build; the stream should then be treated as invalid
+ */
+bool expand_frame(const Frame& frame, std::string& scratch, Frame& expanded);
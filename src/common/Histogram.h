@@ -0,0 +1,151 @@
+// Fixed-size log-linear histogram for latency measurements
+// Records values in constant time and without allocation, so it can sit on a hot measurement path
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/**
+ * Histogram of unsigned 64-bit values with a bounded relative error
+ *
+ * Values below kSubBucketCount are counted exactly. Every larger power-of-two range is split into
+ * kSubBucketCount equal sub-buckets, so a reported percentile is never more than about 3% above the
+ * true value no matter whether it is measured in nanoseconds or seconds. Histograms recorded by
+ * different threads are combined with merge().
+ *
+ * Not thread-safe; give every recording thread its own instance.
+ */
+class Histogram {
+    public:
+        // Sub-buckets per power of two (2^kSubBucketBits); sets the precision
+        static constexpr unsigned kSubBucketBits = 5;
+        static constexpr uint64_t kSubBucketCount = uint64_t(1) << kSubBucketBits;
+
+        // One group of sub-buckets for the exact range plus one per remaining bit position
+        static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketCount;
+
+        /**
+         * Maps a value to its bucket
+         * Values with the same top kSubBucketBits + 1 significant bits share a bucket
+         * Public so concurrent recorders can keep their own (atomic) counts with the same layout
+         */
+        static size_t bucket_of(uint64_t value) {
+            if (value < kSubBucketCount) {
+                return static_cast<size_t>(value);
+            }
+            unsigned shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+            return static_cast<size_t>((shift + 1) * kSubBucketCount + ((value >> shift) - kSubBucketCount));
+        }
+
+        /**
+         * Largest value that maps to a bucket
+         */
+        static uint64_t bucket_limit(size_t index) {
+            if (index < kSubBucketCount) {
+                return index;
+            }
+            unsigned shift = static_cast<unsigned>(index / kSubBucketCount) - 1;
+            uint64_t sub_bucket = index % kSubBucketCount + kSubBucketCount;
+            return ((sub_bucket + 1) << shift) - 1;
+        }
+
+    private:
+        std::array<uint64_t, kBucketCount> counts{};
+        uint64_t total = 0;
+        uint64_t sum = 0;
+        uint64_t smallest = std::numeric_limits<uint64_t>::max();
+        uint64_t largest = 0;
+
+    public:
+        /**
+         * Counts one value
+         * @param value Measurement (any unit, as long as every call uses the same one)
+         */
+        void record(uint64_t value) {
+            record(value, 1);
+        }
+
+        /**
+         * Counts the same value several times
+         * @param value Measurement
+         * @param occurrences How often it was observed
+         */
+        void record(uint64_t value, uint64_t occurrences) {
+            if (occurrences == 0) {
+                return;
+            }
+            counts[bucket_of(value)] += occurrences;
+            total += occurrences;
+            sum += value * occurrences;
+            if (value < smallest) {
+                smallest = value;
+            }
+            if (value > largest) {
+                largest = value;
+            }
+        }
+
+        /**
+         * Adds every value recorded by another histogram to this one
+         * @param other Histogram to merge in (left unchanged)
+         */
+        void merge(const Histogram& other) {
+            for (size_t i = 0; i < kBucketCount; ++i) {
+                counts[i] += other.counts[i];
+            }
+            total += other.total;
+            sum += other.sum;
+            if (other.smallest < smallest) {
+                smallest = other.smallest;
+            }
+            if (other.largest > largest) {
+                largest = other.largest;
+            }
+        }
+
+        /**
+         * Number of recorded values
+         */
+        uint64_t count() const { return total; }
+
+        /**
+         * Smallest and largest recorded value (both 0 while the histogram is empty)
+         */
+        uint64_t min() const { return total > 0 ? smallest : 0; }
+        uint64_t max() const { return largest; }
+
+        /**
+         * Arithmetic mean of the recorded values (0 while the histogram is empty)
+         */
+        double mean() const { return total > 0 ? static_cast<double>(sum) / total : 0.0; }
+
+        /**
+         * Finds the value below which the given share of recordings fall
+         * @param percentile Share in percent, e.g. 99.9 for p999
+         * @return Upper bound of the bucket holding that recording, capped at max() (0 while empty)
+         */
+        uint64_t percentile(double percentile) const {
+            if (total == 0) {
+                return 0;
+            }
+            // Rank of the recording we are looking for, counting from 1
+            uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+            if (rank < 1) {
+                rank = 1;
+            } else if (rank > total) {
+                rank = total;
+            }
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBucketCount; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    uint64_t value = bucket_limit(i);
+                    return value < largest ? value : largest;
+                }
+            }
+            return largest;
+        }
+};
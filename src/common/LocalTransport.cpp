@@ -0,0 +1,146 @@
+// In-process transport implementation
+
+#include "LocalTransport.h"
+#include "SpscRing.h"
+#include <atomic>
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/**
+ * Everything both ends share; index i of each array belongs to end i
+ * The eventfds are only closed when both ends are gone, so a late notification from one end never
+ * lands on a descriptor number the process has meanwhile reused
+ */
+struct LocalEndpoint::Pipe {
+    // rings[i] carries the bytes written by end 1 - i to end i
+    SpscRing rings[2];
+
+    // Readiness notification of end i
+    int events[2];
+
+    // Set while end i has an unacknowledged notification, so further ones skip the eventfd write
+    std::atomic<bool> pending[2];
+
+    // Set when end i found its outgoing ring full and waits for the reader to make room
+    std::atomic<bool> blocked[2];
+
+    // Set once end i is closed
+    std::atomic<bool> closed[2];
+
+    explicit Pipe(size_t capacity)
+        : rings{SpscRing(capacity), SpscRing(capacity)}, events{-1, -1}, pending{{false}, {false}},
+          blocked{{false}, {false}}, closed{{false}, {false}} {}
+
+    ~Pipe() {
+        for (int fd : events) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    /**
+     * Raises end i's notification unless one is already outstanding
+     * The fence orders the caller's ring update before the check, pairing with the one in rearm()
+     */
+    void signal(int i) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pending[i].exchange(true)) {
+            uint64_t one = 1;
+            ssize_t ignored = ::write(events[i], &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+};
+
+std::pair<std::unique_ptr<LocalEndpoint>, std::unique_ptr<LocalEndpoint>>
+LocalEndpoint::create_pair(size_t capacity) {
+    auto pipe = std::make_shared<Pipe>(capacity);
+    for (int& fd : pipe->events) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create in-process connection eventfd");
+        }
+    }
+    return {std::unique_ptr<LocalEndpoint>(new LocalEndpoint(pipe, 0)),
+            std::unique_ptr<LocalEndpoint>(new LocalEndpoint(pipe, 1))};
+}
+
+LocalEndpoint::LocalEndpoint(std::shared_ptr<Pipe> pipe, int side) : pipe(std::move(pipe)), side(side) {}
+
+/**
+ * Closing is only a flag: the other end still drains what was written before it
+ */
+LocalEndpoint::~LocalEndpoint() {
+    pipe->closed[side].store(true, std::memory_order_release);
+    pipe->signal(1 - side);
+}
+
+int LocalEndpoint::fd() const {
+    return pipe->events[side];
+}
+
+/**
+ * The counter is read as well so level-triggered watchers (poll, plain epoll) go quiet again
+ */
+void LocalEndpoint::rearm() {
+    pipe->pending[side].store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t value;
+    ssize_t ignored = ::read(pipe->events[side], &value, sizeof(value));
+    (void)ignored;
+}
+
+/**
+ * A writer that found the ring full is told once room was made, so it can write the rest
+ */
+ssize_t LocalEndpoint::readv(const struct iovec* segments, int count) {
+    int peer = 1 - side;
+    size_t bytes = pipe->rings[side].read(segments, count);
+    if (bytes == 0 && pipe->closed[peer].load(std::memory_order_acquire)) {
+        // Everything written before the close is visible now; an empty ring means end of stream
+        return static_cast<ssize_t>(pipe->rings[side].read(segments, count));
+    }
+    if (bytes == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pipe->blocked[peer].load(std::memory_order_relaxed) && pipe->blocked[peer].exchange(false)) {
+        pipe->signal(peer);
+    }
+    return static_cast<ssize_t>(bytes);
+}
+
+/**
+ * A full ring is retried once after announcing the wait, so room the reader made in between is
+ * either seen here or answered with a notification
+ */
+ssize_t LocalEndpoint::writev(const struct iovec* segments, int count) {
+    int peer = 1 - side;
+    if (pipe->closed[peer].load(std::memory_order_acquire)) {
+        errno = EPIPE;
+        return -1;
+    }
+    size_t wanted = 0;
+    for (int i = 0; i < count; ++i) {
+        wanted += segments[i].iov_len;
+    }
+    SpscRing& ring = pipe->rings[peer];
+    size_t bytes = ring.write(segments, count);
+    if (bytes < wanted) {
+        pipe->blocked[side].store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (bytes == 0) {
+            bytes = ring.write(segments, count);
+        }
+    }
+    if (bytes == 0 && wanted > 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    pipe->signal(peer);
+    return static_cast<ssize_t>(bytes);
+}
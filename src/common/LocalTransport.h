@@ -0,0 +1,93 @@
+// In-process byte stream connecting a client and a server that live in the same process
+// Stands in for a TCP connection so a hub can be embedded, or benchmarked without kernel networking
+
+#pragma once
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Capacity of each direction of an in-process connection, comparable to a socket buffer
+constexpr size_t kLocalRingSize = 64 * 1024;
+
+/**
+ * One end of an in-process connection
+ *
+ * The two ends share a pair of lock-free SPSC rings (see SpscRing.h), one per direction, so the
+ * bytes themselves never pass through the kernel. Each end is used by one thread at a time and
+ * behaves like a non-blocking socket: readv() and writev() move what they can and fail with EAGAIN
+ * otherwise, readv() returns 0 once the other end is closed and drained, and writev() fails with
+ * EPIPE after that. Readiness is reported through fd(), an eventfd that becomes readable when the
+ * other end wrote data, made room in a full ring, or closed; it can be watched with epoll or poll
+ * like any socket, and a burst of writes costs a single eventfd write until the reader calls
+ * rearm(). An end that was reported readable must call rearm() and then read (and retry blocked
+ * writes) until EAGAIN, as with edge-triggered epoll.
+ */
+class LocalEndpoint {
+    private:
+        // State shared by both ends, freed with the last of them
+        struct Pipe;
+        std::shared_ptr<Pipe> pipe;
+
+        // Index of this end within the pipe (0 or 1); the other end is 1 - side
+        int side;
+
+        LocalEndpoint(std::shared_ptr<Pipe> pipe, int side);
+
+    public:
+        /**
+         * Creates a connected pair of ends
+         * @param capacity Size of each direction's ring in bytes, must be a power of two
+         * @return The two ends; which one plays the client does not matter
+         * @throws std::runtime_error if the eventfds cannot be created
+         */
+        static std::pair<std::unique_ptr<LocalEndpoint>, std::unique_ptr<LocalEndpoint>>
+        create_pair(size_t capacity = kLocalRingSize);
+
+        /**
+         * Closes this end; the other end reads the remaining data, then end of stream
+         */
+        ~LocalEndpoint();
+
+        LocalEndpoint(const LocalEndpoint&) = delete;
+        LocalEndpoint& operator=(const LocalEndpoint&) = delete;
+
+        /**
+         * File descriptor that becomes readable when this end may be able to make progress
+         * It stays open (and keeps its number) for as long as either end exists
+         */
+        int fd() const;
+
+        /**
+         * Acknowledges a readiness notification so the next write by the other end raises another
+         * Call it before draining, never after, or a notification may be lost
+         */
+        void rearm();
+
+        /**
+         * Reads available bytes, like readv() on a non-blocking socket
+         * @param segments Destination buffers, filled in order
+         * @param count Number of iovecs
+         * @return Bytes read, 0 at end of stream, or -1 with errno EAGAIN if nothing is available
+         */
+        ssize_t readv(const struct iovec* segments, int count);
+
+        /**
+         * Writes as many bytes as the ring towards the other end has room for, like writev() on a
+         * non-blocking socket
+         * @param segments Data to write, in order
+         * @param count Number of iovecs
+         * @return Bytes written, or -1 with errno EAGAIN if the ring is full (fd() becomes readable
+         *         once the other end made room) or EPIPE if the other end is closed
+         */
+        ssize_t writev(const struct iovec* segments, int count);
+
+        /**
+         * Convenience form of writev() for one contiguous buffer
+         */
+        ssize_t write(const char* data, size_t length) {
+            struct iovec segment = {const_cast<char*>(data), length};
+            return writev(&segment, 1);
+        }
+};
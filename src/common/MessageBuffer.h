@@ -0,0 +1,151 @@
+// Reference-counted immutable byte buffer for encoded frames
+// Lets one encoded message be queued for many recipients (and threads) without copying it
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include "SlabAllocator.h"
+
+/**
+ * Block holding a reference count, a length and the message bytes in one allocation
+ * Blocks come from the SlabAllocator and go back to a free list when the last handle is released
+ * A block may instead describe bytes that live elsewhere (see MessageRef::wrap())
+ * Never used directly; MessageRef manages the reference count
+ */
+class MessageBuffer {
+    private:
+        // Number of MessageRef handles pointing at this buffer
+        std::atomic<uint32_t> references;
+
+        // Number of bytes in the message
+        uint32_t length;
+
+        // When the message entered the server (steady clock ns), 0 if nobody is timing it
+        uint64_t origin_time;
+
+        // Start of the message bytes: right after this header, or memory owned by someone else
+        const char* contents;
+
+        MessageBuffer(uint32_t length, const char* external)
+            : references(1), length(length), origin_time(0), contents(external ? external : bytes()) {}
+
+        // Whether the bytes are stored in this allocation
+        bool owns_contents() const { return contents == bytes(); }
+
+        // Message bytes are stored directly after the header in the same allocation
+        char* bytes() { return reinterpret_cast<char*>(this + 1); }
+        const char* bytes() const { return reinterpret_cast<const char*>(this + 1); }
+
+        friend class MessageRef;
+};
+
+/**
+ * Called with a timed message's origin time on the thread that drops its last handle
+ */
+using ReleaseObserver = void (*)(uint64_t origin_time);
+
+/**
+ * Shared handle to a MessageBuffer, similar to std::shared_ptr but with an intrusive counter
+ * Copying a handle is a single atomic increment; the buffer is freed by the last handle.
+ * Buffers are written once right after allocate() and treated as immutable once shared.
+ */
+class MessageRef {
+    private:
+        MessageBuffer* buffer;
+
+        // Hook notified when a timed buffer is freed (see set_origin_time())
+        static inline std::atomic<ReleaseObserver> release_observer{nullptr};
+
+        explicit MessageRef(MessageBuffer* buffer) : buffer(buffer) {}
+
+        void release() {
+            if (buffer && buffer->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (buffer->origin_time != 0) {
+                    ReleaseObserver observer = release_observer.load(std::memory_order_relaxed);
+                    if (observer) {
+                        observer(buffer->origin_time);
+                    }
+                }
+                size_t size = sizeof(MessageBuffer) + (buffer->owns_contents() ? buffer->length : 0);
+                buffer->~MessageBuffer();
+                SlabAllocator::deallocate(buffer, size);
+            }
+            buffer = nullptr;
+        }
+
+    public:
+        MessageRef() : buffer(nullptr) {}
+
+        MessageRef(const MessageRef& other) : buffer(other.buffer) {
+            if (buffer) {
+                buffer->references.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        MessageRef(MessageRef&& other) noexcept : buffer(other.buffer) { other.buffer = nullptr; }
+
+        MessageRef& operator=(MessageRef other) noexcept {
+            std::swap(buffer, other.buffer);
+            return *this;
+        }
+
+        ~MessageRef() { release(); }
+
+        /**
+         * Allocates a buffer with uninitialized contents
+         * The caller fills it through mutable_data() before handing out copies of the handle
+         * @param length Number of bytes the message will hold
+         * @return Handle owning the only reference to the new buffer
+         */
+        static MessageRef allocate(size_t length) {
+            void* memory = SlabAllocator::allocate(sizeof(MessageBuffer) + length);
+            return MessageRef(new (memory) MessageBuffer(static_cast<uint32_t>(length), nullptr));
+        }
+
+        /**
+         * Creates a handle for bytes that are already in memory, without copying them
+         * Used to queue read-only mapped data (such as replayed message log segments) like any
+         * other frame; mutable_data() must not be called on such a handle
+         * @param data Bytes to refer to; must stay valid and unchanged until every handle is released
+         * @param length Number of bytes
+         * @return Handle owning the only reference to the new buffer
+         */
+        static MessageRef wrap(const char* data, size_t length) {
+            void* memory = SlabAllocator::allocate(sizeof(MessageBuffer));
+            return MessageRef(new (memory) MessageBuffer(static_cast<uint32_t>(length), data));
+        }
+
+        /**
+         * Stamps the time the message entered the server, only valid while this is the sole handle
+         * Once every recipient's queue has let go of the message the release observer learns how
+         * long the whole fan-out took
+         * @param time Steady clock time in nanoseconds (0 leaves the message untimed)
+         */
+        void set_origin_time(uint64_t time) { buffer->origin_time = time; }
+
+        /**
+         * Time stamped by set_origin_time() (0 if the message is untimed)
+         */
+        uint64_t origin_time() const { return buffer->origin_time; }
+
+        /**
+         * Installs the function told about every timed message when its last handle is released
+         * @param observer Function to call (nullptr to stop observing)
+         */
+        static void set_release_observer(ReleaseObserver observer) {
+            release_observer.store(observer, std::memory_order_relaxed);
+        }
+
+        /**
+         * Writable view of the bytes, only valid while this is the sole handle
+         */
+        char* mutable_data() { return buffer->bytes(); }
+
+        const char* data() const { return buffer->contents; }
+        size_t size() const { return buffer->length; }
+
+        explicit operator bool() const { return buffer != nullptr; }
+};
@@ -0,0 +1,234 @@
+// Wire protocol implementation
+
+#include "Protocol.h"
+#include <cstring>
+
+namespace {
+    void write_u32(char* out, uint32_t value) {
+        out[0] = static_cast<char>(value >> 24);
+        out[1] = static_cast<char>(value >> 16);
+        out[2] = static_cast<char>(value >> 8);
+        out[3] = static_cast<char>(value);
+    }
+}
+
+/**
+ * Decodes a big-endian 32-bit integer
+ */
+uint32_t read_u32(const char* in) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+/**
+ * Decodes a big-endian 64-bit integer from its two 32-bit halves
+ */
+uint64_t read_u64(const char* in) {
+    return (uint64_t(read_u32(in)) << 32) | read_u32(in + 4);
+}
+
+/**
+ * Room names are restricted to printable, non-space bytes so they can be typed in commands
+ */
+bool is_valid_room_name(std::string_view name) {
+    if (name.empty() || name.size() > kMaxRoomNameLength) {
+        return false;
+    }
+    for (char c : name) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (byte <= ' ' || byte == 0x7f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Prefixes the text with the length-delimited room name
+ */
+std::string encode_room_payload(std::string_view room, std::string_view text) {
+    std::string payload;
+    payload.reserve(1 + room.size() + text.size());
+    payload.push_back(static_cast<char>(room.size()));
+    payload.append(room);
+    payload.append(text);
+    return payload;
+}
+
+/**
+ * Prefixes the text with the recipient's id
+ */
+std::string encode_direct_payload(uint32_t recipient_id, std::string_view text) {
+    std::string payload(kDirectPrefixSize, '\0');
+    write_u32(&payload[0], recipient_id);
+    payload.append(text);
+    return payload;
+}
+
+/**
+ * Appends the sequence number to the length-delimited room name
+ */
+std::string encode_history_payload(std::string_view room, uint64_t sequence) {
+    std::string payload = encode_room_payload(room, std::string_view());
+    char number[8];
+    write_u32(number, static_cast<uint32_t>(sequence >> 32));
+    write_u32(number + 4, static_cast<uint32_t>(sequence));
+    payload.append(number, sizeof(number));
+    return payload;
+}
+
+/**
+ * Serializes every header field in network byte order
+ */
+void encode_frame_header(const FrameHeader& header, char* out) {
+    write_u32(out, header.length);
+    out[4] = static_cast<char>(header.type);
+    out[5] = static_cast<char>(header.flags);
+    out[6] = static_cast<char>(kProtocolVersion);
+    out[7] = 0;
+    write_u32(out + 8, header.sender_id);
+    write_u32(out + 12, static_cast<uint32_t>(header.sequence >> 32));
+    write_u32(out + 16, static_cast<uint32_t>(header.sequence));
+}
+
+/**
+ * Deserializes a header and checks the fields a peer is not allowed to vary
+ */
+bool decode_frame_header(const char* in, FrameHeader& header) {
+    if (static_cast<uint8_t>(in[6]) != kProtocolVersion || in[7] != 0) {
+        return false;
+    }
+    header.length = read_u32(in);
+    header.type = static_cast<MessageType>(in[4]);
+    header.flags = static_cast<uint8_t>(in[5]);
+    header.sender_id = read_u32(in + 8);
+    header.sequence = (uint64_t(read_u32(in + 12)) << 32) | read_u32(in + 16);
+    return true;
+}
+
+/**
+ * Encodes the header directly into the string's storage, then appends the payload
+ */
+void append_frame(std::string& out, MessageType type, uint32_t sender_id, uint64_t sequence,
+                  const char* payload, size_t length, uint8_t flags) {
+    FrameHeader header;
+    header.length = static_cast<uint32_t>(length);
+    header.type = type;
+    header.flags = flags;
+    header.sender_id = sender_id;
+    header.sequence = sequence;
+
+    size_t start = out.size();
+    out.resize(start + kFrameHeaderSize);
+    encode_frame_header(header, &out[start]);
+    out.append(payload, length);
+}
+
+/**
+ * Allocates the exact frame size once and writes header and payload into it
+ */
+MessageRef encode_frame(FrameHeader header, const char* first, size_t first_length,
+                        const char* second, size_t second_length) {
+    header.length = static_cast<uint32_t>(first_length + second_length);
+
+    MessageRef message = MessageRef::allocate(kFrameHeaderSize + header.length);
+    char* out = message.mutable_data();
+    encode_frame_header(header, out);
+    memcpy(out + kFrameHeaderSize, first, first_length);
+    if (second_length > 0) {
+        memcpy(out + kFrameHeaderSize + first_length, second, second_length);
+    }
+    return message;
+}
+
+/**
+ * Joins both payload pieces into one owned string
+ */
+std::string Frame::payload() const {
+    std::string result;
+    result.reserve(payload_size());
+    result.append(first, first_length);
+    if (second_length > 0) {
+        result.append(second, second_length);
+    }
+    return result;
+}
+
+/**
+ * Copies from whichever piece(s) the requested range falls into
+ */
+void Frame::read(size_t offset, char* out, size_t length) const {
+    if (offset < first_length) {
+        size_t from_first = first_length - offset < length ? first_length - offset : length;
+        memcpy(out, first + offset, from_first);
+        out += from_first;
+        length -= from_first;
+        offset = 0;
+    } else {
+        offset -= first_length;
+    }
+    if (length > 0) {
+        memcpy(out, second + offset, length);
+    }
+}
+
+/**
+ * Join and Leave carry the bare name; RoomMessage and History prefix it with a length byte
+ */
+bool Frame::read_room_name(char* out, size_t& length) const {
+    size_t offset = 0;
+    if (header.type == MessageType::RoomMessage || header.type == MessageType::History) {
+        if (payload_size() < 1) {
+            return false;
+        }
+        char name_length;
+        read(0, &name_length, 1);
+        length = static_cast<unsigned char>(name_length);
+        offset = 1;
+    } else {
+        length = payload_size();
+    }
+
+    if (length == 0 || length > kMaxRoomNameLength || offset + length > payload_size()) {
+        return false;
+    }
+    read(offset, out, length);
+    return is_valid_room_name(std::string_view(out, length));
+}
+
+/**
+ * Decodes the header once it has fully arrived, then waits for the whole payload
+ */
+ParseStatus FrameParser::next(const RingBuffer& buffer, Frame& frame) {
+    if (!header_ready) {
+        if (buffer.size() < kFrameHeaderSize) {
+            return ParseStatus::NeedMore;
+        }
+
+        // The header may straddle the end of the ring, so copy these few bytes out
+        char raw[kFrameHeaderSize];
+        buffer.peek(0, raw, kFrameHeaderSize);
+        if (!decode_frame_header(raw, header) || header.length > kMaxPayloadSize) {
+            return ParseStatus::Invalid;
+        }
+        header_ready = true;
+    }
+
+    if (buffer.size() < kFrameHeaderSize + header.length) {
+        return ParseStatus::NeedMore;
+    }
+
+    frame.header = header;
+    buffer.view(kFrameHeaderSize, header.length,
+                frame.first, frame.first_length, frame.second, frame.second_length);
+    return ParseStatus::Ready;
+}
+
+/**
+ * Drops the frame's bytes from the ring and prepares for the next header
+ */
+void FrameParser::release(RingBuffer& buffer, const Frame& frame) {
+    buffer.consume(kFrameHeaderSize + frame.header.length);
+    header_ready = false;
+}
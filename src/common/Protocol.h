@@ -0,0 +1,264 @@
+// Wire protocol shared by the chat Server and Client
+// Every message travels as a fixed-size binary header followed by a length-delimited payload
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include "RingBuffer.h"
+#include "MessageBuffer.h"
+
+/**
+ * Kind of payload carried by a frame
+ */
+enum class MessageType : uint8_t {
+    Chat = 1,        // Text for the default room, which every client joins on connect
+    Join = 2,        // Client asks to join the room named by the payload
+    Leave = 3,       // Client asks to leave the room named by the payload
+    RoomMessage = 4, // Text for one room; payload is [u8 name length][name][text]
+    Direct = 5,      // Private text for one user; payload is [u32 recipient id][text]
+    Notice = 6,      // Informational text generated by the server itself
+    History = 7,     // Replay request for a room's logged messages; payload is [u8 name length][name][u64 sequence]
+                     // The server answers with every logged frame of the room after that sequence number,
+                     // then echoes a History frame carrying the last sequence number the replay covered
+
+    // Frames exchanged only between federated servers (see Federation.h); servers ignore them from clients
+    PeerHello = 8,   // Link handshake; payload is [u32 node id][u64 incarnation]
+    Subscribe = 9,   // The sending node has local members in the room named by the payload
+    Unsubscribe = 10, // The sending node no longer has local members in the room named by the payload
+    Relay = 11,      // Room frame forwarded by the node it originated on; the sender id is that node's id
+                     // and the payload is the complete Chat or RoomMessage frame as its clients saw it
+
+    Compression = 12, // Client asks for compressed frames; payload is [u8 CompressionMethod]
+                     // The server answers with a Compression frame naming the method it accepted
+                     // (CompressionMethod::None if it declined), see Compression.h
+
+    // Liveness checks, sent by either side; the payload is opaque (the server sends empty Pings)
+    Ping = 13,       // Asks the other side to show it is alive; must be answered with a Pong
+    Pong = 14        // Answer to a Ping, echoing its payload
+};
+
+/**
+ * Decoded frame header
+ *
+ * Wire layout (all integers big-endian, 20 bytes total):
+ *   0..3   payload length in bytes (not counting the header)
+ *   4      message type
+ *   5      flags (kFlagCompressed; the other bits are reserved and must be 0)
+ *   6      protocol version
+ *   7      reserved, must be 0
+ *   8..11  sender id (assigned by the server, 0 for frames originating from the server itself;
+ *          kRelayedSenderBit marks senders connected to another node of a federation)
+ *   12..19 sequence number
+ */
+struct FrameHeader {
+    uint32_t length = 0;
+    MessageType type = MessageType::Chat;
+    uint8_t flags = 0;
+    uint32_t sender_id = 0;
+    uint64_t sequence = 0;
+};
+
+// Size of an encoded FrameHeader on the wire
+constexpr size_t kFrameHeaderSize = 20;
+
+// Header flag: the payload is deflate-compressed and the length field counts the compressed bytes
+// Only sent to and by peers that negotiated compression (see Compression.h)
+constexpr uint8_t kFlagCompressed = 0x01;
+
+// Sender id bit set on frames relayed from another node of a federation; the other bits hold the
+// sender's id on its own node, which may equal a local client's id. Servers never assign ids with
+// this bit, and Direct messages to such ids are refused since they stay on the sender's node
+constexpr uint32_t kRelayedSenderBit = 0x80000000u;
+
+// Protocol version written into every header; frames with another version are rejected
+constexpr uint8_t kProtocolVersion = 1;
+
+// Largest payload a peer may send in one frame
+constexpr uint32_t kMaxPayloadSize = 16 * 1024;
+
+// Receive ring size; twice the largest frame so a complete frame always fits after a partial one
+constexpr size_t kReceiveBufferSize = 32 * 1024;
+
+// Longest accepted room name in bytes
+constexpr size_t kMaxRoomNameLength = 64;
+
+// Room that Chat frames are delivered to and that every client is placed in on connect
+constexpr std::string_view kDefaultRoom = "lobby";
+
+// Size of the recipient id that prefixes a Direct payload
+constexpr size_t kDirectPrefixSize = 4;
+
+/**
+ * Checks that a room name is non-empty, short enough and free of whitespace and control bytes
+ * @param name Candidate room name
+ * @return true if the name may be used
+ */
+bool is_valid_room_name(std::string_view name);
+
+/**
+ * Builds the payload of a RoomMessage frame
+ * @param room Destination room (must be a valid room name)
+ * @param text Message text
+ * @return [u8 name length][name][text]
+ */
+std::string encode_room_payload(std::string_view room, std::string_view text);
+
+/**
+ * Builds the payload of a Direct frame
+ * @param recipient_id Server-assigned id of the user to message
+ * @param text Message text
+ * @return [u32 recipient id][text]
+ */
+std::string encode_direct_payload(uint32_t recipient_id, std::string_view text);
+
+/**
+ * Builds the payload of a History frame
+ * @param room Room whose history is requested (must be a valid room name)
+ * @param sequence Sequence number to replay after (in a reply: the last sequence number replayed)
+ * @return [u8 name length][name][u64 sequence]
+ */
+std::string encode_history_payload(std::string_view room, uint64_t sequence);
+
+/**
+ * Reads the big-endian 32-bit integer at the start of a buffer
+ * @param in Source of at least 4 bytes
+ * @return Decoded value
+ */
+uint32_t read_u32(const char* in);
+
+/**
+ * Reads the big-endian 64-bit integer at the start of a buffer
+ * @param in Source of at least 8 bytes
+ * @return Decoded value
+ */
+uint64_t read_u64(const char* in);
+
+/**
+ * Writes a header in wire format
+ * @param header Header to encode
+ * @param out Destination of at least kFrameHeaderSize bytes
+ */
+void encode_frame_header(const FrameHeader& header, char* out);
+
+/**
+ * Reads a header from wire format
+ * @param in Source of at least kFrameHeaderSize bytes
+ * @param header Receives the decoded fields
+ * @return false if the version or reserved fields are invalid
+ */
+bool decode_frame_header(const char* in, FrameHeader& header);
+
+/**
+ * Appends a complete frame (header and payload) to a string
+ * @param out String the frame is appended to
+ * @param type Message type
+ * @param sender_id Sender id to store in the header
+ * @param sequence Sequence number to store in the header
+ * @param payload Pointer to the payload bytes
+ * @param length Payload length in bytes
+ * @param flags Header flags (kFlagCompressed if the payload is already compressed)
+ */
+void append_frame(std::string& out, MessageType type, uint32_t sender_id, uint64_t sequence,
+                  const char* payload, size_t length, uint8_t flags = 0);
+
+/**
+ * Encodes a complete frame into a new shared buffer
+ * The payload may be given in two pieces (e.g. straight from a Frame view); header.length is
+ * filled in from their combined size
+ * @param header Header fields to encode
+ * @param first Pointer to the first payload piece
+ * @param first_length Length of the first piece
+ * @param second Pointer to the second payload piece (may be nullptr)
+ * @param second_length Length of the second piece
+ * @return Immutable buffer holding header and payload, ready to be queued for any number of clients
+ */
+MessageRef encode_frame(FrameHeader header, const char* first, size_t first_length,
+                        const char* second = nullptr, size_t second_length = 0);
+
+/**
+ * A frame located inside a RingBuffer
+ * The payload is not copied: it is described by up to two pieces because it may wrap around the
+ * end of the ring. The pointers stay valid until the frame is released from its parser.
+ */
+struct Frame {
+    FrameHeader header;
+
+    // First (or only) piece of the payload
+    const char* first = nullptr;
+    size_t first_length = 0;
+
+    // Piece that wrapped around to the start of the ring (nullptr if the payload is contiguous)
+    const char* second = nullptr;
+    size_t second_length = 0;
+
+    /**
+     * Number of payload bytes
+     */
+    size_t payload_size() const { return first_length + second_length; }
+
+    /**
+     * Copies the payload into a string
+     * Only meant for consumers that need an owned copy, the hot path reads the pieces directly
+     * @return Payload bytes
+     */
+    std::string payload() const;
+
+    /**
+     * Copies part of the payload, hiding the split between the two pieces
+     * Meant for small fields such as room names and user ids
+     * @param offset Position within the payload
+     * @param out Destination buffer
+     * @param length Number of bytes to copy (offset + length must not exceed payload_size())
+     */
+    void read(size_t offset, char* out, size_t length) const;
+
+    /**
+     * Extracts the room name from a Join, Leave, RoomMessage or History frame
+     * @param out Buffer of at least kMaxRoomNameLength bytes receiving the name
+     * @param length Receives the name length
+     * @return false if the frame does not carry a valid room name
+     */
+    bool read_room_name(char* out, size_t& length) const;
+};
+
+/**
+ * Outcome of asking the parser for the next frame
+ */
+enum class ParseStatus {
+    Ready,    // A complete frame is available
+    NeedMore, // The buffer holds only part of a frame, read more data first
+    Invalid   // The peer sent a malformed or oversized frame; the connection should be dropped
+};
+
+/**
+ * Incremental frame parser over a RingBuffer
+ * Decodes each header only once even when the payload arrives over many reads,
+ * and never allocates: frames are returned as views into the ring
+ */
+class FrameParser {
+    private:
+        // Header of the frame currently being assembled
+        FrameHeader header;
+
+        // Whether header holds a decoded header whose payload is still arriving
+        bool header_ready = false;
+
+    public:
+        /**
+         * Looks for the next complete frame at the front of the buffer
+         * @param buffer Ring holding received bytes
+         * @param frame Receives the frame when Ready is returned
+         * @return Ready, NeedMore or Invalid
+         */
+        ParseStatus next(const RingBuffer& buffer, Frame& frame);
+
+        /**
+         * Releases a frame returned by next() from the front of the buffer
+         * The frame's payload pointers must not be used afterwards
+         * @param buffer Ring the frame was parsed from
+         * @param frame Frame to release
+         */
+        void release(RingBuffer& buffer, const Frame& frame);
+};
@@ -0,0 +1,134 @@
+// Fixed-capacity byte ring buffer used to receive socket data without per-message allocation
+// Shared by the Server and the Client so both sides parse frames the same way
+
+#pragma once
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/uio.h>
+
+/**
+ * Circular byte buffer with a power-of-two capacity
+ * Data is written in place by recv()/readv() and read in place by the frame parser, so bytes are
+ * never shifted or copied just to make room. Positions are free-running 64-bit counters and are
+ * only reduced modulo the capacity when indexing into the storage.
+ */
+class RingBuffer {
+    private:
+        // Backing storage (intentionally left uninitialized; only written bytes are ever read)
+        std::unique_ptr<char[]> storage;
+
+        // Size of the storage in bytes (always a power of two)
+        size_t capacity;
+
+        // capacity - 1, used to wrap positions with a cheap bitwise AND
+        size_t mask;
+
+        // Total number of bytes ever consumed / written
+        uint64_t read_position;
+        uint64_t write_position;
+
+    public:
+        /**
+         * Allocates the ring storage
+         * @param capacity Size in bytes, must be a power of two
+         */
+        explicit RingBuffer(size_t capacity)
+            : storage(new char[capacity]), capacity(capacity), mask(capacity - 1),
+              read_position(0), write_position(0) {}
+
+        /**
+         * Number of bytes written but not yet consumed
+         */
+        size_t size() const { return static_cast<size_t>(write_position - read_position); }
+
+        /**
+         * Number of bytes that can still be written before the buffer is full
+         */
+        size_t free_space() const { return capacity - size(); }
+
+        /**
+         * Describes the free space as up to two iovecs so readv() can fill it in one syscall
+         * @param segments Receives the free regions in write order
+         * @return Number of iovecs filled in (0 if the buffer is full)
+         */
+        int free_segments(struct iovec segments[2]) {
+            size_t free = free_space();
+            if (free == 0) {
+                return 0;
+            }
+            size_t start = write_position & mask;
+            size_t first = capacity - start < free ? capacity - start : free;
+            segments[0].iov_base = storage.get() + start;
+            segments[0].iov_len = first;
+            if (first == free) {
+                return 1;
+            }
+            segments[1].iov_base = storage.get();
+            segments[1].iov_len = free - first;
+            return 2;
+        }
+
+        /**
+         * Discards all buffered bytes, keeping the storage for reuse
+         */
+        void clear() { read_position = write_position = 0; }
+
+        /**
+         * Marks bytes as written after data was placed into the free segments
+         * @param length Number of bytes that were written
+         */
+        void commit(size_t length) { write_position += length; }
+
+        /**
+         * Marks bytes at the front of the buffer as consumed
+         * @param length Number of bytes to release
+         */
+        void consume(size_t length) {
+            read_position += length;
+            // Restarting from offset 0 when empty keeps later data contiguous for as long as possible
+            if (read_position == write_position) {
+                read_position = write_position = 0;
+            }
+        }
+
+        /**
+         * Returns a readable region without copying
+         * The region starting at offset may wrap around the end of the storage, so it is
+         * described by up to two pieces
+         * @param offset Distance from the front of the readable data
+         * @param length Number of bytes requested (must be available)
+         * @param first Receives a pointer to the first piece
+         * @param first_length Receives the length of the first piece
+         * @param second Receives a pointer to the wrapped piece (nullptr if none)
+         * @param second_length Receives the length of the wrapped piece
+         */
+        void view(size_t offset, size_t length,
+                  const char*& first, size_t& first_length,
+                  const char*& second, size_t& second_length) const {
+            size_t start = (read_position + offset) & mask;
+            first = storage.get() + start;
+            first_length = capacity - start < length ? capacity - start : length;
+            second_length = length - first_length;
+            second = second_length > 0 ? storage.get() : nullptr;
+        }
+
+        /**
+         * Copies bytes out of the buffer without consuming them
+         * Used for small fixed-size reads such as frame headers that may straddle the wrap point
+         * @param offset Distance from the front of the readable data
+         * @param out Destination buffer
+         * @param length Number of bytes to copy (must be available)
+         */
+        void peek(size_t offset, char* out, size_t length) const {
+            const char* first;
+            const char* second;
+            size_t first_length, second_length;
+            view(offset, length, first, first_length, second, second_length);
+            memcpy(out, first, first_length);
+            if (second_length > 0) {
+                memcpy(out + first_length, second, second_length);
+            }
+        }
+};
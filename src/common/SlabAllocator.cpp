@@ -0,0 +1,134 @@
+// Slab allocator slow paths: the shared depot and slab carving
+
+#include "SlabAllocator.h"
+#include <mutex>
+
+namespace {
+    /**
+     * First block of a batch parked in the depot
+     * The remaining blocks hang off next exactly as in a thread's free list
+     */
+    struct Batch {
+        void* next;
+        Batch* next_batch;
+        size_t count;
+    };
+
+    static_assert(sizeof(Batch) <= SlabAllocator::kMinBlockSize, "a batch header must fit in the smallest block");
+
+    /**
+     * Batches of free blocks shared by all threads, one stack per size class
+     */
+    struct Depot {
+        std::mutex mutex;
+        Batch* batches[SlabAllocator::kClassCount] = {};
+    };
+
+    /**
+     * The depot is intentionally never destroyed: detached threads may still free blocks while
+     * the process is shutting down
+     */
+    Depot& depot() {
+        static Depot* instance = new Depot();
+        return *instance;
+    }
+
+    void push_batch(size_t size_class, Batch* batch) {
+        Depot& shared = depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        batch->next_batch = shared.batches[size_class];
+        shared.batches[size_class] = batch;
+    }
+}
+
+/**
+ * Prefers recycled blocks from the depot; only when there are none is a new slab carved up,
+ * so the number of slabs is bounded by the peak number of blocks in use
+ */
+void* SlabAllocator::refill(ThreadCache& cache, size_t size_class) {
+    size_t size = block_size(size_class);
+    if (cache.retired) {
+        // The thread is exiting; anything cached now would never be handed back
+        void* memory = std::malloc(size);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    Batch* batch = nullptr;
+    {
+        Depot& shared = depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        batch = shared.batches[size_class];
+        if (batch != nullptr) {
+            shared.batches[size_class] = batch->next_batch;
+        }
+    }
+    if (batch != nullptr) {
+        // The batch's first block is returned, the rest becomes the thread's free list
+        cache.heads[size_class] = static_cast<FreeBlock*>(batch->next);
+        cache.counts[size_class] = batch->count - 1;
+        return batch;
+    }
+
+    size_t count = batch_size(size_class);
+    char* slab = static_cast<char*>(std::malloc(count * size));
+    if (slab == nullptr) {
+        throw std::bad_alloc();
+    }
+    FreeBlock* head = nullptr;
+    for (size_t i = count; i-- > 1;) {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * size);
+        block->next = head;
+        head = block;
+    }
+    cache.heads[size_class] = head;
+    cache.counts[size_class] = count - 1;
+    return slab;
+}
+
+/**
+ * Detaches the first batch_size() blocks of the list and parks them in the depot
+ */
+void SlabAllocator::drain(ThreadCache& cache, size_t size_class) {
+    size_t count = batch_size(size_class);
+    FreeBlock* first = cache.heads[size_class];
+    FreeBlock* last = first;
+    for (size_t i = 1; i < count; ++i) {
+        last = last->next;
+    }
+    cache.heads[size_class] = last->next;
+    cache.counts[size_class] -= count;
+    last->next = nullptr;
+
+    // The link to the second block already sits where Batch::next expects it
+    Batch* batch = reinterpret_cast<Batch*>(first);
+    batch->count = count;
+    push_batch(size_class, batch);
+}
+
+void SlabAllocator::release_to_depot(void* block, size_t size_class) {
+    Batch* batch = static_cast<Batch*>(block);
+    batch->next = nullptr;
+    batch->count = 1;
+    push_batch(size_class, batch);
+}
+
+/**
+ * Runs during thread exit: each non-empty free list becomes one batch in the depot
+ */
+SlabAllocator::CacheReleaser::~CacheReleaser() {
+    for (size_t size_class = 0; size_class < kClassCount; ++size_class) {
+        FreeBlock* first = cache->heads[size_class];
+        if (first == nullptr) {
+            continue;
+        }
+        Batch* batch = reinterpret_cast<Batch*>(first);
+        batch->count = cache->counts[size_class];
+        push_batch(size_class, batch);
+        cache->heads[size_class] = nullptr;
+        cache->counts[size_class] = 0;
+    }
+    cache->retired = true;
+}
@@ -0,0 +1,163 @@
+// Size-class slab allocator with per-thread free lists
+// Recycles message buffers and queue nodes so steady-state messaging never reaches the system allocator
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Process-wide allocator for short-lived fixed-size blocks
+ *
+ * Requests are rounded up to a power-of-two size class. Every thread keeps a free list per class,
+ * so allocating and freeing are a few pointer operations without locks or atomics. Blocks may be
+ * freed on a different thread than the one that allocated them (a broadcast is encoded by the
+ * sender's reactor and released by whichever recipient finishes last); a thread whose list grows
+ * past kCacheLimit hands a batch to a shared depot, where threads with empty lists pick it up.
+ * New blocks are carved out of large slabs, which are never returned to the system: memory use
+ * settles at the high-water mark of blocks in flight.
+ *
+ * Requests larger than the biggest class go straight to malloc().
+ */
+class SlabAllocator {
+    public:
+        // Smallest and largest size class (bytes)
+        static constexpr size_t kMinBlockSize = 64;
+        static constexpr size_t kMaxBlockSize = 32 * 1024;
+
+        // Number of size classes: 64, 128, ..., 32 KiB
+        static constexpr size_t kClassCount = 10;
+
+        // Bytes of blocks moved between a thread and the depot at once
+        static constexpr size_t kBatchBytes = 64 * 1024;
+
+        // A thread's free list for a class may hold this many batches before one is handed back
+        static constexpr size_t kCacheLimit = 2;
+
+    private:
+        // A free block stores the link to the next free block in its own first bytes
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        /**
+         * One thread's free lists; trivially destructible so it stays usable until the thread is gone
+         */
+        struct ThreadCache {
+            FreeBlock* heads[kClassCount];
+            size_t counts[kClassCount];
+
+            // Set once the thread's blocks were returned to the depot during thread exit
+            bool retired;
+        };
+
+        /**
+         * Returns a thread's cached blocks to the depot when the thread exits
+         */
+        struct CacheReleaser {
+            ThreadCache* cache;
+            ~CacheReleaser();
+        };
+
+        /**
+         * Maps a request size to its size class
+         * @return Class index, or kClassCount if the request is larger than every class
+         */
+        static size_t class_of(size_t size) {
+            if (size <= kMinBlockSize) {
+                return 0;
+            }
+            if (size > kMaxBlockSize) {
+                return kClassCount;
+            }
+            // Position of the highest bit of size - 1, relative to the 64 byte class
+            return static_cast<size_t>(64 - __builtin_clzll(size - 1)) - 6;
+        }
+
+        static size_t block_size(size_t size_class) { return kMinBlockSize << size_class; }
+
+        // Number of blocks in one batch of a class (at least one, for the largest classes)
+        static size_t batch_size(size_t size_class) {
+            size_t blocks = kBatchBytes / block_size(size_class);
+            return blocks > 0 ? blocks : 1;
+        }
+
+        /**
+         * Gives the calling thread its free lists, registering the exit hook on first use
+         */
+        static ThreadCache& local_cache() {
+            static thread_local ThreadCache cache{};
+            static thread_local CacheReleaser releaser{&cache};
+            (void)releaser;
+            return cache;
+        }
+
+        /**
+         * Slow path of allocate(): fills an empty free list from the depot or from a new slab
+         * @return One block of the class (the rest of the batch lands in the thread's list)
+         */
+        static void* refill(ThreadCache& cache, size_t size_class);
+
+        /**
+         * Slow path of deallocate(): moves one batch from an overfull free list to the depot
+         */
+        static void drain(ThreadCache& cache, size_t size_class);
+
+        /**
+         * Hands a single block to the depot (used after the thread's cache was retired)
+         */
+        static void release_to_depot(void* block, size_t size_class);
+
+    public:
+        /**
+         * Allocates a block of at least the given size
+         * @param size Requested size in bytes
+         * @return Block aligned for any fundamental type
+         * @throws std::bad_alloc if no memory is available
+         */
+        static void* allocate(size_t size) {
+            size_t size_class = class_of(size);
+            if (size_class == kClassCount) {
+                void* memory = std::malloc(size);
+                if (memory == nullptr) {
+                    throw std::bad_alloc();
+                }
+                return memory;
+            }
+
+            ThreadCache& cache = local_cache();
+            FreeBlock* block = cache.heads[size_class];
+            if (block == nullptr || cache.retired) {
+                return refill(cache, size_class);
+            }
+            cache.heads[size_class] = block->next;
+            --cache.counts[size_class];
+            return block;
+        }
+
+        /**
+         * Returns a block to the calling thread's free list
+         * @param block Block obtained from allocate() on any thread
+         * @param size The size that was passed to allocate()
+         */
+        static void deallocate(void* block, size_t size) {
+            size_t size_class = class_of(size);
+            if (size_class == kClassCount) {
+                std::free(block);
+                return;
+            }
+
+            ThreadCache& cache = local_cache();
+            if (cache.retired) {
+                release_to_depot(block, size_class);
+                return;
+            }
+            FreeBlock* free_block = static_cast<FreeBlock*>(block);
+            free_block->next = cache.heads[size_class];
+            cache.heads[size_class] = free_block;
+            if (++cache.counts[size_class] > kCacheLimit * batch_size(size_class)) {
+                drain(cache, size_class);
+            }
+        }
+};
@@ -0,0 +1,116 @@
+// Lock-free byte ring shared by exactly one producer thread and one consumer thread
+// Carries one direction of an in-process connection (see LocalTransport.h)
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/uio.h>
+
+/**
+ * Single-producer single-consumer byte ring with a power-of-two capacity
+ * Like RingBuffer, positions are free-running 64-bit counters reduced modulo the capacity only when
+ * indexing into the storage. The producer publishes bytes by storing write_position with release
+ * ordering after copying them in, and the consumer frees space the same way with read_position,
+ * so neither side ever waits for the other or takes a lock. Each side also keeps a private copy
+ * of the other side's position and only reloads it when the copy says the ring is full (or empty),
+ * so in the steady state the two threads do not bounce each other's cache lines.
+ */
+class SpscRing {
+    private:
+        // Backing storage (intentionally left uninitialized; only written bytes are ever read)
+        std::unique_ptr<char[]> storage;
+
+        // Size of the storage in bytes (always a power of two), and capacity - 1
+        size_t capacity;
+        size_t mask;
+
+        // Producer side: total bytes ever written, and the last read_position it loaded
+        alignas(64) std::atomic<uint64_t> write_position;
+        uint64_t cached_read_position;
+
+        // Consumer side: total bytes ever consumed, and the last write_position it loaded
+        alignas(64) std::atomic<uint64_t> read_position;
+        uint64_t cached_write_position;
+
+    public:
+        /**
+         * Allocates the ring storage
+         * @param capacity Size in bytes, must be a power of two
+         */
+        explicit SpscRing(size_t capacity)
+            : storage(new char[capacity]), capacity(capacity), mask(capacity - 1), write_position(0),
+              cached_read_position(0), read_position(0), cached_write_position(0) {}
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        /**
+         * Copies as much of the given data into the ring as fits
+         * Must only be called by the producer thread
+         * @param segments Data to write, in order
+         * @param count Number of iovecs
+         * @return Number of bytes written (0 if the ring is full)
+         */
+        size_t write(const struct iovec* segments, int count) {
+            uint64_t position = write_position.load(std::memory_order_relaxed);
+            size_t wanted = 0;
+            for (int i = 0; i < count; ++i) {
+                wanted += segments[i].iov_len;
+            }
+            size_t free = capacity - static_cast<size_t>(position - cached_read_position);
+            if (free < wanted) {
+                cached_read_position = read_position.load(std::memory_order_acquire);
+                free = capacity - static_cast<size_t>(position - cached_read_position);
+            }
+
+            size_t written = 0;
+            for (int i = 0; i < count && written < free; ++i) {
+                const char* data = static_cast<const char*>(segments[i].iov_base);
+                size_t length = std::min(segments[i].iov_len, free - written);
+                size_t offset = static_cast<size_t>(position + written) & mask;
+                size_t first = std::min(length, capacity - offset);
+                memcpy(&storage[offset], data, first);
+                memcpy(&storage[0], data + first, length - first);
+                written += length;
+            }
+            write_position.store(position + written, std::memory_order_release);
+            return written;
+        }
+
+        /**
+         * Moves as many buffered bytes into the given buffers as they hold
+         * Must only be called by the consumer thread
+         * @param segments Destination buffers, filled in order
+         * @param count Number of iovecs
+         * @return Number of bytes read (0 if the ring is empty)
+         */
+        size_t read(const struct iovec* segments, int count) {
+            uint64_t position = read_position.load(std::memory_order_relaxed);
+            size_t wanted = 0;
+            for (int i = 0; i < count; ++i) {
+                wanted += segments[i].iov_len;
+            }
+            size_t available = static_cast<size_t>(cached_write_position - position);
+            if (available < wanted) {
+                cached_write_position = write_position.load(std::memory_order_acquire);
+                available = static_cast<size_t>(cached_write_position - position);
+            }
+
+            size_t copied = 0;
+            for (int i = 0; i < count && copied < available; ++i) {
+                char* data = static_cast<char*>(segments[i].iov_base);
+                size_t length = std::min(segments[i].iov_len, available - copied);
+                size_t offset = static_cast<size_t>(position + copied) & mask;
+                size_t first = std::min(length, capacity - offset);
+                memcpy(data, &storage[offset], first);
+                memcpy(data + first, &storage[0], length - first);
+                copied += length;
+            }
+            read_position.store(position + copied, std::memory_order_release);
+            return copied;
+        }
+};
@@ -1,11 +1,281 @@
 // Main execution file for the chat application
 // This program can run in two modes: as a server (to host chat rooms) or as a client (to join chat rooms)
-// Usage: ./program [server|client]
+// Usage: ./program server [threaded|epoll|sharded [threads]] [--option value ...] | ./program client [--option value ...]
 
 #include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
 #include "client/Client.h"
 #include "server/Server.h"
 
+namespace {
+    /**
+     * Parses a non-negative integer command-line value
+     * @param text Argument text
+     * @param value Receives the parsed number
+     * @return false if the text is not a non-negative integer
+     */
+    bool parse_number(const std::string& text, size_t& value) {
+        char* end = nullptr;
+        unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+        if (text.empty() || text[0] == '-' || *end != '\0') {
+            return false;
+        }
+        value = static_cast<size_t>(parsed);
+        return true;
+    }
+
+    /**
+     * Parses a strictly positive integer command-line value
+     * @param text Argument text
+     * @param value Receives the parsed number
+     * @return false if the text is not a positive integer
+     */
+    bool parse_count(const std::string& text, size_t& value) {
+        size_t parsed = 0;
+        if (!parse_number(text, parsed) || parsed == 0) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    }
+
+    /**
+     * Fills a ServerConfig from the "server" mode arguments
+     * Accepts an optional engine name ("threaded", "epoll" or "sharded [threads]")
+     * followed by any number of "--option value" pairs
+     * @return true on success, false (after printing the problem) on invalid arguments
+     */
+    bool parse_server_arguments(int argc, char* argv[], ServerConfig& config) {
+        int index = 2;
+
+        // Select how the server handles connections
+        // "epoll" serves every client from one event loop, "threaded" uses one thread per client
+        // "sharded" runs one event loop per core, each owning its own slice of the clients
+        if (index < argc && argv[index][0] != '-') {
+            std::string engine = argv[index++];
+            if (engine == "threaded") {
+                config.mode = ServerMode::Threaded;
+            } else if (engine == "epoll") {
+                config.mode = ServerMode::Epoll;
+            } else if (engine == "sharded") {
+                config.mode = ServerMode::Sharded;
+                if (index < argc && argv[index][0] != '-') {
+                    if (!parse_count(argv[index], config.threads)) {
+                        std::cerr << "Invalid thread count: " << argv[index] << std::endl;
+                        return false;
+                    }
+                    ++index;
+                }
+            } else {
+                std::cerr << "Unknown server mode: " << engine << std::endl;
+                return false;
+            }
+        }
+
+        // Remaining arguments tune the server; every option takes exactly one value
+        while (index < argc) {
+            std::string option = argv[index];
+            if (index + 1 >= argc) {
+                std::cerr << "Missing value for " << option << std::endl;
+                return false;
+            }
+            std::string value = argv[index + 1];
+            index += 2;
+
+            bool valid = true;
+            size_t number = 0;
+            if (option == "--port") {
+                valid = parse_count(value, number) && number <= 65535;
+                config.port = static_cast<int>(number);
+            } else if (option == "--backlog") {
+                valid = parse_count(value, number) && number <= 65535;
+                config.listen_backlog = static_cast<int>(number);
+            } else if (option == "--max-connections") {
+                valid = parse_count(value, config.max_connections);
+            } else if (option == "--per-ip-rate") {
+                valid = parse_count(value, config.per_ip_rate);
+            } else if (option == "--per-ip-burst") {
+                valid = parse_count(value, config.per_ip_burst);
+            } else if (option == "--admin-port") {
+                valid = parse_count(value, number) && number <= 65535;
+                config.admin_port = static_cast<int>(number);
+            } else if (option == "--log-dir") {
+                config.log_directory = value;
+            } else if (option == "--log-sync-ms") {
+                valid = parse_count(value, number) && number <= 60 * 1000;
+                config.log_sync_ms = static_cast<int>(number);
+            } else if (option == "--max-queue-messages") {
+                valid = parse_count(value, config.max_queued_messages);
+            } else if (option == "--max-queue-bytes") {
+                valid = parse_count(value, config.max_queued_bytes);
+            } else if (option == "--flush-delay-us") {
+                // 0 (the default) writes output as soon as the event loop iteration ends
+                valid = parse_number(value, number) && number <= 1000 * 1000;
+                config.flush_delay_us = static_cast<int>(number);
+            } else if (option == "--flush-bytes") {
+                valid = parse_count(value, config.flush_bytes);
+            } else if (option == "--node-id") {
+                valid = parse_count(value, number) && number <= UINT32_MAX;
+                config.node_id = static_cast<uint32_t>(number);
+            } else if (option == "--federation-port") {
+                valid = parse_count(value, number) && number <= 65535;
+                config.federation_port = static_cast<int>(number);
+            } else if (option == "--peer") {
+                // Repeatable: one option per other node of the federation
+                config.peers.push_back(value);
+            } else if (option == "--heartbeat-ms") {
+                valid = parse_count(value, number) && number <= 24 * 60 * 60 * 1000;
+                config.heartbeat_ms = static_cast<int>(number);
+            } else if (option == "--read-timeout-ms") {
+                valid = parse_count(value, number) && number <= 24 * 60 * 60 * 1000;
+                config.read_timeout_ms = static_cast<int>(number);
+            } else if (option == "--idle-timeout-ms") {
+                valid = parse_count(value, number) && number <= 24 * 60 * 60 * 1000;
+                config.idle_timeout_ms = static_cast<int>(number);
+            } else if (option == "--write-timeout-ms") {
+                valid = parse_count(value, number) && number <= 24 * 60 * 60 * 1000;
+                config.write_timeout_ms = static_cast<int>(number);
+            } else if (option == "--handoff-socket") {
+                config.handoff_path = value;
+            } else if (option == "--io") {
+                if (value == "epoll") {
+                    config.io_backend = IoBackend::Epoll;
+                } else if (value == "uring") {
+                    config.io_backend = IoBackend::Uring;
+                } else {
+                    valid = false;
+                }
+            } else if (option == "--overflow") {
+                if (value == "drop-oldest") {
+                    config.overflow_policy = OverflowPolicy::DropOldest;
+                } else if (value == "drop-newest") {
+                    config.overflow_policy = OverflowPolicy::DropNewest;
+                } else if (value == "disconnect") {
+                    config.overflow_policy = OverflowPolicy::Disconnect;
+                } else {
+                    valid = false;
+                }
+            } else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return false;
+            }
+
+            if (!valid) {
+                std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+                return false;
+            }
+        }
+        if (!config.peers.empty() && config.federation_port == 0) {
+            std::cerr << "--peer requires --federation-port" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Applies the "client" mode options to a client that is not connected yet
+     * Accepts "--port N" (the server's port, 8080 by default), "--batch-delay-us N" and
+     * "--batch-bytes N" (see Client::set_batching) and "--compress deflate|none"
+     * (see Client::set_compression)
+     * @param port Receives the port to connect to
+     * @return true on success, false (after printing the problem) on invalid arguments
+     */
+    bool parse_client_arguments(int argc, char* argv[], Client& client, int& port) {
+        size_t delay_us = 0;
+        size_t batch_bytes = 16 * 1024;
+        for (int index = 2; index < argc; index += 2) {
+            std::string option = argv[index];
+            if (index + 1 >= argc) {
+                std::cerr << "Missing value for " << option << std::endl;
+                return false;
+            }
+            std::string value = argv[index + 1];
+
+            bool valid = true;
+            size_t number = 0;
+            if (option == "--port") {
+                valid = parse_count(value, number) && number <= 65535;
+                port = static_cast<int>(number);
+            } else if (option == "--batch-delay-us") {
+                // 0 (the default) sends every message right away
+                valid = parse_number(value, delay_us) && delay_us <= 1000 * 1000;
+            } else if (option == "--batch-bytes") {
+                valid = parse_count(value, batch_bytes);
+            } else if (option == "--compress") {
+                // "deflate" asks the server to compress large frames in both directions
+                valid = value == "deflate" || value == "none";
+                client.set_compression(value == "deflate");
+            } else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return false;
+            }
+
+            if (!valid) {
+                std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+                return false;
+            }
+        }
+        client.set_batching(std::chrono::microseconds(delay_us), batch_bytes);
+        return true;
+    }
+
+    /**
+     * Interprets one line typed into the client
+     * Lines starting with "/" are commands, anything else is sent to the default room:
+     *   /join <room>          join (and create if needed) a room
+     *   /leave <room>         leave a room
+     *   /msg <room> <text>    send to a room you have joined
+     *   /dm <user id> <text>  send a private message to one user
+     *   /history <room> [seq] replay a room's logged messages after sequence number seq (default 0)
+     * @param client Connected client
+     * @param line Line read from standard input
+     */
+    void handle_client_input(Client& client, const std::string& line) {
+        if (line.empty() || line[0] != '/') {
+            client.send_message(line);
+            return;
+        }
+
+        // Split into "/command", its first argument and the rest of the line
+        size_t command_end = line.find(' ');
+        std::string command = line.substr(0, command_end);
+        std::string argument;
+        std::string text;
+        if (command_end != std::string::npos) {
+            size_t argument_end = line.find(' ', command_end + 1);
+            argument = line.substr(command_end + 1, argument_end - command_end - 1);
+            if (argument_end != std::string::npos) {
+                text = line.substr(argument_end + 1);
+            }
+        }
+
+        bool sent;
+        if (command == "/join") {
+            sent = client.join_room(argument);
+        } else if (command == "/leave") {
+            sent = client.leave_room(argument);
+        } else if (command == "/msg") {
+            sent = client.send_room_message(argument, text);
+        } else if (command == "/dm") {
+            size_t recipient_id = 0;
+            sent = parse_count(argument, recipient_id) && recipient_id <= UINT32_MAX &&
+                   client.send_direct_message(static_cast<uint32_t>(recipient_id), text);
+        } else if (command == "/history") {
+            size_t since = 0;
+            sent = (text.empty() || text == "0" || parse_count(text, since)) &&
+                   client.request_history(argument, since);
+        } else {
+            std::cerr << "Unknown command: " << command << std::endl;
+            return;
+        }
+        if (!sent) {
+            std::cerr << "Could not send " << command << " (check the room name or user id)" << std::endl;
+        }
+    }
+}
+
 /**
  * Main entry point for the chat application
  * Determines whether to run as a server or client based on command-line arguments
@@ -14,12 +284,16 @@
  * @param argv Array of command-line argument strings
  *             argv[0] = program name
  *             argv[1] = mode ("server" or "client")
+ *             argv[2] = optional server engine ("threaded", "epoll" or "sharded", default "epoll")
+ *             argv[3] = optional reactor thread count for "sharded" (default: one per hardware thread)
+ *             followed by optional "--option value" pairs for the server (see parse_server_arguments)
+ *             or for the client (see parse_client_arguments)
  * @return 0 on success, 1 on error
  */
 int main(int argc, char* argv[]) {
     // Check if the user provided the required command-line argument
     if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " [server|client]" << std::endl;
+        std::cout << "Usage: " << argv[0] << " server [threaded|epoll|sharded [threads]] [--option value ...] | " << argv[0] << " client [--option value ...]" << std::endl;
         return 1;
     }
 
@@ -28,10 +302,15 @@ int main(int argc, char* argv[]) {
 
     // SERVER MODE: Run as a chat server that accepts multiple client connections
     if (mode == "server") {
+        ServerConfig config;
+        if (!parse_server_arguments(argc, argv, config)) {
+            return 1;
+        }
+
         try {
-            // Create a server instance that listens on port 8080
+            // Create a server instance that listens on the configured port (8080 by default)
             // This server will handle multiple concurrent client connections
-            Server server(8080);
+            Server server(config);
             
             // Start the server - this will block and run indefinitely
             // The server will accept client connections and facilitate chat between them
@@ -47,10 +326,14 @@ int main(int argc, char* argv[]) {
         try {
             // Create a client instance for connecting to the chat server
             Client client;
+            int port = 8080;
+            if (!parse_client_arguments(argc, argv, client, port)) {
+                return 1;
+            }
             
-            // Attempt to connect to the server running on localhost (127.0.0.1) port 8080
+            // Attempt to connect to the server running on localhost (127.0.0.1), port 8080 unless --port says otherwise
             // This establishes the TCP connection and starts the message receiving thread
-            if(!client.connect("127.0.0.1", 8080)) {
+            if(!client.connect("127.0.0.1", port)) {
                 std::cerr << "Failed to connect to server" << std::endl;
                 return 1;
             }
@@ -59,17 +342,19 @@ int main(int argc, char* argv[]) {
             std::string message;
             while (true) {
                 // Read a full line of input from the user (including spaces)
-                // This blocks until the user presses Enter
-                std::getline(std::cin, message);
+                // This blocks until the user presses Enter; end of input is treated like "exit"
+                if (!std::getline(std::cin, message)) {
+                    break;
+                }
                 
                 // Check if user wants to exit the chat
                 if (message == "exit") {
                     break; // Exit the input loop
                 }
                 
-                // Send the user's message to the server
-                // The server will then broadcast it to all other connected clients
-                client.send_message(message);
+                // Send the user's message or command to the server
+                // Plain messages go to everyone in the default room
+                handle_client_input(client, message);
             }
 
             // User chose to exit - gracefully disconnect from the server
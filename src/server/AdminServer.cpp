@@ -0,0 +1,129 @@
+// Admin endpoint implementation
+
+#include "AdminServer.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+    // A request line longer than this is not something we serve
+    constexpr size_t kMaxRequestSize = 4096;
+
+    // A scraper that does not finish sending its request within this time is dropped
+    constexpr int kRequestTimeoutMs = 1000;
+
+    /**
+     * Writes the whole buffer to a blocking socket
+     */
+    void send_all(int socket, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return;
+            }
+            data += sent;
+            length -= sent;
+        }
+    }
+}
+
+/**
+ * Constructor: Binds to the loopback interface so metrics are never exposed to the network
+ */
+AdminServer::AdminServer(int port, std::function<std::string()> render)
+    : render(std::move(render)), running(false) {
+    listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_socket < 0) {
+        throw std::runtime_error("Failed to create admin socket");
+    }
+    int enable_reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable_reuse, sizeof(enable_reuse));
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listen_socket, 16) < 0) {
+        close(listen_socket);
+        throw std::runtime_error("Failed to bind admin socket");
+    }
+}
+
+AdminServer::~AdminServer() {
+    stop();
+    close(listen_socket);
+}
+
+void AdminServer::start() {
+    running = true;
+    thread = std::thread(&AdminServer::serve, this);
+}
+
+/**
+ * shutdown() wakes the thread blocked in accept()
+ */
+void AdminServer::stop() {
+    running = false;
+    shutdown(listen_socket, SHUT_RDWR);
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void AdminServer::serve() {
+    while (running) {
+        int client = accept4(listen_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break; // The socket was shut down by stop()
+        }
+        respond(client);
+        close(client);
+    }
+}
+
+/**
+ * Reads until the end of the request headers, then answers based on the request line only
+ */
+void AdminServer::respond(int client) {
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < kMaxRequestSize) {
+        struct pollfd entry{};
+        entry.fd = client;
+        entry.events = POLLIN;
+        if (poll(&entry, 1, kRequestTimeoutMs) <= 0) {
+            return;
+        }
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, received);
+    }
+
+    std::string status = "404 Not Found";
+    std::string body = "Not found\n";
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        status = "200 OK";
+        body = render();
+    }
+
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n";
+    response += body;
+    send_all(client, response.data(), response.size());
+}
@@ -0,0 +1,68 @@
+// Minimal HTTP endpoint for operators, bound to the loopback interface only
+// Serves the server's metrics to Prometheus scrapers (or curl) from one background thread
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * Answers every HTTP request on its port with a freshly rendered text document
+ *
+ * Requests are handled one at a time on a dedicated thread, so scraping never runs on (or slows
+ * down) an event loop thread. Only GET /metrics (and GET /) are recognized; anything else gets a
+ * 404. Connections are closed after each response.
+ */
+class AdminServer {
+    private:
+        // Listening socket bound to 127.0.0.1
+        int listen_socket;
+
+        // Produces the response body for each request
+        std::function<std::string()> render;
+
+        // Thread running serve()
+        std::thread thread;
+
+        // Cleared by stop() to end serve()
+        std::atomic<bool> running;
+
+        /**
+         * Accept loop: reads one request per connection and writes the response
+         */
+        void serve();
+
+        /**
+         * Handles one admin connection
+         * @param client Accepted socket (closed by the caller)
+         */
+        void respond(int client);
+
+    public:
+        /**
+         * Binds the admin port; nothing is served until start()
+         * @param port Port to listen on (loopback only)
+         * @param render Function returning the metrics text; called on the admin thread
+         * @throws std::runtime_error if the port cannot be bound
+         */
+        AdminServer(int port, std::function<std::string()> render);
+
+        /**
+         * Stops serving and closes the listening socket
+         */
+        ~AdminServer();
+
+        AdminServer(const AdminServer&) = delete;
+        AdminServer& operator=(const AdminServer&) = delete;
+
+        /**
+         * Starts the admin thread
+         */
+        void start();
+
+        /**
+         * Stops the admin thread and waits for it; safe to call more than once
+         */
+        void stop();
+};
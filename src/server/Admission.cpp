@@ -0,0 +1,94 @@
+// Admission control implementation
+
+#include "Admission.h"
+#include "Metrics.h"
+#include "common/Protocol.h"
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+    // Buckets are swept at most this often (nanoseconds), and only once this many are tracked
+    constexpr uint64_t kSweepInterval = 1000000000ull;
+    constexpr size_t kSweepThreshold = 4096;
+}
+
+AdmissionControl::AdmissionControl(const ServerConfig& config)
+    : max_connections(config.max_connections), rate(static_cast<double>(config.per_ip_rate)),
+      burst(static_cast<double>(config.per_ip_burst > 0 ? config.per_ip_burst : config.per_ip_rate)),
+      open(0), last_sweep(0) {
+    if (burst < 1) {
+        burst = 1;
+    }
+}
+
+/**
+ * The connection is counted before the rate check so concurrent shards never overshoot the cap
+ */
+Admission AdmissionControl::admit(uint32_t address) {
+    size_t previous = open.fetch_add(1, std::memory_order_relaxed);
+    if (max_connections > 0 && previous >= max_connections) {
+        open.fetch_sub(1, std::memory_order_relaxed);
+        return Admission::Full;
+    }
+    if (rate > 0 && !take_token(address, Metrics::now())) {
+        open.fetch_sub(1, std::memory_order_relaxed);
+        return Admission::RateLimited;
+    }
+    return Admission::Accepted;
+}
+
+/**
+ * Buckets are refilled lazily from the time elapsed since they were last used
+ */
+bool AdmissionControl::take_token(uint32_t address, uint64_t now) {
+    std::lock_guard<std::mutex> lock(buckets_mutex);
+    if (buckets.size() >= kSweepThreshold && now - last_sweep >= kSweepInterval) {
+        // A bucket that would be full again behaves exactly like a missing one
+        for (auto it = buckets.begin(); it != buckets.end();) {
+            double refilled = it->second.tokens + (now - it->second.updated) / 1e9 * rate;
+            it = refilled >= burst ? buckets.erase(it) : std::next(it);
+        }
+        last_sweep = now;
+    }
+
+    auto inserted = buckets.emplace(address, Bucket{burst, now});
+    Bucket& bucket = inserted.first->second;
+    if (!inserted.second) {
+        bucket.tokens += (now - bucket.updated) / 1e9 * rate;
+        if (bucket.tokens > burst) {
+            bucket.tokens = burst;
+        }
+        bucket.updated = now;
+    }
+    if (bucket.tokens < 1) {
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
+/**
+ * The frames are encoded once; every rejection writes the same bytes
+ */
+void reject_connection(int socket, Admission reason) {
+    static const std::string kFull = [] {
+        std::string frame;
+        std::string_view text = "Server is full, try again later";
+        append_frame(frame, MessageType::Notice, 0, 0, text.data(), text.size());
+        return frame;
+    }();
+    static const std::string kRateLimited = [] {
+        std::string frame;
+        std::string_view text = "Too many connections from your address, try again later";
+        append_frame(frame, MessageType::Notice, 0, 0, text.data(), text.size());
+        return frame;
+    }();
+
+    const std::string& frame = reason == Admission::Full ? kFull : kRateLimited;
+    ssize_t ignored = send(socket, frame.data(), frame.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)ignored;
+    close(socket);
+}
@@ -0,0 +1,103 @@
+// Admission control for new client connections
+// Caps the number of open connections and rate-limits how fast each client address may connect
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include "ServerConfig.h"
+
+/**
+ * Decision taken for a newly accepted connection
+ */
+enum class Admission {
+    Accepted,    // Serve the client; it counts as open until AdmissionControl::release()
+    Full,        // config.max_connections connections are already open
+    RateLimited  // The client's address used up its token bucket
+};
+
+/**
+ * Admission checks shared by every shard (and the threaded accept loop)
+ *
+ * Connections are accepted from the backlog first and judged afterwards: a rejected client is
+ * told why and closed at once, which keeps the backlog draining during a reconnect storm instead
+ * of leaving clients stuck in it until their connect times out.
+ *
+ * Each client IPv4 address has a token bucket refilled at config.per_ip_rate tokens per second up
+ * to config.per_ip_burst; every connection takes one token. Buckets that have refilled completely
+ * carry no information and are swept out, so memory follows the number of recently active addresses.
+ */
+class AdmissionControl {
+    private:
+        struct Bucket {
+            double tokens;
+            uint64_t updated; // Metrics::now() of the last refill
+        };
+
+        // Limits taken from the configuration (0 = unlimited)
+        size_t max_connections;
+        double rate;
+        double burst;
+
+        // Connections accepted and not yet released, across all shards
+        std::atomic<size_t> open;
+
+        // Token buckets by address (guarded by buckets_mutex; only touched while accepting)
+        std::unordered_map<uint32_t, Bucket> buckets;
+        std::mutex buckets_mutex;
+
+        // Time of the last sweep of full buckets
+        uint64_t last_sweep;
+
+        /**
+         * Takes a token from an address's bucket
+         * @return false if the bucket is empty
+         */
+        bool take_token(uint32_t address, uint64_t now);
+
+    public:
+        /**
+         * @param config Server settings (max_connections, per_ip_rate and per_ip_burst are used)
+         */
+        explicit AdmissionControl(const ServerConfig& config);
+
+        AdmissionControl(const AdmissionControl&) = delete;
+        AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+        /**
+         * Decides whether to serve a newly accepted connection; safe to call from any thread
+         * @param address Client IPv4 address in network byte order
+         * @return Accepted (the caller must call release() when the connection closes), Full or RateLimited
+         */
+        Admission admit(uint32_t address);
+
+        /**
+         * Counts a connection that bypasses the checks (one taken over from a previous process)
+         */
+        void adopt() { open.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+         * Notes that an admitted connection has closed
+         */
+        void release() { open.fetch_sub(1, std::memory_order_relaxed); }
+
+        /**
+         * Whether admit() needs the client's address (only when per-address rate limiting is on)
+         */
+        bool rate_limited() const { return rate > 0; }
+
+        /**
+         * Connections currently open across the server
+         */
+        size_t open_connections() const { return open.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Tells a rejected client why with a best-effort Notice frame, then closes its socket
+ * The notice is written without blocking; if it does not fit, the client only sees the close.
+ * @param socket Accepted client socket
+ * @param reason Admission::Full or Admission::RateLimited
+ */
+void reject_connection(int socket, Admission reason);
@@ -0,0 +1,131 @@
+// Per-connection state used by the event-driven (epoll) server modes
+// Each accepted client gets exactly one Connection object owned by the event loop
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "common/Protocol.h"
+#include "common/LocalTransport.h"
+#include "WriteQueue.h"
+#include "ServerConfig.h"
+#include "RoomIndex.h"
+#include "MessageLog.h"
+#include "TimingWheel.h"
+
+// Maximum frames gathered into one io_uring sendmsg operation (UIO_MAXIOV, which also covers a
+// full queue with the default limits): only one send is in flight per client, so each one has to
+// be able to take whatever accumulated meanwhile
+constexpr int kUringSendSegments = 1024;
+
+/**
+ * State kept for a single client connection while it is served by an event loop
+ * Because the loop never blocks on one client, anything that cannot be written
+ * immediately has to be remembered here until the socket becomes writable again
+ * The TimerNode base is the connection's entry in its reactor's timing wheel, which fires when
+ * the next heartbeat or timeout check is due
+ */
+struct Connection : TimerNode {
+    // Non-blocking socket file descriptor for this client (for an in-process client, the
+    // notification fd of its endpoint)
+    int socket;
+
+    // Server end of an in-process connection, used instead of the socket (nullptr for TCP clients)
+    std::unique_ptr<LocalEndpoint> local;
+
+    // Server-assigned id stamped as sender_id on every frame this client sends
+    uint32_t id;
+
+    // Received bytes that have not yet been parsed into complete frames
+    RingBuffer inbound;
+
+    // Incremental parser that extracts frames from inbound
+    FrameParser parser;
+
+    // Encoded frames accepted for delivery to this client but not yet written to the socket
+    WriteQueue outbound;
+
+    // Position of this connection in its reactor's dense client list (for O(1) removal)
+    size_t slot;
+
+    // Rooms this client has joined on its reactor's RoomIndex (the reverse index)
+    std::vector<RoomMembership> rooms;
+
+    // History replay in progress for this client, fed into outbound as the client drains it
+    std::unique_ptr<HistoryCursor> history;
+
+    // Whether the client negotiated compression; large frames are then queued in compressed form
+    bool compress;
+
+    // Set while the connection sits in its reactor's list of queues to flush
+    bool flush_scheduled;
+
+    // Time (Metrics::now()) by which scheduled output must be written when a flush delay is configured
+    uint64_t flush_deadline;
+
+    // Times (Metrics::now()) of the last bytes received, the last frame other than Ping or Pong,
+    // and the last write progress (or the moment output was queued for an empty queue)
+    uint64_t last_received;
+    uint64_t last_activity;
+    uint64_t last_write_progress;
+
+    // Time the last heartbeat Ping was sent (0 = none yet)
+    uint64_t last_ping;
+
+    // Set when the connection failed or hung up and is waiting to be closed
+    // Closing is deferred so other code iterating over connections never sees a freed object
+    bool closing;
+
+    // io_uring backend only: the kernel reads these while a sendmsg operation is in flight,
+    // so they live here instead of on the stack (the frames themselves are pinned in outbound)
+    // The iovec array is allocated by the first send, so epoll connections do not carry it
+    struct msghdr send_header;
+    std::unique_ptr<struct iovec[]> send_segments;
+
+    // io_uring backend only: whether a sendmsg is in flight
+    bool send_in_flight;
+
+    // io_uring backend only: operations the kernel still holds (receive, send, cancel) plus one
+    // reference owned by the reactor until the connection is closed; the object is freed at 0
+    uint32_t io_references;
+
+    Connection(int socket, uint32_t id, const ServerConfig& config, ShardMetrics* metrics)
+        : socket(socket), id(id), inbound(kReceiveBufferSize),
+          outbound(config.max_queued_messages, config.max_queued_bytes, config.overflow_policy, metrics),
+          slot(0), compress(false), flush_scheduled(false), flush_deadline(0), last_received(0), last_activity(0),
+          last_write_progress(0), last_ping(0), closing(false), send_header{},
+          send_in_flight(false), io_references(0) {}
+
+    /**
+     * Returns a closed connection to its freshly constructed state for the next client
+     * The receive ring, write queue slots and room list keep their memory, so a recycled
+     * connection is served without any allocation
+     * @param socket Socket of the new client
+     * @param id Id assigned to the new client
+     */
+    void reset(int socket, uint32_t id) {
+        this->socket = socket;
+        this->id = id;
+        local.reset();
+        inbound.clear();
+        parser = FrameParser();
+        outbound.clear();
+        slot = 0;
+        rooms.clear();
+        history.reset();
+        compress = false;
+        flush_scheduled = false;
+        flush_deadline = 0;
+        last_received = 0;
+        last_activity = 0;
+        last_write_progress = 0;
+        last_ping = 0;
+        closing = false;
+        send_header = {};
+        send_in_flight = false;
+        io_references = 0;
+    }
+};
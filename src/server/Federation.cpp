@@ -0,0 +1,729 @@
+// Server federation implementation
+
+#include "Federation.h"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Metrics.h"
+
+namespace {
+    // Peers that do not finish the handshake (or stop taking writes) within this time are dropped
+    constexpr int kLinkTimeoutMs = 2000;
+
+    // Pause between attempts to reach a peer that is down
+    constexpr int kReconnectDelayMs = 500;
+
+    // Items a link may have waiting; relays beyond this are dropped while the peer catches up
+    constexpr size_t kMaxLinkQueue = 64 * 1024;
+
+    // Gather entries per sendmsg() call
+    constexpr size_t kMaxIov = 64;
+
+    // Size of a PeerHello payload: [u32 node id][u64 incarnation]
+    constexpr size_t kHelloSize = 12;
+
+    /**
+     * Room a relayed frame is addressed to (Chat frames go to the default room)
+     * Same layout rules as the reactor's helper; the frame was validated on arrival
+     */
+    std::string_view room_of(const MessageRef& message) {
+        const char* frame = message.data();
+        if (static_cast<MessageType>(frame[4]) != MessageType::RoomMessage) {
+            return kDefaultRoom;
+        }
+        size_t length = static_cast<unsigned char>(frame[kFrameHeaderSize]);
+        return std::string_view(frame + kFrameHeaderSize + 1, length);
+    }
+
+    /**
+     * Reads exactly length bytes from a blocking socket
+     * @return false if the connection closed, failed or timed out first
+     */
+    bool receive_all(int socket, char* out, size_t length) {
+        while (length > 0) {
+            ssize_t received = recv(socket, out, length, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            out += received;
+            length -= received;
+        }
+        return true;
+    }
+
+    /**
+     * Writes the whole buffer to a blocking socket
+     * @return false if the connection failed or timed out first
+     */
+    bool send_all(int socket, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            length -= sent;
+        }
+        return true;
+    }
+
+    /**
+     * Bounds how long blocking reads and writes on a link socket may stall (0 removes the bound)
+     */
+    void set_timeouts(int socket, int timeout_ms) {
+        struct timeval timeout{};
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    /**
+     * Encodes a PeerHello frame
+     */
+    std::string encode_hello(uint32_t node_id, uint64_t incarnation) {
+        char payload[kHelloSize];
+        for (int i = 0; i < 4; ++i) {
+            payload[i] = static_cast<char>(node_id >> (24 - 8 * i));
+        }
+        for (int i = 0; i < 8; ++i) {
+            payload[4 + i] = static_cast<char>(incarnation >> (56 - 8 * i));
+        }
+        std::string frame;
+        append_frame(frame, MessageType::PeerHello, node_id, 0, payload, sizeof(payload));
+        return frame;
+    }
+
+    /**
+     * Reads a PeerHello frame
+     * @return false if the next frame is not a well-formed PeerHello
+     */
+    bool receive_hello(int socket, uint32_t& node, uint64_t& incarnation) {
+        char header_bytes[kFrameHeaderSize];
+        char payload[kHelloSize];
+        FrameHeader header;
+        if (!receive_all(socket, header_bytes, sizeof(header_bytes)) ||
+            !decode_frame_header(header_bytes, header) ||
+            header.type != MessageType::PeerHello || header.length != kHelloSize ||
+            !receive_all(socket, payload, sizeof(payload))) {
+            return false;
+        }
+        node = read_u32(payload);
+        incarnation = read_u64(payload + 4);
+        return true;
+    }
+
+    /**
+     * Checks that a relay payload is a complete Chat or RoomMessage frame
+     */
+    bool is_valid_relayed_frame(const char* frame, size_t size) {
+        FrameHeader header;
+        if (size < kFrameHeaderSize || !decode_frame_header(frame, header) ||
+            header.length != size - kFrameHeaderSize || header.length > kMaxPayloadSize) {
+            return false;
+        }
+        if (header.type == MessageType::Chat) {
+            return true;
+        }
+        if (header.type != MessageType::RoomMessage || header.length < 1) {
+            return false;
+        }
+        size_t name_length = static_cast<unsigned char>(frame[kFrameHeaderSize]);
+        return 1 + name_length <= header.length &&
+               is_valid_room_name(std::string_view(frame + kFrameHeaderSize + 1, name_length));
+    }
+
+    /**
+     * Sleeps until the eventfd is written or the timeout passes, then clears it
+     */
+    void wait_for_wake(int wake_fd, int timeout_ms) {
+        struct pollfd entry{};
+        entry.fd = wake_fd;
+        entry.events = POLLIN;
+        if (poll(&entry, 1, timeout_ms) > 0) {
+            uint64_t wakeups;
+            ssize_t ignored = read(wake_fd, &wakeups, sizeof(wakeups));
+            (void)ignored;
+        }
+    }
+}
+
+/**
+ * A newer sequence slides the window forward; an older one is looked up in the bitmap
+ */
+bool SequenceWindow::accept(uint64_t sequence) {
+    if (sequence > highest) {
+        uint64_t shift = sequence - highest;
+        if (shift >= kWindow) {
+            seen.reset();
+        } else {
+            seen <<= shift;
+        }
+        seen.set(0);
+        highest = sequence;
+        return true;
+    }
+    uint64_t age = highest - sequence;
+    if (age >= kWindow || seen.test(age)) {
+        return false;
+    }
+    seen.set(age);
+    return true;
+}
+
+/**
+ * Constructor: Validates the settings, binds the federation port and parses the peer addresses
+ */
+Federation::Federation(const ServerConfig& config, DeliverFunction deliver)
+    : node_id(config.node_id), deliver(std::move(deliver)), running(false) {
+    if (node_id == 0) {
+        throw std::runtime_error("Federation needs a nonzero node id");
+    }
+    if (config.peers.size() > 64) {
+        throw std::runtime_error("Federation supports at most 64 peers");
+    }
+
+    std::random_device random;
+    incarnation = (uint64_t(random()) << 32) ^ random() ^ Metrics::now();
+
+    for (const std::string& peer : config.peers) {
+        size_t colon = peer.rfind(':');
+        char* end = nullptr;
+        long port = colon == std::string::npos ? 0 : std::strtol(peer.c_str() + colon + 1, &end, 10);
+        if (colon == 0 || port <= 0 || port > 65535 || *end != '\0') {
+            throw std::runtime_error("Invalid federation peer (expected HOST:PORT): " + peer);
+        }
+        auto link = std::make_unique<PeerLink>();
+        link->host = peer.substr(0, colon);
+        link->port = static_cast<int>(port);
+        link->index = links.size();
+        link->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (link->wake_fd < 0) {
+            throw std::runtime_error("Failed to create federation eventfd");
+        }
+        links.push_back(std::move(link));
+    }
+
+    listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_socket < 0) {
+        throw std::runtime_error("Failed to create federation socket");
+    }
+    int enable_reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable_reuse, sizeof(enable_reuse));
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(config.federation_port);
+    if (bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listen_socket, 64) < 0) {
+        close(listen_socket);
+        throw std::runtime_error("Failed to bind federation socket");
+    }
+
+    interest = std::make_shared<const InterestTable>();
+}
+
+Federation::~Federation() {
+    stop();
+    close(listen_socket);
+    for (auto& link : links) {
+        close(link->wake_fd);
+    }
+}
+
+void Federation::start() {
+    running = true;
+    accept_thread = std::thread(&Federation::accept_links, this);
+    for (auto& link : links) {
+        link->thread = std::thread(&Federation::run_link, this, std::ref(*link));
+    }
+}
+
+/**
+ * shutdown() wakes the threads blocked in accept() and recv(); link threads are woken through
+ * their eventfd. Inbound sockets are only closed after their thread is joined.
+ */
+void Federation::stop() {
+    running = false;
+    shutdown(listen_socket, SHUT_RDWR);
+    if (accept_thread.joinable()) {
+        accept_thread.join();
+    }
+
+    for (auto& link : links) {
+        uint64_t one = 1;
+        ssize_t ignored = write(link->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    for (auto& link : links) {
+        if (link->thread.joinable()) {
+            link->thread.join();
+        }
+    }
+
+    // The accept thread is gone, so nothing else touches the inbound list any more
+    for (auto& link : inbound) {
+        shutdown(link->socket, SHUT_RDWR);
+    }
+    for (auto& link : inbound) {
+        if (link->thread.joinable()) {
+            link->thread.join();
+        }
+        close(link->socket);
+    }
+    inbound.clear();
+}
+
+/**
+ * Finished inbound links are reaped whenever a new peer connects, which bounds them by the
+ * number of peers that ever reconnected at once
+ */
+void Federation::accept_links() {
+    while (running) {
+        int peer = accept4(listen_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (peer < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break; // The socket was shut down by stop()
+        }
+        int enable = 1;
+        setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        std::lock_guard<std::mutex> lock(inbound_mutex);
+        auto finished = std::partition(inbound.begin(), inbound.end(),
+                                       [](const std::unique_ptr<InboundLink>& link) { return !link->finished; });
+        for (auto it = finished; it != inbound.end(); ++it) {
+            (*it)->thread.join();
+            close((*it)->socket);
+        }
+        inbound.erase(finished, inbound.end());
+
+        auto link = std::make_unique<InboundLink>();
+        link->socket = peer;
+        link->thread = std::thread(&Federation::serve_inbound, this, std::ref(*link));
+        inbound.push_back(std::move(link));
+    }
+}
+
+/**
+ * Frames from a peer are read with plain blocking reads; a peer sending anything malformed is
+ * disconnected and will redial
+ */
+void Federation::serve_inbound(InboundLink& link) {
+    set_timeouts(link.socket, kLinkTimeoutMs);
+    uint32_t peer_node = 0;
+    uint64_t peer_incarnation = 0;
+    std::string hello = encode_hello(node_id, incarnation);
+    if (!receive_hello(link.socket, peer_node, peer_incarnation) || peer_node == 0 || peer_node == node_id ||
+        !send_all(link.socket, hello.data(), hello.size())) {
+        link.finished = true;
+        return;
+    }
+    set_timeouts(link.socket, 0);
+    link.node = peer_node;
+
+    {
+        // A restarted peer numbers its messages from scratch, so its old window no longer applies
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        SequenceWindow& window = seen[peer_node];
+        if (window.incarnation != peer_incarnation) {
+            window = SequenceWindow();
+            window.incarnation = peer_incarnation;
+        }
+    }
+    {
+        // The newest link of a node replaces whatever an older one announced
+        std::lock_guard<std::mutex> lock(interest_mutex);
+        NodeInterest& entry = interest_by_node[peer_node];
+        entry.link = &link;
+        entry.rooms.clear();
+        publish_interest();
+    }
+
+    char header_bytes[kFrameHeaderSize];
+    std::string room;
+    while (running) {
+        FrameHeader header;
+        if (!receive_all(link.socket, header_bytes, sizeof(header_bytes)) ||
+            !decode_frame_header(header_bytes, header)) {
+            break;
+        }
+
+        if (header.type == MessageType::Subscribe || header.type == MessageType::Unsubscribe) {
+            if (header.length > kMaxRoomNameLength) {
+                break;
+            }
+            room.resize(header.length);
+            if (!receive_all(link.socket, &room[0], room.size()) || !is_valid_room_name(room)) {
+                break;
+            }
+            update_interest(link, room, header.type == MessageType::Subscribe);
+        } else if (header.type == MessageType::Relay) {
+            if (header.length > kFrameHeaderSize + kMaxPayloadSize) {
+                break;
+            }
+            MessageRef frame = MessageRef::allocate(header.length);
+            if (!receive_all(link.socket, frame.mutable_data(), header.length) ||
+                !is_valid_relayed_frame(frame.data(), frame.size())) {
+                break;
+            }
+            receive_relay(header.sender_id, std::move(frame));
+        } else {
+            break;
+        }
+    }
+
+    drop_interest(link);
+    link.finished = true;
+}
+
+/**
+ * A link whose connection failed waits kReconnectDelayMs (or until stop()) before redialing
+ */
+void Federation::run_link(PeerLink& link) {
+    while (running) {
+        if (!connect_link(link)) {
+            wait_for_wake(link.wake_fd, kReconnectDelayMs);
+            continue;
+        }
+
+        // The peer never sends anything after the handshake, so a readable socket means it went away
+        struct pollfd entries[2]{};
+        entries[0].fd = link.wake_fd;
+        entries[0].events = POLLIN;
+        entries[1].fd = link.socket;
+        entries[1].events = POLLIN;
+        while (running) {
+            if (!write_queue(link)) {
+                break;
+            }
+            if (poll(entries, 2, -1) < 0 && errno != EINTR) {
+                break;
+            }
+            if (entries[1].revents != 0) {
+                break;
+            }
+            if (entries[0].revents & POLLIN) {
+                uint64_t wakeups;
+                ssize_t ignored = read(link.wake_fd, &wakeups, sizeof(wakeups));
+                (void)ignored;
+            }
+        }
+
+        link.connected = false;
+        close(link.socket);
+        link.socket = -1;
+    }
+}
+
+/**
+ * Whatever was queued while the link was down is discarded: the peer gets a fresh list of this
+ * node's rooms instead, and relays from before the reconnect are not worth replaying late
+ */
+bool Federation::connect_link(PeerLink& link) {
+    struct addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(link.host.c_str(), std::to_string(link.port).c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+    link.socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (link.socket < 0) {
+        freeaddrinfo(addresses);
+        return false;
+    }
+    // SO_SNDTIMEO also bounds connect(); it stays set so a stalled peer cannot block the link forever
+    set_timeouts(link.socket, kLinkTimeoutMs);
+    int enable = 1;
+    setsockopt(link.socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    bool connected = ::connect(link.socket, addresses->ai_addr, addresses->ai_addrlen) == 0;
+    freeaddrinfo(addresses);
+
+    uint32_t peer_node = 0;
+    uint64_t peer_incarnation = 0;
+    std::string hello = encode_hello(node_id, incarnation);
+    if (!connected || !send_all(link.socket, hello.data(), hello.size()) ||
+        !receive_hello(link.socket, peer_node, peer_incarnation) || peer_node == 0 || peer_node == node_id) {
+        close(link.socket);
+        link.socket = -1;
+        return false;
+    }
+
+    if (link.node.exchange(peer_node) != peer_node) {
+        // The link's bit in the interest masks now stands for this node
+        std::lock_guard<std::mutex> lock(interest_mutex);
+        publish_interest();
+    }
+
+    std::string subscriptions;
+    {
+        std::lock_guard<std::mutex> lock(local_mutex);
+        LinkItem stale;
+        while (link.queue.pop(stale)) {
+            link.queued.fetch_sub(1);
+        }
+        for (const auto& entry : local_rooms) {
+            append_frame(subscriptions, MessageType::Subscribe, node_id, 0, entry.first.data(), entry.first.size());
+        }
+        // Announcements made from here on are queued behind the list
+        link.connected = true;
+    }
+    if (!send_all(link.socket, subscriptions.data(), subscriptions.size())) {
+        link.connected = false;
+        close(link.socket);
+        link.socket = -1;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Relayed frames are not copied: each gets a Relay header of its own and both are handed to
+ * sendmsg() as gather entries
+ */
+bool Federation::write_queue(PeerLink& link) {
+    link.wake_pending.store(false);
+
+    std::vector<LinkItem> items;
+    LinkItem item;
+    while (link.queue.pop(item)) {
+        items.push_back(std::move(item));
+    }
+    if (items.empty()) {
+        return true;
+    }
+    link.queued.fetch_sub(items.size());
+
+    std::vector<char> headers(items.size() * kFrameHeaderSize);
+    std::vector<struct iovec> iov;
+    iov.reserve(items.size() * 2);
+    for (size_t i = 0; i < items.size(); ++i) {
+        const MessageRef& frame = items[i].frame;
+        if (items[i].relay) {
+            FrameHeader header;
+            header.length = static_cast<uint32_t>(frame.size());
+            header.type = MessageType::Relay;
+            header.sender_id = node_id;
+            header.sequence = read_u64(frame.data() + 12);
+            char* out = &headers[i * kFrameHeaderSize];
+            encode_frame_header(header, out);
+            iov.push_back({out, kFrameHeaderSize});
+        }
+        iov.push_back({const_cast<char*>(frame.data()), frame.size()});
+    }
+
+    size_t next = 0;
+    while (next < iov.size()) {
+        struct msghdr message{};
+        message.msg_iov = &iov[next];
+        message.msg_iovlen = std::min(iov.size() - next, kMaxIov);
+        ssize_t sent = sendmsg(link.socket, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        // Skip what was written, trimming a partially written entry
+        size_t remaining = static_cast<size_t>(sent);
+        while (remaining > 0) {
+            if (remaining >= iov[next].iov_len) {
+                remaining -= iov[next].iov_len;
+                ++next;
+            } else {
+                iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + remaining;
+                iov[next].iov_len -= remaining;
+                remaining = 0;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the eventfd only if no wake-up is outstanding yet
+ */
+bool Federation::enqueue(PeerLink& link, LinkItem item) {
+    if (link.queued.fetch_add(1) >= kMaxLinkQueue) {
+        link.queued.fetch_sub(1);
+        return false;
+    }
+    link.queue.push(std::move(item));
+    if (!link.wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(link.wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    return true;
+}
+
+/**
+ * Links that are down are skipped; they send the full list when they reconnect
+ */
+void Federation::announce(MessageType type, std::string_view room) {
+    FrameHeader header;
+    header.type = type;
+    header.sender_id = node_id;
+    MessageRef frame = encode_frame(header, room.data(), room.size());
+    for (auto& link : links) {
+        if (link->connected) {
+            enqueue(*link, LinkItem{frame, false});
+        }
+    }
+}
+
+void Federation::update_interest(const InboundLink& link, std::string_view room, bool subscribed) {
+    std::lock_guard<std::mutex> lock(interest_mutex);
+    auto entry = interest_by_node.find(link.node);
+    if (entry == interest_by_node.end() || entry->second.link != &link) {
+        return; // A newer link from the same node took over
+    }
+    std::vector<std::string>& rooms = entry->second.rooms;
+    auto position = std::lower_bound(rooms.begin(), rooms.end(), room);
+    bool present = position != rooms.end() && *position == room;
+    if (subscribed && !present) {
+        rooms.emplace(position, room);
+    } else if (!subscribed && present) {
+        rooms.erase(position);
+    } else {
+        return;
+    }
+    publish_interest();
+}
+
+void Federation::drop_interest(const InboundLink& link) {
+    std::lock_guard<std::mutex> lock(interest_mutex);
+    auto entry = interest_by_node.find(link.node);
+    if (entry != interest_by_node.end() && entry->second.link == &link) {
+        interest_by_node.erase(entry);
+        publish_interest();
+    }
+}
+
+/**
+ * Interest arrives on the inbound link from a node, but relays leave on the outbound link to it;
+ * the two are matched by the node id both handshakes carry
+ */
+void Federation::publish_interest() {
+    auto table = std::make_shared<InterestTable>();
+    for (const auto& node : interest_by_node) {
+        uint64_t mask = 0;
+        for (const auto& link : links) {
+            if (link->node.load() == node.first) {
+                mask |= uint64_t(1) << link->index;
+            }
+        }
+        if (mask == 0) {
+            continue;
+        }
+        for (const std::string& room : node.second.rooms) {
+            table->emplace_back(room, mask);
+        }
+    }
+
+    // Merge the nodes' entries for the same room into one mask
+    std::sort(table->begin(), table->end());
+    size_t merged = 0;
+    for (size_t i = 0; i < table->size(); ++i) {
+        if (merged > 0 && (*table)[merged - 1].first == (*table)[i].first) {
+            (*table)[merged - 1].second |= (*table)[i].second;
+        } else {
+            if (merged != i) {
+                (*table)[merged] = std::move((*table)[i]);
+            }
+            ++merged;
+        }
+    }
+    table->resize(merged);
+
+    std::atomic_store(&interest, std::shared_ptr<const InterestTable>(std::move(table)));
+}
+
+void Federation::receive_relay(uint32_t origin, MessageRef frame) {
+    {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        if (!seen[origin].accept(read_u64(frame.data() + 12))) {
+            return;
+        }
+    }
+    // The sender's id only means something on its own node, so it is marked as relayed where a
+    // local client or a Direct message could otherwise mistake it for a local user's
+    FrameHeader header;
+    decode_frame_header(frame.data(), header);
+    header.sender_id |= kRelayedSenderBit;
+    encode_frame_header(header, frame.mutable_data());
+
+    // Latency is measured from arrival on this node; the origin's clock is not comparable.
+    // Stamped before deliver() shares the buffer with the recipients' queues
+    frame.set_origin_time(Metrics::now());
+    deliver(room_of(frame), frame);
+}
+
+void Federation::room_opened(std::string_view room) {
+    std::lock_guard<std::mutex> lock(local_mutex);
+    if (++local_rooms[std::string(room)] == 1) {
+        announce(MessageType::Subscribe, room);
+    }
+}
+
+void Federation::room_closed(std::string_view room) {
+    std::lock_guard<std::mutex> lock(local_mutex);
+    auto entry = local_rooms.find(std::string(room));
+    if (entry != local_rooms.end() && --entry->second == 0) {
+        local_rooms.erase(entry);
+        announce(MessageType::Unsubscribe, room);
+    }
+}
+
+/**
+ * Called on the event loop thread that handled the client's frame, so it only looks up the
+ * snapshot and pushes onto the links' queues
+ * The links get an untimed copy, like the message log: a link thread holding the client's frame
+ * would either end its fan-out measurement outside any shard or stretch it by the relay's send
+ */
+void Federation::forward(std::string_view room, const MessageRef& frame) {
+    if (links.empty()) {
+        return;
+    }
+    std::shared_ptr<const InterestTable> table = std::atomic_load(&interest);
+    auto entry = std::lower_bound(table->begin(), table->end(), room,
+                                  [](const std::pair<std::string, uint64_t>& item, std::string_view name) {
+                                      return item.first < name;
+                                  });
+    if (entry == table->end() || entry->first != room) {
+        return;
+    }
+    MessageRef relayed;
+    for (uint64_t mask = entry->second; mask != 0; mask &= mask - 1) {
+        PeerLink& link = *links[__builtin_ctzll(mask)];
+        if (link.connected) {
+            if (!relayed) {
+                relayed = MessageRef::allocate(frame.size());
+                memcpy(relayed.mutable_data(), frame.data(), frame.size());
+            }
+            enqueue(link, LinkItem{relayed, true});
+        }
+    }
+}
@@ -0,0 +1,285 @@
+// Federation of several chat servers into one chat network
+// Each server relays room messages to the peer nodes that have members in the room
+
+#pragma once
+#include <atomic>
+#include <bitset>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "common/MessageBuffer.h"
+#include "common/Protocol.h"
+#include "MpscQueue.h"
+#include "ServerConfig.h"
+
+/**
+ * Item waiting to be written to a peer link
+ */
+struct LinkItem {
+    // Encoded frame: a room frame to relay, or a Subscribe/Unsubscribe frame sent as is
+    MessageRef frame;
+
+    // Whether the frame is a room frame that has to be wrapped in a Relay header
+    bool relay = false;
+};
+
+/**
+ * Connection from this node to one peer node; carries this node's relays and subscriptions to it
+ *
+ * Every node dials every configured peer, so each pair of nodes is joined by two links, one per
+ * direction. After the PeerHello handshake a link only carries traffic from the dialing node.
+ */
+struct PeerLink {
+    // Where the peer's federation port is
+    std::string host;
+    int port;
+
+    // Position in Federation::links; bit number in the interest masks
+    size_t index;
+
+    // Socket of the current connection (-1 while disconnected; link thread only)
+    int socket = -1;
+
+    // Node id the peer announced in its handshake (0 until the first handshake)
+    std::atomic<uint32_t> node{0};
+
+    // Set while the link is connected; relays are only queued for connected links
+    std::atomic<bool> connected{false};
+
+    // Frames waiting for the link thread, with a count that bounds the queue
+    MpscQueue<LinkItem> queue;
+    std::atomic<size_t> queued{0};
+
+    // eventfd the link thread sleeps on; written when the queue gains work or the federation stops
+    int wake_fd = -1;
+    std::atomic<bool> wake_pending{false};
+
+    std::thread thread;
+};
+
+/**
+ * Connection accepted from a peer node; carries that node's relays and subscriptions to this node
+ */
+struct InboundLink {
+    int socket = -1;
+
+    // Node id the peer announced in its handshake
+    uint32_t node = 0;
+
+    // Set once the link thread has finished, so the accept loop can join it
+    std::atomic<bool> finished{false};
+
+    std::thread thread;
+};
+
+/**
+ * Duplicate filter for the sequence numbers of one origin node
+ * Remembers which of the last kWindow sequence numbers were seen; anything older counts as seen
+ */
+struct SequenceWindow {
+    static constexpr size_t kWindow = 4096;
+
+    // Incarnation of the origin node the window belongs to; a restarted node starts a new window
+    uint64_t incarnation = 0;
+
+    // Highest sequence number seen, and which of the kWindow numbers up to it were seen (bit 0 = highest)
+    uint64_t highest = 0;
+    std::bitset<kWindow> seen;
+
+    /**
+     * Records a sequence number
+     * @return true the first time it is seen, false for a duplicate (or one too old to tell)
+     */
+    bool accept(uint64_t sequence);
+};
+
+/**
+ * Links this server to the other nodes of a federation and relays room messages between them
+ *
+ * Nodes form a full mesh: each one is configured with the federation addresses of all the others.
+ * A node tells its peers which rooms have members on it (Subscribe/Unsubscribe frames, sent when a
+ * room gains its first or loses its last local member on any shard) and relays a message that one
+ * of its own clients sent only to the peers subscribed to the message's room. Relayed messages are
+ * delivered to the local members of the room but never relayed again, so no node sees traffic for
+ * rooms it has no members in.
+ *
+ * Every relay carries the origin node's id and the sequence number the origin stamped on it; a
+ * receiving node drops any (origin node, sequence) pair it has already delivered, so a message
+ * that reaches it twice (e.g. over a reconnected link) is shown once.
+ *
+ * Client ids are only unique per node, so a relayed frame reaches local members with
+ * kRelayedSenderBit set in its sender id. Direct messages never cross nodes, and one addressed
+ * to a relayed sender id is refused instead of reaching the local client with the same number.
+ *
+ * The federation runs on its own threads with blocking sockets: one accept thread, one thread per
+ * inbound link and one per outbound link. The event loops only push to lock-free queues.
+ */
+class Federation {
+    public:
+        /**
+         * Delivers a relayed frame to this node's members of a room (called on a link thread)
+         */
+        using DeliverFunction = std::function<void(std::string_view room, const MessageRef& frame)>;
+
+    private:
+        // Interest of the peer nodes: room name -> bit mask of the links whose node has members in it
+        // Sorted by name; replaced as a whole whenever it changes, so readers never lock
+        using InterestTable = std::vector<std::pair<std::string, uint64_t>>;
+
+        // This node's id, and a random number telling this run apart from earlier ones
+        uint32_t node_id;
+        uint64_t incarnation;
+
+        // Socket peer nodes connect to
+        int listen_socket;
+
+        DeliverFunction deliver;
+
+        // One outbound link per configured peer
+        std::vector<std::unique_ptr<PeerLink>> links;
+
+        // Inbound links, finished ones included until the accept thread joins them (guarded by inbound_mutex)
+        std::vector<std::unique_ptr<InboundLink>> inbound;
+        std::mutex inbound_mutex;
+
+        // Rooms of each peer node as announced over its current inbound link (guarded by interest_mutex)
+        struct NodeInterest {
+            const InboundLink* link = nullptr;
+            std::vector<std::string> rooms;
+        };
+        std::unordered_map<uint32_t, NodeInterest> interest_by_node;
+        std::mutex interest_mutex;
+
+        // Snapshot of interest_by_node mapped onto links, read by forward() with std::atomic_load
+        std::shared_ptr<const InterestTable> interest;
+
+        // Rooms with local members: name -> number of shards on which the room has members
+        // Guarded by local_mutex, which also orders the Subscribe/Unsubscribe frames queued to the links
+        std::unordered_map<std::string, size_t> local_rooms;
+        std::mutex local_mutex;
+
+        // Duplicate filters by origin node (guarded by seen_mutex)
+        std::unordered_map<uint32_t, SequenceWindow> seen;
+        std::mutex seen_mutex;
+
+        std::thread accept_thread;
+        std::atomic<bool> running;
+
+        /**
+         * Accept loop: starts a thread for every peer that connects
+         */
+        void accept_links();
+
+        /**
+         * Inbound link thread: handshake, then subscriptions and relays until the peer disconnects
+         */
+        void serve_inbound(InboundLink& link);
+
+        /**
+         * Outbound link thread: keeps the link connected and writes its queue
+         */
+        void run_link(PeerLink& link);
+
+        /**
+         * Connects a link and exchanges PeerHello frames
+         * @return true once the link is ready to carry traffic
+         */
+        bool connect_link(PeerLink& link);
+
+        /**
+         * Writes everything queued on a connected link
+         * @return false if the connection failed
+         */
+        bool write_queue(PeerLink& link);
+
+        /**
+         * Queues an item on a link and wakes its thread
+         * @return false if the link's queue is full
+         */
+        bool enqueue(PeerLink& link, LinkItem item);
+
+        /**
+         * Queues a Subscribe or Unsubscribe frame for a room on every link (local_mutex must be held)
+         */
+        void announce(MessageType type, std::string_view room);
+
+        /**
+         * Records a peer node's subscription change and republishes the interest table
+         */
+        void update_interest(const InboundLink& link, std::string_view room, bool subscribed);
+
+        /**
+         * Forgets the rooms a peer node announced over a link that has closed
+         */
+        void drop_interest(const InboundLink& link);
+
+        /**
+         * Rebuilds the interest snapshot (interest_mutex must be held)
+         */
+        void publish_interest();
+
+        /**
+         * Marks a relayed frame's sender id as remote and hands the frame to the local members of its
+         * room, unless it was delivered before
+         * @param origin Node the frame originated on
+         * @param frame The complete room frame, which must be the only handle to its buffer
+         */
+        void receive_relay(uint32_t origin, MessageRef frame);
+
+    public:
+        /**
+         * Binds the federation port and prepares one link per configured peer; nothing runs until start()
+         * @param config Server settings (node_id, federation_port and peers are used)
+         * @param deliver Called with every relayed frame that should reach this node's room members
+         * @throws std::runtime_error if the settings are invalid or the port cannot be bound
+         */
+        Federation(const ServerConfig& config, DeliverFunction deliver);
+
+        /**
+         * Stops every link thread and closes the sockets
+         */
+        ~Federation();
+
+        Federation(const Federation&) = delete;
+        Federation& operator=(const Federation&) = delete;
+
+        /**
+         * Starts accepting peers and connecting to them
+         */
+        void start();
+
+        /**
+         * Disconnects from every peer and waits for the link threads; safe to call more than once
+         */
+        void stop();
+
+        /**
+         * Notes that a room gained its first member on one shard
+         * Peers are asked to relay the room's messages once the first shard reports it
+         * @param room Room name
+         */
+        void room_opened(std::string_view room);
+
+        /**
+         * Notes that a room lost its last member on one shard
+         * Peers stop relaying the room's messages once no shard has members left
+         * @param room Room name
+         */
+        void room_closed(std::string_view room);
+
+        /**
+         * Relays a frame sent by one of this node's clients to every peer with members in its room
+         * Only reads the interest snapshot, so it is cheap and safe to call from any thread
+         * @param room Room the frame is addressed to
+         * @param frame Encoded Chat or RoomMessage frame, as delivered to local members
+         */
+        void forward(std::string_view room, const MessageRef& frame);
+};
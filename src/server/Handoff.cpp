@@ -0,0 +1,442 @@
+// Socket handoff implementation
+
+#include "Handoff.h"
+#include "common/Protocol.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace {
+    // First bytes of a takeover request, followed by kVersion as a u32
+    constexpr char kMagic[4] = {'Q', 'C', 'H', 'O'};
+    constexpr uint32_t kVersion = 1;
+    constexpr size_t kRequestSize = 8;
+
+    // Packet kinds, stored in the first byte of every packet after the request
+    enum PacketKind : uint8_t {
+        Hello = 1,      // [u64 next sequence][u32 listening sockets][u32 connections]
+        Listener = 2,   // No payload; carries one listening socket
+        Connection = 3, // [u32 client id][u8 compress][u32 record length]; carries the client socket
+        Data = 4,       // Next piece of the current connection's record
+        Done = 5,       // Everything was sent
+        Ack = 6         // Sent back by the successor once it has received Done
+    };
+
+    // Largest packet; connection records are split into Data packets of at most this size
+    constexpr size_t kMaxPacketSize = 32 * 1024;
+
+    // A peer that stops reading or writing for this long is considered gone
+    constexpr int kHandoffTimeoutMs = 10000;
+
+    // How often the listener thread checks whether it was stopped
+    constexpr int kListenerPollMs = 100;
+
+    void put_u32(std::string& out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<char>(value >> (24 - 8 * i)));
+        }
+    }
+
+    void put_u64(std::string& out, uint64_t value) {
+        put_u32(out, static_cast<uint32_t>(value >> 32));
+        put_u32(out, static_cast<uint32_t>(value));
+    }
+
+    /**
+     * Fills a Unix socket address
+     * @throws std::runtime_error if the path does not fit
+     */
+    struct sockaddr_un unix_address(const std::string& path) {
+        struct sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Invalid handoff socket path: " + path);
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    void set_timeouts(int socket) {
+        struct timeval timeout{};
+        timeout.tv_sec = kHandoffTimeoutMs / 1000;
+        timeout.tv_usec = (kHandoffTimeoutMs % 1000) * 1000;
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    /**
+     * Sends one packet, optionally passing a file descriptor along with it
+     * @return false if the peer is gone or timed out
+     */
+    bool send_packet(int socket, const std::string& packet, int fd = -1) {
+        struct iovec segment{const_cast<char*>(packet.data()), packet.size()};
+        struct msghdr message{};
+        message.msg_iov = &segment;
+        message.msg_iovlen = 1;
+
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0) {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        }
+
+        while (true) {
+            ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return sent == static_cast<ssize_t>(packet.size());
+        }
+    }
+
+    /**
+     * Receives one packet and the file descriptor passed with it, if any
+     * @param packet Receives the packet bytes
+     * @param fd Receives the passed descriptor (owned by the caller), or -1
+     * @return false if the peer is gone, timed out or sent something malformed
+     */
+    bool receive_packet(int socket, std::string& packet, int& fd) {
+        packet.resize(kMaxPacketSize + 1);
+        struct iovec segment{&packet[0], packet.size()};
+        struct msghdr message{};
+        message.msg_iov = &segment;
+        message.msg_iovlen = 1;
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t received;
+        do {
+            received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        } while (received < 0 && errno == EINTR);
+
+        fd = -1;
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+             header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS &&
+                header->cmsg_len == CMSG_LEN(sizeof(int))) {
+                memcpy(&fd, CMSG_DATA(header), sizeof(int));
+            }
+        }
+        if (received <= 0 || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+            return false;
+        }
+        packet.resize(received);
+        return true;
+    }
+
+    /**
+     * Encodes the part of a connection that follows its Connection packet
+     * [u32 room count]([u8 name length][name])*[u32 inbound length][inbound][u32 outbound length][outbound]
+     */
+    std::string encode_record(const HandoffConnection& connection) {
+        std::string record;
+        put_u32(record, static_cast<uint32_t>(connection.rooms.size()));
+        for (const std::string& room : connection.rooms) {
+            record.push_back(static_cast<char>(room.size()));
+            record += room;
+        }
+        put_u32(record, static_cast<uint32_t>(connection.inbound.size()));
+        record += connection.inbound;
+        put_u32(record, static_cast<uint32_t>(connection.outbound.size()));
+        record += connection.outbound;
+        return record;
+    }
+
+    /**
+     * Reverse of encode_record()
+     * @return false if the record is malformed
+     */
+    bool decode_record(const std::string& record, HandoffConnection& connection) {
+        size_t position = 0;
+        auto take_length = [&](uint32_t& value) {
+            if (record.size() - position < 4) {
+                return false;
+            }
+            value = read_u32(record.data() + position);
+            position += 4;
+            return true;
+        };
+        auto take_bytes = [&](std::string& out, size_t length) {
+            if (record.size() - position < length) {
+                return false;
+            }
+            out.assign(record, position, length);
+            position += length;
+            return true;
+        };
+
+        uint32_t count;
+        if (!take_length(count)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            if (position >= record.size()) {
+                return false;
+            }
+            size_t length = static_cast<unsigned char>(record[position++]);
+            std::string room;
+            if (!take_bytes(room, length) || !is_valid_room_name(room)) {
+                return false;
+            }
+            connection.rooms.push_back(std::move(room));
+        }
+        uint32_t length;
+        return take_length(length) && take_bytes(connection.inbound, length) &&
+               take_length(length) && take_bytes(connection.outbound, length) && position == record.size();
+    }
+
+    /**
+     * Receives the packets following a takeover request
+     * @return false if anything was missing or malformed
+     */
+    bool receive_state(int socket, HandoffState& state) {
+        std::string packet;
+        int fd;
+        if (!receive_packet(socket, packet, fd) || fd >= 0 || packet.size() != 17 || packet[0] != Hello) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        state.next_sequence = read_u64(packet.data() + 1);
+        uint32_t listener_count = read_u32(packet.data() + 9);
+        uint32_t connection_count = read_u32(packet.data() + 13);
+        if (listener_count == 0) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < listener_count; ++i) {
+            if (!receive_packet(socket, packet, fd)) {
+                return false;
+            }
+            if (fd >= 0) {
+                state.listen_sockets.push_back(fd);
+            }
+            if (fd < 0 || packet.size() != 1 || packet[0] != Listener) {
+                return false;
+            }
+        }
+
+        std::string record;
+        for (uint32_t i = 0; i < connection_count; ++i) {
+            if (!receive_packet(socket, packet, fd)) {
+                return false;
+            }
+            if (fd >= 0) {
+                // Held by the state right away so a failure below closes it
+                state.connections.emplace_back();
+                state.connections.back().socket = fd;
+            }
+            if (fd < 0 || packet.size() != 10 || packet[0] != Connection) {
+                return false;
+            }
+            HandoffConnection& connection = state.connections.back();
+            connection.id = read_u32(packet.data() + 1);
+            connection.compress = packet[5] != 0;
+            size_t remaining = read_u32(packet.data() + 6);
+
+            record.clear();
+            while (remaining > 0) {
+                if (!receive_packet(socket, packet, fd) || fd >= 0 || packet.empty() || packet[0] != Data ||
+                    packet.size() - 1 > remaining) {
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                    return false;
+                }
+                record.append(packet, 1, std::string::npos);
+                remaining -= packet.size() - 1;
+            }
+            if (!decode_record(record, connection)) {
+                return false;
+            }
+        }
+
+        return receive_packet(socket, packet, fd) && fd < 0 && packet.size() == 1 && packet[0] == Done;
+    }
+}
+
+void HandoffState::close_sockets() {
+    for (int socket : listen_sockets) {
+        close(socket);
+    }
+    listen_sockets.clear();
+    for (HandoffConnection& connection : connections) {
+        if (connection.socket >= 0) {
+            close(connection.socket);
+            connection.socket = -1;
+        }
+    }
+}
+
+/**
+ * Constructor: A stale socket file left by a crashed server is removed before binding
+ */
+HandoffListener::HandoffListener(const std::string& path, std::function<void()> requested)
+    : path(path), successor(-1), requested(std::move(requested)), running(false) {
+    struct sockaddr_un address = unix_address(path);
+    listen_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_socket < 0) {
+        throw std::runtime_error("Failed to create handoff socket");
+    }
+    unlink(path.c_str());
+    if (bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listen_socket, 4) < 0) {
+        close(listen_socket);
+        throw std::runtime_error("Failed to bind handoff socket " + path);
+    }
+}
+
+HandoffListener::~HandoffListener() {
+    stop();
+    close(listen_socket);
+    unlink(path.c_str());
+    if (successor >= 0) {
+        close(successor);
+    }
+}
+
+void HandoffListener::start() {
+    running = true;
+    thread = std::thread(&HandoffListener::serve, this);
+}
+
+void HandoffListener::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/**
+ * Called after stop(), so the listener thread no longer touches successor
+ */
+int HandoffListener::take_successor() {
+    stop();
+    int socket = successor;
+    successor = -1;
+    return socket;
+}
+
+/**
+ * Polls with a timeout so stop() is noticed; anything but a well-formed request is turned away
+ */
+void HandoffListener::serve() {
+    while (running) {
+        struct pollfd entry{};
+        entry.fd = listen_socket;
+        entry.events = POLLIN;
+        if (poll(&entry, 1, kListenerPollMs) <= 0) {
+            continue;
+        }
+        int client = accept4(listen_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        set_timeouts(client);
+
+        char request[kRequestSize];
+        ssize_t received = recv(client, request, sizeof(request), 0);
+        if (received != static_cast<ssize_t>(kRequestSize) || memcmp(request, kMagic, sizeof(kMagic)) != 0 ||
+            read_u32(request + 4) != kVersion) {
+            close(client);
+            continue;
+        }
+        successor = client;
+        requested();
+        return; // A server is handed over only once
+    }
+}
+
+/**
+ * Sends the Hello, then one packet per listening socket, then every connection: a Connection
+ * packet carrying its socket followed by its record in Data packets
+ */
+bool send_handoff(int successor, const HandoffState& state) {
+    std::string packet(1, static_cast<char>(Hello));
+    put_u64(packet, state.next_sequence);
+    put_u32(packet, static_cast<uint32_t>(state.listen_sockets.size()));
+    put_u32(packet, static_cast<uint32_t>(state.connections.size()));
+    if (!send_packet(successor, packet)) {
+        return false;
+    }
+
+    for (int listen_socket : state.listen_sockets) {
+        if (!send_packet(successor, std::string(1, static_cast<char>(Listener)), listen_socket)) {
+            return false;
+        }
+    }
+
+    for (const HandoffConnection& connection : state.connections) {
+        std::string record = encode_record(connection);
+        packet.assign(1, static_cast<char>(Connection));
+        put_u32(packet, connection.id);
+        packet.push_back(connection.compress ? 1 : 0);
+        put_u32(packet, static_cast<uint32_t>(record.size()));
+        if (!send_packet(successor, packet, connection.socket)) {
+            return false;
+        }
+        for (size_t offset = 0; offset < record.size(); offset += kMaxPacketSize) {
+            packet.assign(1, static_cast<char>(Data));
+            packet.append(record, offset, kMaxPacketSize);
+            if (!send_packet(successor, packet)) {
+                return false;
+            }
+        }
+    }
+
+    if (!send_packet(successor, std::string(1, static_cast<char>(Done)))) {
+        return false;
+    }
+    char ack = 0;
+    ssize_t received;
+    do {
+        received = recv(successor, &ack, 1, 0);
+    } while (received < 0 && errno == EINTR);
+    return received == 1 && ack == static_cast<char>(Ack);
+}
+
+/**
+ * A missing socket file or a refused connection means no server is running there
+ */
+bool receive_handoff(const std::string& path, HandoffState& state) {
+    struct sockaddr_un address = unix_address(path);
+    int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) {
+        throw std::runtime_error("Failed to create handoff socket");
+    }
+    if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        int error = errno;
+        close(socket_fd);
+        if (error == ENOENT || error == ECONNREFUSED) {
+            return false;
+        }
+        throw std::runtime_error("Failed to connect to handoff socket " + path);
+    }
+    set_timeouts(socket_fd);
+
+    std::string request(kMagic, sizeof(kMagic));
+    put_u32(request, kVersion);
+    bool received = send_packet(socket_fd, request) && receive_state(socket_fd, state) &&
+                    send_packet(socket_fd, std::string(1, static_cast<char>(Ack)));
+    close(socket_fd);
+    if (!received) {
+        state.close_sockets();
+        throw std::runtime_error("Takeover from the server at " + path + " failed");
+    }
+    return true;
+}
@@ -0,0 +1,136 @@
+// Hand-over of a running server's sockets to the process replacing it
+// Lets a new server binary take over the listening sockets and every live client without a reconnect
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+/**
+ * One client connection as it is handed from the old server process to the new one
+ */
+struct HandoffConnection {
+    // Client socket (a descriptor of the receiving process once received; -1 once adopted)
+    int socket = -1;
+
+    // Id the client was known by; kept so peers can keep sending it direct messages
+    uint32_t id = 0;
+
+    // Whether the client negotiated compression
+    bool compress = false;
+
+    // Rooms the client had joined
+    std::vector<std::string> rooms;
+
+    // Received bytes that did not form a complete frame yet
+    std::string inbound;
+
+    // Bytes queued for the client but not written yet; may start in the middle of a frame
+    std::string outbound;
+};
+
+/**
+ * Everything a server process hands to its successor
+ */
+struct HandoffState {
+    // Next sequence number to stamp, so numbering continues without reusing a number
+    uint64_t next_sequence = 1;
+
+    // Listening sockets, one per reactor (their count decides the successor's shard count)
+    std::vector<int> listen_sockets;
+
+    // Live client connections
+    std::vector<HandoffConnection> connections;
+
+    /**
+     * Closes every socket still held by the state (used when a handoff fails half-way)
+     */
+    void close_sockets();
+};
+
+/**
+ * Unix socket on which a running server waits for its successor to ask for its sockets
+ *
+ * A successor connects, sends a takeover request and keeps the connection open; the listener then
+ * stops accepting, remembers that connection and calls the request callback, which is expected to
+ * stop the server's event loops. Once they have stopped the server sends its state over the same
+ * connection with send_handoff().
+ */
+class HandoffListener {
+    private:
+        // Path of the Unix socket, removed again when the listener is destroyed
+        std::string path;
+
+        // SOCK_SEQPACKET socket bound to path
+        int listen_socket;
+
+        // Connection of the successor that asked for the takeover (-1 until then)
+        int successor;
+
+        // Called on the listener thread once a valid takeover request arrived
+        std::function<void()> requested;
+
+        std::thread thread;
+        std::atomic<bool> running;
+
+        /**
+         * Accept loop: waits for the first valid takeover request
+         */
+        void serve();
+
+    public:
+        /**
+         * Binds the Unix socket, replacing any stale socket file at the same path
+         * @param path File system path of the socket
+         * @param requested Called (on the listener thread) when a successor asks for a takeover
+         * @throws std::runtime_error if the socket cannot be bound
+         */
+        HandoffListener(const std::string& path, std::function<void()> requested);
+
+        /**
+         * Stops listening, closes the sockets and removes the socket file
+         */
+        ~HandoffListener();
+
+        HandoffListener(const HandoffListener&) = delete;
+        HandoffListener& operator=(const HandoffListener&) = delete;
+
+        /**
+         * Starts the listener thread
+         */
+        void start();
+
+        /**
+         * Stops the listener thread and waits for it; safe to call more than once
+         */
+        void stop();
+
+        /**
+         * Takes the connection of the successor that asked for a takeover
+         * @return Its socket (now owned by the caller), or -1 if no takeover was requested
+         */
+        int take_successor();
+};
+
+/**
+ * Sends a server's state to its successor, passing every socket with SCM_RIGHTS
+ * The caller keeps its own descriptors and closes them afterwards; the connections stay open
+ * because the successor now holds descriptors of the same sockets.
+ * @param successor Connection returned by HandoffListener::take_successor()
+ * @param state Sockets and connection state to hand over
+ * @return true once the successor confirmed it received everything
+ */
+bool send_handoff(int successor, const HandoffState& state);
+
+/**
+ * Asks the server listening on a handoff socket for its sockets and connections
+ * @param path File system path of the running server's handoff socket
+ * @param state Receives the handed over sockets and connection state
+ * @return false if no server is listening on path (the caller starts from scratch)
+ * @throws std::runtime_error if a server answered but the handoff failed; every socket received
+ *         so far has been closed by then
+ */
+bool receive_handoff(const std::string& path, HandoffState& state);
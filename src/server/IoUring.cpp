@@ -0,0 +1,256 @@
+// io_uring wrapper implementation using the raw system calls
+
+#include "IoUring.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+    int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    int io_uring_register(int ring_fd, unsigned opcode, void* arg, unsigned arg_count) {
+        return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, arg_count));
+    }
+
+    // The completion queue is sized generously because every multishot receive can post many entries
+    constexpr unsigned kCompletionQueueFactor = 4;
+
+    // Lets the kernel skip inter-processor interrupts for completions; the reactor polls on enter anyway
+    constexpr unsigned kPreferredSetupFlags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+}
+
+/**
+ * The probe checks for IORING_OP_SEND_ZC, which arrived in the same release (6.0) as multishot
+ * receive; multishot accept and provided buffer rings are older still
+ */
+bool IoUring::supported() {
+    struct io_uring_params params{};
+    int ring_fd = io_uring_setup(4, &params);
+    if (ring_fd < 0) {
+        return false; // ENOSYS on old kernels, EPERM when disabled by sysctl or a seccomp filter
+    }
+
+    constexpr unsigned kProbeOps = 256;
+    std::vector<char> probe_storage(sizeof(struct io_uring_probe) + kProbeOps * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(probe_storage.data());
+
+    bool usable = (params.features & IORING_FEAT_NODROP) &&
+                  io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, kProbeOps) == 0 &&
+                  probe->last_op >= IORING_OP_SEND_ZC &&
+                  (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    close(ring_fd);
+    return usable;
+}
+
+/**
+ * Constructor: Sets up the rings, maps them and registers the provided receive buffers
+ */
+IoUring::IoUring(unsigned entries, unsigned buffer_count, size_t buffer_size)
+    : ring_fd(-1), sq_map(MAP_FAILED), sq_map_size(0), sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size(0), sq_pending(0), cq_map(MAP_FAILED), cq_map_size(0), buffer_ring(nullptr),
+      buffer_ring_size(0), buffers(nullptr), buffer_count(buffer_count), buffer_size(buffer_size) {
+    struct io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | kPreferredSetupFlags;
+    params.cq_entries = entries * kCompletionQueueFactor;
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        // Older kernels reject the optional flags; they are only an optimization
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * kCompletionQueueFactor;
+        ring_fd = io_uring_setup(entries, &params);
+    }
+    if (ring_fd < 0) {
+        throw std::runtime_error("Failed to create io_uring instance");
+    }
+
+    // Map the rings; with IORING_FEAT_SINGLE_MMAP one mapping covers both queues
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map && cq_map_size > sq_map_size) {
+        sq_map_size = cq_map_size;
+    }
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        destroy();
+        throw std::runtime_error("Failed to map io_uring submission queue");
+    }
+    if (single_map) {
+        cq_map = sq_map;
+    } else {
+        cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            destroy();
+            throw std::runtime_error("Failed to map io_uring completion queue");
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+        destroy();
+        throw std::runtime_error("Failed to map io_uring submission entries");
+    }
+
+    char* sq_base = static_cast<char*>(sq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+
+    char* cq_base = static_cast<char*>(cq_map);
+    cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq_base + params.cq_off.cqes);
+
+    // The submission array is an indirection table; an identity mapping makes it invisible
+    for (unsigned i = 0; i < params.sq_entries; ++i) {
+        sq_array[i] = i;
+    }
+
+    // Provided buffer ring: page-aligned descriptor ring plus one contiguous block of buffers
+    buffer_ring_size = buffer_count * sizeof(struct io_uring_buf);
+    void* ring_memory = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* buffer_memory = mmap(nullptr, buffer_count * buffer_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_memory == MAP_FAILED || buffer_memory == MAP_FAILED) {
+        if (ring_memory != MAP_FAILED) {
+            munmap(ring_memory, buffer_ring_size);
+        }
+        if (buffer_memory != MAP_FAILED) {
+            munmap(buffer_memory, buffer_count * buffer_size);
+        }
+        destroy();
+        throw std::runtime_error("Failed to allocate io_uring receive buffers");
+    }
+    buffer_ring = static_cast<struct io_uring_buf_ring*>(ring_memory);
+    buffers = static_cast<char*>(buffer_memory);
+
+    struct io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    registration.ring_entries = buffer_count;
+    registration.bgid = kReceiveBufferGroup;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        destroy();
+        throw std::runtime_error("Failed to register io_uring receive buffers");
+    }
+    for (unsigned i = 0; i < buffer_count; ++i) {
+        add_buffer(static_cast<uint16_t>(i));
+    }
+}
+
+/**
+ * Destructor: Tears down the ring; in-flight operations are cancelled by the kernel
+ */
+IoUring::~IoUring() {
+    destroy();
+}
+
+/**
+ * Undoes whatever part of the constructor succeeded
+ * The ring is closed first so the kernel stops using the buffers before they are unmapped
+ */
+void IoUring::destroy() {
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (buffers != nullptr) {
+        munmap(buffers, buffer_count * buffer_size);
+        buffers = nullptr;
+    }
+    if (buffer_ring != nullptr) {
+        munmap(buffer_ring, buffer_ring_size);
+        buffer_ring = nullptr;
+    }
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqes_size);
+        sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    }
+    if (cq_map != MAP_FAILED && cq_map != sq_map) {
+        munmap(cq_map, cq_map_size);
+    }
+    cq_map = MAP_FAILED;
+    if (sq_map != MAP_FAILED) {
+        munmap(sq_map, sq_map_size);
+        sq_map = MAP_FAILED;
+    }
+}
+
+/**
+ * Only the reactor thread writes the tail, so a plain read of it is enough; the release store
+ * makes the filled-in descriptor visible to the kernel before the new tail
+ */
+void IoUring::add_buffer(uint16_t id) {
+    uint16_t tail = buffer_ring->tail;
+    // Indexed by hand: compiled as C++, the header's flexible bufs[] member lands at offset 8, not 0
+    struct io_uring_buf* entry = reinterpret_cast<struct io_uring_buf*>(buffer_ring) + (tail & (buffer_count - 1));
+    entry->addr = reinterpret_cast<uint64_t>(buffers + static_cast<size_t>(id) * buffer_size);
+    entry->len = static_cast<uint32_t>(buffer_size);
+    entry->bid = id;
+    __atomic_store_n(&buffer_ring->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Entries are published to the kernel only in submit_and_wait(), so a whole event loop
+ * iteration's worth of operations goes out in one system call
+ */
+struct io_uring_sqe* IoUring::get_sqe() {
+    unsigned tail = *sq_tail + sq_pending;
+    while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) > *sq_mask) {
+        // Queue full: hand what we have to the kernel without waiting, then take a freed slot
+        submit_and_wait(0);
+        tail = *sq_tail;
+    }
+
+    struct io_uring_sqe* sqe = &sqes[tail & *sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_pending;
+    return sqe;
+}
+
+/**
+ * Publishes the prepared entries by moving the tail, then enters the kernel once
+ */
+bool IoUring::submit_and_wait(unsigned wait_count) {
+    if (sq_pending > 0) {
+        __atomic_store_n(sq_tail, *sq_tail + sq_pending, __ATOMIC_RELEASE);
+        sq_pending = 0;
+    }
+
+    while (true) {
+        // Everything published but not yet consumed, including entries left over by an earlier EBUSY
+        unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && wait_count == 0) {
+            return true;
+        }
+        int result = io_uring_enter(ring_fd, to_submit, wait_count, wait_count > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (result >= 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue; // Interrupted by a signal, simply enter again
+        }
+        if (errno == EAGAIN || errno == EBUSY) {
+            // The completion queue is backed up; the caller drains it and calls again
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,136 @@
+// Minimal io_uring wrapper built directly on the kernel interface (no liburing dependency)
+// Owns the submission/completion rings and one ring of provided receive buffers
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+/**
+ * One io_uring instance as used by a Reactor
+ *
+ * Operations are prepared in the shared submission queue and handed to the kernel in bulk by
+ * submit_and_wait(), which is also where the thread sleeps until something completes. Receives
+ * use a provided buffer ring: the kernel picks a free buffer when data actually arrives, so idle
+ * connections do not pin any receive memory.
+ *
+ * Not thread-safe; each reactor owns its own instance and only touches it from its own thread.
+ */
+class IoUring {
+    private:
+        // File descriptor returned by io_uring_setup()
+        int ring_fd;
+
+        // Submission queue ring shared with the kernel
+        void* sq_map;
+        size_t sq_map_size;
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned* sq_mask;
+        unsigned* sq_array;
+        struct io_uring_sqe* sqes;
+        size_t sqes_size;
+
+        // Entries prepared by get_sqe() but not yet passed to io_uring_enter()
+        unsigned sq_pending;
+
+        // Completion queue ring shared with the kernel (may share sq_map)
+        void* cq_map;
+        size_t cq_map_size;
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned* cq_mask;
+        struct io_uring_cqe* cqes;
+
+        // Provided buffer ring registered as buffer group kReceiveBufferGroup
+        struct io_uring_buf_ring* buffer_ring;
+        size_t buffer_ring_size;
+        char* buffers;
+        unsigned buffer_count;
+        size_t buffer_size;
+
+        /**
+         * Publishes a buffer to the provided buffer ring so the kernel can fill it again
+         * @param id Buffer id
+         */
+        void add_buffer(uint16_t id);
+
+        /**
+         * Releases every mapping and the ring file descriptor
+         */
+        void destroy();
+
+    public:
+        // Buffer group id of the provided receive buffers (sqe.buf_group)
+        static constexpr uint16_t kReceiveBufferGroup = 0;
+
+        /**
+         * Creates the rings and registers the provided receive buffers
+         * @param entries Submission queue size (rounded up to a power of two by the kernel)
+         * @param buffer_count Number of provided receive buffers (must be a power of two)
+         * @param buffer_size Size of each receive buffer in bytes
+         * @throws std::runtime_error if the kernel rejects any part of the setup
+         */
+        IoUring(unsigned entries, unsigned buffer_count, size_t buffer_size);
+
+        /**
+         * Unmaps the rings and closes the io_uring instance
+         * The kernel cancels whatever operations are still in flight
+         */
+        ~IoUring();
+
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+
+        /**
+         * Checks whether the running kernel offers what the reactor relies on
+         * (multishot accept and receive, provided buffer rings; roughly Linux 6.0 or newer)
+         * @return true if an io_uring backend can be used
+         */
+        static bool supported();
+
+        /**
+         * Returns a zeroed submission queue entry to fill in
+         * If the queue is full the pending entries are submitted first
+         * @return Entry that will be submitted by the next submit_and_wait()
+         */
+        struct io_uring_sqe* get_sqe();
+
+        /**
+         * Submits every prepared entry and waits for completions in a single system call
+         * @param wait_count Number of completions to wait for (0 to only submit)
+         * @return false on an unexpected io_uring_enter() failure
+         */
+        bool submit_and_wait(unsigned wait_count);
+
+        /**
+         * Number of completions waiting in the completion queue
+         */
+        unsigned ready() const { return __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head; }
+
+        /**
+         * Accesses a waiting completion without consuming it
+         * @param offset Position relative to the oldest waiting completion (less than ready())
+         * @return Completion queue entry
+         */
+        const struct io_uring_cqe& completion(unsigned offset) const { return cqes[(*cq_head + offset) & *cq_mask]; }
+
+        /**
+         * Hands the slots of the oldest completions back to the kernel
+         * @param count Number of completions that have been handled
+         */
+        void consume(unsigned count) { __atomic_store_n(cq_head, *cq_head + count, __ATOMIC_RELEASE); }
+
+        /**
+         * Gives access to the received bytes of a completed buffer-select receive
+         * @param id Buffer id taken from the completion flags
+         * @return Start of the buffer
+         */
+        const char* buffer(uint16_t id) const { return buffers + static_cast<size_t>(id) * buffer_size; }
+
+        /**
+         * Returns a consumed receive buffer to the kernel
+         * @param id Buffer id taken from the completion flags
+         */
+        void recycle_buffer(uint16_t id) { add_buffer(id); }
+};
@@ -0,0 +1,592 @@
+// Message log implementation
+
+#include "MessageLog.h"
+#include "common/Protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace {
+    // Largest segment file; a frame that does not fit starts the next segment
+    // Only address space is reserved up front, the file itself grows as frames are written
+    constexpr size_t kSegmentCapacity = 64 * 1024 * 1024;
+
+    // Distance between sparse index entries; a replay scans at most this many bytes to find its start
+    constexpr size_t kIndexInterval = 4096;
+
+    // Index entries a segment can need: one at offset 0 plus at most one per interval
+    constexpr size_t kIndexCapacity = kSegmentCapacity / kIndexInterval + 1;
+
+    // How long the log thread collects frames before writing them as one batch
+    constexpr int kBatchIntervalMs = 5;
+
+    // Digits in a segment file name (its number, zero-padded so names sort numerically)
+    constexpr size_t kSegmentNameDigits = 10;
+
+    // Size of the frame starting at the given position of a segment
+    size_t frame_size(const char* frame) {
+        return kFrameHeaderSize + read_u32(frame);
+    }
+
+    // Sequence number stored in an encoded frame header
+    uint64_t frame_sequence(const char* frame) {
+        return read_u64(frame + 12);
+    }
+
+    // Finds the room an encoded Chat or RoomMessage frame was relayed to (see Reactor.cpp)
+    std::string_view room_of(const MessageRef& message) {
+        const char* frame = message.data();
+        if (static_cast<MessageType>(frame[4]) != MessageType::RoomMessage) {
+            return kDefaultRoom;
+        }
+        size_t length = static_cast<unsigned char>(frame[kFrameHeaderSize]);
+        return std::string_view(frame + kFrameHeaderSize + 1, length);
+    }
+
+    // Room names may contain any printable byte (including '/'), so directories are named in hex
+    std::string encode_directory_name(std::string_view room) {
+        static const char kDigits[] = "0123456789abcdef";
+        std::string name;
+        for (char c : room) {
+            name.push_back(kDigits[static_cast<unsigned char>(c) >> 4]);
+            name.push_back(kDigits[static_cast<unsigned char>(c) & 15]);
+        }
+        return name;
+    }
+
+    bool decode_directory_name(const std::string& name, std::string& room) {
+        if (name.empty() || name.size() % 2 != 0) {
+            return false;
+        }
+        room.clear();
+        for (size_t i = 0; i < name.size(); i += 2) {
+            unsigned value = 0;
+            if (sscanf(name.c_str() + i, "%2x", &value) != 1 || !isxdigit(name[i]) || !isxdigit(name[i + 1])) {
+                return false;
+            }
+            room.push_back(static_cast<char>(value));
+        }
+        return is_valid_room_name(room);
+    }
+
+    // Path of a segment's files without their extension
+    std::string segment_path(const std::string& directory, uint64_t number) {
+        char name[kSegmentNameDigits + 1];
+        snprintf(name, sizeof(name), "%0*llu", static_cast<int>(kSegmentNameDigits),
+                 static_cast<unsigned long long>(number));
+        return directory + "/" + name;
+    }
+
+    // Creates a directory unless it already exists
+    void make_directory(const std::string& path) {
+        if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+            throw std::runtime_error("Failed to create log directory " + path + ": " + strerror(errno));
+        }
+    }
+
+    // Size of an open file
+    size_t file_size(int fd) {
+        struct stat info{};
+        return fstat(fd, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+    }
+
+    /**
+     * Writes a list of buffers at a file offset, retrying short writes
+     * @return false if the write failed (errno is set)
+     */
+    bool write_fully(int fd, std::vector<struct iovec>& segments, off_t offset) {
+        size_t index = 0;
+        while (index < segments.size()) {
+            int count = static_cast<int>(std::min<size_t>(segments.size() - index, IOV_MAX));
+            ssize_t written = pwritev(fd, &segments[index], count, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            offset += written;
+            // Skip the buffers written completely and trim the one written in part
+            size_t remaining = static_cast<size_t>(written);
+            while (index < segments.size() && remaining >= segments[index].iov_len) {
+                remaining -= segments[index].iov_len;
+                ++index;
+            }
+            if (remaining > 0) {
+                segments[index].iov_base = static_cast<char*>(segments[index].iov_base) + remaining;
+                segments[index].iov_len -= remaining;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Walks the complete, well-formed frames of a segment, as left behind by a previous run
+     * @param segment Segment to scan
+     * @param offset Position of the first frame to look at
+     * @param length Bytes of the segment that may hold frames (the file size)
+     * @param sequence Highest sequence number before offset; receives the highest one scanned
+     * @param entries If not nullptr, receives the index entries due for the scanned frames
+     * @return Offset of the first damaged or incomplete frame (or length)
+     */
+    size_t scan_frames(LogSegment& segment, size_t offset, size_t length, uint64_t& sequence,
+                       std::vector<LogIndexEntry>* entries) {
+        while (offset + kFrameHeaderSize <= length) {
+            FrameHeader header;
+            if (!decode_frame_header(segment.data + offset, header) || header.length > kMaxPayloadSize ||
+                offset + kFrameHeaderSize + header.length > length) {
+                break;
+            }
+            if (entries != nullptr && offset >= segment.next_index_offset) {
+                entries->push_back(LogIndexEntry{sequence, offset});
+                segment.next_index_offset = offset + kIndexInterval;
+            }
+            sequence = std::max(sequence, header.sequence);
+            offset += kFrameHeaderSize + header.length;
+        }
+        return offset;
+    }
+}
+
+/**
+ * Constructor: Maps the segment's whole capacity so the mappings stay valid while the files grow
+ */
+LogSegment::LogSegment(const std::string& path, uint64_t base_sequence)
+    : fd(-1), index_fd(-1), data(nullptr), index(nullptr), size(0), index_count(0),
+      base_sequence(base_sequence), next_index_offset(0), dirty(false) {
+    fd = open((path + ".log").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    index_fd = open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    void* data_map = MAP_FAILED;
+    void* index_map = MAP_FAILED;
+    if (fd >= 0 && index_fd >= 0) {
+        data_map = mmap(nullptr, kSegmentCapacity, PROT_READ, MAP_SHARED, fd, 0);
+        index_map = mmap(nullptr, kIndexCapacity * sizeof(LogIndexEntry), PROT_READ, MAP_SHARED, index_fd, 0);
+    }
+    if (data_map == MAP_FAILED || index_map == MAP_FAILED) {
+        std::string error = strerror(errno);
+        if (data_map != MAP_FAILED) {
+            munmap(data_map, kSegmentCapacity);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (index_fd >= 0) {
+            close(index_fd);
+        }
+        throw std::runtime_error("Failed to open log segment " + path + ": " + error);
+    }
+    data = static_cast<const char*>(data_map);
+    index = static_cast<const LogIndexEntry*>(index_map);
+}
+
+LogSegment::~LogSegment() {
+    munmap(const_cast<char*>(data), kSegmentCapacity);
+    munmap(const_cast<LogIndexEntry*>(index), kIndexCapacity * sizeof(LogIndexEntry));
+    close(fd);
+    close(index_fd);
+}
+
+/**
+ * Splits the next span into chunks that end on frame boundaries, so frames from the live
+ * fan-out can be queued between two chunks without corrupting the stream
+ */
+MessageRef HistoryCursor::next(size_t max_bytes) {
+    while (current < spans.size()) {
+        Span& span = spans[current];
+        if (span.offset >= span.end) {
+            ++current;
+            continue;
+        }
+        const char* start = span.segment->data + span.offset;
+        size_t length = frame_size(start);
+        while (span.offset + length < span.end && length + frame_size(start + length) <= max_bytes) {
+            length += frame_size(start + length);
+        }
+        span.offset += length;
+        return MessageRef::wrap(start, length);
+    }
+    return MessageRef();
+}
+
+/**
+ * Skips the spans that are used up, exactly as next() would
+ */
+size_t HistoryCursor::next_frame_size() {
+    while (current < spans.size()) {
+        Span& span = spans[current];
+        if (span.offset < span.end) {
+            return frame_size(span.segment->data + span.offset);
+        }
+        ++current;
+    }
+    return 0;
+}
+
+/**
+ * The marker is a server frame, so its sender id and sequence number are 0
+ */
+MessageRef HistoryCursor::end_marker() const {
+    FrameHeader header;
+    header.type = MessageType::History;
+    std::string payload = encode_history_payload(room, last_sequence);
+    return encode_frame(header, payload.data(), payload.size());
+}
+
+/**
+ * Constructor: Recovers the existing log before the log thread starts, so the server can continue
+ * the sequence numbering where the previous run stopped
+ */
+MessageLog::MessageLog(const std::string& directory, int sync_interval_ms)
+    : directory(directory), sync_interval_ms(sync_interval_ms), recovered_sequence(0), running(true) {
+    make_directory(directory);
+    recover();
+    thread = std::thread(&MessageLog::run, this);
+}
+
+MessageLog::~MessageLog() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        running = false;
+    }
+    wake.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/**
+ * Sealed segments are trusted up to their file size and only their last index interval is read;
+ * the last segment of each room is scanned completely because a crash may have cut off its
+ * final write, and its index is rebuilt from the frames that survived
+ */
+void MessageLog::recover() {
+    DIR* root = opendir(directory.c_str());
+    if (root == nullptr) {
+        throw std::runtime_error("Failed to open log directory " + directory + ": " + strerror(errno));
+    }
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(root)) {
+        names.push_back(entry->d_name);
+    }
+    closedir(root);
+
+    for (const std::string& name : names) {
+        std::string room;
+        if (!decode_directory_name(name, room)) {
+            continue;
+        }
+        auto log = std::make_unique<RoomLog>();
+        log->directory = directory + "/" + name;
+
+        // Segment numbers present in the room's directory, oldest first
+        std::vector<uint64_t> numbers;
+        if (DIR* room_directory = opendir(log->directory.c_str())) {
+            while (struct dirent* entry = readdir(room_directory)) {
+                std::string file = entry->d_name;
+                if (file.size() == kSegmentNameDigits + 4 && file.compare(kSegmentNameDigits, 4, ".log") == 0 &&
+                    std::all_of(file.begin(), file.begin() + kSegmentNameDigits, ::isdigit)) {
+                    numbers.push_back(std::stoull(file.substr(0, kSegmentNameDigits)));
+                }
+            }
+            closedir(room_directory);
+        }
+        if (numbers.empty()) {
+            continue;
+        }
+        std::sort(numbers.begin(), numbers.end());
+
+        uint64_t sequence = 0;
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            auto segment = std::make_shared<LogSegment>(segment_path(log->directory, numbers[i]), sequence);
+            size_t length = std::min(file_size(segment->fd), kSegmentCapacity);
+            size_t entries = std::min(file_size(segment->index_fd) / sizeof(LogIndexEntry), kIndexCapacity);
+            bool sealed = i + 1 < numbers.size();
+
+            if (sealed && entries > 0) {
+                const LogIndexEntry& last = segment->index[entries - 1];
+                uint64_t scanned = last.sequence;
+                scan_frames(*segment, last.offset, length, scanned, nullptr);
+                segment->size = length;
+                segment->index_count = entries;
+                segment->next_index_offset = last.offset + kIndexInterval;
+                sequence = std::max(sequence, scanned);
+            } else {
+                std::vector<LogIndexEntry> rebuilt;
+                segment->size = scan_frames(*segment, 0, length, sequence, &rebuilt);
+                std::vector<struct iovec> buffer{{rebuilt.data(), rebuilt.size() * sizeof(LogIndexEntry)}};
+                if (segment->size < length && ftruncate(segment->fd, segment->size) < 0) {
+                    throw std::runtime_error("Failed to repair log segment in " + log->directory);
+                }
+                if (ftruncate(segment->index_fd, 0) < 0 ||
+                    (!rebuilt.empty() && !write_fully(segment->index_fd, buffer, 0))) {
+                    throw std::runtime_error("Failed to rebuild log index in " + log->directory);
+                }
+                segment->index_count = rebuilt.size();
+            }
+            log->segments.push_back(std::move(segment));
+        }
+        log->last_sequence = sequence;
+        log->next_segment = numbers.back() + 1;
+        recovered_sequence = std::max(recovered_sequence, sequence);
+        rooms.emplace(std::move(room), std::move(log));
+    }
+}
+
+/**
+ * Rooms are created lazily by their first logged frame
+ */
+RoomLog* MessageLog::room_log(std::string_view room) {
+    {
+        std::lock_guard<std::mutex> lock(rooms_mutex);
+        auto it = rooms.find(std::string(room));
+        if (it != rooms.end()) {
+            return it->second.get();
+        }
+    }
+
+    auto log = std::make_unique<RoomLog>();
+    log->directory = directory + "/" + encode_directory_name(room);
+    try {
+        make_directory(log->directory);
+        log->segments.push_back(std::make_shared<LogSegment>(segment_path(log->directory, 0), 0));
+        log->next_segment = 1;
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return nullptr;
+    }
+
+    RoomLog* result = log.get();
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    rooms.emplace(std::string(room), std::move(log));
+    return result;
+}
+
+/**
+ * Frames appended by the same shard arrive in order; sorting the batch also orders frames of
+ * different shards that were relayed at nearly the same time
+ */
+void MessageLog::write_batch(std::vector<MessageRef>& batch, std::vector<LogSegment*>& dirty) {
+    std::stable_sort(batch.begin(), batch.end(), [](const MessageRef& a, const MessageRef& b) {
+        return frame_sequence(a.data()) < frame_sequence(b.data());
+    });
+
+    // Frames of one room waiting to be written to its last segment with a single pwritev()
+    struct PendingWrite {
+        RoomLog* room;
+        std::vector<struct iovec> frames;
+        std::vector<LogIndexEntry> entries;
+        size_t bytes = 0;
+        uint64_t sequence = 0;
+    };
+    std::vector<PendingWrite> writes;
+
+    // Writes one room's pending frames and index entries, then publishes them to readers
+    auto flush = [&dirty](PendingWrite& write) {
+        LogSegment& segment = *write.room->segments.back();
+        std::vector<struct iovec> entries{{write.entries.data(), write.entries.size() * sizeof(LogIndexEntry)}};
+        bool written = write.frames.empty() ||
+            (write_fully(segment.fd, write.frames, segment.size) &&
+             (write.entries.empty() ||
+              write_fully(segment.index_fd, entries, segment.index_count * sizeof(LogIndexEntry))));
+        if (!written) {
+            // Readers never see the failed frames; the next batch overwrites them
+            std::cerr << "Failed to write message log in " << write.room->directory << ": "
+                      << strerror(errno) << std::endl;
+            segment.next_index_offset = segment.index_count > 0
+                ? segment.index[segment.index_count - 1].offset + kIndexInterval : 0;
+        } else if (!write.frames.empty()) {
+            std::lock_guard<std::mutex> lock(write.room->mutex);
+            segment.size += write.bytes;
+            segment.index_count += write.entries.size();
+            write.room->last_sequence = write.sequence;
+            if (!segment.dirty) {
+                segment.dirty = true;
+                dirty.push_back(&segment);
+            }
+        }
+        write.frames.clear();
+        write.entries.clear();
+        write.bytes = 0;
+    };
+
+    RoomLog* room = nullptr;
+    std::string_view room_name;
+    for (const MessageRef& frame : batch) {
+        std::string_view name = room_of(frame);
+        if (room == nullptr || name != room_name) {
+            room = room_log(name);
+            room_name = name;
+            if (room == nullptr) {
+                continue;
+            }
+        }
+
+        auto write = std::find_if(writes.begin(), writes.end(),
+                                  [room](const PendingWrite& pending) { return pending.room == room; });
+        if (write == writes.end()) {
+            writes.push_back(PendingWrite{room, {}, {}, 0, room->last_sequence});
+            write = writes.end() - 1;
+        }
+
+        LogSegment* segment = room->segments.back().get();
+        if (segment->size + write->bytes + frame.size() > kSegmentCapacity) {
+            // The segment is full: write what it still gets, then continue in a new one
+            flush(*write);
+            try {
+                auto next = std::make_shared<LogSegment>(segment_path(room->directory, room->next_segment),
+                                                         room->last_sequence);
+                std::lock_guard<std::mutex> lock(room->mutex);
+                room->segments.push_back(std::move(next));
+                ++room->next_segment;
+            } catch (const std::exception& error) {
+                std::cerr << error.what() << std::endl;
+                continue;
+            }
+            segment = room->segments.back().get();
+            write->sequence = room->last_sequence;
+        }
+
+        size_t offset = segment->size + write->bytes;
+        if (offset >= segment->next_index_offset) {
+            write->entries.push_back(LogIndexEntry{write->sequence, offset});
+            segment->next_index_offset = offset + kIndexInterval;
+        }
+        write->frames.push_back(iovec{const_cast<char*>(frame.data()), frame.size()});
+        write->bytes += frame.size();
+        write->sequence = std::max(write->sequence, frame_sequence(frame.data()));
+    }
+
+    for (PendingWrite& write : writes) {
+        flush(write);
+    }
+}
+
+/**
+ * Wakes every kBatchIntervalMs; frames queued meanwhile are written together and synced
+ * together once the sync interval has passed (group commit)
+ */
+void MessageLog::run() {
+    std::vector<MessageRef> batch;
+    std::vector<LogSegment*> dirty;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool stopping = false;
+
+    while (!stopping) {
+        stopping = !running.load();
+
+        MessageRef frame;
+        while (pending.pop(frame)) {
+            batch.push_back(std::move(frame));
+        }
+        if (!batch.empty()) {
+            write_batch(batch, dirty);
+            batch.clear();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (stopping || now - last_sync >= std::chrono::milliseconds(sync_interval_ms)) {
+            for (LogSegment* segment : dirty) {
+                fdatasync(segment->fd);
+                fdatasync(segment->index_fd);
+                segment->dirty = false;
+            }
+            dirty.clear();
+            last_sync = now;
+        }
+
+        if (!stopping) {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(kBatchIntervalMs), [this] { return !running.load(); });
+        }
+    }
+}
+
+/**
+ * The log keeps its own copy: fan-out latency is measured until the last handle of the relayed
+ * frame is released, and the log thread holding one for a batch interval would distort it
+ */
+void MessageLog::append(const MessageRef& frame) {
+    MessageRef copy = MessageRef::allocate(frame.size());
+    memcpy(copy.mutable_data(), frame.data(), frame.size());
+    pending.push(std::move(copy));
+}
+
+/**
+ * Skips whole segments by their base sequence number, then jumps to the last index entry that
+ * only has older frames before it and scans at most one index interval from there
+ */
+std::unique_ptr<HistoryCursor> MessageLog::replay(std::string_view room, uint64_t since) const {
+    auto cursor = std::make_unique<HistoryCursor>();
+    cursor->room = std::string(room);
+    cursor->last_sequence = since;
+
+    RoomLog* log = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(rooms_mutex);
+        auto it = rooms.find(cursor->room);
+        if (it != rooms.end()) {
+            log = it->second.get();
+        }
+    }
+    if (log == nullptr) {
+        return cursor;
+    }
+
+    // Take the sizes once; frames written after this point are not part of the replay
+    struct Snapshot {
+        std::shared_ptr<LogSegment> segment;
+        size_t size;
+        size_t index_count;
+    };
+    std::vector<Snapshot> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        for (const auto& segment : log->segments) {
+            snapshot.push_back(Snapshot{segment, segment->size, segment->index_count});
+        }
+        cursor->last_sequence = std::max(since, log->last_sequence);
+    }
+
+    // The first frame after since is in the last segment that starts at or below since
+    auto first = std::upper_bound(snapshot.begin() + 1, snapshot.end(), since,
+                                  [](uint64_t value, const Snapshot& s) { return value < s.segment->base_sequence; }) - 1;
+
+    const LogSegment& segment = *first->segment;
+    const LogIndexEntry* entries_end = segment.index + first->index_count;
+    const LogIndexEntry* entry = std::upper_bound(segment.index, entries_end, since,
+                                                  [](uint64_t value, const LogIndexEntry& e) { return value < e.sequence; });
+    size_t offset = 0;
+    uint64_t sequence = segment.base_sequence;
+    if (entry != segment.index) {
+        --entry;
+        offset = entry->offset;
+        sequence = entry->sequence;
+    }
+    while (offset < first->size) {
+        sequence = std::max(sequence, frame_sequence(segment.data + offset));
+        if (sequence > since) {
+            break;
+        }
+        offset += frame_size(segment.data + offset);
+    }
+
+    for (auto it = first; it != snapshot.end(); ++it) {
+        size_t start = it == first ? offset : 0;
+        if (start < it->size) {
+            cursor->spans.push_back(HistoryCursor::Span{it->segment, start, it->size});
+        }
+    }
+    return cursor;
+}
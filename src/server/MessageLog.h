@@ -0,0 +1,241 @@
+// Append-only on-disk history of the messages relayed to each room
+// Frames are persisted by a background thread and replayed to clients straight from memory-mapped segments
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "common/MessageBuffer.h"
+#include "MpscQueue.h"
+
+/**
+ * Sparse index entry: every frame stored before offset has a sequence number of at most sequence
+ * Frames from different shards can reach the log slightly out of sequence order, so the entry
+ * records the highest sequence number seen so far rather than the sequence of the frame at offset
+ */
+struct LogIndexEntry {
+    uint64_t sequence;
+    uint64_t offset;
+};
+
+/**
+ * One segment of a room's log: a file of encoded frames plus a file of sparse index entries
+ *
+ * Both files are appended to with pwrite() by the log thread only and mapped read-only for replay.
+ * The mappings cover the segment's full capacity up front, so they never move while the file grows;
+ * readers only look at bytes below the sizes published under RoomLog::mutex.
+ */
+struct LogSegment {
+    // Segment file of encoded frames, exactly as they were sent to clients
+    int fd;
+
+    // Index file of LogIndexEntry records, one for roughly every kIndexInterval bytes of frames
+    int index_fd;
+
+    // Read-only mappings of the two files
+    const char* data;
+    const LogIndexEntry* index;
+
+    // Bytes of complete frames and number of index entries written (guarded by RoomLog::mutex)
+    size_t size;
+    size_t index_count;
+
+    // Highest sequence number stored before the segment's first frame
+    uint64_t base_sequence;
+
+    // Log thread only: offset at which the next index entry is due, and unsynced writes are pending
+    size_t next_index_offset;
+    bool dirty;
+
+    /**
+     * Opens (or creates) a segment's files and maps them
+     * @param path Path of the segment file without its extension
+     * @param base_sequence Highest sequence number stored in earlier segments
+     * @throws std::runtime_error if a file cannot be opened or mapped
+     */
+    LogSegment(const std::string& path, uint64_t base_sequence);
+
+    /**
+     * Unmaps and closes both files
+     */
+    ~LogSegment();
+
+    LogSegment(const LogSegment&) = delete;
+    LogSegment& operator=(const LogSegment&) = delete;
+};
+
+/**
+ * The log of one room: its segments in order, the last one being appended to
+ */
+struct RoomLog {
+    // Directory holding the room's segment files
+    std::string directory;
+
+    // Protects segments and the published sizes of the last segment
+    // Held by readers only to take a snapshot, and by the log thread only to publish a batch
+    std::mutex mutex;
+
+    // Every segment of the room, oldest first; never shrinks while the server runs
+    std::vector<std::shared_ptr<LogSegment>> segments;
+
+    // Highest sequence number stored in the room (guarded by mutex)
+    uint64_t last_sequence = 0;
+
+    // Number given to the room's next segment file (log thread only)
+    uint64_t next_segment = 0;
+};
+
+/**
+ * Replay of one room's history to one client, handed out in frame-aligned chunks
+ *
+ * The chunks are MessageRef handles pointing straight into the mapped segment files, so replaying
+ * a history copies nothing in user space: the kernel reads the page cache directly when the chunk
+ * is written to the socket. The replay covers what the room's log held when it was requested.
+ */
+class HistoryCursor {
+    private:
+        // Contiguous range of frames within one segment
+        struct Span {
+            std::shared_ptr<LogSegment> segment;
+            size_t offset;
+            size_t end;
+        };
+
+        // Ranges still to be replayed, in log order
+        std::vector<Span> spans;
+        size_t current = 0;
+
+        // Room being replayed and the last sequence number the replay covers
+        std::string room;
+        uint64_t last_sequence;
+
+        friend class MessageLog;
+
+    public:
+        /**
+         * Takes the next chunk of the replay
+         * @param max_bytes Preferred chunk size; a single larger frame is still returned whole
+         * @return Whole frames of the log, or an empty handle once the replay is complete
+         */
+        MessageRef next(size_t max_bytes);
+
+        /**
+         * Size of the frame the next chunk starts with, so a caller can check it fits before taking it
+         * @return Frame size in bytes, or 0 once the replay is complete
+         */
+        size_t next_frame_size();
+
+        /**
+         * Builds the History frame that tells the client the replay is complete
+         * @return Frame naming the room and the last sequence number the replay covered
+         */
+        MessageRef end_marker() const;
+};
+
+/**
+ * Persistent per-room message log with batched writes and a timed group fsync
+ *
+ * The event loops call append() for every room frame they relay. That only copies the frame into
+ * a slab buffer and pushes it onto a lock-free queue, so the live fan-out never waits for the disk.
+ * A background thread drains the queue every few milliseconds, writes each room's frames with a
+ * single pwritev() and syncs every segment written since the last sync once per sync interval.
+ *
+ * Each room lives in its own directory of fixed-capacity segment files; a sparse index maps
+ * sequence numbers to file offsets so replay() finds where "history since N" starts without
+ * reading the log. Segments are never deleted while the server runs.
+ */
+class MessageLog {
+    private:
+        // Directory containing one subdirectory per room
+        std::string directory;
+
+        // How often written segments are flushed to stable storage
+        int sync_interval_ms;
+
+        // Room name -> log (guarded by rooms_mutex; entries are never removed)
+        std::unordered_map<std::string, std::unique_ptr<RoomLog>> rooms;
+        mutable std::mutex rooms_mutex;
+
+        // Frames appended by the event loops, drained by the log thread
+        MpscQueue<MessageRef> pending;
+
+        // Highest sequence number found in the log when it was opened
+        uint64_t recovered_sequence;
+
+        // Log thread and its stop signal
+        std::thread thread;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        /**
+         * Loads every room log found on disk, repairing the end of each room's last segment
+         */
+        void recover();
+
+        /**
+         * Finds a room's log, creating its directory and first segment if needed (log thread only)
+         * @param room Room name
+         * @return The room's log, or nullptr if it could not be created
+         */
+        RoomLog* room_log(std::string_view room);
+
+        /**
+         * Log thread: writes batches of queued frames and syncs written segments periodically
+         */
+        void run();
+
+        /**
+         * Appends a batch of frames to their rooms' logs and publishes the new sizes
+         * @param batch Frames in the order they were queued (sorted by sequence number in place)
+         * @param dirty Receives the segments that were written to and need syncing
+         */
+        void write_batch(std::vector<MessageRef>& batch, std::vector<LogSegment*>& dirty);
+
+    public:
+        /**
+         * Opens (or creates) the log directory, recovers existing room logs and starts the log thread
+         * @param directory Directory to keep the log in
+         * @param sync_interval_ms Maximum time written frames may wait before being synced to disk
+         * @throws std::runtime_error if the directory or an existing segment cannot be opened
+         */
+        MessageLog(const std::string& directory, int sync_interval_ms);
+
+        /**
+         * Writes and syncs every frame appended so far, then stops the log thread
+         */
+        ~MessageLog();
+
+        MessageLog(const MessageLog&) = delete;
+        MessageLog& operator=(const MessageLog&) = delete;
+
+        /**
+         * Queues a relayed Chat or RoomMessage frame for the log of its room
+         * Lock-free and safe to call from any thread
+         * @param frame Encoded frame, with the sequence number clients saw
+         */
+        void append(const MessageRef& frame);
+
+        /**
+         * Prepares a replay of every logged frame of a room after a sequence number
+         * Frames still waiting for the log thread are not included; they reached the room live
+         * @param room Room name
+         * @param since Sequence number the client has already seen (0 for the whole history)
+         * @return Cursor over the matching part of the log (empty if the room has no log)
+         */
+        std::unique_ptr<HistoryCursor> replay(std::string_view room, uint64_t since) const;
+
+        /**
+         * Highest sequence number stored when the log was opened
+         * The server continues numbering after it so sequence numbers stay unique across restarts
+         */
+        uint64_t last_sequence() const { return recovered_sequence; }
+};
@@ -0,0 +1,185 @@
+// Metrics implementation and Prometheus text formatting
+
+#include "Metrics.h"
+#include "ServerContext.h"
+#include "common/MessageBuffer.h"
+#include <chrono>
+#include <cstdio>
+
+namespace {
+    // Slot that fan-out measurements finishing on this thread are recorded into
+    thread_local ShardMetrics* thread_slot = nullptr;
+
+    // Quantiles exported for the fan-out latency summary
+    constexpr double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    /**
+     * Appends the HELP and TYPE lines that introduce a metric family
+     */
+    void append_family(std::string& out, const char* name, const char* type, const char* help) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    /**
+     * Appends one sample line; labels are given preformatted, e.g. shard="0"
+     */
+    void append_sample(std::string& out, const char* name, const std::string& labels, double value) {
+        char number[32];
+        snprintf(number, sizeof(number), "%.17g", value);
+        out += name;
+        if (!labels.empty()) {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+        out += ' ';
+        out += number;
+        out += '\n';
+    }
+}
+
+void LatencyRecorder::snapshot(Histogram& out, uint64_t& exact_sum, uint64_t& exact_count) const {
+    for (size_t i = 0; i < Histogram::kBucketCount; ++i) {
+        uint64_t count = counts[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            out.record(Histogram::bucket_limit(i), count);
+        }
+    }
+    exact_sum += sum.load(std::memory_order_relaxed);
+    exact_count += total.load(std::memory_order_relaxed);
+}
+
+/**
+ * Constructor: Allocates the slots up front so recording never allocates
+ */
+Metrics::Metrics(size_t shard_count) {
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards.push_back(std::make_unique<ShardMetrics>());
+    }
+    MessageRef::set_release_observer(&Metrics::record_fanout);
+}
+
+void Metrics::attach_thread(ShardMetrics* slot) {
+    thread_slot = slot;
+}
+
+uint64_t Metrics::now() {
+    uint64_t time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    return time != 0 ? time : 1;
+}
+
+/**
+ * Runs on whichever thread dropped the message last: that is where the fan-out ended
+ */
+void Metrics::record_fanout(uint64_t origin_time) {
+    if (thread_slot != nullptr) {
+        uint64_t finished = now();
+        thread_slot->fanout.record(finished > origin_time ? finished - origin_time : 0);
+    }
+}
+
+/**
+ * Counters and gauges are reported per shard; the latency summary covers the whole server
+ */
+std::string Metrics::render(const OverloadCounters& overload) const {
+    struct Counter {
+        const char* name;
+        const char* type;
+        const char* help;
+        double (*read)(const ShardMetrics&);
+    };
+    static const Counter kCounters[] = {
+        {"quickchat_connections_accepted_total", "counter", "Client connections accepted.",
+         [](const ShardMetrics& m) { return double(m.connections_accepted.load(std::memory_order_relaxed)); }},
+        {"quickchat_connections_closed_total", "counter", "Client connections closed.",
+         [](const ShardMetrics& m) { return double(m.connections_closed.load(std::memory_order_relaxed)); }},
+        {"quickchat_connections_active", "gauge", "Client connections currently open.",
+         [](const ShardMetrics& m) {
+             return double(m.connections_accepted.load(std::memory_order_relaxed)) -
+                    double(m.connections_closed.load(std::memory_order_relaxed));
+         }},
+        {"quickchat_accept_batches_total", "counter", "Passes draining the listening socket's backlog (epoll backend).",
+         [](const ShardMetrics& m) { return double(m.accept_batches.load(std::memory_order_relaxed)); }},
+        {"quickchat_pings_sent_total", "counter", "Heartbeat pings sent to quiet clients.",
+         [](const ShardMetrics& m) { return double(m.pings_sent.load(std::memory_order_relaxed)); }},
+        {"quickchat_messages_received_total", "counter", "Frames received from clients.",
+         [](const ShardMetrics& m) { return double(m.messages_received.load(std::memory_order_relaxed)); }},
+        {"quickchat_received_bytes_total", "counter", "Bytes received from clients.",
+         [](const ShardMetrics& m) { return double(m.bytes_received.load(std::memory_order_relaxed)); }},
+        {"quickchat_messages_sent_total", "counter", "Frames completely written to clients.",
+         [](const ShardMetrics& m) { return double(m.messages_sent.load(std::memory_order_relaxed)); }},
+        {"quickchat_sent_bytes_total", "counter", "Bytes written to clients.",
+         [](const ShardMetrics& m) { return double(m.bytes_sent.load(std::memory_order_relaxed)); }},
+        {"quickchat_queued_messages", "gauge", "Frames waiting in client write queues.",
+         [](const ShardMetrics& m) { return double(m.queued_messages.load(std::memory_order_relaxed)); }},
+        {"quickchat_queued_bytes", "gauge", "Unsent bytes waiting in client write queues.",
+         [](const ShardMetrics& m) { return double(m.queued_bytes.load(std::memory_order_relaxed)); }},
+    };
+
+    std::string out;
+    for (const Counter& counter : kCounters) {
+        append_family(out, counter.name, counter.type, counter.help);
+        for (size_t i = 0; i < shards.size(); ++i) {
+            append_sample(out, counter.name, "shard=\"" + std::to_string(i) + "\"", counter.read(*shards[i]));
+        }
+    }
+
+    append_family(out, "quickchat_connections_rejected_total", "counter",
+                  "Connections closed right after accept by admission control.");
+    for (size_t i = 0; i < shards.size(); ++i) {
+        std::string shard = "shard=\"" + std::to_string(i) + "\"";
+        append_sample(out, "quickchat_connections_rejected_total", shard + ",reason=\"full\"",
+                      double(shards[i]->connections_rejected_full.load(std::memory_order_relaxed)));
+        append_sample(out, "quickchat_connections_rejected_total", shard + ",reason=\"rate\"",
+                      double(shards[i]->connections_rejected_rate.load(std::memory_order_relaxed)));
+    }
+
+    append_family(out, "quickchat_connection_timeouts_total", "counter",
+                  "Connections closed because a read, idle or write timeout ran out.");
+    for (size_t i = 0; i < shards.size(); ++i) {
+        std::string shard = "shard=\"" + std::to_string(i) + "\"";
+        append_sample(out, "quickchat_connection_timeouts_total", shard + ",reason=\"read\"",
+                      double(shards[i]->timeouts_read.load(std::memory_order_relaxed)));
+        append_sample(out, "quickchat_connection_timeouts_total", shard + ",reason=\"idle\"",
+                      double(shards[i]->timeouts_idle.load(std::memory_order_relaxed)));
+        append_sample(out, "quickchat_connection_timeouts_total", shard + ",reason=\"write\"",
+                      double(shards[i]->timeouts_write.load(std::memory_order_relaxed)));
+    }
+
+    append_family(out, "quickchat_messages_dropped_total", "counter",
+                  "Frames discarded because a client's write queue was full.");
+    append_sample(out, "quickchat_messages_dropped_total", "policy=\"drop-oldest\"",
+                  double(overload.dropped_oldest.load(std::memory_order_relaxed)));
+    append_sample(out, "quickchat_messages_dropped_total", "policy=\"drop-newest\"",
+                  double(overload.dropped_newest.load(std::memory_order_relaxed)));
+    append_family(out, "quickchat_slow_consumer_disconnects_total", "counter",
+                  "Clients disconnected because their write queue overflowed.");
+    append_sample(out, "quickchat_slow_consumer_disconnects_total", "",
+                  double(overload.disconnected.load(std::memory_order_relaxed)));
+
+    Histogram fanout;
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    for (const auto& shard : shards) {
+        shard->fanout.snapshot(fanout, sum, count);
+    }
+    append_family(out, "quickchat_fanout_latency_seconds", "summary",
+                  "Time from receiving a frame until its last recipient's write completed.");
+    for (double quantile : kQuantiles) {
+        char label[32];
+        snprintf(label, sizeof(label), "quantile=\"%g\"", quantile);
+        append_sample(out, "quickchat_fanout_latency_seconds", label, fanout.percentile(quantile * 100.0) / 1e9);
+    }
+    append_sample(out, "quickchat_fanout_latency_seconds_sum", "", sum / 1e9);
+    append_sample(out, "quickchat_fanout_latency_seconds_count", "", double(count));
+    return out;
+}
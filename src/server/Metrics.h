@@ -0,0 +1,153 @@
+// Runtime metrics of the chat server: hot-path counters, queue gauges and fan-out latency
+// Every event loop thread records into its own slot; the admin endpoint sums the slots when scraped
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "common/Histogram.h"
+
+struct OverloadCounters;
+
+/**
+ * Latency histogram that one thread records into while any other thread reads it
+ * Uses the bucket layout of Histogram with relaxed atomic counts, so recording is a couple of
+ * uncontended increments and a scrape never has to stop the recording thread
+ */
+class LatencyRecorder {
+    private:
+        std::array<std::atomic<uint64_t>, Histogram::kBucketCount> counts{};
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> sum{0};
+
+    public:
+        /**
+         * Counts one measurement
+         * @param value Latency in nanoseconds
+         */
+        void record(uint64_t value) {
+            counts[Histogram::bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        /**
+         * Adds the current counts to a histogram (values are approximated by their bucket limit)
+         * @param out Histogram to merge into
+         * @param exact_sum Receives the exact sum of all measurements added so far
+         * @param exact_count Receives the exact number of measurements added so far
+         */
+        void snapshot(Histogram& out, uint64_t& exact_sum, uint64_t& exact_count) const;
+};
+
+/**
+ * Counters of one event loop thread (or of all threads together in threaded mode)
+ * Aligned to a cache line so shards never write to the same line
+ */
+struct alignas(64) ShardMetrics {
+    std::atomic<uint64_t> connections_accepted{0};
+    std::atomic<uint64_t> connections_closed{0};
+
+    // Connections turned away by admission control, by reason
+    std::atomic<uint64_t> connections_rejected_full{0};
+    std::atomic<uint64_t> connections_rejected_rate{0};
+
+    // Passes over the listening socket's backlog; accepted plus rejected connections per pass is
+    // the mean accept batch
+    std::atomic<uint64_t> accept_batches{0};
+
+    // Heartbeat Pings sent to clients that had gone quiet
+    std::atomic<uint64_t> pings_sent{0};
+
+    // Connections closed because a timeout ran out, by timeout
+    std::atomic<uint64_t> timeouts_read{0};
+    std::atomic<uint64_t> timeouts_idle{0};
+    std::atomic<uint64_t> timeouts_write{0};
+
+    // Frames and bytes read from clients
+    std::atomic<uint64_t> messages_received{0};
+    std::atomic<uint64_t> bytes_received{0};
+
+    // Frames completely written to clients, and bytes written (including partial frames)
+    std::atomic<uint64_t> messages_sent{0};
+    std::atomic<uint64_t> bytes_sent{0};
+
+    // Frames and bytes waiting in this shard's write queues; a frame shared by several clients
+    // counts once per queue. Signed because in threaded mode one thread may queue a frame that
+    // another thread later writes
+    std::atomic<int64_t> queued_messages{0};
+    std::atomic<int64_t> queued_bytes{0};
+
+    // Time from receiving a client frame until its last recipient no longer needs it
+    LatencyRecorder fanout;
+
+    /**
+     * Adds to a counter; only relaxed ordering is needed since counters are independent
+     */
+    template <typename T, typename V>
+    static void add(std::atomic<T>& counter, V amount) {
+        counter.fetch_add(static_cast<T>(amount), std::memory_order_relaxed);
+    }
+};
+
+/**
+ * All metric slots of one Server and the Prometheus text exposition of them
+ */
+class Metrics {
+    private:
+        // One slot per reactor (one in threaded mode), indexed by shard number
+        std::vector<std::unique_ptr<ShardMetrics>> shards;
+
+        /**
+         * Records a fan-out measurement into the calling thread's slot (installed as release observer)
+         */
+        static void record_fanout(uint64_t origin_time);
+
+    public:
+        /**
+         * Creates the slots and starts timing message fan-out
+         * The release observer is process-wide and stays installed once set: samples go to the
+         * releasing thread's attached slot, so several servers in one process never share one
+         * and destroying a server leaves the others' timing alone
+         * @param shard_count Number of slots to create
+         */
+        explicit Metrics(size_t shard_count);
+
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+        /**
+         * Slot written by one shard
+         * @param index Shard number
+         */
+        ShardMetrics& shard(size_t index) { return *shards[index]; }
+
+        /**
+         * Makes a slot the calling thread's slot for fan-out measurements
+         * Messages whose last handle is released on a thread without a slot are not timed
+         * @param slot Slot of the thread's shard (nullptr to detach)
+         */
+        static void attach_thread(ShardMetrics* slot);
+
+        /**
+         * Current steady clock time as stored in MessageRef::set_origin_time()
+         * @return Nanoseconds since an arbitrary fixed point (never 0)
+         */
+        static uint64_t now();
+
+        /**
+         * Converts a configured number of milliseconds to now() units
+         */
+        static uint64_t milliseconds(int value) { return static_cast<uint64_t>(value) * 1000000; }
+
+        /**
+         * Formats every metric in the Prometheus text exposition format (version 0.0.4)
+         * @param overload Slow-consumer counters kept by the server
+         * @return Text to serve on the admin endpoint
+         */
+        std::string render(const OverloadCounters& overload) const;
+};
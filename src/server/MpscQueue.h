@@ -0,0 +1,79 @@
+// Lock-free multi-producer single-consumer queue used to pass work between reactor threads
+// Any thread may push, but only the thread that owns the queue may pop
+
+#pragma once
+#include <atomic>
+#include <utility>
+#include "common/SlabAllocator.h"
+
+/**
+ * Unbounded intrusive MPSC queue (Dmitry Vyukov's algorithm)
+ * Producers only perform a single atomic exchange, so pushing never blocks or retries,
+ * and the consumer pops without any atomic read-modify-write operations at all
+ * @tparam T Type of the values carried by the queue (must be default constructible)
+ */
+template <typename T>
+class MpscQueue {
+    private:
+        // Nodes are recycled through the slab allocator, so a push does not reach malloc()
+        struct Node {
+            std::atomic<Node*> next{nullptr};
+            T value;
+
+            static void* operator new(size_t size) { return SlabAllocator::allocate(size); }
+            static void operator delete(void* node, size_t size) { SlabAllocator::deallocate(node, size); }
+        };
+
+        // Most recently pushed node; producers swap themselves in here
+        std::atomic<Node*> head;
+
+        // Oldest node, only touched by the consumer; always a "stub" whose value was already taken
+        Node* tail;
+
+    public:
+        MpscQueue() {
+            Node* stub = new Node();
+            head.store(stub, std::memory_order_relaxed);
+            tail = stub;
+        }
+
+        ~MpscQueue() {
+            T ignored;
+            while (pop(ignored)) {
+            }
+            delete tail;
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /**
+         * Appends a value to the queue
+         * Safe to call concurrently from any number of threads
+         * @param value Value to enqueue
+         */
+        void push(T value) {
+            Node* node = new Node();
+            node->value = std::move(value);
+            Node* previous = head.exchange(node, std::memory_order_acq_rel);
+            previous->next.store(node, std::memory_order_release);
+        }
+
+        /**
+         * Removes the oldest value from the queue
+         * Must only be called by the single consumer thread
+         * A push that is still in progress may be reported as empty; its producer wakes the consumer afterwards
+         * @param out Receives the dequeued value
+         * @return true if a value was dequeued, false if the queue is (momentarily) empty
+         */
+        bool pop(T& out) {
+            Node* next = tail->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+            out = std::move(next->value);
+            delete tail;
+            tail = next;
+            return true;
+        }
+};
@@ -0,0 +1,1377 @@
+// Epoll event loop implementation
+
+#include "Reactor.h"
+#include "common/Compression.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace {
+    // Maximum number of readiness events fetched by a single epoll_wait() call
+    constexpr int kMaxEvents = 256;
+
+    // Connections taken from the backlog per event loop iteration; during an accept storm the
+    // rest waits for the next iteration so established clients keep being served in between
+    constexpr int kAcceptBatch = 64;
+
+    constexpr uint32_t kShardMask = (1u << kShardBits) - 1;
+
+    // Largest value of a shard's client counter, which fills the bits between the shard number and
+    // kRelayedSenderBit
+    constexpr uint32_t kMaxClientCounter = (1u << (31 - kShardBits)) - 1;
+
+    // Closed connections kept for reuse per reactor (each holds a kReceiveBufferSize receive ring)
+    constexpr size_t kMaxSpareConnections = 128;
+
+    // Resolution of heartbeats and timeouts: the timing wheel advances one slot per tick
+    constexpr uint64_t kTimerTick = 100 * 1000000ull;
+
+    // io_uring sizing: submission queue entries, and count and size of the provided receive buffers
+    // A receive buffer must fit in the free part of a connection's receive ring after a partial frame
+    constexpr unsigned kUringEntries = 1024;
+    constexpr unsigned kUringBufferCount = 1024;
+    constexpr size_t kUringBufferSize = 4096;
+
+    // Operation kinds stored in the low bits of io_uring user_data; the remaining bits hold the
+    // Connection pointer (objects are at least 8-byte aligned)
+    enum UringOperation : uint64_t {
+        Accept = 1,
+        Receive = 2,
+        Send = 3,
+        Wake = 4,
+        Cancel = 5,
+        FlushTimer = 6,
+        TimeoutTimer = 7
+    };
+    constexpr uint64_t kOperationMask = 7;
+
+    uint64_t operation_data(UringOperation operation, const Connection* connection = nullptr) {
+        return reinterpret_cast<uint64_t>(connection) | operation;
+    }
+
+    // Switches a file descriptor to non-blocking mode
+    void set_non_blocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            throw std::runtime_error("Failed to make socket non-blocking");
+        }
+    }
+
+    // Finds the room an encoded Chat or RoomMessage frame is addressed to
+    // The name was validated when the frame was received, so it can be read back without checks
+    std::string_view room_of(const MessageRef& message) {
+        const char* frame = message.data();
+        if (static_cast<MessageType>(frame[4]) != MessageType::RoomMessage) {
+            return kDefaultRoom;
+        }
+        size_t length = static_cast<unsigned char>(frame[kFrameHeaderSize]);
+        return std::string_view(frame + kFrameHeaderSize + 1, length);
+    }
+}
+
+/**
+ * Constructor: Creates the wake-up eventfd and the epoll or io_uring instance
+ * With epoll the listening socket is registered so new connections are reported as read readiness;
+ * with io_uring the operations are armed when run() starts
+ */
+Reactor::Reactor(int listen_socket, size_t index, ServerContext& context)
+    : listen_socket(listen_socket), index(index), context(context), metrics(context.metrics->shard(index)),
+      next_client_id(1),
+      epoll_fd(-1), wake_value(0), flush_timer_fd(-1), flush_timer_value(0), flush_timer_deadline(0),
+      timeout_timer_fd(-1), timeout_timer_value(0), timers(kTimerTick, Metrics::now()), loop_time(Metrics::now()),
+      accept_pending(false), running(true), wake_pending(false) {
+    // File descriptors stay blocking with io_uring: it then waits for readiness internally
+    // instead of completing operations with EAGAIN
+    bool use_uring = context.config.io_backend == IoBackend::Uring;
+    wake_fd = eventfd(0, EFD_CLOEXEC | (use_uring ? 0 : EFD_NONBLOCK));
+    if (wake_fd < 0) {
+        throw std::runtime_error("Failed to create wake-up eventfd");
+    }
+    rooms.set_observer(context.room_observer());
+    auto close_timers = [this] {
+        close(wake_fd);
+        if (flush_timer_fd >= 0) {
+            close(flush_timer_fd);
+        }
+        if (timeout_timer_fd >= 0) {
+            close(timeout_timer_fd);
+        }
+    };
+    if (context.config.flush_delay_us > 0) {
+        flush_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (use_uring ? 0 : TFD_NONBLOCK));
+        if (flush_timer_fd < 0) {
+            close_timers();
+            throw std::runtime_error("Failed to create flush timer");
+        }
+    }
+    const ServerConfig& config = context.config;
+    if (config.heartbeat_ms > 0 || config.read_timeout_ms > 0 || config.idle_timeout_ms > 0 ||
+        config.write_timeout_ms > 0) {
+        // Ticks for as long as the reactor runs; each tick only visits the wheel slots that fall due
+        timeout_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (use_uring ? 0 : TFD_NONBLOCK));
+        if (timeout_timer_fd < 0) {
+            close_timers();
+            throw std::runtime_error("Failed to create timeout timer");
+        }
+        struct itimerspec interval{};
+        interval.it_interval.tv_nsec = static_cast<long>(kTimerTick);
+        interval.it_value = interval.it_interval;
+        timerfd_settime(timeout_timer_fd, 0, &interval, nullptr);
+    }
+
+    if (use_uring) {
+        try {
+            uring = std::make_unique<IoUring>(kUringEntries, kUringBufferCount, kUringBufferSize);
+        } catch (...) {
+            close_timers();
+            throw;
+        }
+        return;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        close_timers();
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+
+    // The listening socket must never block, otherwise one spurious wake-up would stall every client
+    set_non_blocking(listen_socket);
+
+    struct epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = listen_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event);
+
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+    if (flush_timer_fd >= 0) {
+        event.data.fd = flush_timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, flush_timer_fd, &event);
+    }
+    if (timeout_timer_fd >= 0) {
+        event.data.fd = timeout_timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timeout_timer_fd, &event);
+    }
+}
+
+/**
+ * Destructor: Closes all client connections still owned by the loop
+ */
+Reactor::~Reactor() {
+    // Tear down io_uring first so the kernel is done with the connections' buffers before they are freed
+    uring.reset();
+    for (auto& connection : connections) {
+        if (connection && !connection->local) {
+            close(connection->socket);
+        }
+    }
+    clients.clear();
+    connections.clear();
+    close(wake_fd);
+    if (flush_timer_fd >= 0) {
+        close(flush_timer_fd);
+    }
+    if (timeout_timer_fd >= 0) {
+        close(timeout_timer_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+/**
+ * Main event loop: waits for readiness and dispatches each event
+ * All work happens on the calling thread, so no locking is needed for connection state
+ */
+void Reactor::run() {
+    // Fan-out measurements that finish on this thread belong to this shard
+    Metrics::attach_thread(&metrics);
+    if (uring) {
+        run_uring();
+        Metrics::attach_thread(nullptr);
+        return;
+    }
+
+    struct epoll_event events[kMaxEvents];
+
+    while (running) {
+        // A backlog left over from the last batch only waits for the events that are ready now
+        int ready = epoll_wait(epoll_fd, events, kMaxEvents, accept_pending ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue; // Interrupted by a signal, simply wait again
+            }
+            std::cerr << "epoll_wait failed" << std::endl;
+            break;
+        }
+        loop_time = Metrics::now();
+
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+
+            if (fd == listen_socket) {
+                accept_pending = true; // Accepted after the clients' events of this batch
+                continue;
+            }
+            if (fd == wake_fd) {
+                // Drain the counter, then deliver whatever other shards posted
+                // The loop condition decides whether to keep running after a stop()
+                uint64_t value;
+                ssize_t ignored = read(wake_fd, &value, sizeof(value));
+                (void)ignored;
+                drain_inbox();
+                continue;
+            }
+            if (fd == flush_timer_fd) {
+                // Only ends the wait; flush_scheduled() below writes whatever has fallen due
+                uint64_t expirations;
+                ssize_t ignored = read(flush_timer_fd, &expirations, sizeof(expirations));
+                (void)ignored;
+                flush_timer_deadline = 0;
+                continue;
+            }
+            if (fd == timeout_timer_fd) {
+                // Only ends the wait; the timing wheel is advanced below
+                uint64_t expirations;
+                ssize_t ignored = read(timeout_timer_fd, &expirations, sizeof(expirations));
+                (void)ignored;
+                continue;
+            }
+
+            // The connection may have been closed earlier in this same batch of events
+            if (fd >= static_cast<int>(connections.size()) || !connections[fd]) {
+                continue;
+            }
+            Connection& connection = *connections[fd];
+
+            if (connection.closing) {
+                continue;
+            }
+            if (connection.local) {
+                // One notification covers new input, room made in a full ring and the client closing
+                connection.local->rearm();
+                handle_readable(connection);
+                if (!connection.closing) {
+                    handle_writable(connection);
+                }
+                continue;
+            }
+            if (flags & (EPOLLERR | EPOLLHUP)) {
+                schedule_close(connection);
+            } else {
+                if (flags & (EPOLLIN | EPOLLRDHUP)) {
+                    handle_readable(connection);
+                }
+                if ((flags & EPOLLOUT) && !connection.closing) {
+                    handle_writable(connection);
+                }
+            }
+        }
+
+        if (accept_pending) {
+            accept_connections();
+        }
+        if (timeout_timer_fd >= 0) {
+            timers.advance(loop_time, [this](TimerNode& node) { check_timeouts(static_cast<Connection&>(node)); });
+        }
+
+        // Output produced while handling this batch is written once per client, then dead
+        // connections are released; nothing is freed while the batch is still being processed
+        flush_scheduled();
+        close_scheduled();
+    }
+    Metrics::attach_thread(nullptr);
+}
+
+/**
+ * Signals the loop to stop and wakes it up if it is blocked in epoll_wait()
+ */
+void Reactor::stop() {
+    running = false;
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+/**
+ * Enqueues a message from another shard and makes sure this loop will look at it
+ */
+void Reactor::post(ShardMessage message) {
+    inbox.push(std::move(message));
+    wake();
+}
+
+/**
+ * Registered by the reactor thread itself when it drains its inboxes
+ */
+void Reactor::connect_local(std::unique_ptr<LocalEndpoint> endpoint) {
+    local_inbox.push(std::move(endpoint));
+    wake();
+}
+
+/**
+ * Writes the eventfd only if no wake-up is outstanding yet
+ * Under heavy cross-shard traffic this collapses many posts into a single syscall
+ */
+void Reactor::wake() {
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+/**
+ * Delivers all posted messages to this shard's room members or addressed clients
+ * The pending flag is cleared first so a post racing with the drain triggers a new wake-up
+ */
+void Reactor::drain_inbox() {
+    wake_pending.store(false);
+
+    ShardMessage message;
+    while (inbox.pop(message)) {
+        if (message.recipient_id != 0) {
+            deliver_direct(message.recipient_id, message.payload);
+        } else {
+            deliver_local(room_of(message.payload), message.payload, message.compressed, nullptr);
+        }
+        message.payload = MessageRef();
+        message.compressed = MessageRef();
+    }
+
+    // In-process clients skip admission control: the embedding process decides how many it opens
+    std::unique_ptr<LocalEndpoint> endpoint;
+    while (local_inbox.pop(endpoint)) {
+        // Registering reports input the client already wrote; its notifications are edge-like too
+        int fd = endpoint->fd();
+        struct epoll_event event{};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            endpoint.reset(); // The client reads end of stream
+            continue;
+        }
+        context.admission->adopt();
+        add_connection(fd, 0, std::move(endpoint));
+    }
+}
+
+/**
+ * Accepts up to kAcceptBatch queued connections and registers each admitted one with epoll
+ * Every client socket is non-blocking and watched for both read and write readiness
+ */
+void Reactor::accept_connections() {
+    ShardMetrics::add(metrics.accept_batches, 1);
+    accept_pending = false;
+    for (int batch = 0; batch < kAcceptBatch; ++batch) {
+        struct sockaddr_in address{};
+        socklen_t address_length = sizeof(address);
+        int client_socket = accept4(listen_socket, (struct sockaddr*)&address, &address_length,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue; // Transient failure for this one connection, keep draining
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept client connection" << std::endl;
+            }
+            return; // Backlog drained (or a hard error that retrying now won't fix)
+        }
+        if (!admit_connection(client_socket, address.sin_addr.s_addr)) {
+            continue;
+        }
+
+        // Edge-triggered: the kernel only notifies on transitions, so handlers must drain fully
+        // Registering EPOLLOUT up front avoids an epoll_ctl() call every time output gets queued
+        struct epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            close(client_socket);
+            context.admission->release();
+            continue;
+        }
+
+        add_connection(client_socket);
+    }
+    // Edge-triggered epoll will not report the rest of the backlog again, so it is remembered here
+    accept_pending = true;
+}
+
+/**
+ * A rejected client costs one accept and one non-blocking send; it is never registered
+ */
+bool Reactor::admit_connection(int socket, uint32_t address) {
+    Admission admission = context.admission->admit(address);
+    if (admission == Admission::Accepted) {
+        return true;
+    }
+    ShardMetrics::add(admission == Admission::Full ? metrics.connections_rejected_full
+                                                   : metrics.connections_rejected_rate, 1);
+    reject_connection(socket, admission);
+    return false;
+}
+
+/**
+ * Registers the connection in the fd table, the dense client list and the id index,
+ * reusing a spare Connection object when one is available
+ */
+Connection& Reactor::add_connection(int socket, uint32_t client_id, std::unique_ptr<LocalEndpoint> local) {
+    if (socket >= static_cast<int>(connections.size())) {
+        connections.resize(socket + 1);
+    }
+    // Id 0 is reserved for the server itself, so the per-shard counter starts at 1. After 2^24
+    // connections it wraps back to 1 and skips ids still in use; a direct message addressed to a
+    // client that left long ago may then reach the newer client that got its id
+    bool new_client = client_id == 0;
+    if (new_client) {
+        do {
+            client_id = (next_client_id << kShardBits) | static_cast<uint32_t>(index);
+            next_client_id = next_client_id < kMaxClientCounter ? next_client_id + 1 : 1;
+        } while (clients_by_id.count(client_id) != 0);
+    }
+    if (!spare_connections.empty()) {
+        connections[socket] = std::move(spare_connections.back());
+        spare_connections.pop_back();
+        connections[socket]->reset(socket, client_id);
+    } else {
+        connections[socket] = std::make_unique<Connection>(socket, client_id, context.config, &metrics);
+    }
+    Connection& connection = *connections[socket];
+    ShardMetrics::add(metrics.connections_accepted, 1);
+
+    // Output is already coalesced per event loop iteration (and by the flush delay), so Nagle's
+    // algorithm would only hold back the last partial segment of every write
+    connection.local = std::move(local);
+    if (!connection.local) {
+        int enable = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    connection.slot = clients.size();
+    clients.push_back(&connection);
+    clients_by_id[client_id] = &connection;
+    if (new_client) {
+        rooms.join(connection, kDefaultRoom);
+    }
+    if (timeout_timer_fd >= 0) {
+        connection.last_received = loop_time;
+        connection.last_activity = loop_time;
+        connection.last_write_progress = loop_time;
+        check_timeouts(connection);
+    }
+    return connection;
+}
+
+/**
+ * Drains the socket until readv() reports EAGAIN, handling every complete frame as it arrives
+ * Data lands directly in the connection's ring buffer and frames are parsed in place
+ */
+void Reactor::handle_readable(Connection& connection) {
+    while (!connection.closing) {
+        struct iovec segments[2];
+        int segment_count = connection.inbound.free_segments(segments);
+        if (segment_count == 0) {
+            // Cannot happen with well-formed frames (the ring holds two maximum-size frames)
+            schedule_close(connection);
+            return;
+        }
+
+        ssize_t bytes_received = connection.local ? connection.local->readv(segments, segment_count)
+                                                  : readv(connection.socket, segments, segment_count);
+        if (bytes_received > 0) {
+            connection.inbound.commit(bytes_received);
+            connection.last_received = loop_time;
+            ShardMetrics::add(metrics.bytes_received, bytes_received);
+            process_input(connection);
+            continue;
+        }
+        if (bytes_received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // Nothing more to read until the next edge
+        }
+        // readv() returned 0 (orderly shutdown) or a hard error
+        schedule_close(connection);
+    }
+}
+
+/**
+ * Parses frames in place and hands each one to handle_frame() before releasing it
+ * Compressed frames are inflated first, so handle_frame() only ever sees plain payloads
+ */
+void Reactor::process_input(Connection& connection) {
+    // One clock read covers every frame that arrived with this read
+    uint64_t received_at = Metrics::now();
+    Frame frame;
+    ParseStatus status;
+    while ((status = connection.parser.next(connection.inbound, frame)) == ParseStatus::Ready) {
+        ShardMetrics::add(metrics.messages_received, 1);
+        Frame expanded;
+        if (!expand_frame(frame, inflated, expanded)) {
+            status = ParseStatus::Invalid;
+            break;
+        }
+        handle_frame(connection, expanded, received_at);
+        connection.parser.release(connection.inbound, frame);
+    }
+    if (status == ParseStatus::Invalid) {
+        schedule_close(connection); // Protocol violation, the stream cannot be resynchronized
+    }
+}
+
+/**
+ * Routes one client frame: Join/Leave update the room index, chat frames are stamped with the
+ * sender's id and a server sequence number and relayed to their room or recipient
+ * Frame types a client is not allowed to send (such as Notice) are ignored
+ */
+void Reactor::handle_frame(Connection& connection, const Frame& frame, uint64_t received_at) {
+    char name[kMaxRoomNameLength];
+    size_t name_length = 0;
+    MessageType type = frame.header.type;
+    if (type != MessageType::Ping && type != MessageType::Pong) {
+        connection.last_activity = received_at;
+    }
+
+    switch (type) {
+        case MessageType::Join:
+        case MessageType::Leave:
+            if (!frame.read_room_name(name, name_length)) {
+                send_notice(connection, "Invalid room name");
+            } else if (type == MessageType::Join) {
+                rooms.join(connection, std::string_view(name, name_length));
+            } else {
+                rooms.leave(connection, std::string_view(name, name_length));
+            }
+            return;
+        case MessageType::RoomMessage:
+            if (!frame.read_room_name(name, name_length)) {
+                send_notice(connection, "Invalid room name");
+                return;
+            }
+            if (!rooms.contains(connection, std::string_view(name, name_length))) {
+                send_notice(connection, "Join " + std::string(name, name_length) + " before sending to it");
+                return;
+            }
+            break;
+        case MessageType::Chat:
+            if (!rooms.contains(connection, kDefaultRoom)) {
+                return; // The client left the lobby and no longer takes part in it
+            }
+            break;
+        case MessageType::Direct:
+            if (frame.payload_size() < kDirectPrefixSize) {
+                return;
+            }
+            break;
+        case MessageType::Compression: {
+            char method = 0;
+            if (frame.payload_size() == 1) {
+                frame.read(0, &method, 1);
+            }
+            // Only deflate exists so far; anything else (or a build without zlib) is declined
+            connection.compress = static_cast<CompressionMethod>(method) == CompressionMethod::Deflate &&
+                                  compression_supported();
+            CompressionMethod accepted = connection.compress ? CompressionMethod::Deflate : CompressionMethod::None;
+            method = static_cast<char>(accepted);
+            FrameHeader header;
+            header.type = MessageType::Compression;
+            queue_output(connection, encode_frame(header, &method, 1));
+            return;
+        }
+        case MessageType::History: {
+            char since[8];
+            if (!frame.read_room_name(name, name_length) || frame.payload_size() != 1 + name_length + sizeof(since)) {
+                send_notice(connection, "Invalid history request");
+                return;
+            }
+            frame.read(1 + name_length, since, sizeof(since));
+            start_history(connection, std::string_view(name, name_length), read_u64(since));
+            return;
+        }
+        case MessageType::Ping: {
+            // Echoed back as is; receiving it already proved the client alive
+            FrameHeader header;
+            header.type = MessageType::Pong;
+            queue_output(connection, encode_frame(header, frame.first, frame.first_length,
+                                                  frame.second, frame.second_length));
+            return;
+        }
+        default:
+            return; // Pong included: it only had to arrive to count
+    }
+
+    FrameHeader header;
+    header.type = type;
+    header.sender_id = connection.id;
+    header.sequence = context.next_sequence.fetch_add(1, std::memory_order_relaxed);
+
+    // Encode once; every recipient on every shard shares this buffer
+    // The payload is relayed unchanged, so recipients see the room name or their own id in it
+    MessageRef message = encode_frame(header, frame.first, frame.first_length,
+                                      frame.second, frame.second_length);
+    message.set_origin_time(received_at);
+    if (type == MessageType::Direct) {
+        char recipient[kDirectPrefixSize];
+        frame.read(0, recipient, kDirectPrefixSize);
+        deliver_direct(read_u32(recipient), message);
+    } else {
+        std::string_view room = type == MessageType::Chat ? kDefaultRoom : std::string_view(name, name_length);
+        if (context.log) {
+            context.log->append(message);
+        }
+        if (context.federation) {
+            context.federation->forward(room, message);
+        }
+        deliver_to_room(room, message, connection);
+    }
+}
+
+/**
+ * Writes queued frames until the queue is empty or the socket buffer is full
+ * When the socket is full the remainder simply waits for the next EPOLLOUT edge
+ * With io_uring the write is only queued here and goes out with the next submission
+ */
+void Reactor::handle_writable(Connection& connection) {
+    if (uring) {
+        submit_send(connection);
+        return;
+    }
+    // While a history replay runs, every time the socket takes the whole queue the next part follows
+    uint64_t written = connection.outbound.written();
+    FlushStatus status;
+    do {
+        pump_history(connection);
+        status = connection.local ? connection.outbound.flush(*connection.local)
+                                  : connection.outbound.flush(connection.socket);
+    } while (status == FlushStatus::Done && connection.history && !connection.closing);
+    if (connection.outbound.written() != written) {
+        connection.last_write_progress = loop_time;
+    }
+    if (status == FlushStatus::Error) {
+        schedule_close(connection);
+    }
+}
+
+/**
+ * Only one replay runs per client (see ServerContext::start_history())
+ */
+void Reactor::start_history(Connection& connection, std::string_view room, uint64_t since) {
+    if (const char* refusal = context.start_history(connection.history, room, since)) {
+        send_notice(connection, refusal);
+        return;
+    }
+    schedule_flush(connection);
+}
+
+/**
+ * Queues history as far as the budget of ServerContext::next_history_chunk() allows
+ */
+void Reactor::pump_history(Connection& connection) {
+    while (!connection.closing) {
+        MessageRef chunk = context.next_history_chunk(connection.history, connection.outbound);
+        if (!chunk) {
+            break;
+        }
+        push_output(connection, chunk);
+    }
+}
+
+/**
+ * Queues the frame for the room's members on every shard
+ * Other shards receive the same buffer through their inbox and look up their own members
+ */
+void Reactor::deliver_to_room(std::string_view room, const MessageRef& message, const Connection& sender) {
+    MessageRef compressed;
+    deliver_local(room, message, compressed, &sender);
+
+    if (context.shards.size() > 1) {
+        for (auto& shard : context.shards) {
+            if (shard.get() != this) {
+                shard->post(ShardMessage{message, 0, compressed});
+            }
+        }
+    }
+}
+
+/**
+ * Visits only the room's member array, so the cost is proportional to the room size
+ * rather than to the number of connected clients
+ * The frame is compressed at most once however many members asked for compression
+ */
+void Reactor::deliver_local(std::string_view room, const MessageRef& message, MessageRef& compressed,
+                            const Connection* sender) {
+    const std::vector<Connection*>* members = rooms.members(room);
+    if (members == nullptr) {
+        return;
+    }
+    for (Connection* connection : *members) {
+        if (connection == sender || connection->closing) {
+            continue;
+        }
+        if (connection->compress) {
+            if (!compressed) {
+                compressed = compress_frame(message);
+            }
+            queue_output(*connection, compressed);
+        } else {
+            queue_output(*connection, message);
+        }
+    }
+}
+
+/**
+ * The shard is encoded in the recipient id, so the message is either queued here or handed
+ * straight to the one shard that can own the recipient
+ */
+void Reactor::deliver_direct(uint32_t recipient_id, const MessageRef& message) {
+    size_t shard = recipient_id & kShardMask;
+    if (shard != index && shard < context.shards.size()) {
+        ShardMessage shard_message{};
+        shard_message.payload = message;
+        shard_message.recipient_id = recipient_id;
+        context.shards[shard]->post(std::move(shard_message));
+        return;
+    }
+
+    if (shard == index) {
+        auto it = clients_by_id.find(recipient_id);
+        if (it != clients_by_id.end() && !it->second->closing) {
+            queue_output(*it->second, it->second->compress ? compress_frame(message) : message);
+            return;
+        }
+    }
+
+    // Only a Direct message gets a reply; a Notice that cannot be delivered is simply dropped
+    const char* frame = message.data();
+    if (static_cast<MessageType>(frame[4]) == MessageType::Direct) {
+        std::string text = ServerContext::unreachable_notice(recipient_id);
+        FrameHeader header;
+        header.type = MessageType::Notice;
+        deliver_direct(read_u32(frame + 8), encode_frame(header, text.data(), text.size()));
+    }
+}
+
+/**
+ * Notices come from the server itself, so their sender id and sequence number are 0
+ */
+void Reactor::send_notice(Connection& connection, std::string_view text) {
+    FrameHeader header;
+    header.type = MessageType::Notice;
+    queue_output(connection, encode_frame(header, text.data(), text.size()));
+}
+
+/**
+ * A full queue is handled according to the configured overflow policy
+ */
+bool Reactor::push_output(Connection& connection, const MessageRef& message) {
+    size_t evicted = 0;
+    bool was_empty = connection.outbound.empty();
+    PushResult result = connection.outbound.push(message, evicted);
+    if (evicted > 0) {
+        context.overload.dropped_oldest.fetch_add(evicted, std::memory_order_relaxed);
+    }
+    if (result == PushResult::Dropped) {
+        context.overload.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (result == PushResult::Overflow) {
+        // The client stopped reading long enough to fill its queue; drop it rather than buffer forever
+        context.overload.disconnected.fetch_add(1, std::memory_order_relaxed);
+        schedule_close(connection);
+        return false;
+    }
+    if (was_empty && context.config.write_timeout_ms > 0) {
+        // The write timeout runs from now; the connection's timer may be set much later than that
+        connection.last_write_progress = loop_time;
+        timers.schedule_by(connection, loop_time + Metrics::milliseconds(context.config.write_timeout_ms));
+    }
+    return true;
+}
+
+/**
+ * Pushes a reference onto the client's queue; the actual write happens in flush_scheduled()
+ */
+void Reactor::queue_output(Connection& connection, const MessageRef& message) {
+    if (!push_output(connection, message)) {
+        return;
+    }
+
+    if (connection.outbound.size() * 2 >= context.config.max_queued_messages ||
+        connection.outbound.bytes() * 2 >= context.config.max_queued_bytes) {
+        // A large burst is being handled in one iteration; write now instead of letting the queue fill
+        // With io_uring this is the one place that writes directly (MSG_DONTWAIT), and only when no
+        // sendmsg is in flight, so the byte stream stays in order
+        if (!uring) {
+            handle_writable(connection);
+        } else if (!connection.send_in_flight &&
+                   connection.outbound.flush(connection.socket) == FlushStatus::Error) {
+            schedule_close(connection);
+        }
+    }
+    schedule_flush(connection);
+}
+
+void Reactor::schedule_flush(Connection& connection) {
+    if (!connection.flush_scheduled) {
+        connection.flush_scheduled = true;
+        connection.flush_deadline = loop_time + static_cast<uint64_t>(context.config.flush_delay_us) * 1000;
+        flush_connections.push_back(&connection);
+    }
+}
+
+/**
+ * Gives every client with new output one chance to write it
+ * With a flush delay, a small queue is kept back so that output of the next iterations can join
+ * the same write; it goes out once it reaches config.flush_bytes or its deadline passes
+ */
+void Reactor::flush_scheduled() {
+    bool delayed = context.config.flush_delay_us > 0;
+    size_t kept = 0;
+    uint64_t earliest = 0;
+    for (Connection* connection : flush_connections) {
+        if (delayed && !connection->closing && !connection->history &&
+            connection->outbound.bytes() < context.config.flush_bytes && loop_time < connection->flush_deadline) {
+            flush_connections[kept++] = connection;
+            if (earliest == 0 || connection->flush_deadline < earliest) {
+                earliest = connection->flush_deadline;
+            }
+            continue;
+        }
+        connection->flush_scheduled = false;
+        if (!connection->closing) {
+            handle_writable(*connection);
+        }
+    }
+    flush_connections.resize(kept);
+    if (kept > 0) {
+        arm_flush_timer(earliest);
+    }
+}
+
+/**
+ * The timer only moves to an earlier deadline; a later one is re-armed once it has fired
+ */
+void Reactor::arm_flush_timer(uint64_t deadline) {
+    if (flush_timer_deadline != 0 && flush_timer_deadline <= deadline) {
+        return;
+    }
+    struct itimerspec expiry{};
+    expiry.it_value.tv_sec = static_cast<time_t>(deadline / 1000000000);
+    expiry.it_value.tv_nsec = static_cast<long>(deadline % 1000000000);
+    timerfd_settime(flush_timer_fd, TFD_TIMER_ABSTIME, &expiry, nullptr);
+    flush_timer_deadline = deadline;
+}
+
+/**
+ * Only the deadlines derived from the connection's timestamps are compared, so traffic never has to
+ * touch the wheel: a timer that fires early for a connection that was active meanwhile just moves on
+ */
+void Reactor::check_timeouts(Connection& connection) {
+    if (connection.closing) {
+        return;
+    }
+    const ServerConfig& config = context.config;
+    uint64_t next = UINT64_MAX;
+
+    if (config.read_timeout_ms > 0) {
+        uint64_t deadline = connection.last_received + Metrics::milliseconds(config.read_timeout_ms);
+        if (loop_time >= deadline) {
+            ShardMetrics::add(metrics.timeouts_read, 1);
+            schedule_close(connection);
+            return;
+        }
+        next = std::min(next, deadline);
+    }
+    if (config.idle_timeout_ms > 0) {
+        uint64_t deadline = connection.last_activity + Metrics::milliseconds(config.idle_timeout_ms);
+        if (loop_time >= deadline) {
+            // Written right away (best effort): the socket is closed before the next flush
+            ShardMetrics::add(metrics.timeouts_idle, 1);
+            send_notice(connection, "Disconnected after being idle for too long");
+            if (!connection.closing && connection.local) {
+                connection.outbound.flush(*connection.local);
+            } else if (!connection.closing && !connection.send_in_flight) {
+                connection.outbound.flush(connection.socket);
+            }
+            schedule_close(connection);
+            return;
+        }
+        next = std::min(next, deadline);
+    }
+    if (config.heartbeat_ms > 0) {
+        // Pings repeat every interval for as long as the client stays silent
+        uint64_t due = std::max(connection.last_received, connection.last_ping) +
+                       Metrics::milliseconds(config.heartbeat_ms);
+        if (loop_time >= due) {
+            ShardMetrics::add(metrics.pings_sent, 1);
+            FrameHeader header;
+            header.type = MessageType::Ping;
+            queue_output(connection, encode_frame(header, "", 0));
+            connection.last_ping = loop_time;
+            due = loop_time + Metrics::milliseconds(config.heartbeat_ms);
+        }
+        next = std::min(next, due);
+    }
+    // Checked last, so a Ping queued above is covered too
+    if (config.write_timeout_ms > 0 && !connection.outbound.empty()) {
+        uint64_t deadline = connection.last_write_progress + Metrics::milliseconds(config.write_timeout_ms);
+        if (loop_time >= deadline) {
+            ShardMetrics::add(metrics.timeouts_write, 1);
+            schedule_close(connection);
+            return;
+        }
+        next = std::min(next, deadline);
+    }
+
+    if (next == UINT64_MAX) {
+        timers.cancel(connection);
+    } else {
+        timers.schedule(connection, next);
+    }
+}
+
+/**
+ * Defers closing so that callers iterating over connections never see a freed object
+ */
+void Reactor::schedule_close(Connection& connection) {
+    if (!connection.closing) {
+        connection.closing = true;
+        closing_connections.push_back(&connection);
+    }
+}
+
+/**
+ * Closes every connection that was scheduled for closing
+ */
+void Reactor::close_scheduled() {
+    for (Connection* connection : closing_connections) {
+        close_connection(connection->socket);
+    }
+    closing_connections.clear();
+}
+
+/**
+ * Makes the client unreachable for routing, then unregisters it from epoll or cancels its
+ * io_uring operations before releasing its state
+ */
+void Reactor::close_connection(int socket) {
+    // Swap-remove from the dense client list, fixing up the moved connection's slot
+    Connection* connection = connections[socket].get();
+    ShardMetrics::add(metrics.connections_closed, 1);
+    context.admission->release();
+    timers.cancel(*connection);
+    rooms.leave_all(*connection);
+    clients_by_id.erase(connection->id);
+    Connection* last = clients.back();
+    clients[connection->slot] = last;
+    last->slot = connection->slot;
+    clients.pop_back();
+
+    if (uring) {
+        // The socket stays open (so its fd cannot be reused) until the kernel returned every operation
+        if (connection->io_references > 1) {
+            struct io_uring_sqe* sqe = uring->get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = socket;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = operation_data(UringOperation::Cancel, connection);
+            ++connection->io_references;
+        }
+        release_io_reference(*connection);
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+    release_connection(socket);
+}
+
+/**
+ * Closing the socket last keeps its fd number reserved while the Connection still exists
+ * An in-process client's fd belongs to its pipe, which closes it once the client end is gone too
+ */
+void Reactor::release_connection(int socket) {
+    std::unique_ptr<Connection> connection = std::move(connections[socket]);
+    if (connection->local) {
+        connection->local.reset();
+    } else {
+        close(socket);
+    }
+    if (spare_connections.size() < kMaxSpareConnections) {
+        // Queued frames (and any history replay) are released now rather than when the object is reused
+        connection->outbound.clear();
+        connection->history.reset();
+        spare_connections.push_back(std::move(connection));
+    }
+}
+
+/**
+ * The sockets stay registered, so the destructor still closes this process's descriptors of them;
+ * only the epoll backend is exported (the Server refuses a handoff with io_uring)
+ */
+void Reactor::export_connections(HandoffState& state) {
+    drain_inbox();
+    for (Connection* connection : clients) {
+        if (connection->closing || connection->local) {
+            continue; // Failed, hung up or in-process; the successor has nothing left to serve
+        }
+        HandoffConnection entry;
+        entry.socket = connection->socket;
+        entry.id = connection->id;
+        entry.compress = connection->compress;
+        for (const RoomMembership& membership : connection->rooms) {
+            entry.rooms.emplace_back(rooms.name(membership.room));
+        }
+        entry.inbound.resize(connection->inbound.size());
+        connection->inbound.peek(0, &entry.inbound[0], entry.inbound.size());
+        connection->outbound.take_unsent(entry.outbound);
+        if (connection->history) {
+            // A replay points into this process's log mappings; the client has to ask again
+            std::string_view text = "History replay interrupted by a server restart";
+            append_frame(entry.outbound, MessageType::Notice, 0, 0, text.data(), text.size());
+            connection->history.reset();
+        }
+        state.connections.push_back(std::move(entry));
+    }
+}
+
+/**
+ * Client ids carry their shard number, so every client returns to the shard with the same index;
+ * ids handed out from now on continue above the highest adopted one
+ */
+void Reactor::adopt_connections(std::vector<HandoffConnection>& handed_over) {
+    for (HandoffConnection& entry : handed_over) {
+        if (entry.socket < 0 || (entry.id & kShardMask) != index) {
+            continue;
+        }
+        int socket = entry.socket;
+        entry.socket = -1;
+
+        // Registering reports the current readiness, so input that arrived during the handoff is
+        // read and the restored output is written in the first iteration
+        set_non_blocking(socket);
+        struct epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = socket;
+        if (entry.id >> kShardBits == 0 || clients_by_id.count(entry.id) != 0 ||
+            entry.inbound.size() > kReceiveBufferSize || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event) < 0) {
+            close(socket);
+            continue;
+        }
+        uint32_t counter = entry.id >> kShardBits;
+        next_client_id = std::max(next_client_id, counter < kMaxClientCounter ? counter + 1 : 1);
+
+        context.admission->adopt();
+        Connection& connection = add_connection(socket, entry.id);
+        connection.compress = entry.compress;
+        for (const std::string& room : entry.rooms) {
+            rooms.join(connection, room);
+        }
+
+        // The ring only ever held the start of a frame, so nothing is ready to be handled yet
+        struct iovec segments[2];
+        int segment_count = connection.inbound.free_segments(segments);
+        size_t copied = 0;
+        for (int i = 0; i < segment_count && copied < entry.inbound.size(); ++i) {
+            size_t chunk = std::min(segments[i].iov_len, entry.inbound.size() - copied);
+            memcpy(segments[i].iov_base, entry.inbound.data() + copied, chunk);
+            copied += chunk;
+        }
+        connection.inbound.commit(copied);
+
+        if (!entry.outbound.empty()) {
+            // Queued as one piece: dropping part of it would tear the frame it starts in
+            MessageRef pending = MessageRef::allocate(entry.outbound.size());
+            memcpy(pending.mutable_data(), entry.outbound.data(), entry.outbound.size());
+            size_t evicted = 0;
+            if (connection.outbound.push(std::move(pending), evicted) != PushResult::Queued) {
+                schedule_close(connection);
+            } else if (timeout_timer_fd >= 0) {
+                check_timeouts(connection); // The write timeout now covers the restored output
+            }
+        }
+    }
+}
+
+/**
+ * Event loop for the io_uring backend
+ * Each iteration submits everything queued since the last one (receives to re-arm, sends, cancels)
+ * and waits for at least one completion with the same io_uring_enter() call
+ */
+void Reactor::run_uring() {
+    submit_accept();
+    submit_wake();
+    if (flush_timer_fd >= 0) {
+        submit_flush_timer();
+    }
+    if (timeout_timer_fd >= 0) {
+        submit_timeout_timer();
+    }
+
+    while (running) {
+        if (!uring->submit_and_wait(1)) {
+            std::cerr << "io_uring_enter failed" << std::endl;
+            break;
+        }
+        loop_time = Metrics::now();
+
+        // Send completions go first: they free write queue space that the receives of the same
+        // batch are about to fill, which keeps bursts from hitting the overflow policy
+        unsigned count = uring->ready();
+        for (unsigned i = 0; i < count; ++i) {
+            if ((uring->completion(i).user_data & kOperationMask) == UringOperation::Send) {
+                handle_completion(uring->completion(i));
+            }
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            if ((uring->completion(i).user_data & kOperationMask) != UringOperation::Send) {
+                handle_completion(uring->completion(i));
+            }
+        }
+        uring->consume(count);
+        if (timeout_timer_fd >= 0) {
+            timers.advance(loop_time, [this](TimerNode& node) { check_timeouts(static_cast<Connection&>(node)); });
+        }
+
+        // Same end-of-batch work as the epoll loop; here it only queues submissions
+        flush_scheduled();
+        close_scheduled();
+    }
+}
+
+/**
+ * The operation kind lives in the low bits of user_data, the Connection pointer in the rest
+ */
+void Reactor::handle_completion(const struct io_uring_cqe& completion) {
+    Connection* connection = reinterpret_cast<Connection*>(completion.user_data & ~kOperationMask);
+    bool more = completion.flags & IORING_CQE_F_MORE;
+
+    switch (completion.user_data & kOperationMask) {
+        case UringOperation::Accept:
+            if (completion.res >= 0) {
+                // The multishot accept does not report the address; it is only looked up when needed
+                struct sockaddr_in address{};
+                socklen_t address_length = sizeof(address);
+                if (context.admission->rate_limited()) {
+                    getpeername(completion.res, (struct sockaddr*)&address, &address_length);
+                }
+                if (admit_connection(completion.res, address.sin_addr.s_addr)) {
+                    submit_receive(add_connection(completion.res));
+                }
+            } else if (completion.res != -EINTR && completion.res != -ECONNABORTED &&
+                       completion.res != -ECANCELED) {
+                std::cerr << "Failed to accept client connection" << std::endl;
+            }
+            if (!more && running) {
+                submit_accept(); // The kernel ended the multishot accept (e.g. after an error)
+            }
+            break;
+        case UringOperation::Wake:
+            drain_inbox();
+            if (running) {
+                submit_wake();
+            }
+            break;
+        case UringOperation::Receive:
+            handle_receive(*connection, completion);
+            break;
+        case UringOperation::Send:
+            handle_send(*connection, completion);
+            break;
+        case UringOperation::Cancel:
+            release_io_reference(*connection);
+            break;
+        case UringOperation::FlushTimer:
+            flush_timer_deadline = 0;
+            if (running) {
+                submit_flush_timer();
+            }
+            break;
+        case UringOperation::TimeoutTimer:
+            if (running) {
+                submit_timeout_timer();
+            }
+            break;
+    }
+}
+
+/**
+ * Copies the provided buffer into the connection's receive ring and returns it to the kernel at once,
+ * so the buffer pool is shared by all connections and only data in transit occupies it
+ */
+void Reactor::handle_receive(Connection& connection, const struct io_uring_cqe& completion) {
+    bool more = completion.flags & IORING_CQE_F_MORE;
+
+    if (completion.flags & IORING_CQE_F_BUFFER) {
+        uint16_t buffer_id = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (completion.res > 0 && !connection.closing) {
+            size_t length = static_cast<size_t>(completion.res);
+            connection.last_received = loop_time;
+            ShardMetrics::add(metrics.bytes_received, length);
+            struct iovec segments[2];
+            int segment_count = connection.inbound.free_segments(segments);
+            const char* data = uring->buffer(buffer_id);
+            if (connection.inbound.free_space() < length) {
+                // Cannot happen with well-formed frames (see kUringBufferSize)
+                schedule_close(connection);
+            } else {
+                for (int i = 0; i < segment_count && length > 0; ++i) {
+                    size_t chunk = segments[i].iov_len < length ? segments[i].iov_len : length;
+                    memcpy(segments[i].iov_base, data, chunk);
+                    connection.inbound.commit(chunk);
+                    data += chunk;
+                    length -= chunk;
+                }
+                process_input(connection);
+            }
+        }
+        uring->recycle_buffer(buffer_id);
+    }
+
+    if (!more) {
+        // The multishot receive has ended: re-arm it if the buffer pool ran dry or it simply
+        // stopped, close the connection on end of stream or error
+        if (!connection.closing) {
+            if (completion.res > 0 || completion.res == -ENOBUFS) {
+                submit_receive(connection);
+            } else {
+                schedule_close(connection);
+            }
+        }
+        release_io_reference(connection);
+    } else if (completion.res <= 0 && !connection.closing) {
+        schedule_close(connection);
+    }
+}
+
+/**
+ * A short write leaves the rest of the pinned frames queued; the next sendmsg picks them up
+ */
+void Reactor::handle_send(Connection& connection, const struct io_uring_cqe& completion) {
+    connection.send_in_flight = false;
+    if (completion.res > 0) {
+        connection.outbound.advance(static_cast<size_t>(completion.res));
+        connection.last_write_progress = loop_time;
+        submit_send(connection);
+    } else {
+        connection.outbound.advance(0); // Unpin the frames the failed write described
+        if (completion.res == -EINTR || completion.res == -EAGAIN) {
+            submit_send(connection);
+        } else {
+            schedule_close(connection);
+        }
+    }
+    release_io_reference(connection);
+}
+
+/**
+ * The socket is closed only after the last operation referring to it has completed
+ */
+void Reactor::release_io_reference(Connection& connection) {
+    if (--connection.io_references == 0) {
+        release_connection(connection.socket);
+    }
+}
+
+/**
+ * One multishot accept stays armed for the lifetime of the loop and yields one completion per client
+ */
+void Reactor::submit_accept() {
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = operation_data(UringOperation::Accept);
+}
+
+/**
+ * The reactor's own reference is taken here, when the connection's first receive is armed
+ */
+void Reactor::submit_receive(Connection& connection) {
+    if (connection.io_references == 0) {
+        connection.io_references = 1;
+    }
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection.socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = 1u << IOSQE_BUFFER_SELECT_BIT;
+    sqe->buf_group = IoUring::kReceiveBufferGroup;
+    sqe->user_data = operation_data(UringOperation::Receive, &connection);
+    ++connection.io_references;
+}
+
+void Reactor::submit_wake() {
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value);
+    sqe->len = sizeof(wake_value);
+    sqe->user_data = operation_data(UringOperation::Wake);
+}
+
+void Reactor::submit_flush_timer() {
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = flush_timer_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&flush_timer_value);
+    sqe->len = sizeof(flush_timer_value);
+    sqe->user_data = operation_data(UringOperation::FlushTimer);
+}
+
+void Reactor::submit_timeout_timer() {
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = timeout_timer_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&timeout_timer_value);
+    sqe->len = sizeof(timeout_timer_value);
+    sqe->user_data = operation_data(UringOperation::TimeoutTimer);
+}
+
+/**
+ * Gathers the queued frames into the connection's own msghdr; WriteQueue pins them until
+ * the completion calls advance(), so eviction cannot free memory the kernel is reading
+ */
+void Reactor::submit_send(Connection& connection) {
+    if (connection.send_in_flight || connection.closing) {
+        return;
+    }
+    pump_history(connection);
+    if (connection.outbound.empty()) {
+        return;
+    }
+    if (!connection.send_segments) {
+        connection.send_segments.reset(new struct iovec[kUringSendSegments]); // Kept when the connection is reused
+    }
+    connection.send_header = msghdr{};
+    connection.send_header.msg_iov = connection.send_segments.get();
+    connection.send_header.msg_iovlen = connection.outbound.gather(connection.send_segments.get(), kUringSendSegments);
+    bool more = connection.send_header.msg_iovlen < connection.outbound.size();
+
+    struct io_uring_sqe* sqe = uring->get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = connection.socket;
+    sqe->addr = reinterpret_cast<uint64_t>(&connection.send_header);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    sqe->user_data = operation_data(UringOperation::Send, &connection);
+    connection.send_in_flight = true;
+    ++connection.io_references;
+}
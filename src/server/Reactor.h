@@ -0,0 +1,451 @@
+// Event loop for the epoll based server modes
+// A Reactor serves its share of client connections from one thread using non-blocking sockets
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Connection.h"
+#include "MpscQueue.h"
+#include "ServerContext.h"
+#include "RoomIndex.h"
+#include "IoUring.h"
+#include "Handoff.h"
+#include "TimingWheel.h"
+
+// Client ids carry the shard number in their low bits so any shard can tell where a client lives
+constexpr uint32_t kShardBits = 8;
+
+// Most shards a server can run: as many as the low bits of a client id can tell apart
+constexpr size_t kMaxShards = size_t(1) << kShardBits;
+
+/**
+ * Work item posted to a reactor by another reactor thread
+ */
+struct ShardMessage {
+    // Encoded frame to deliver; shared between all shards so a room message is encoded only once
+    // Chat and RoomMessage frames go to the receiving shard's members of the room named in the frame
+    MessageRef payload;
+
+    // Client the frame is addressed to, or 0 to deliver it to a room
+    uint32_t recipient_id = 0;
+
+    // Compressed form of payload for members that negotiated compression, shared like payload
+    // (empty until some shard needed it; the receiving shard then compresses on demand)
+    MessageRef compressed;
+};
+
+/**
+ * Edge-triggered epoll event loop that accepts, reads from and writes to many clients
+ * Replaces the thread-per-client model: one thread waits for readiness on all sockets
+ * at once and only touches a socket when the kernel reports it can make progress
+ *
+ * With IoBackend::Uring the same loop is driven by io_uring completions instead of epoll readiness:
+ * one multishot accept and one multishot receive per client stay armed in the kernel, received
+ * data lands in provided buffers, and every send produced by an iteration is submitted together
+ * with the next wait in a single io_uring_enter() call.
+ *
+ * In sharded mode several reactors run side by side, each on its own thread with its own
+ * SO_REUSEPORT listening socket and its own shard of the clients. Room and direct messages
+ * reach the other shards through their lock-free inbox queues, so no global client lock exists.
+ */
+class Reactor {
+    private:
+        // Listening socket owned by the Server (must stay open while running)
+        int listen_socket;
+
+        // Position of this reactor in context.shards
+        size_t index;
+
+        // State shared with the other reactors (shard list, sequence counter)
+        ServerContext& context;
+
+        // This shard's metrics slot, written only by the reactor thread
+        ShardMetrics& metrics;
+
+        // Per-shard counter used to build client ids that are unique across all shards
+        // It fills the 23 bits between the shard number and kRelayedSenderBit and wraps back to 1
+        // (see add_connection())
+        uint32_t next_client_id;
+
+        // epoll instance that reports readiness for the listening socket and all clients
+        // (-1 when the io_uring backend is used)
+        int epoll_fd;
+
+        // io_uring instance used instead of epoll_fd with IoBackend::Uring, otherwise nullptr
+        std::unique_ptr<IoUring> uring;
+
+        // eventfd registered with epoll (or read through io_uring) so stop() can interrupt a blocking wait
+        int wake_fd;
+
+        // Destination of the io_uring read on wake_fd
+        uint64_t wake_value;
+
+        // timerfd that ends the wait when a delayed flush falls due (-1 without a flush delay)
+        int flush_timer_fd;
+
+        // Destination of the io_uring read on flush_timer_fd
+        uint64_t flush_timer_value;
+
+        // Time the flush timer is armed for (0 = not armed)
+        uint64_t flush_timer_deadline;
+
+        // timerfd ticking at the timing wheel's resolution while heartbeats or timeouts are configured
+        // (-1 otherwise)
+        int timeout_timer_fd;
+
+        // Destination of the io_uring read on timeout_timer_fd
+        uint64_t timeout_timer_value;
+
+        // Next heartbeat or timeout check of every connection
+        TimingWheel timers;
+
+        // Start of the current event loop iteration (Metrics::now()), used to stamp flush deadlines
+        uint64_t loop_time;
+
+        // Set when the listening socket's backlog may hold connections not accepted yet
+        bool accept_pending;
+
+        // Thread-safe flag controlling the event loop; starts out set, so a stop() that comes before
+        // the shard's thread reached run() is not lost
+        std::atomic<bool> running;
+
+        // Connection objects indexed by their socket file descriptor
+        // File descriptors are small dense integers, so a vector gives O(1) lookup
+        std::vector<std::unique_ptr<Connection>> connections;
+
+        // Closed Connection objects kept for reuse, so connection churn does not hit the allocator
+        std::vector<std::unique_ptr<Connection>> spare_connections;
+
+        // Dense list of this shard's live connections
+        std::vector<Connection*> clients;
+
+        // Client id -> connection for the clients of this shard, used to route direct messages
+        std::unordered_map<uint32_t, Connection*> clients_by_id;
+
+        // Room memberships of this shard's clients; a room message only visits that room's members
+        RoomIndex<Connection> rooms;
+
+        // Inflated payload of the compressed frame being handled
+        std::string inflated;
+
+        // Messages posted by other shards, drained by this reactor's thread
+        MpscQueue<ShardMessage> inbox;
+
+        // Server ends of in-process connections handed over by connect_local(), registered on wake-up
+        MpscQueue<std::unique_ptr<LocalEndpoint>> local_inbox;
+
+        // Set while a wake-up is already pending so concurrent posters skip redundant eventfd writes
+        std::atomic<bool> wake_pending;
+
+        // Connections with newly queued output, flushed once per event loop iteration
+        std::vector<Connection*> flush_connections;
+
+        // Connections that failed or hung up and must be closed at the end of the iteration
+        std::vector<Connection*> closing_connections;
+
+        /**
+         * Accepts pending connections on the listening socket, at most kAcceptBatch per call
+         * Edge-triggered epoll only reports new readiness once, so accept() runs until EAGAIN or
+         * the batch is full, in which case accept_pending makes the next iteration continue
+         */
+        void accept_connections();
+
+        /**
+         * Applies admission control to a newly accepted client, rejecting it if needed
+         * @param socket Accepted client socket (closed if the client is rejected)
+         * @param address Client IPv4 address in network byte order
+         * @return true if the client should be served
+         */
+        bool admit_connection(int socket, uint32_t address);
+
+        /**
+         * Creates the state for a client and registers it with the routing tables
+         * @param socket Accepted client socket
+         * @param client_id Id the client kept from a previous server process, or 0 to assign a new
+         *                  one; only new clients are placed in the default room
+         * @param local Server end of an in-process connection (socket is then its fd()), or nullptr
+         * @return The new connection
+         */
+        Connection& add_connection(int socket, uint32_t client_id = 0, std::unique_ptr<LocalEndpoint> local = nullptr);
+
+        /**
+         * Reads everything currently available from a client and handles each complete frame
+         * @param connection Client whose socket became readable
+         */
+        void handle_readable(Connection& connection);
+
+        /**
+         * Handles every complete frame in a client's receive ring
+         * @param connection Client that received data
+         */
+        void process_input(Connection& connection);
+
+        /**
+         * Acts on one frame received from a client
+         * @param connection Client that sent the frame
+         * @param frame Parsed frame (payload still inside the connection's receive ring)
+         * @param received_at Time the frame was read (Metrics::now()), used to time its fan-out
+         */
+        void handle_frame(Connection& connection, const Frame& frame, uint64_t received_at);
+
+        /**
+         * Writes as much of a client's queued frames as the socket accepts
+         * @param connection Client whose socket became writable
+         */
+        void handle_writable(Connection& connection);
+
+        /**
+         * Starts replaying a room's logged messages to a client
+         * @param connection Client that asked for the history
+         * @param room Room whose log is replayed
+         * @param since Last sequence number the client has already seen
+         */
+        void start_history(Connection& connection, std::string_view room, uint64_t since);
+
+        /**
+         * Moves the next chunks of a client's history replay into its write queue
+         * Queues the end marker and finishes the replay once the log range is exhausted
+         * @param connection Client with a replay in progress (does nothing otherwise)
+         */
+        void pump_history(Connection& connection);
+
+        /**
+         * Queues a frame for every member of a room except the sender
+         * Delivers directly to this shard's members and posts the same buffer to every other shard,
+         * along with its compressed form if one was made for this shard's members
+         * @param room Destination room
+         * @param message Encoded frame, shared by every recipient
+         * @param sender Connection the message came from (excluded from delivery)
+         */
+        void deliver_to_room(std::string_view room, const MessageRef& message, const Connection& sender);
+
+        /**
+         * Queues a frame for this shard's members of a room
+         * @param room Destination room
+         * @param message Encoded frame, shared by every recipient
+         * @param compressed Compressed form of message for members that negotiated compression;
+         *                   if empty it is made on first use and left here for the caller to pass on
+         * @param sender Connection to skip, or nullptr to deliver to every member
+         */
+        void deliver_local(std::string_view room, const MessageRef& message, MessageRef& compressed,
+                           const Connection* sender);
+
+        /**
+         * Queues a frame for a single client on whichever shard owns it
+         * If the recipient is not connected and the frame is a Direct message, the sender is told so
+         * @param recipient_id Id of the client to deliver to
+         * @param message Encoded frame
+         */
+        void deliver_direct(uint32_t recipient_id, const MessageRef& message);
+
+        /**
+         * Sends a server-generated Notice frame to one client of this shard
+         * @param connection Client to inform
+         * @param text Notice text
+         */
+        void send_notice(Connection& connection, std::string_view text);
+
+        /**
+         * Delivers every message other shards have posted to this reactor's inbox, and starts
+         * serving the in-process connections handed to connect_local()
+         */
+        void drain_inbox();
+
+        /**
+         * Wakes the event loop if it is blocked in epoll_wait()
+         */
+        void wake();
+
+        /**
+         * Adds a frame to a client's write queue, applying the overflow policy if it is full
+         * @param connection Client that should receive the frame
+         * @param message Encoded frame to send
+         * @return false if the frame was dropped or the client is being disconnected
+         */
+        bool push_output(Connection& connection, const MessageRef& message);
+
+        /**
+         * Adds a frame to a client's write queue and schedules the queue to be flushed
+         * A client whose queue is already full is disconnected
+         * @param connection Client that should receive the frame
+         * @param message Encoded frame to send
+         */
+        void queue_output(Connection& connection, const MessageRef& message);
+
+        /**
+         * Adds a connection to the list of queues flushed at the end of this iteration
+         * @param connection Client with new output
+         */
+        void schedule_flush(Connection& connection);
+
+        /**
+         * Flushes every write queue that received output during this iteration
+         * Each client gets at most one gathering write per iteration, however many frames it was sent
+         * With a flush delay, queues below config.flush_bytes stay scheduled until their deadline
+         */
+        void flush_scheduled();
+
+        /**
+         * Makes sure the flush timer fires no later than the given time
+         * @param deadline Steady clock time in nanoseconds
+         */
+        void arm_flush_timer(uint64_t deadline);
+
+        /**
+         * Sends a heartbeat or closes a connection whose timeout ran out, then reschedules its timer
+         * for the earliest time one of its heartbeat or timeout checks can fall due
+         * Called when the connection's timer fires, and when a connection is added to start its timer
+         * @param connection Client to check
+         */
+        void check_timeouts(Connection& connection);
+
+        /**
+         * Marks a connection to be closed at the end of the current event loop iteration
+         * @param connection Client to close
+         */
+        void schedule_close(Connection& connection);
+
+        /**
+         * Closes every connection previously passed to schedule_close()
+         */
+        void close_scheduled();
+
+        /**
+         * Removes a client from the routing tables, then closes its socket and frees its state
+         * With io_uring the release waits until the kernel has returned every operation on it
+         * @param socket File descriptor of the client to close
+         */
+        void close_connection(int socket);
+
+        /**
+         * Closes a client socket and frees its Connection, or keeps it as a spare for the next client
+         * @param socket File descriptor of the client
+         */
+        void release_connection(int socket);
+
+        /**
+         * Event loop used with IoBackend::Uring
+         */
+        void run_uring();
+
+        /**
+         * Dispatches one io_uring completion to the operation it belongs to
+         * @param completion Completion queue entry
+         */
+        void handle_completion(const struct io_uring_cqe& completion);
+
+        /**
+         * Handles data (or the end of the stream) delivered by a client's multishot receive
+         * @param connection Client the receive belongs to
+         * @param completion Completion queue entry
+         */
+        void handle_receive(Connection& connection, const struct io_uring_cqe& completion);
+
+        /**
+         * Settles a finished sendmsg and submits the next one if more output is queued
+         * @param connection Client the send belongs to
+         * @param completion Completion queue entry
+         */
+        void handle_send(Connection& connection, const struct io_uring_cqe& completion);
+
+        /**
+         * Drops one io_uring reference to a connection, freeing it when the last one is gone
+         * @param connection Client whose operation finished
+         */
+        void release_io_reference(Connection& connection);
+
+        /**
+         * Arms the multishot accept on the listening socket
+         */
+        void submit_accept();
+
+        /**
+         * Arms a multishot receive for a client, using the provided buffer ring
+         * @param connection Client to receive from
+         */
+        void submit_receive(Connection& connection);
+
+        /**
+         * Queues a read of wake_fd so stop() and post() can interrupt the wait for completions
+         */
+        void submit_wake();
+
+        /**
+         * Queues a read of flush_timer_fd so a due flush ends the wait for completions
+         */
+        void submit_flush_timer();
+
+        /**
+         * Queues a read of timeout_timer_fd so the timing wheel advances while the loop is idle
+         */
+        void submit_timeout_timer();
+
+        /**
+         * Queues one gathering sendmsg of a client's pending frames unless one is already in flight
+         * @param connection Client with queued output
+         */
+        void submit_send(Connection& connection);
+
+    public:
+        /**
+         * Creates the epoll instance (or io_uring instance) and registers the listening socket
+         * @param listen_socket Bound socket this reactor accepts connections from
+         * @param index Shard number of this reactor within context.shards
+         * @param context State shared by all reactors of the server
+         */
+        Reactor(int listen_socket, size_t index, ServerContext& context);
+
+        /**
+         * Closes all remaining client connections and the epoll resources
+         */
+        ~Reactor();
+
+        /**
+         * Runs the event loop on the calling thread until stop() is called
+         * Returns right away if stop() was already called
+         */
+        void run();
+
+        /**
+         * Asks the event loop to exit
+         * Safe to call from any thread
+         */
+        void stop();
+
+        /**
+         * Hands a message to this reactor for delivery to its room members or to one of its clients
+         * Lock-free and safe to call from any thread
+         * @param message Message posted by another shard
+         */
+        void post(ShardMessage message);
+
+        /**
+         * Hands the server end of an in-process connection to this reactor, which serves it like an
+         * accepted client from its next iteration on (epoll backend only)
+         * Lock-free and safe to call from any thread
+         * @param endpoint Server end of the connection
+         */
+        void connect_local(std::unique_ptr<LocalEndpoint> endpoint);
+
+        /**
+         * Moves every live client into a handoff state, leaving the sockets open
+         * Delivers whatever other shards posted first, so no message is lost in an inbox.
+         * In-process clients cannot follow into another process; they are closed with the reactor.
+         * Must be called after run() has returned on every shard; the reactor only releases its
+         * own descriptors of the sockets when it is destroyed.
+         * @param state Receives one entry per client of this shard
+         */
+        void export_connections(HandoffState& state);
+
+        /**
+         * Takes over the clients a previous server process served on this shard
+         * Must be called before run(); entries adopted here get their socket set to -1
+         * @param handed_over Connections received from the previous process (entries of other
+         *                    shards are left alone)
+         */
+        void adopt_connections(std::vector<HandoffConnection>& handed_over);
+};
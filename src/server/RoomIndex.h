@@ -0,0 +1,214 @@
+// Subscription index mapping chat rooms to their members and members back to their rooms
+// Lets the server deliver a room message to exactly that room's members
+
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * Entry of a member's reverse index: a room it belongs to and its position in that room's list
+ * Knowing the position makes leaving a room O(1) instead of a scan over all members
+ */
+struct RoomMembership {
+    uint32_t room;
+    uint32_t position;
+};
+
+/**
+ * Two-way room index built only from flat vectors
+ *   - rooms:    room id -> name and contiguous member array (iterated on every delivery)
+ *   - by_name:  sorted (name, room id) pairs, binary searched on lookup
+ *   - member.rooms: the reverse index, a short vector of RoomMembership stored in the member itself
+ * Not thread-safe; each reactor owns its own index and threaded mode guards it with clients_mutex.
+ * @tparam Member Connection type; must have a std::vector<RoomMembership> rooms field
+ */
+template <typename Member>
+class RoomIndex {
+    private:
+        struct Room {
+            std::string name;
+            std::vector<Member*> members;
+        };
+
+        // Rooms by id; ids of removed rooms are recycled through free_ids
+        std::vector<Room> rooms;
+        std::vector<uint32_t> free_ids;
+
+        // (name, id) pairs sorted by name
+        std::vector<std::pair<std::string, uint32_t>> by_name;
+
+        // Told when a room gains its first or loses its last member (may be empty)
+        std::function<void(std::string_view name, bool occupied)> observer;
+
+        typename std::vector<std::pair<std::string, uint32_t>>::iterator lookup(std::string_view name) {
+            return std::lower_bound(by_name.begin(), by_name.end(), name,
+                [](const std::pair<std::string, uint32_t>& entry, std::string_view key) {
+                    return std::string_view(entry.first) < key;
+                });
+        }
+
+        typename std::vector<std::pair<std::string, uint32_t>>::const_iterator lookup(std::string_view name) const {
+            return std::lower_bound(by_name.begin(), by_name.end(), name,
+                [](const std::pair<std::string, uint32_t>& entry, std::string_view key) {
+                    return std::string_view(entry.first) < key;
+                });
+        }
+
+        /**
+         * Removes a member from one room via its reverse index entry
+         * The last member is swapped into the freed position and its own entry is patched
+         * @param member Member to remove
+         * @param entry Index into member.rooms of the membership to drop
+         */
+        void remove_membership(Member& member, size_t entry) {
+            RoomMembership membership = member.rooms[entry];
+            Room& room = rooms[membership.room];
+
+            Member* last = room.members.back();
+            room.members[membership.position] = last;
+            room.members.pop_back();
+            if (last != &member) {
+                for (RoomMembership& other : last->rooms) {
+                    if (other.room == membership.room) {
+                        other.position = membership.position;
+                        break;
+                    }
+                }
+            }
+
+            member.rooms[entry] = member.rooms.back();
+            member.rooms.pop_back();
+
+            // Empty rooms are forgotten so the index only holds rooms that have members
+            if (room.members.empty()) {
+                if (observer) {
+                    observer(room.name, false);
+                }
+                by_name.erase(lookup(room.name));
+                room.name.clear();
+                free_ids.push_back(membership.room);
+            }
+        }
+
+    public:
+        /**
+         * Sets the callback told whenever a room is created by its first join or removed when its
+         * last member leaves; it runs on whichever thread changes the index
+         * @param callback Receives the room name and whether the room now has members
+         */
+        void set_observer(std::function<void(std::string_view name, bool occupied)> callback) {
+            observer = std::move(callback);
+        }
+
+        /**
+         * Name of a room a member belongs to
+         * @param room Room id from one of the member's RoomMembership entries
+         */
+        std::string_view name(uint32_t room) const {
+            return rooms[room].name;
+        }
+
+        /**
+         * Looks up the members of a room
+         * @param name Room name
+         * @return Member array, or nullptr if nobody is in the room
+         */
+        const std::vector<Member*>* members(std::string_view name) const {
+            auto it = lookup(name);
+            if (it == by_name.end() || it->first != name) {
+                return nullptr;
+            }
+            return &rooms[it->second].members;
+        }
+
+        /**
+         * Adds a member to a room, creating the room on first join
+         * @param member Member joining
+         * @param name Room name
+         * @return false if the member was already in the room
+         */
+        bool join(Member& member, std::string_view name) {
+            auto it = lookup(name);
+            uint32_t id;
+            if (it != by_name.end() && it->first == name) {
+                id = it->second;
+                for (const RoomMembership& membership : member.rooms) {
+                    if (membership.room == id) {
+                        return false;
+                    }
+                }
+            } else {
+                if (!free_ids.empty()) {
+                    id = free_ids.back();
+                    free_ids.pop_back();
+                } else {
+                    id = static_cast<uint32_t>(rooms.size());
+                    rooms.emplace_back();
+                }
+                rooms[id].name.assign(name);
+                by_name.insert(it, std::make_pair(std::string(name), id));
+                if (observer) {
+                    observer(name, true);
+                }
+            }
+
+            Room& room = rooms[id];
+            member.rooms.push_back(RoomMembership{id, static_cast<uint32_t>(room.members.size())});
+            room.members.push_back(&member);
+            return true;
+        }
+
+        /**
+         * Removes a member from a room
+         * @param member Member leaving
+         * @param name Room name
+         * @return false if the member was not in the room
+         */
+        bool leave(Member& member, std::string_view name) {
+            auto it = lookup(name);
+            if (it == by_name.end() || it->first != name) {
+                return false;
+            }
+            for (size_t i = 0; i < member.rooms.size(); ++i) {
+                if (member.rooms[i].room == it->second) {
+                    remove_membership(member, i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Checks whether a member belongs to a room
+         * @param member Member to check
+         * @param name Room name
+         * @return true if the member is in the room
+         */
+        bool contains(const Member& member, std::string_view name) const {
+            auto it = lookup(name);
+            if (it == by_name.end() || it->first != name) {
+                return false;
+            }
+            for (const RoomMembership& membership : member.rooms) {
+                if (membership.room == it->second) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Removes a member from every room it joined (used when it disconnects)
+         * @param member Member leaving
+         */
+        void leave_all(Member& member) {
+            while (!member.rooms.empty()) {
+                remove_membership(member, member.rooms.size() - 1);
+            }
+        }
+};
@@ -1,31 +1,200 @@
 // Server implementation
 
 #include "Server.h"
+#include "Reactor.h"
+#include "IoUring.h"
+#include "AdminServer.h"
+#include "common/Protocol.h"
+#include "common/Compression.h"
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
 #include <unistd.h>
 #include <cstring>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <cerrno>
+
+namespace {
+    // How often a threaded client's thread re-checks its write queue while waiting for input
+    constexpr int kThreadedPollTimeoutMs = 100;
+
+    // Maximum iovecs handed to a single sendmsg() call when flushing a threaded client
+    constexpr int kMaxFlushSegments = 64;
+
+    /**
+     * Creates a TCP socket bound to the given port on every local interface
+     * @param port Port number to bind to
+     * @param reuse_port Whether to set SO_REUSEPORT so several sockets can share the port
+     * @return File descriptor of the bound (not yet listening) socket
+     */
+    int open_listen_socket(int port, bool reuse_port) {
+        // Create a TCP socket using IPv4 (AF_INET) and stream protocol (SOCK_STREAM)
+        int listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_socket < 0) {
+            throw std::runtime_error("Failed to create server socket");
+        }
+
+        // Allow rebinding while connections from a previous run are still in TIME_WAIT
+        int enable_reuse = 1;
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable_reuse, sizeof(enable_reuse));
+
+        if (reuse_port) {
+            int enable = 1;
+            if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+                close(listen_socket);
+                throw std::runtime_error("Failed to enable SO_REUSEPORT");
+            }
+        }
+
+        // Configure the server address structure
+        struct sockaddr_in server_address;
+        server_address.sin_family = AF_INET;        // Use IPv4
+        server_address.sin_addr.s_addr = INADDR_ANY; // Accept connections from any IP address
+        server_address.sin_port = htons(port);       // Convert port to network byte order
+
+        // Bind the socket to the specified address and port
+        // This reserves the port for this server application
+        if (bind(listen_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
+            close(listen_socket);
+            throw std::runtime_error("Failed to bind server socket");
+        }
+        return listen_socket;
+    }
+
+    // Default settings with only the port changed
+    ServerConfig default_config(int port) {
+        ServerConfig config{};
+        config.port = port;
+        return config;
+    }
+}
+
+/**
+ * Constructor: Uses the default configuration with the given port
+ */
+Server::Server(int port) : Server(default_config(port)) {}
 
 /**
  * Constructor: Creates and configures the server socket
- * Sets up the socket for TCP communication and binds it to the specified port
+ * Sets up the socket for TCP communication and binds it to the configured port
+ * In the event loop modes this also creates the reactor(s) that will serve clients
+ */
+Server::Server(const ServerConfig& config)
+    : server_socket(-1), mode(config.mode), running(false), live_threads(0), next_client_id(1), next_local_shard(0) {
+    context.config = config;
+    context.admission = std::make_unique<AdmissionControl>(config);
+
+    // A server still running on the handoff socket passes its sockets over before anything here
+    // binds, since it only releases its admin and federation ports to do so
+    HandoffState inherited;
+    if (!config.handoff_path.empty()) {
+        if (mode == ServerMode::Threaded || config.io_backend == IoBackend::Uring) {
+            throw std::runtime_error("Socket handoff needs the epoll or sharded mode with the epoll backend");
+        }
+        if (receive_handoff(config.handoff_path, inherited)) {
+            // One listening socket per shard of the previous server; its clients' ids name those shards
+            mode = inherited.listen_sockets.size() > 1 ? ServerMode::Sharded : ServerMode::Epoll;
+            context.config.mode = mode;
+            std::cout << "Took over " << inherited.connections.size() << " connections from the previous server"
+                      << std::endl;
+        }
+    }
+
+    // Sharded reactors each bind their own socket to the same port, which requires SO_REUSEPORT
+    bool sharded = mode == ServerMode::Sharded;
+    bool took_over = !inherited.listen_sockets.empty();
+    if (took_over) {
+        listen_sockets = std::move(inherited.listen_sockets);
+        inherited.listen_sockets.clear();
+        server_socket = listen_sockets[0];
+    } else {
+        server_socket = open_listen_socket(config.port, sharded);
+    }
+
+    // The destructor does not run when a constructor throws, so the listening sockets (and the
+    // inherited clients) are closed here instead; a failed takeover must not keep the ports bound
+    try {
+        set_up(inherited, took_over);
+    } catch (...) {
+        context.shards.clear();
+        close_listen_sockets();
+        inherited.close_sockets();
+        throw;
+    }
+}
+
+/**
+ * Everything after the listening sockets: log, admin endpoint, federation and the event loops
  */
-Server::Server(int port) : running(false) {
-    // Create a TCP socket using IPv4 (AF_INET) and stream protocol (SOCK_STREAM)
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        throw std::runtime_error("Failed to create server socket");
+void Server::set_up(HandoffState& inherited, bool took_over) {
+    const ServerConfig& config = context.config;
+    bool sharded = mode == ServerMode::Sharded;
+    if (!config.log_directory.empty()) {
+        // Continue numbering after the logged messages so a replay never mixes up two runs
+        context.log = std::make_unique<MessageLog>(config.log_directory, config.log_sync_ms);
+        context.next_sequence = context.log->last_sequence() + 1;
+    }
+    context.next_sequence = std::max(context.next_sequence.load(), inherited.next_sequence);
+    if (config.admin_port != 0) {
+        admin = std::make_unique<AdminServer>(config.admin_port, [this] {
+            return context.metrics->render(context.overload);
+        });
+    }
+    if (config.federation_port != 0) {
+        context.federation = std::make_unique<Federation>(config, [this](std::string_view room, const MessageRef& frame) {
+            deliver_relayed(room, frame);
+        });
+        rooms.set_observer(context.room_observer());
+    }
+    if (mode == ServerMode::Threaded) {
+        // Every client thread reports to the same slot
+        context.metrics = std::make_unique<Metrics>(1);
+        return;
+    }
+
+    // io_uring is an optimization; kernels without the needed features simply keep using epoll
+    if (context.config.io_backend == IoBackend::Uring && !IoUring::supported()) {
+        std::cerr << "io_uring is not available, falling back to epoll" << std::endl;
+        context.config.io_backend = IoBackend::Epoll;
+    }
+
+    size_t shard_count = 1;
+    if (took_over) {
+        shard_count = listen_sockets.size();
+    } else if (sharded) {
+        shard_count = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+        if (shard_count > kMaxShards) {
+            std::cerr << "Client ids can only name " << kMaxShards << " shards, using that many" << std::endl;
+            shard_count = kMaxShards;
+        }
+    }
+
+    // Shard 0 uses server_socket; every additional shard gets its own SO_REUSEPORT socket
+    // so the kernel load-balances incoming connections across the reactor threads
+    if (!took_over) {
+        listen_sockets.push_back(server_socket);
+        for (size_t i = 1; i < shard_count; ++i) {
+            listen_sockets.push_back(open_listen_socket(config.port, true));
+        }
+    }
+
+    // The event loops are created up front so stop() can always reach them from another thread
+    context.metrics = std::make_unique<Metrics>(listen_sockets.size());
+    for (size_t i = 0; i < listen_sockets.size(); ++i) {
+        context.shards.push_back(std::make_unique<Reactor>(listen_sockets[i], i, context));
     }
 
-    // Configure the server address structure
-    struct sockaddr_in server_address;
-    server_address.sin_family = AF_INET;        // Use IPv4
-    server_address.sin_addr.s_addr = INADDR_ANY; // Accept connections from any IP address
-    server_address.sin_port = htons(port);       // Convert port to network byte order
+    // Every shard takes back the clients it served before; anything left over is closed
+    for (auto& reactor : context.shards) {
+        reactor->adopt_connections(inherited.connections);
+    }
+    inherited.close_sockets();
 
-    // Bind the socket to the specified address and port
-    // This reserves the port for this server application
-    if (bind(server_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
-        throw std::runtime_error("Failed to bind server socket");
+    if (!config.handoff_path.empty()) {
+        handoff = std::make_unique<HandoffListener>(config.handoff_path, [this] { stop(); });
     }
 }
 
@@ -34,28 +203,117 @@ Server::Server(int port) : running(false) {
  */
 Server::~Server() {
     stop(); // Stop the server and close all client connections
-    // Close the server socket file descriptor to free up system resources
-    close(server_socket);
+    context.shards.clear(); // Release the event loops before the listening sockets they watch
+    close_listen_sockets();
 }
 
 /**
- * Main server loop: Starts accepting client connections
- * Creates a new thread for each client to handle concurrent communication
+ * Close the listening socket file descriptors to free up system resources
+ */
+void Server::close_listen_sockets() {
+    for (size_t i = 1; i < listen_sockets.size(); ++i) {
+        close(listen_sockets[i]);
+    }
+    listen_sockets.clear();
+    if (server_socket >= 0) {
+        close(server_socket);
+        server_socket = -1;
+    }
+}
+
+/**
+ * Main server entry point: Starts accepting client connections
+ * Dispatches to the threaded accept loop or the epoll event loop(s)
  */
 void Server::start() {
     running = true; // Set the server to running state
     
-    // Listen for incoming connections, allowing up to 5 pending connections in the queue
-    // This means up to 5 clients can be waiting to connect while the server is busy
-    listen(server_socket, 5);
+    // Listen for incoming connections; a long queue rides out reconnect storms, since clients
+    // whose SYN finds the queue full only retry after a growing timeout
+    int backlog = context.config.listen_backlog;
+    listen(server_socket, backlog);
+    for (size_t i = 1; i < listen_sockets.size(); ++i) {
+        listen(listen_sockets[i], backlog);
+    }
 
     std::cout << "Server started, waiting for connections..." << std::endl;
+    if (admin) {
+        admin->start();
+        std::cout << "Metrics available at http://127.0.0.1:" << context.config.admin_port << "/metrics" << std::endl;
+    }
+    if (context.federation) {
+        context.federation->start();
+        std::cout << "Federation node " << context.config.node_id << " listening on port "
+                  << context.config.federation_port << std::endl;
+    }
 
+    if (mode == ServerMode::Threaded) {
+        run_threaded();
+        return;
+    }
+    if (handoff) {
+        handoff->start();
+        std::cout << "Handoff socket at " << context.config.handoff_path
+                  << " (start the next server with the same path to take over)" << std::endl;
+    }
+
+    // Shards 1..N-1 get their own threads; shard 0 runs on the calling thread
+    // In epoll mode there is only shard 0, so every client is served from this thread
+    std::vector<std::thread> shard_threads;
+    for (size_t i = 1; i < context.shards.size(); ++i) {
+        shard_threads.emplace_back(&Reactor::run, context.shards[i].get());
+    }
+    context.shards[0]->run(); // Returns once stop() is called
+    for (auto& thread : shard_threads) {
+        thread.join();
+    }
+
+    if (handoff) {
+        int successor = handoff->take_successor();
+        handoff.reset(); // Frees the path for the successor's own handoff socket
+        if (successor >= 0) {
+            hand_over(successor);
+        }
+    }
+}
+
+/**
+ * Client sockets are passed with their rooms, unparsed input and unsent output; this process's
+ * descriptors are closed when the reactors are destroyed, which leaves the connections open
+ */
+void Server::hand_over(int successor) {
+    admin.reset();
+    context.federation.reset();
+
+    HandoffState state;
+    for (auto& reactor : context.shards) {
+        reactor->export_connections(state);
+    }
+    // Destroying the log writes and syncs what is still queued, so the successor reads all of it
+    context.log.reset();
+    state.next_sequence = context.next_sequence.load();
+    state.listen_sockets = listen_sockets;
+
+    if (send_handoff(successor, state)) {
+        std::cout << "Handed " << state.connections.size() << " connections over to the new server" << std::endl;
+    } else {
+        std::cerr << "Handoff failed; the clients of this server are disconnected" << std::endl;
+    }
+    close(successor);
+}
+
+/**
+ * Threaded accept loop: the original connection handling strategy
+ * Creates a new thread for each client to handle concurrent communication
+ */
+void Server::run_threaded() {
     // Main server loop: continuously accept new client connections
     while (running) {
         // Accept a new client connection (this call blocks until a client connects)
         // Returns a new socket file descriptor specifically for this client
-        int client_socket = accept(server_socket, nullptr, nullptr);
+        struct sockaddr_in address{};
+        socklen_t address_length = sizeof(address);
+        int client_socket = accept(server_socket, (struct sockaddr*)&address, &address_length);
         
         if (client_socket < 0) {
             // Only report error if server is still supposed to be running
@@ -65,15 +323,42 @@ void Server::start() {
             continue; // Skip to next iteration and try to accept another connection
         }
 
+        // Turn the client away before a thread is spent on it
+        Admission admission = context.admission->admit(address.sin_addr.s_addr);
+        if (admission != Admission::Accepted) {
+            ShardMetrics& metrics = context.metrics->shard(0);
+            ShardMetrics::add(admission == Admission::Full ? metrics.connections_rejected_full
+                                                           : metrics.connections_rejected_rate, 1);
+            reject_connection(client_socket, admission);
+            continue;
+        }
+
+        // Frames are written whole, so waiting for more data (Nagle's algorithm) would only add latency
+        int enable = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
         // Thread-safe addition of new client to the client list
+        // Every client starts out in the default room
+        auto client = std::make_shared<ThreadedClient>(client_socket, next_client_id++, context.config,
+                                                       &context.metrics->shard(0));
         {
             std::lock_guard<std::mutex> lock(clients_mutex);
-            client_sockets.push_back(client_socket);
+            // stop() may already have shut down the clients it knew about; this one would be missed
+            // It is not counted as accepted, so it needs no matching close either
+            if (!running) {
+                close(client_socket);
+                context.admission->release();
+                break;
+            }
+            ShardMetrics::add(context.metrics->shard(0).connections_accepted, 1);
+            clients.push_back(client);
+            rooms.join(*client, kDefaultRoom);
+            ++live_threads;
         }
 
         // Create a new thread to handle this specific client
-        // detach() allows the thread to run independently without needing to be joined
-        std::thread client_thread(&Server::handle_client, this, client_socket);
+        // detach() allows the thread to run independently; stop() waits for it through live_threads
+        std::thread client_thread(&Server::handle_client, this, client);
         client_thread.detach();
     }
 }
@@ -84,73 +369,508 @@ void Server::start() {
  */
 void Server::stop() {
     running = false; // Signal all threads to stop
+    if (admin) {
+        admin->stop();
+    }
+    // Relays stop arriving before the clients they would be delivered to go away
+    if (context.federation) {
+        context.federation->stop();
+    }
+
+    // Wake the threaded accept loop, which would otherwise stay blocked in accept()
+    if (mode == ServerMode::Threaded) {
+        shutdown(server_socket, SHUT_RDWR);
+    }
+
+    // In the event loop modes each reactor owns its clients' sockets and closes them on exit
+    for (auto& reactor : context.shards) {
+        reactor->stop();
+    }
     
     // Thread-safe cleanup of all client connections
     {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        // Close all client sockets to disconnect clients gracefully
-        for (int socket : client_sockets) {
-            close(socket);
+        std::unique_lock<std::mutex> lock(clients_mutex);
+        // Shut down all client sockets to disconnect clients gracefully
+        // Each client's thread notices and closes its own socket
+        for (auto& client : clients) {
+            std::lock_guard<std::mutex> write_lock(client->write_mutex);
+            if (!client->closed) {
+                shutdown(client->socket, SHUT_RDWR);
+            }
         }
         // Clear the client list
-        client_sockets.clear();
+        clients.clear();
+        // The client threads use the context (metrics, admission, rooms), so it must outlive them
+        threads_done.wait(lock, [this] { return live_threads == 0; });
+    }
+}
+
+/**
+ * The shards take turns, as the kernel's SO_REUSEPORT balancing would do for TCP clients
+ */
+std::unique_ptr<LocalEndpoint> Server::connect_local() {
+    if (mode == ServerMode::Threaded || context.config.io_backend == IoBackend::Uring) {
+        throw std::runtime_error("In-process connections need the epoll or sharded mode with the epoll backend");
     }
+    auto endpoints = LocalEndpoint::create_pair();
+    size_t shard = next_local_shard.fetch_add(1, std::memory_order_relaxed) % context.shards.size();
+    context.shards[shard]->connect_local(std::move(endpoints.second));
+    return std::move(endpoints.first);
 }
 
 /**
  * Handles communication with a single client in a dedicated thread
- * Continuously receives messages from the client and broadcasts them to others
+ * Continuously receives frames from the client and routes them to rooms or recipients
  */
-void Server::handle_client(int client_socket) {
-    char buffer[1024]; // Buffer to store incoming messages (up to 1024 bytes)
-    
+void Server::handle_client(std::shared_ptr<ThreadedClient> client) {
+    // Incoming bytes accumulate in a ring buffer until they form complete frames
+    RingBuffer inbound(kReceiveBufferSize);
+    FrameParser parser;
+    std::string inflated;
+    bool valid = true;
+    ShardMetrics& metrics = context.metrics->shard(0);
+    Metrics::attach_thread(&metrics);
+
+    // Heartbeats and timeouts need no timer here: the poll timeout wakes this thread regularly anyway
+    const ServerConfig& config = context.config;
+    uint64_t last_received = Metrics::now();
+    uint64_t last_activity = last_received;
+    uint64_t last_ping = 0;
+
     // Keep handling messages while server is running
-    while (running) {
-        // Clear the buffer to ensure no leftover data from previous messages
-        memset(buffer, 0, sizeof(buffer));
-        
-        // Receive data from the client socket
-        // recv() blocks until data is available or connection is closed
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
-        
+    while (running && valid) {
+        // Wait for incoming data, and for writability while this client has frames left over
+        // from a write that would have blocked; the timeout picks up frames queued meanwhile
+        bool pending;
+        {
+            std::lock_guard<std::mutex> lock(client->write_mutex);
+            pending = !client->outbound.empty() || client->history;
+        }
+        struct pollfd poll_entry{};
+        poll_entry.fd = client->socket;
+        poll_entry.events = POLLIN | (pending ? POLLOUT : 0);
+        if (poll(&poll_entry, 1, kThreadedPollTimeoutMs) < 0 && errno != EINTR) {
+            break;
+        }
+        if (poll_entry.revents & POLLOUT) {
+            flush_client(*client);
+        }
+
+        uint64_t now = Metrics::now();
+        if (config.read_timeout_ms > 0 && now - last_received >= Metrics::milliseconds(config.read_timeout_ms)) {
+            ShardMetrics::add(metrics.timeouts_read, 1);
+            break;
+        }
+        if (config.idle_timeout_ms > 0 && now - last_activity >= Metrics::milliseconds(config.idle_timeout_ms)) {
+            ShardMetrics::add(metrics.timeouts_idle, 1);
+            send_notice(*client, "Disconnected after being idle for too long");
+            break;
+        }
+        if (config.write_timeout_ms > 0) {
+            std::lock_guard<std::mutex> lock(client->write_mutex);
+            if (!client->outbound.empty() &&
+                now - client->last_write_progress >= Metrics::milliseconds(config.write_timeout_ms)) {
+                ShardMetrics::add(metrics.timeouts_write, 1);
+                break;
+            }
+        }
+        if (config.heartbeat_ms > 0 &&
+            now - std::max(last_received, last_ping) >= Metrics::milliseconds(config.heartbeat_ms)) {
+            ShardMetrics::add(metrics.pings_sent, 1);
+            FrameHeader header;
+            header.type = MessageType::Ping;
+            queue_message(*client, encode_frame(header, "", 0));
+            last_ping = now;
+        }
+
+        if (!(poll_entry.revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        // Receive data directly into the free space of the ring buffer
+        struct iovec segments[2];
+        int segment_count = inbound.free_segments(segments);
+        ssize_t bytes_received = segment_count > 0 ? readv(client->socket, segments, segment_count) : -1;
+
         // Check if client disconnected or error occurred
         if (bytes_received <= 0) {
             break; // Exit the loop to clean up this client
         }
-        
-        // Broadcast the received message to all other connected clients
-        // Convert buffer to string using exact number of bytes received
-        broadcast_message(std::string(buffer, bytes_received), client_socket);
+        inbound.commit(bytes_received);
+        ShardMetrics::add(metrics.bytes_received, bytes_received);
+
+        // A single read may contain several frames, or only part of one
+        uint64_t received_at = Metrics::now();
+        last_received = received_at;
+        Frame frame;
+        Frame expanded;
+        ParseStatus status;
+        while ((status = parser.next(inbound, frame)) == ParseStatus::Ready) {
+            ShardMetrics::add(metrics.messages_received, 1);
+            if (!expand_frame(frame, inflated, expanded)) {
+                status = ParseStatus::Invalid;
+                break;
+            }
+            if (expanded.header.type != MessageType::Ping && expanded.header.type != MessageType::Pong) {
+                last_activity = received_at;
+            }
+            handle_frame(*client, expanded, received_at);
+            parser.release(inbound, frame);
+        }
+        valid = status != ParseStatus::Invalid; // Drop clients that violate the protocol
     }
 
     // Client disconnected or error occurred - clean up
     {
         std::lock_guard<std::mutex> lock(clients_mutex);
-        // Find and remove this client's socket from the active client list
-        auto it = std::find(client_sockets.begin(), client_sockets.end(), client_socket);
-        if (it != client_sockets.end()) {
-            client_sockets.erase(it);
+        // Find and remove this client from the active client list and from every room
+        rooms.leave_all(*client);
+        auto it = std::find(clients.begin(), clients.end(), client);
+        if (it != clients.end()) {
+            clients.erase(it);
         }
     }
 
     // Close the client socket to free up resources
-    close(client_socket);
+    // If another thread is writing to it right now, that thread closes it once its write returns
+    {
+        std::lock_guard<std::mutex> lock(client->write_mutex);
+        client->closed = true;
+        if (!client->flushing) {
+            close(client->socket);
+        }
+    }
+    ShardMetrics::add(metrics.connections_closed, 1);
+    context.admission->release();
+    Metrics::attach_thread(nullptr);
+
+    // Last use of the server: the client goes first, since its queue reports to the metrics
+    client.reset();
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    if (--live_threads == 0) {
+        threads_done.notify_all();
+    }
 }
 
 /**
- * Broadcasts a message to all connected clients except the sender
- * Ensures thread-safe access to the client list while sending messages
+ * Same routing rules as Reactor::handle_frame(): Join/Leave update the room index, chat frames are
+ * re-framed once with the sender's id and a server sequence number and sent to their room or recipient
  */
-void Server::broadcast_message(const std::string& message, int sender_socket) {
-    // Lock the client list to prevent modification during iteration
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    
-    // Send message to each connected client except the sender
-    for (int socket : client_sockets) {
-        if (socket != sender_socket) {
-            // Send the message to this client
-            // send() transmits the message data over the TCP connection
-            send(socket, message.c_str(), message.length(), 0);
+void Server::handle_frame(ThreadedClient& client, const Frame& frame, uint64_t received_at) {
+    char name[kMaxRoomNameLength];
+    size_t name_length = 0;
+    MessageType type = frame.header.type;
+
+    switch (type) {
+        case MessageType::Join:
+        case MessageType::Leave:
+            if (!frame.read_room_name(name, name_length)) {
+                send_notice(client, "Invalid room name");
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                if (type == MessageType::Join) {
+                    rooms.join(client, std::string_view(name, name_length));
+                } else {
+                    rooms.leave(client, std::string_view(name, name_length));
+                }
+            }
+            return;
+        case MessageType::RoomMessage:
+        case MessageType::Chat: {
+            if (type == MessageType::RoomMessage && !frame.read_room_name(name, name_length)) {
+                send_notice(client, "Invalid room name");
+                return;
+            }
+            std::string_view room = type == MessageType::Chat ? kDefaultRoom : std::string_view(name, name_length);
+            bool member;
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                member = rooms.contains(client, room);
+            }
+            if (!member) {
+                if (type == MessageType::RoomMessage) {
+                    send_notice(client, "Join " + std::string(room) + " before sending to it");
+                }
+                return;
+            }
+            break;
+        }
+        case MessageType::Direct:
+            if (frame.payload_size() < kDirectPrefixSize) {
+                return;
+            }
+            break;
+        case MessageType::Compression: {
+            char method = 0;
+            if (frame.payload_size() == 1) {
+                frame.read(0, &method, 1);
+            }
+            bool enabled = static_cast<CompressionMethod>(method) == CompressionMethod::Deflate &&
+                           compression_supported();
+            client.compress = enabled;
+            method = static_cast<char>(enabled ? CompressionMethod::Deflate : CompressionMethod::None);
+            FrameHeader header;
+            header.type = MessageType::Compression;
+            queue_message(client, encode_frame(header, &method, 1));
+            return;
+        }
+        case MessageType::History: {
+            char since[8];
+            if (!frame.read_room_name(name, name_length) || frame.payload_size() != 1 + name_length + sizeof(since)) {
+                send_notice(client, "Invalid history request");
+                return;
+            }
+            frame.read(1 + name_length, since, sizeof(since));
+            start_history(client, std::string_view(name, name_length), read_u64(since));
+            return;
+        }
+        case MessageType::Ping: {
+            FrameHeader header;
+            header.type = MessageType::Pong;
+            queue_message(client, encode_frame(header, frame.first, frame.first_length,
+                                               frame.second, frame.second_length));
+            return;
+        }
+        default:
+            return;
+    }
+
+    FrameHeader header;
+    header.type = type;
+    header.sender_id = client.id;
+    header.sequence = context.next_sequence.fetch_add(1, std::memory_order_relaxed);
+
+    MessageRef message = encode_frame(header, frame.first, frame.first_length,
+                                      frame.second, frame.second_length);
+    message.set_origin_time(received_at);
+    if (type == MessageType::Direct) {
+        char recipient[kDirectPrefixSize];
+        frame.read(0, recipient, kDirectPrefixSize);
+        deliver_direct(read_u32(recipient), message, client);
+    } else {
+        std::string_view room = type == MessageType::Chat ? kDefaultRoom : std::string_view(name, name_length);
+        if (context.log) {
+            context.log->append(message);
+        }
+        if (context.federation) {
+            context.federation->forward(room, message);
+        }
+        deliver_to_room(room, message, &client);
+    }
+}
+
+/**
+ * Relayed frames are not logged: they carry the origin node's sequence numbers, which the local
+ * log's sequence index must not mix with its own (the origin logs them itself)
+ */
+void Server::deliver_relayed(std::string_view room, const MessageRef& message) {
+    if (mode == ServerMode::Threaded) {
+        deliver_to_room(room, message, nullptr);
+        return;
+    }
+    // Every shard may have members of the room; each delivers to its own
+    ShardMessage shard_message{};
+    shard_message.payload = message;
+    for (auto& reactor : context.shards) {
+        reactor->post(shard_message);
+    }
+}
+
+/**
+ * Copies the room's member list under the lock, then queues and flushes without holding it
+ */
+void Server::deliver_to_room(std::string_view room, const MessageRef& message, const ThreadedClient* sender) {
+    // Take a snapshot of the members so no lock is held while sending
+    std::vector<std::shared_ptr<ThreadedClient>> recipients;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        const std::vector<ThreadedClient*>* members = rooms.members(room);
+        if (members == nullptr) {
+            return;
+        }
+        recipients.reserve(members->size());
+        for (ThreadedClient* member : *members) {
+            if (member != sender) {
+                recipients.push_back(member->shared_from_this());
+            }
+        }
+    }
+
+    // Recipients that negotiated compression share one compressed copy
+    MessageRef compressed;
+    for (auto& client : recipients) {
+        if (client->compress) {
+            if (!compressed) {
+                compressed = compress_frame(message);
+            }
+            queue_message(*client, compressed);
+        } else {
+            queue_message(*client, message);
+        }
+    }
+}
+
+/**
+ * Threaded mode is meant for small deployments, so the recipient is found with a scan of the client list
+ */
+void Server::deliver_direct(uint32_t recipient_id, const MessageRef& message, ThreadedClient& sender) {
+    std::shared_ptr<ThreadedClient> recipient;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        for (auto& client : clients) {
+            if (client->id == recipient_id) {
+                recipient = client;
+                break;
+            }
+        }
+    }
+
+    if (recipient) {
+        queue_message(*recipient, recipient->compress ? compress_frame(message) : message);
+    } else {
+        send_notice(sender, ServerContext::unreachable_notice(recipient_id));
+    }
+}
+
+/**
+ * Pushes the shared frame onto the client's queue under its write mutex, then writes it
+ */
+void Server::queue_message(ThreadedClient& client, const MessageRef& message) {
+    PushResult result;
+    size_t evicted;
+    bool overflowed = false;
+    {
+        std::lock_guard<std::mutex> lock(client.write_mutex);
+        if (client.outbound.empty()) {
+            client.last_write_progress = Metrics::now(); // The write timeout runs from here
         }
+        result = client.outbound.push(message, evicted);
+        if (result == PushResult::Overflow && !client.overflowed) {
+            client.overflowed = true;
+            overflowed = true;
+            if (!client.closed) {
+                // The client stopped reading long enough to fill its queue; its thread will clean up
+                // Only while the lock is held and the client open is the socket still this client's
+                shutdown(client.socket, SHUT_RDWR);
+            }
+        }
+    }
+    if (evicted > 0) {
+        context.overload.dropped_oldest.fetch_add(evicted, std::memory_order_relaxed);
+    }
+    if (result == PushResult::Dropped) {
+        context.overload.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
-}
\ No newline at end of file
+    if (result == PushResult::Overflow) {
+        if (overflowed) {
+            context.overload.disconnected.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    flush_client(client);
+}
+
+/**
+ * Notices come from the server itself, so their sender id and sequence number are 0
+ */
+void Server::send_notice(ThreadedClient& client, std::string_view text) {
+    FrameHeader header;
+    header.type = MessageType::Notice;
+    queue_message(client, encode_frame(header, text.data(), text.size()));
+}
+
+/**
+ * Same rules as Reactor::start_history(); the replay slot is guarded by write_mutex
+ */
+void Server::start_history(ThreadedClient& client, std::string_view room, uint64_t since) {
+    const char* refusal;
+    {
+        std::lock_guard<std::mutex> lock(client.write_mutex);
+        refusal = context.start_history(client.history, room, since);
+    }
+    if (refusal) {
+        send_notice(client, refusal);
+        return;
+    }
+    flush_client(client);
+}
+
+/**
+ * Same budget as Reactor::pump_history(), so history is never dropped and never evicts live frames
+ */
+void Server::pump_history(ThreadedClient& client) {
+    while (!client.closed) {
+        MessageRef chunk = context.next_history_chunk(client.history, client.outbound);
+        if (!chunk) {
+            break; // Resumes once the flush made room
+        }
+        size_t evicted = 0;
+        PushResult result = client.outbound.push(chunk, evicted);
+        if (evicted > 0) {
+            context.overload.dropped_oldest.fetch_add(evicted, std::memory_order_relaxed);
+        }
+        if (result == PushResult::Dropped) {
+            context.overload.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+        } else if (result == PushResult::Overflow) {
+            client.history.reset();
+            if (!client.overflowed) {
+                client.overflowed = true;
+                context.overload.disconnected.fetch_add(1, std::memory_order_relaxed);
+                if (!client.closed) {
+                    shutdown(client.socket, SHUT_RDWR); // Called with write_mutex held, as in queue_message()
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Flushes a client's queue with non-blocking gathering writes
+ * Only one thread writes to a client at a time; the mutex is released around every sendmsg()
+ * Frames stay alive while unlocked because only the flushing thread removes them from the queue
+ */
+void Server::flush_client(ThreadedClient& client) {
+    std::unique_lock<std::mutex> lock(client.write_mutex);
+    if (client.flushing || client.closed) {
+        return; // Another thread is writing and will also send the frames queued just now
+    }
+    client.flushing = true;
+
+    while (true) {
+        pump_history(client);
+        if (client.outbound.empty()) {
+            break;
+        }
+        struct iovec segments[kMaxFlushSegments];
+        struct msghdr message{};
+        message.msg_iov = segments;
+        message.msg_iovlen = client.outbound.gather(segments, kMaxFlushSegments);
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (message.msg_iovlen < client.outbound.size() ? MSG_MORE : 0);
+
+        lock.unlock();
+        ssize_t bytes_sent = sendmsg(client.socket, &message, flags);
+        lock.lock();
+
+        if (bytes_sent > 0) {
+            client.outbound.advance(bytes_sent);
+            client.last_write_progress = Metrics::now();
+            continue;
+        }
+        client.outbound.advance(0); // Unpin the frames the failed write described
+        if (bytes_sent < 0 && errno == EINTR) {
+            continue;
+        }
+        // Socket full (the client's thread retries once it is writable) or connection broken
+        // (the client's thread notices when reading)
+        break;
+    }
+    client.flushing = false;
+
+    // The client's thread exited while this write was in progress and left the socket to us
+    if (client.closed) {
+        close(client.socket);
+    }
+}
@@ -0,0 +1,284 @@
+// Structure for the server side of the chat application
+// This server handles multiple client connections concurrently using threads or an epoll event loop
+
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "common/Protocol.h"
+#include "common/LocalTransport.h"
+#include "ServerContext.h"
+#include "WriteQueue.h"
+#include "RoomIndex.h"
+#include "AdminServer.h"
+#include "Handoff.h"
+
+/**
+ * Server class that manages multiple client connections for a chat application
+ * Uses TCP sockets for reliable communication and multithreading for concurrent client handling
+ */
+class Server {
+    private:
+        /**
+         * State of one client in threaded mode
+         * Shared between the client's own thread and every thread sending to it
+         */
+        struct ThreadedClient : std::enable_shared_from_this<ThreadedClient> {
+            // Blocking socket connected to the client
+            int socket;
+
+            // Server-assigned id stamped as sender_id on every frame this client sends
+            uint32_t id;
+
+            // Rooms this client has joined on the server's RoomIndex (guarded by clients_mutex)
+            std::vector<RoomMembership> rooms;
+
+            // Protects outbound, flushing and closed (never held across a syscall that can block)
+            std::mutex write_mutex;
+
+            // Frames waiting to be written to this client
+            WriteQueue outbound;
+
+            // History replay in progress, fed into outbound as the client drains it (guarded by write_mutex)
+            std::unique_ptr<HistoryCursor> history;
+
+            // Whether the client negotiated compression (set by its own thread, read by senders)
+            std::atomic<bool> compress;
+
+            // Set while one thread is writing outbound; others only enqueue
+            bool flushing;
+
+            // Set once the client's thread has finished; whoever stops using the socket last closes it
+            bool closed;
+
+            // Set by the first push that overflowed outbound, which alone counts the disconnect
+            // (guarded by write_mutex; later pushes keep overflowing until the thread cleaned up)
+            bool overflowed;
+
+            // Time (Metrics::now()) outbound last got written further, or got its first frame after
+            // being empty (guarded by write_mutex)
+            uint64_t last_write_progress;
+
+            ThreadedClient(int socket, uint32_t id, const ServerConfig& config, ShardMetrics* metrics)
+                : socket(socket), id(id),
+                  outbound(config.max_queued_messages, config.max_queued_bytes, config.overflow_policy, metrics),
+                  compress(false), flushing(false), closed(false), overflowed(false), last_write_progress(0) {}
+        };
+
+        // Socket file descriptor for the server to listen for incoming connections
+        int server_socket;
+
+        // Connection handling strategy chosen at construction time
+        ServerMode mode;
+
+        // Listening sockets of the event loop modes, one per reactor (the first is server_socket)
+        std::vector<int> listen_sockets;
+
+        // State shared with the event loops; context.shards holds one reactor in ServerMode::Epoll,
+        // one per thread in ServerMode::Sharded and none in threaded mode
+        ServerContext context;
+        
+        // Thread-safe boolean flag to control server running state
+        // Atomic ensures thread-safe access without explicit locking
+        std::atomic<bool> running;
+        
+        // Vector storing all connected clients in threaded mode
+        // Each element represents an active client connection
+        std::vector<std::shared_ptr<ThreadedClient>> clients;
+        
+        // Room memberships of the threaded clients (guarded by clients_mutex)
+        RoomIndex<ThreadedClient> rooms;
+
+        // Mutex to protect concurrent access to the clients vector and the room index
+        // Prevents race conditions when multiple threads modify the client list
+        // Only held while the list is read or changed, never while sending
+        std::mutex clients_mutex;
+
+        // Client threads of threaded mode that have not finished yet (guarded by clients_mutex)
+        // They are detached but use the context, so stop() waits on threads_done until this is 0
+        size_t live_threads;
+        std::condition_variable threads_done;
+
+        // Next id handed out to a client in threaded mode (stamped as sender_id on its frames)
+        std::atomic<uint32_t> next_client_id;
+
+        // Counter spreading in-process connections over the shards round-robin
+        std::atomic<size_t> next_local_shard;
+
+        // Loopback HTTP endpoint serving the metrics (nullptr unless config.admin_port is set)
+        std::unique_ptr<AdminServer> admin;
+
+        // Unix socket a successor process asks for a takeover on (nullptr unless config.handoff_path is set)
+        std::unique_ptr<HandoffListener> handoff;
+
+        /**
+         * Handles communication with a single client in a dedicated thread
+         * Continuously listens for frames from the client and routes them
+         * @param client Client to handle (kept alive by this thread until it exits)
+         */
+        void handle_client(std::shared_ptr<ThreadedClient> client);
+        
+        /**
+         * Acts on one frame received from a threaded client
+         * @param client Client that sent the frame
+         * @param frame Parsed frame (payload still inside the client's receive ring)
+         * @param received_at Time the frame was read (Metrics::now()), used to time its fan-out
+         */
+        void handle_frame(ThreadedClient& client, const Frame& frame, uint64_t received_at);
+
+        /**
+         * Sends a message to every member of a room except the sender
+         * The frame is shared by every recipient's write queue; no lock is held while sending
+         * @param room Destination room
+         * @param message The encoded frame to deliver
+         * @param sender Client who sent the message (excluded from delivery)
+         */
+        void deliver_to_room(std::string_view room, const MessageRef& message, const ThreadedClient* sender);
+
+        /**
+         * Delivers a room frame relayed by another federation node to this node's members of the room
+         * Called on a federation link thread
+         * @param room Destination room
+         * @param message The frame as the origin node encoded it
+         */
+        void deliver_relayed(std::string_view room, const MessageRef& message);
+
+        /**
+         * Sends a message to one client, or tells the sender that the recipient is not online
+         * @param recipient_id Id of the client to deliver to
+         * @param message The encoded frame to deliver
+         * @param sender Client who sent the message
+         */
+        void deliver_direct(uint32_t recipient_id, const MessageRef& message, ThreadedClient& sender);
+
+        /**
+         * Queues a frame for one client, applies the overflow policy and starts writing it
+         * @param client Recipient
+         * @param message The encoded frame to send
+         */
+        void queue_message(ThreadedClient& client, const MessageRef& message);
+
+        /**
+         * Sends a server-generated Notice frame to one client
+         * @param client Client to inform
+         * @param text Notice text
+         */
+        void send_notice(ThreadedClient& client, std::string_view text);
+
+        /**
+         * Starts replaying a room's logged messages to a threaded client
+         * @param client Client that asked for the history
+         * @param room Room whose log is replayed
+         * @param since Last sequence number the client has already seen
+         */
+        void start_history(ThreadedClient& client, std::string_view room, uint64_t since);
+
+        /**
+         * Moves the next chunks of a client's history replay into its write queue
+         * Must be called with the client's write_mutex held
+         * @param client Client with a replay in progress (does nothing otherwise)
+         */
+        void pump_history(ThreadedClient& client);
+
+        /**
+         * Writes a threaded client's queued frames without blocking
+         * If another thread is already writing to this client the call returns immediately
+         * @param client Client whose queue should be flushed
+         */
+        void flush_client(ThreadedClient& client);
+
+        /**
+         * Second half of the constructor, once the listening sockets are open: creates the message
+         * log, admin endpoint, federation and event loops and gives the inherited clients back
+         * @param inherited State taken over from the previous server (empty without a handoff)
+         * @param took_over Whether listen_sockets came from the previous server
+         * @throws std::runtime_error if any part cannot be set up; the caller closes the sockets
+         */
+        void set_up(HandoffState& inherited, bool took_over);
+
+        /**
+         * Closes server_socket and the other listening sockets, once the event loops are gone
+         */
+        void close_listen_sockets();
+
+        /**
+         * Hands the listening sockets and every client to the successor that asked for them
+         * Called once the event loops have stopped; releases the admin and federation ports and
+         * closes the message log first so the successor can open them
+         * @param successor Connection of the successor (closed by this call)
+         */
+        void hand_over(int successor);
+
+        /**
+         * Accept loop for ServerMode::Threaded
+         * Blocks in accept() and spawns one detached thread per client, counted in live_threads
+         */
+        void run_threaded();
+
+    public:
+        /**
+         * Constructor that initializes the server socket and binds it to a port
+         * Sets up the server socket for listening but doesn't start accepting connections yet
+         * @param port Port number to bind the server socket (default: 8080)
+         */
+        Server(int port = 8080);
+
+        /**
+         * Constructor that sets up the server according to a full configuration
+         * If config.handoff_path names the handoff socket of a running server, that server's
+         * listening sockets and clients are taken over instead of binding the port
+         * @param config Port and connection handling mode to use
+         * @throws std::runtime_error if a socket cannot be bound or a takeover failed
+         */
+        explicit Server(const ServerConfig& config);
+        
+        /**
+         * Destructor that ensures proper cleanup of server resources
+         * Stops the server and closes the server socket
+         */
+        ~Server();
+
+        /**
+         * Starts the server and begins accepting client connections
+         * Runs the threaded accept loop or the epoll event loop depending on the configured mode
+         * This function blocks until stop() is called, or until a successor took the server over
+         */
+        void start();
+        
+        /**
+         * Stops the server and closes all client connections
+         * Sets running flag to false and cleans up all active client sockets
+         */
+        void stop();
+
+        /**
+         * Opens an in-process connection to this server, which serves it like a TCP client
+         * (default room, heartbeats and timeouts included) without any kernel networking on the way
+         * The returned end speaks the wire protocol; drive it with ClientEngine::connect_local() or
+         * read and write it directly. May be called from any thread, also before start(); the
+         * server closes its end when it is destroyed.
+         * @return Client end of the connection
+         * @throws std::runtime_error in threaded mode or with the io_uring backend
+         */
+        std::unique_ptr<LocalEndpoint> connect_local();
+
+        /**
+         * Counters of slow-consumer overload events since the server was created
+         * Safe to call from any thread while the server is running
+         * @return Live counters (read them with load())
+         */
+        const OverloadCounters& overload_counters() const { return context.overload; }
+
+        /**
+         * Renders the current metrics in the Prometheus text format (what the admin port serves)
+         * Safe to call from any thread while the server is running
+         */
+        std::string metrics_text() const { return context.metrics->render(context.overload); }
+};
\ No newline at end of file
@@ -0,0 +1,115 @@
+// Configuration types for the chat server
+// Kept separate from Server.h so the event loop code can read settings without the full Server class
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Strategy the server uses to serve its client connections
+ */
+enum class ServerMode {
+    Threaded, // One detached thread per client (original design, kept for comparison)
+    Epoll,    // One edge-triggered epoll event loop serving every client from a single thread
+    Sharded   // Several epoll event loops on separate threads, each with its own SO_REUSEPORT socket
+};
+
+/**
+ * Kernel interface the event loop modes use for socket I/O
+ */
+enum class IoBackend {
+    Epoll, // Readiness notifications, then one accept/readv/sendmsg system call per operation
+    Uring  // io_uring completions: multishot accept and receive, sends batched into one io_uring_enter()
+};
+
+/**
+ * What to do when a message is queued for a client whose write queue is already at its limit
+ */
+enum class OverflowPolicy {
+    DropOldest, // Discard the oldest unsent messages to make room (a lagging reader skips ahead)
+    DropNewest, // Discard the new message (a lagging reader keeps its backlog, misses new traffic)
+    Disconnect  // Close the connection; the client has to reconnect and catch up
+};
+
+/**
+ * Settings used to construct a Server
+ */
+struct ServerConfig {
+    // Port number to bind the listening socket to
+    int port = 8080;
+
+    // Length of each listening socket's queue of connections waiting to be accepted
+    // (the kernel caps it at net.core.somaxconn)
+    int listen_backlog = 1024;
+
+    // Most client connections open at once across the whole server (0 = unlimited)
+    // Connections beyond it are accepted, told the server is full and closed right away
+    size_t max_connections = 0;
+
+    // New connections per second allowed from one client IP address (0 = unlimited), and how
+    // many it may open at once after being quiet (0 = same as per_ip_rate)
+    size_t per_ip_rate = 0;
+    size_t per_ip_burst = 0;
+
+    // Connection handling strategy
+    ServerMode mode = ServerMode::Epoll;
+
+    // Number of reactor threads in ServerMode::Sharded (0 = one per hardware thread; at most
+    // kMaxShards, since client ids name their shard in 8 bits)
+    size_t threads = 0;
+
+    // I/O interface of the reactors (ignored in ServerMode::Threaded)
+    // IoBackend::Uring falls back to IoBackend::Epoll when the kernel lacks the required features
+    IoBackend io_backend = IoBackend::Epoll;
+
+    // Maximum number of messages waiting in one client's write queue
+    size_t max_queued_messages = 1024;
+
+    // Maximum number of unsent bytes in one client's write queue
+    size_t max_queued_bytes = 1024 * 1024;
+
+    // How a client that reached either limit is treated; either way its memory stays bounded
+    OverflowPolicy overflow_policy = OverflowPolicy::DropOldest;
+
+    // How long a client's output may wait to be coalesced with more output into fewer, fuller
+    // writes (0 = write at the end of every event loop iteration); ignored in ServerMode::Threaded
+    int flush_delay_us = 0;
+
+    // Queued bytes that make a client's output be written without waiting for flush_delay_us
+    size_t flush_bytes = 16 * 1024;
+
+    // Local port serving metrics in the Prometheus text format (0 = no admin endpoint)
+    int admin_port = 0;
+
+    // Directory of the persistent per-room message log that clients can replay (empty = no log)
+    std::string log_directory;
+
+    // Longest time logged messages may wait before they are synced to disk
+    int log_sync_ms = 100;
+
+    // Id of this server within its federation; must be unique and nonzero when federating
+    uint32_t node_id = 0;
+
+    // Port other nodes of the federation connect to (0 = no federation)
+    int federation_port = 0;
+
+    // Federation ports of every other node, as "host:port"
+    std::vector<std::string> peers;
+
+    // Inbound silence after which a client is sent a Ping to check it is still there (0 = never)
+    int heartbeat_ms = 0;
+
+    // Connection timeouts (0 = none): nothing at all received from the client, not even a Pong
+    // (catches dead peers, together with heartbeat_ms); no frame other than Ping and Pong received
+    // (catches clients that stay connected without using the chat); queued output not written any
+    // further (catches clients that stopped reading before their queue overflows)
+    int read_timeout_ms = 0;
+    int idle_timeout_ms = 0;
+    int write_timeout_ms = 0;
+
+    // Unix socket used to hand the running server's sockets to a new server process (empty = no
+    // handoff); a server started with the path of a running one takes over its clients first
+    std::string handoff_path;
+};
@@ -0,0 +1,77 @@
+// Server context implementation: history replay, room reporting and notices shared by both server models
+
+#include "ServerContext.h"
+#include <algorithm>
+
+namespace {
+    // Size of the log chunks a history replay queues at a time
+    constexpr size_t kHistoryChunkSize = 64 * 1024;
+}
+
+std::function<void(std::string_view, bool)> ServerContext::room_observer() const {
+    if (!federation) {
+        return nullptr;
+    }
+    Federation* links = federation.get();
+    return [links](std::string_view room, bool occupied) {
+        if (occupied) {
+            links->room_opened(room);
+        } else {
+            links->room_closed(room);
+        }
+    };
+}
+
+/**
+ * The log position is fixed now; frames logged later reach the client live
+ */
+const char* ServerContext::start_history(std::unique_ptr<HistoryCursor>& history, std::string_view room,
+                                         uint64_t since) {
+    if (!log) {
+        return "History is not enabled on this server";
+    }
+    if (history) {
+        return "A history replay is already in progress";
+    }
+    history = log->replay(room, since);
+    return nullptr;
+}
+
+/**
+ * Keeps at most half of the queue limits filled with history, so live frames still fit next to it;
+ * the chunks point into the log's mappings and are written without being copied
+ * Chunks are sized to what is left of that half, so the overflow policy never drops history or
+ * evicts live frames for it; the rest waits until the socket took part of the queue. Only a single
+ * frame larger than the whole half goes in alone, once the queue is empty, so it cannot stall the replay.
+ */
+MessageRef ServerContext::next_history_chunk(std::unique_ptr<HistoryCursor>& history,
+                                             const WriteQueue& outbound) const {
+    if (!history || outbound.size() * 2 >= config.max_queued_messages) {
+        return MessageRef();
+    }
+    size_t budget = outbound.history_budget();
+    size_t next = history->next_frame_size();
+    if (next == 0) {
+        MessageRef marker = history->end_marker();
+        if (marker.size() > budget && !outbound.empty()) {
+            return MessageRef();
+        }
+        history.reset();
+        return marker;
+    }
+    if (next > budget && !outbound.empty()) {
+        return MessageRef();
+    }
+    return history->next(std::min(budget, kHistoryChunkSize));
+}
+
+/**
+ * Relayed senders are named by their id on their own node, the one their frames showed
+ */
+std::string ServerContext::unreachable_notice(uint32_t recipient_id) {
+    if (recipient_id & kRelayedSenderBit) {
+        return "User " + std::to_string(recipient_id & ~kRelayedSenderBit) +
+               " is connected to another node; direct messages only reach users on this one";
+    }
+    return "User " + std::to_string(recipient_id) + " is not online";
+}
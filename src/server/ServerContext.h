@@ -0,0 +1,94 @@
+// State shared by every reactor of one Server
+// Owned by the Server and handed to each Reactor by reference
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include "ServerConfig.h"
+#include "Metrics.h"
+#include "MessageLog.h"
+#include "Federation.h"
+#include "Admission.h"
+#include "WriteQueue.h"
+
+class Reactor;
+
+/**
+ * Counters of slow-consumer overload events, one per overflow policy outcome
+ * Only incremented when a write queue overflows, so sharing them between threads is cheap
+ */
+struct OverloadCounters {
+    // Queued messages discarded to make room for newer ones (OverflowPolicy::DropOldest)
+    std::atomic<uint64_t> dropped_oldest{0};
+
+    // New messages discarded because the queue was full (OverflowPolicy::DropNewest)
+    std::atomic<uint64_t> dropped_newest{0};
+
+    // Clients disconnected because their queue overflowed (OverflowPolicy::Disconnect)
+    std::atomic<uint64_t> disconnected{0};
+};
+
+/**
+ * Server-wide data the reactors need to cooperate
+ * Everything here is either immutable once the reactors run or safe for concurrent access
+ */
+struct ServerContext {
+    // Settings the server was constructed with
+    ServerConfig config;
+
+    // Every reactor of the server, indexed by shard number
+    std::vector<std::unique_ptr<Reactor>> shards;
+
+    // Next sequence number stamped on frames relayed by the server (shared by all shards)
+    std::atomic<uint64_t> next_sequence{1};
+
+    // Slow-consumer overload events across all shards (and threaded mode)
+    OverloadCounters overload;
+
+    // Per-shard counters and latency histograms (a single slot shared by all threads in threaded mode)
+    std::unique_ptr<Metrics> metrics;
+
+    // Connection cap and per-address connection rate limits shared by every shard
+    std::unique_ptr<AdmissionControl> admission;
+
+    // Persistent history of every room (nullptr unless config.log_directory is set)
+    std::unique_ptr<MessageLog> log;
+
+    // Links to the other nodes of a federation (nullptr unless config.federation_port is set)
+    // Declared last so it is destroyed first: its link threads deliver into the members above
+    std::unique_ptr<Federation> federation;
+
+    /**
+     * Observer for a room index that lets the federation follow which rooms have local members
+     * @return Callback for RoomIndex::set_observer(), empty without a federation
+     */
+    std::function<void(std::string_view room, bool occupied)> room_observer() const;
+
+    /**
+     * Starts a history replay for a client; only one runs per client, covering the log as it is now
+     * @param history The client's replay slot, set on success
+     * @param room Room to replay
+     * @param since Replay frames with a higher sequence number
+     * @return nullptr once started, otherwise the notice to send the client
+     */
+    const char* start_history(std::unique_ptr<HistoryCursor>& history, std::string_view room, uint64_t since);
+
+    /**
+     * Takes the next piece of a history replay that fits next to a client's live output
+     * @param history The client's replay, reset once its end marker is handed out
+     * @param outbound The client's write queue; the caller pushes the chunk
+     * @return Chunk to queue, or an empty handle if there is none or it has to wait for room
+     */
+    MessageRef next_history_chunk(std::unique_ptr<HistoryCursor>& history, const WriteQueue& outbound) const;
+
+    /**
+     * Text of the notice answering a Direct message nobody on this server can receive
+     * @param recipient_id Id the message was addressed to
+     */
+    static std::string unreachable_notice(uint32_t recipient_id);
+};
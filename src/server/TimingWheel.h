@@ -0,0 +1,173 @@
+// Hierarchical timing wheel tracking a deadline for every connection of an event loop
+// Scheduling, cancelling and expiring a timer are O(1), however many timers are pending
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Intrusive timer: the object that owns a deadline derives from it, so the wheel never allocates
+ */
+struct TimerNode {
+    // Neighbours in the slot list (both nullptr while not scheduled)
+    TimerNode* timer_prev = nullptr;
+    TimerNode* timer_next = nullptr;
+
+    // Tick at which the timer expires
+    uint64_t timer_expires = 0;
+
+    bool timer_scheduled() const { return timer_prev != nullptr; }
+};
+
+/**
+ * Four wheels of 64 slots each, like a clock with seconds, minutes and hours hands
+ *
+ * Level 0 holds timers due within 64 ticks, one slot per tick. Each higher level holds timers 64
+ * times further away, one slot per 64^level ticks; whenever the level below wraps around, the
+ * next slot of a higher level is emptied and its timers are re-filed one level down ("cascading").
+ * A timer is therefore moved at most three times before it fires, and advancing one tick only
+ * touches the slots that fall due. Timers further away than the wheels reach (64^4 ticks) are
+ * filed at the furthest reachable tick; their owner simply re-checks its deadline when they fire.
+ *
+ * Meant for coarse timeouts: deadlines are rounded up to whole ticks, so a timer never fires
+ * early but may fire up to one tick late. Not thread-safe; each event loop owns its own wheel.
+ */
+class TimingWheel {
+    private:
+        static constexpr unsigned kSlotBits = 6;
+        static constexpr uint64_t kSlots = 1u << kSlotBits;
+        static constexpr unsigned kLevels = 4;
+        static constexpr uint64_t kRange = 1ull << (kSlotBits * kLevels);
+
+        // Slot list heads; every slot is a circular doubly linked list through its own sentinel
+        TimerNode slots[kLevels][kSlots];
+
+        // Length of one tick in nanoseconds, and the tick processed last
+        uint64_t tick_ns;
+        uint64_t current;
+
+        // Number of scheduled timers (advance() skips idle time in one step when there are none)
+        size_t count;
+
+        /**
+         * Files a timer in the slot of the level whose reach covers its distance from current
+         */
+        void link(TimerNode& node) {
+            uint64_t delta = node.timer_expires - current;
+            if (delta >= kRange) {
+                node.timer_expires = current + kRange - 1;
+                delta = kRange - 1;
+            }
+            unsigned level = 0;
+            while (delta >= (1ull << (kSlotBits * (level + 1)))) {
+                ++level;
+            }
+            TimerNode& head = slots[level][(node.timer_expires >> (kSlotBits * level)) & (kSlots - 1)];
+            node.timer_prev = head.timer_prev;
+            node.timer_next = &head;
+            head.timer_prev->timer_next = &node;
+            head.timer_prev = &node;
+        }
+
+        void unlink(TimerNode& node) {
+            node.timer_prev->timer_next = node.timer_next;
+            node.timer_next->timer_prev = node.timer_prev;
+            node.timer_prev = nullptr;
+            node.timer_next = nullptr;
+        }
+
+    public:
+        /**
+         * @param tick_ns Length of one tick in nanoseconds (the resolution of every deadline)
+         * @param now Current time in nanoseconds, on the same clock as the deadlines
+         */
+        TimingWheel(uint64_t tick_ns, uint64_t now) : tick_ns(tick_ns), current(now / tick_ns), count(0) {
+            for (auto& level : slots) {
+                for (TimerNode& head : level) {
+                    head.timer_prev = &head;
+                    head.timer_next = &head;
+                }
+            }
+        }
+
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel& operator=(const TimingWheel&) = delete;
+
+        /**
+         * Schedules a timer, moving it if it was already scheduled
+         * @param node Timer to schedule
+         * @param deadline Time in nanoseconds at which it should fire
+         */
+        void schedule(TimerNode& node, uint64_t deadline) {
+            if (node.timer_scheduled()) {
+                unlink(node);
+            } else {
+                ++count;
+            }
+            uint64_t tick = (deadline + tick_ns - 1) / tick_ns;
+            node.timer_expires = tick > current ? tick : current + 1;
+            link(node);
+        }
+
+        /**
+         * Schedules a timer for the given deadline unless it is already due to fire no later
+         * @param node Timer to schedule
+         * @param deadline Time in nanoseconds at which it should fire at the latest
+         */
+        void schedule_by(TimerNode& node, uint64_t deadline) {
+            if (!node.timer_scheduled() || node.timer_expires > (deadline + tick_ns - 1) / tick_ns) {
+                schedule(node, deadline);
+            }
+        }
+
+        /**
+         * Removes a timer if it is scheduled
+         */
+        void cancel(TimerNode& node) {
+            if (node.timer_scheduled()) {
+                unlink(node);
+                --count;
+            }
+        }
+
+        bool empty() const { return count == 0; }
+
+        /**
+         * Fires every timer whose tick has passed, in tick order
+         * The callback may schedule or cancel any timer, including the one it was given
+         * @param now Current time in nanoseconds
+         * @param expired Called with each timer that fired (it is no longer scheduled by then)
+         */
+        template <typename Callback>
+        void advance(uint64_t now, Callback&& expired) {
+            uint64_t target = now / tick_ns;
+            while (current < target) {
+                if (count == 0) {
+                    current = target;
+                    return;
+                }
+                ++current;
+
+                // Wrapping around a level moves the next slot of the level above one level down
+                for (unsigned level = 1; level < kLevels; ++level) {
+                    if ((current & ((1ull << (kSlotBits * level)) - 1)) != 0) {
+                        break;
+                    }
+                    TimerNode& head = slots[level][(current >> (kSlotBits * level)) & (kSlots - 1)];
+                    while (head.timer_next != &head) {
+                        TimerNode& node = *head.timer_next;
+                        unlink(node);
+                        link(node);
+                    }
+                }
+
+                TimerNode& head = slots[0][current & (kSlots - 1)];
+                while (head.timer_next != &head) {
+                    TimerNode& node = *head.timer_next;
+                    unlink(node);
+                    --count;
+                    expired(node);
+                }
+            }
+        }
+};
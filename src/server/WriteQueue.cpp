@@ -0,0 +1,223 @@
+// Per-client write queue implementation
+
+#include "WriteQueue.h"
+#include <cerrno>
+#include <sys/socket.h>
+
+namespace {
+    // Initial number of slots; grown by doubling as a client falls behind
+    constexpr size_t kInitialSlots = 8;
+
+    // Maximum iovecs handed to a single sendmsg() call
+    constexpr int kMaxFlushSegments = 64;
+}
+
+WriteQueue::WriteQueue(size_t max_messages, size_t max_bytes, OverflowPolicy policy, ShardMetrics* metrics)
+    : head(0), count(0), max_messages(max_messages), max_bytes(max_bytes), policy(policy),
+      head_offset(0), queued_bytes(0), written_bytes(0), pinned(0), holes(0), metrics(metrics) {}
+
+/**
+ * Applies the overflow policy if needed, then stores the handle in the next free slot,
+ * growing the slot array if needed
+ */
+PushResult WriteQueue::push(MessageRef message, size_t& evicted) {
+    evicted = 0;
+    if (!fits(message.size())) {
+        if (policy == OverflowPolicy::Disconnect) {
+            return PushResult::Overflow;
+        }
+        if (policy == OverflowPolicy::DropOldest) {
+            while (!fits(message.size()) && evict_oldest()) {
+                ++evicted;
+            }
+        }
+        // DropNewest, or a frame that cannot fit even after evicting everything possible
+        if (!fits(message.size())) {
+            return PushResult::Dropped;
+        }
+    }
+
+    if (count + holes == slots.size()) {
+        // Unroll the circular contents (holes included) into a larger array so they stay in FIFO order
+        std::vector<MessageRef> grown(slots.empty() ? kInitialSlots : slots.size() * 2);
+        for (size_t i = 0; i < count + holes; ++i) {
+            grown[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+        }
+        slots.swap(grown);
+        head = 0;
+    }
+
+    queued_bytes += message.size();
+    report_queued(1, message.size());
+    slots[(head + count + holes) & (slots.size() - 1)] = std::move(message);
+    ++count;
+    return PushResult::Queued;
+}
+
+/**
+ * Releases the handles so the frames can be recycled once every other recipient is done with them
+ */
+void WriteQueue::clear() {
+    report_queued(-static_cast<int64_t>(count), -static_cast<int64_t>(queued_bytes));
+    for (size_t i = 0; i < count + holes; ++i) {
+        slots[(head + i) & (slots.size() - 1)] = MessageRef();
+    }
+    head = 0;
+    count = 0;
+    head_offset = 0;
+    queued_bytes = 0;
+    written_bytes = 0;
+    pinned = 0;
+    holes = 0;
+}
+
+/**
+ * The front frame is copied from where the last write stopped
+ */
+void WriteQueue::take_unsent(std::string& out) {
+    for (size_t i = 0; i < count; ++i) {
+        const MessageRef& message = slots[(head + i) & (slots.size() - 1)];
+        size_t offset = i == 0 ? head_offset : 0;
+        out.append(message.data() + offset, message.size() - offset);
+    }
+    clear();
+}
+
+/**
+ * Removes the first frame behind the protected prefix (pinned or partially written frames)
+ * While frames are pinned, the evicted slot is left empty as a hole behind them (a write may be
+ * reading the pinned slots' frames, and moving up to a gather() worth of them on every eviction
+ * would make a full queue quadratic). Otherwise at most the one partially written frame is
+ * shifted back into the evicted frame's place.
+ */
+bool WriteQueue::evict_oldest() {
+    size_t protected_count = pinned > 0 ? pinned : (head_offset > 0 ? 1 : 0);
+    if (count <= protected_count) {
+        return false;
+    }
+
+    size_t mask = slots.size() - 1;
+    MessageRef& evicted = slots[(head + protected_count + holes) & mask];
+    size_t length = evicted.size();
+    queued_bytes -= length;
+    report_queued(-1, -static_cast<int64_t>(length));
+    --count;
+    if (pinned > 0) {
+        evicted = MessageRef();
+        ++holes;
+        return true;
+    }
+    if (protected_count > 0) {
+        evicted = std::move(slots[head]);
+    }
+    slots[head] = MessageRef();
+    head = (head + 1) & mask;
+    return true;
+}
+
+/**
+ * Walks the queued frames in order, skipping the already written part of the front one
+ */
+int WriteQueue::gather(struct iovec* segments, int max_segments) {
+    int used = 0;
+    for (size_t i = 0; i < count && used < max_segments; ++i) {
+        const MessageRef& message = slots[(head + i) & (slots.size() - 1)];
+        size_t skip = i == 0 ? head_offset : 0;
+        segments[used].iov_base = const_cast<char*>(message.data() + skip);
+        segments[used].iov_len = message.size() - skip;
+        ++used;
+    }
+    pinned = used;
+    return used;
+}
+
+/**
+ * Releases every frame the write fully covered; the last one may remain partially sent
+ */
+void WriteQueue::advance(size_t bytes) {
+    size_t was_pinned = pinned;
+    pinned = 0;
+    queued_bytes -= bytes;
+    written_bytes += bytes;
+    size_t completed = 0;
+    if (metrics && bytes > 0) {
+        ShardMetrics::add(metrics->bytes_sent, bytes);
+        ShardMetrics::add(metrics->queued_bytes, -static_cast<int64_t>(bytes));
+    }
+    while (bytes > 0) {
+        MessageRef& front = slots[head];
+        size_t remaining = front.size() - head_offset;
+        if (bytes < remaining) {
+            head_offset += bytes;
+            break;
+        }
+        bytes -= remaining;
+        front = MessageRef(); // Drop this client's reference; the last recipient frees the buffer
+        head = (head + 1) & (slots.size() - 1);
+        head_offset = 0;
+        --count;
+        ++completed;
+    }
+    if (holes > 0) {
+        // Close up the holes evictions left behind the pinned frames: the pinned frames that are
+        // still queued move back over them (at most one gather() worth, once per write)
+        size_t mask = slots.size() - 1;
+        for (size_t i = was_pinned - completed; i > 0; --i) {
+            slots[(head + holes + i - 1) & mask] = std::move(slots[(head + i - 1) & mask]);
+        }
+        head = (head + holes) & mask;
+        holes = 0;
+    }
+    if (metrics && completed > 0) {
+        ShardMetrics::add(metrics->messages_sent, completed);
+        ShardMetrics::add(metrics->queued_messages, -static_cast<int64_t>(completed));
+    }
+}
+
+/**
+ * Gathers up to kMaxFlushSegments frames per syscall until the queue drains or the socket fills up
+ * While frames remain beyond the gathered ones, MSG_MORE lets the kernel fill whole segments
+ * across the consecutive calls instead of sending a short one at each call boundary
+ */
+FlushStatus WriteQueue::flush(int socket) {
+    while (count > 0) {
+        struct iovec segments[kMaxFlushSegments];
+        struct msghdr message{};
+        message.msg_iov = segments;
+        message.msg_iovlen = gather(segments, kMaxFlushSegments);
+
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (message.msg_iovlen < count ? MSG_MORE : 0);
+        ssize_t bytes_sent = sendmsg(socket, &message, flags);
+        if (bytes_sent > 0) {
+            advance(bytes_sent);
+            continue;
+        }
+        advance(0);
+        if (bytes_sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return FlushStatus::Blocked;
+        }
+        return FlushStatus::Error;
+    }
+    return FlushStatus::Done;
+}
+
+/**
+ * Same loop without the socket flags: the ring copies whole iovecs, so there are no segments to fill
+ */
+FlushStatus WriteQueue::flush(LocalEndpoint& endpoint) {
+    while (count > 0) {
+        struct iovec segments[kMaxFlushSegments];
+        int segment_count = gather(segments, kMaxFlushSegments);
+        ssize_t bytes_sent = endpoint.writev(segments, segment_count);
+        if (bytes_sent > 0) {
+            advance(bytes_sent);
+            continue;
+        }
+        advance(0);
+        return bytes_sent < 0 && errno == EAGAIN ? FlushStatus::Blocked : FlushStatus::Error;
+    }
+    return FlushStatus::Done;
+}
@@ -0,0 +1,177 @@
+// Bounded per-client queue of encoded frames waiting to be written to the socket
+// Holds shared MessageRef handles, so queueing a broadcast for a client is a pointer push
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include "common/MessageBuffer.h"
+#include "common/LocalTransport.h"
+#include "ServerConfig.h"
+#include "Metrics.h"
+
+/**
+ * Result of trying to write queued data to a socket
+ */
+enum class FlushStatus {
+    Done,    // The queue is empty
+    Blocked, // The socket buffer is full; retry when the socket becomes writable
+    Error    // The connection failed and should be closed
+};
+
+/**
+ * Outcome of queueing a frame
+ */
+enum class PushResult {
+    Queued,  // The frame was queued (older frames may have been evicted to make room)
+    Dropped, // The frame was discarded because the queue is full (OverflowPolicy::DropNewest)
+    Overflow // The queue is full and the client should be disconnected (OverflowPolicy::Disconnect)
+};
+
+/**
+ * FIFO of frames for one client, bounded both in frame count and in bytes
+ * The front frame may be partially written; the queue remembers how far it got.
+ * Slot storage starts small and doubles on demand up to the limit, so idle clients stay cheap.
+ */
+class WriteQueue {
+    private:
+        // Circular slot array (size is always a power of two)
+        std::vector<MessageRef> slots;
+
+        // Index of the oldest frame in slots
+        size_t head;
+
+        // Number of frames currently queued
+        size_t count;
+
+        // Maximum number of frames and unsent bytes the queue accepts
+        size_t max_messages;
+        size_t max_bytes;
+
+        // What push() does when a limit would be exceeded
+        OverflowPolicy policy;
+
+        // Bytes of the front frame that have already been written
+        size_t head_offset;
+
+        // Total unsent bytes across all queued frames
+        size_t queued_bytes;
+
+        // Bytes written since the queue was created or last cleared (lets a caller see progress)
+        uint64_t written_bytes;
+
+        // Number of front frames handed out by gather() and not yet settled by advance()
+        // A write may be in progress on them, so the overflow policy must not evict them
+        size_t pinned;
+
+        // Slots emptied by evictions while frames were pinned; they lie right behind the pinned
+        // frames and are closed up by the next advance(), so evicting never moves a pinned frame
+        size_t holes;
+
+        // Slot that queue depth and sent traffic are reported to (nullptr to not report)
+        ShardMetrics* metrics;
+
+        /**
+         * Reports a change of the queue contents to the metrics slot
+         */
+        void report_queued(int64_t messages, int64_t bytes) {
+            if (metrics) {
+                ShardMetrics::add(metrics->queued_messages, messages);
+                ShardMetrics::add(metrics->queued_bytes, bytes);
+            }
+        }
+
+        /**
+         * Checks whether one more frame of the given size fits within both limits
+         */
+        bool fits(size_t length) const {
+            return count < max_messages && queued_bytes + length <= max_bytes;
+        }
+
+        /**
+         * Discards the oldest frame that has not started being written, in constant time
+         * Partially written and pinned frames must stay, or the client would receive a torn frame
+         * @return false if no frame can be evicted
+         */
+        bool evict_oldest();
+
+    public:
+        /**
+         * Creates an empty queue
+         * @param max_messages Maximum number of frames that may be queued at once
+         * @param max_bytes Maximum number of unsent bytes that may be queued at once
+         * @param policy What to do with frames that would exceed either limit
+         * @param metrics Slot to report queue depth and written traffic to (may be nullptr)
+         */
+        WriteQueue(size_t max_messages, size_t max_bytes, OverflowPolicy policy, ShardMetrics* metrics = nullptr);
+
+        /**
+         * Appends a frame, applying the overflow policy if the queue is full
+         * @param message Encoded frame to send
+         * @param evicted Receives the number of older frames discarded to make room
+         * @return Queued, Dropped or Overflow
+         */
+        PushResult push(MessageRef message, size_t& evicted);
+
+        /**
+         * Describes the unsent data as an iovec array for a gathering write
+         * The described frames are pinned: they stay alive and queued until the next advance(),
+         * so the write may run without holding whatever lock protects the queue
+         * @param segments Array to fill
+         * @param max_segments Capacity of the array
+         * @return Number of iovecs filled in
+         */
+        int gather(struct iovec* segments, int max_segments);
+
+        /**
+         * Records that bytes were written, dropping frames that are now fully sent, and unpins
+         * the frames described by the last gather() (call with 0 after a failed write)
+         * @param bytes Number of bytes the kernel accepted
+         */
+        void advance(size_t bytes);
+
+        /**
+         * Drops every queued frame and resets the counters, keeping the slot storage for reuse
+         * Must not be called while a write on gathered frames is still in progress
+         */
+        void clear();
+
+        /**
+         * Appends every unsent byte to a string, then clears the queue (used to hand a client over)
+         * The first bytes may be the rest of a partially written frame
+         * Must not be called while a write on gathered frames is still in progress
+         * @param out String to append to
+         */
+        void take_unsent(std::string& out);
+
+        /**
+         * Writes as much queued data as the socket accepts without blocking
+         * Uses sendmsg() with several iovecs per call (a writev() that also accepts MSG_NOSIGNAL),
+         * flagged MSG_MORE while more frames follow in the next call
+         * @param socket Destination socket
+         * @return Done, Blocked or Error
+         */
+        FlushStatus flush(int socket);
+
+        /**
+         * Writes as much queued data as an in-process connection accepts without blocking
+         * @param endpoint Server end of the connection
+         * @return Done, Blocked or Error
+         */
+        FlushStatus flush(LocalEndpoint& endpoint);
+
+        /**
+         * Bytes a history replay may still queue: what is left of half the byte limit, so live
+         * frames keep the other half
+         */
+        size_t history_budget() const {
+            return queued_bytes < max_bytes / 2 ? max_bytes / 2 - queued_bytes : 0;
+        }
+
+        bool empty() const { return count == 0; }
+        size_t size() const { return count; }
+        size_t bytes() const { return queued_bytes; }
+        uint64_t written() const { return written_bytes; }
+};
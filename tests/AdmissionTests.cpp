@@ -0,0 +1,80 @@
+// Tests of connection admission control: the connection cap and the per-address token buckets
+
+#include "Check.h"
+#include "server/Admission.h"
+#include "server/ServerConfig.h"
+#include <chrono>
+#include <thread>
+
+namespace {
+    /**
+     * Connections beyond the cap are refused until an open one is released
+     */
+    void test_connection_cap() {
+        ServerConfig config;
+        config.max_connections = 2;
+        AdmissionControl admission(config);
+        CHECK(!admission.rate_limited());
+        CHECK(admission.admit(1) == Admission::Accepted && admission.admit(2) == Admission::Accepted);
+        CHECK(admission.admit(3) == Admission::Full && admission.open_connections() == 2);
+
+        admission.release();
+        CHECK(admission.admit(3) == Admission::Accepted && admission.admit(4) == Admission::Full);
+
+        // Connections taken over from a previous process count against the cap too
+        admission.release();
+        admission.adopt();
+        CHECK(admission.open_connections() == 2 && admission.admit(5) == Admission::Full);
+    }
+
+    /**
+     * Each address may open a burst of connections at once and then only as fast as its rate;
+     * a refused connection does not hold a place under the cap
+     */
+    void test_token_buckets() {
+        ServerConfig config;
+        config.per_ip_rate = 20;
+        config.per_ip_burst = 3;
+        AdmissionControl admission(config);
+        CHECK(admission.rate_limited());
+        for (int i = 0; i < 3; ++i) {
+            CHECK(admission.admit(7) == Admission::Accepted);
+        }
+        CHECK(admission.admit(7) == Admission::RateLimited);
+        CHECK(admission.admit(8) == Admission::Accepted);
+        CHECK(admission.open_connections() == 4);
+
+        // One token comes back every 50ms; releasing connections gives none back
+        for (int i = 0; i < 4; ++i) {
+            admission.release();
+        }
+        CHECK(admission.admit(7) == Admission::RateLimited);
+        std::this_thread::sleep_for(std::chrono::milliseconds(120));
+        CHECK(admission.admit(7) == Admission::Accepted && admission.admit(7) == Admission::Accepted);
+    }
+
+    /**
+     * Without a burst the rate doubles as the burst; without a rate nothing is limited
+     */
+    void test_default_burst() {
+        ServerConfig config;
+        config.per_ip_rate = 2;
+        AdmissionControl admission(config);
+        CHECK(admission.admit(1) == Admission::Accepted && admission.admit(1) == Admission::Accepted);
+        CHECK(admission.admit(1) == Admission::RateLimited);
+
+        AdmissionControl unlimited{ServerConfig{}};
+        bool accepted = true;
+        for (int i = 0; i < 1000; ++i) {
+            accepted = accepted && unlimited.admit(1) == Admission::Accepted;
+        }
+        CHECK(accepted);
+    }
+}
+
+int main() {
+    test_connection_cap();
+    test_token_buckets();
+    test_default_burst();
+    return test::result();
+}
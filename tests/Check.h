@@ -0,0 +1,35 @@
+// Minimal assertion helpers shared by the test executables
+// A failed check is reported with its location and the test keeps going; main() returns the verdict
+
+#pragma once
+#include <iostream>
+
+namespace test {
+    // Number of failed checks so far in this executable
+    inline int failures = 0;
+
+    /**
+     * Records the outcome of one check, printing the failed expression
+     * @return The outcome, so a test can stop early when later checks would be meaningless
+     */
+    inline bool check(bool passed, const char* expression, const char* file, int line) {
+        if (!passed) {
+            std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+            ++failures;
+        }
+        return passed;
+    }
+
+    /**
+     * Exit status for main(): 0 if every check passed
+     */
+    inline int result() {
+        if (failures > 0) {
+            std::cerr << failures << " check(s) failed" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+#define CHECK(expression) test::check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
@@ -0,0 +1,233 @@
+// Tests of the event-driven client engine against a running server: many sessions on one thread,
+// frames queued before the connection is up, closing from either side, failed connects,
+// in-process sessions, and heartbeats answered without the application seeing them
+
+#include "Check.h"
+#include "TestClient.h"
+#include "client/ClientEngine.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using test::Received;
+using test::RunningServer;
+
+namespace {
+    /**
+     * Waits until a condition set by the engine thread holds
+     * @return false on timeout
+     */
+    template <typename Condition>
+    bool wait_until(Condition condition) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    /**
+     * What the callbacks of one session saw
+     */
+    struct Observed {
+        std::atomic<int> connects{0};
+        std::atomic<int> failures{0};
+        std::atomic<int> notices{0};
+        std::atomic<int> closes{0};
+        std::atomic<int> pings{0};
+        std::mutex mutex;
+        std::vector<std::string> chats;
+
+        SessionHandlers handlers() {
+            SessionHandlers handlers;
+            handlers.on_connect = [this](ClientSession&, bool connected) { ++(connected ? connects : failures); };
+            handlers.on_frame = [this](ClientSession&, const Frame& frame) {
+                if (frame.header.type == MessageType::Notice) {
+                    ++notices;
+                } else if (frame.header.type == MessageType::Ping) {
+                    ++pings;
+                } else if (frame.header.type == MessageType::Chat) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chats.push_back(frame.payload());
+                }
+            };
+            handlers.on_close = [this](ClientSession&) { ++closes; };
+            return handlers;
+        }
+
+        size_t chat_count() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return chats.size();
+        }
+    };
+
+    /**
+     * One engine thread carries many sessions; a broadcast from one reaches all others in order
+     */
+    void test_many_sessions() {
+        constexpr size_t kSessions = 200;
+        constexpr int kMessages = 10;
+        // Declared before the engine: its callbacks may run until the engine is gone
+        std::vector<std::unique_ptr<Observed>> observed;
+        RunningServer running(ServerConfig{});
+        auto listening = running.connect(); // Only returns once the server accepts connections
+        ClientEngine engine;
+        engine.start();
+
+        // One at a time, so the server's listen backlog never overflows
+        std::vector<std::shared_ptr<ClientSession>> sessions;
+        for (size_t i = 0; i < kSessions; ++i) {
+            observed.push_back(std::make_unique<Observed>());
+            sessions.push_back(engine.connect("127.0.0.1", running.port, observed.back()->handlers()));
+            // Answered with a Notice once the server registered the session (see TestClient::sync)
+            CHECK(sessions.back() && sessions.back()->send_room_message("sync", "x"));
+            CHECK(wait_until([&] { return observed.back()->connects.load() == 1; }));
+        }
+        CHECK(wait_until([&] {
+            for (auto& session : observed) {
+                if (session->notices.load() == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }));
+
+        for (int i = 0; i < kMessages; ++i) {
+            sessions[0]->send_message("broadcast " + std::to_string(i));
+        }
+        CHECK(wait_until([&] {
+            for (size_t i = 1; i < kSessions; ++i) {
+                if (observed[i]->chat_count() < kMessages) {
+                    return false;
+                }
+            }
+            return true;
+        }));
+        bool ordered = observed[0]->chat_count() == 0;
+        for (size_t i = 1; i < kSessions && ordered; ++i) {
+            ordered = observed[i]->chat_count() == kMessages;
+            for (int j = 0; j < kMessages && ordered; ++j) {
+                ordered = observed[i]->chats[j] == "broadcast " + std::to_string(j);
+            }
+        }
+        CHECK(ordered && sessions[kSessions - 1]->is_open() && observed[0]->connects.load() == 1);
+
+        engine.stop();
+        bool closed = true;
+        for (size_t i = 0; i < kSessions; ++i) {
+            closed = closed && observed[i]->closes.load() == 1 && !sessions[i]->is_open();
+        }
+        CHECK(closed && !sessions[0]->send_message("too late"));
+    }
+
+    /**
+     * Frames sent while still connecting go out once connected, and close() lets queued frames
+     * leave first; a server going away closes the remaining sessions
+     */
+    void test_close() {
+        Observed first;
+        Observed second;
+        RunningServer running(ServerConfig{});
+        auto reader = running.connect();
+        ClientEngine engine;
+        engine.start();
+
+        auto session = engine.connect("127.0.0.1", running.port, first.handlers());
+        CHECK(session && session->send_message("early") && session->send_message("goodbye"));
+        session->close();
+        Received frame;
+        CHECK(reader->receive(frame) && frame.payload == "early");
+        CHECK(reader->receive(frame) && frame.payload == "goodbye");
+        CHECK(wait_until([&] { return first.closes.load() == 1; }) && first.connects.load() == 1);
+        CHECK(!session->is_open() && !session->send_message("after close"));
+
+        auto remaining = engine.connect("127.0.0.1", running.port, second.handlers());
+        CHECK(wait_until([&] { return remaining->is_open(); }));
+        running.stop();
+        CHECK(wait_until([&] { return second.closes.load() == 1; }) && !remaining->is_open());
+    }
+
+    /**
+     * A refused connection is reported to on_connect and is never followed by on_close
+     */
+    void test_refused() {
+        Observed observed;
+        ClientEngine engine;
+        engine.start();
+        auto session = engine.connect("127.0.0.1", test::free_port(), observed.handlers());
+        CHECK(session && wait_until([&] { return observed.failures.load() == 1; }));
+        CHECK(!engine.connect("not an address", 80, observed.handlers()));
+        engine.stop();
+        CHECK(observed.connects.load() == 0 && observed.closes.load() == 0 && !session->is_open());
+    }
+
+    /**
+     * A session over an in-process connection counts as connected at once and talks to TCP
+     * clients of the same server, which keeps serving them once the session closed
+     */
+    void test_local() {
+        Observed observed;
+        ServerConfig config;
+        config.mode = ServerMode::Sharded;
+        config.threads = 2;
+        RunningServer running(config);
+        auto reader = running.connect();
+        ClientEngine engine;
+        engine.start();
+        auto session = engine.connect_local(running.server->connect_local(), observed.handlers());
+        CHECK(session && wait_until([&] { return observed.connects.load() == 1; }));
+
+        CHECK(session->send_message("embedded"));
+        Received frame;
+        CHECK(reader->receive(frame) && frame.payload == "embedded");
+        reader->send(MessageType::Chat, "reply");
+        CHECK(wait_until([&] { return observed.chat_count() == 1; }) && observed.chats[0] == "reply");
+
+        session->close();
+        CHECK(wait_until([&] { return observed.closes.load() == 1; }) && !session->is_open());
+        reader->send(MessageType::Chat, "anyone?");
+        CHECK(reader->sync());
+    }
+
+    /**
+     * The engine answers the server's pings itself, so a quiet session outlives the read timeout
+     * and on_frame never sees a ping
+     */
+    void test_heartbeat() {
+        Observed observed;
+        ServerConfig config;
+        config.mode = ServerMode::Epoll;
+        config.heartbeat_ms = 100;
+        config.read_timeout_ms = 400;
+        RunningServer running(config);
+        running.connect(); // Only returns once the server accepts connections
+        ClientEngine engine;
+        engine.start();
+        auto session = engine.connect("127.0.0.1", running.port, observed.handlers());
+        CHECK(session && wait_until([&] { return session->is_open(); }));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        CHECK(session->is_open() && observed.closes.load() == 0 && observed.pings.load() == 0);
+
+        // Epoll mode has a single shard, so each metric has one sample
+        std::string text = running.server->metrics_text();
+        size_t pings = text.find("\nquickchat_pings_sent_total{");
+        CHECK(pings != std::string::npos && std::stod(text.substr(text.find("} ", pings) + 2)) >= 4);
+    }
+}
+
+int main() {
+    test_many_sessions();
+    test_close();
+    test_refused();
+    test_local();
+    test_heartbeat();
+    return test::result();
+}
@@ -0,0 +1,114 @@
+// Tests of the blocking chat client against a running server: write batching by delay and by
+// size, batched frames leaving on flush() and disconnect(), and in-process connections
+
+#include "Check.h"
+#include "TestClient.h"
+#include "client/Client.h"
+#include <chrono>
+#include <string>
+
+using test::Received;
+using test::RunningServer;
+
+namespace {
+    /**
+     * Receives the next chat frame and checks its payload, answering heartbeat pings on the way
+     */
+    bool receives(test::TestClient& reader, const std::string& payload) {
+        Received frame;
+        bool received;
+        while ((received = reader.receive(frame)) && frame.header.type == MessageType::Ping) {
+            reader.send(MessageType::Pong, frame.payload);
+        }
+        return received && frame.header.type == MessageType::Chat && frame.payload == payload;
+    }
+
+    /**
+     * Batched messages wait for the delay and then arrive together, in order
+     */
+    void test_batch_delay() {
+        constexpr auto kDelay = std::chrono::milliseconds(200);
+        RunningServer running(ServerConfig{});
+        auto reader = running.connect();
+        Client client;
+        client.set_batching(kDelay, 64 * 1024);
+        CHECK(client.connect("127.0.0.1", running.port));
+
+        auto start = std::chrono::steady_clock::now();
+        CHECK(client.send_message("one") && client.send_message("two") && client.send_message("three"));
+        CHECK(receives(*reader, "one") && std::chrono::steady_clock::now() - start >= kDelay * 3 / 4);
+        CHECK(receives(*reader, "two") && receives(*reader, "three"));
+    }
+
+    /**
+     * A batch that reaches its byte limit leaves without waiting, and flush() and disconnect()
+     * send whatever is held back; the delay is far longer than any receive timeout
+     */
+    void test_batch_release() {
+        RunningServer running(ServerConfig{});
+        auto reader = running.connect();
+        Client client;
+        client.set_batching(std::chrono::seconds(60), 1000);
+        CHECK(client.connect("127.0.0.1", running.port));
+
+        std::string large(400, 'x');
+        CHECK(client.send_message(large + "1") && client.send_message(large + "2") && client.send_message(large + "3"));
+        CHECK(receives(*reader, large + "1") && receives(*reader, large + "2") && receives(*reader, large + "3"));
+
+        CHECK(client.send_message("flushed") && client.flush());
+        CHECK(receives(*reader, "flushed"));
+
+        CHECK(client.send_message("last words"));
+        client.disconnect();
+        CHECK(receives(*reader, "last words"));
+    }
+
+    /**
+     * Over an in-process connection, output larger than the ring arrives complete and in order,
+     * the receive thread answers heartbeats (so the read timeout never closes the client), and
+     * disconnect() closes the connection
+     */
+    void test_local() {
+        ServerConfig config;
+        config.heartbeat_ms = 100;
+        config.read_timeout_ms = 300;
+        RunningServer running(config);
+        auto reader = running.connect();
+        Client client;
+        CHECK(!client.connect_local(nullptr));
+        CHECK(client.connect_local(running.server->connect_local()));
+
+        std::string large(1000, 'x');
+        bool sent = true;
+        for (int i = 0; i < 200; ++i) {
+            sent = sent && client.send_message(large + std::to_string(i));
+        }
+        CHECK(sent);
+        bool received = true;
+        for (int i = 0; i < 200; ++i) {
+            received = received && receives(*reader, large + std::to_string(i));
+        }
+        CHECK(received);
+
+        // The reader answers its own pings meanwhile; a client that did not would be closed by now
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(700);
+        Received frame;
+        while (std::chrono::steady_clock::now() < until && reader->receive(frame)) {
+            if (frame.header.type == MessageType::Ping) {
+                reader->send(MessageType::Pong, frame.payload);
+            }
+        }
+        CHECK(client.send_message("still here") && receives(*reader, "still here"));
+
+        client.disconnect();
+        CHECK(!client.send_message("gone"));
+        CHECK(reader->quiet());
+    }
+}
+
+int main() {
+    test_batch_delay();
+    test_batch_release();
+    test_local();
+    return test::result();
+}
@@ -0,0 +1,144 @@
+// Tests of payload compression: round trips through the parser, the threshold and incompressible
+// payloads, and corrupt or oversized compressed payloads being rejected
+
+#include "Check.h"
+#include "TestClient.h"
+#include "common/Compression.h"
+#include "common/Protocol.h"
+#include <iostream>
+#include <random>
+#include <string>
+
+using test::Received;
+
+namespace {
+    /**
+     * Text that deflate shrinks well, like chat traffic
+     */
+    std::string repetitive(size_t length) {
+        std::string text;
+        while (text.size() < length) {
+            text += "the quick brown fox jumps over the lazy dog " + std::to_string(text.size() % 7) + " ";
+        }
+        text.resize(length);
+        return text;
+    }
+
+    /**
+     * Bytes deflate cannot shrink
+     */
+    std::string random_bytes(size_t length) {
+        std::mt19937 generator(42);
+        std::string bytes(length, '\0');
+        for (char& byte : bytes) {
+            byte = static_cast<char>(generator());
+        }
+        return bytes;
+    }
+
+    /**
+     * Splits an encoded frame into a header and its payload as a receiving client sees them
+     */
+    Received received(const char* frame, size_t size) {
+        Received result;
+        CHECK(size >= kFrameHeaderSize && decode_frame_header(frame, result.header));
+        result.payload.assign(frame + kFrameHeaderSize, size - kFrameHeaderSize);
+        return result;
+    }
+
+    /**
+     * A compressed copy of a shared frame keeps the header fields, shrinks the payload and
+     * inflates back to the original; the original buffer is left as it was
+     */
+    void test_round_trip() {
+        FrameHeader header;
+        header.type = MessageType::RoomMessage;
+        header.sender_id = 513;
+        header.sequence = 77;
+        std::string text = repetitive(kMaxPayloadSize);
+        MessageRef frame = encode_frame(header, text.data(), text.size());
+        MessageRef compressed = compress_frame(frame);
+        CHECK(compressed.data() != frame.data() && compressed.size() < frame.size() / 4);
+
+        Received wire = received(compressed.data(), compressed.size());
+        CHECK(wire.header.flags == kFlagCompressed && wire.header.type == MessageType::RoomMessage);
+        CHECK(wire.header.sender_id == 513 && wire.header.sequence == 77);
+        std::string payload;
+        CHECK(test::expand(wire, payload) && payload == text);
+        CHECK(received(frame.data(), frame.size()).header.flags == 0);
+
+        // Plain frames pass through expand_frame unchanged
+        Received plain = received(frame.data(), frame.size());
+        CHECK(test::expand(plain, payload) && payload == text);
+    }
+
+    /**
+     * Short payloads and payloads that would not shrink are left alone
+     */
+    void test_left_alone() {
+        FrameHeader header;
+        std::string small = repetitive(kCompressionThreshold - 1);
+        MessageRef short_frame = encode_frame(header, small.data(), small.size());
+        CHECK(compress_frame(short_frame).data() == short_frame.data());
+
+        std::string noise = random_bytes(4096);
+        MessageRef noisy_frame = encode_frame(header, noise.data(), noise.size());
+        CHECK(compress_frame(noisy_frame).data() == noisy_frame.data());
+
+        std::string out;
+        append_compressed_frame(out, MessageType::Chat, 0, 1, noise.data(), noise.size());
+        CHECK(out.size() == kFrameHeaderSize + noise.size() && received(out.data(), out.size()).header.flags == 0);
+    }
+
+    /**
+     * Client-side compression round trips too, and the flag is only set on compressed frames
+     */
+    void test_append() {
+        std::string text = repetitive(2000);
+        std::string out;
+        append_compressed_frame(out, MessageType::Chat, 0, 9, text.data(), text.size());
+        append_compressed_frame(out, MessageType::Chat, 0, 10, "hi", 2);
+        Received first = received(out.data(), out.size());
+        size_t first_size = kFrameHeaderSize + first.header.length;
+        first.payload.resize(first.header.length);
+        Received second = received(out.data() + first_size, out.size() - first_size);
+
+        std::string payload;
+        CHECK(first.header.flags == kFlagCompressed && first.header.sequence == 9);
+        CHECK(test::expand(first, payload) && payload == text);
+        CHECK(second.header.flags == 0 && second.payload == "hi");
+    }
+
+    /**
+     * Garbage and payloads that inflate past the protocol limit are refused
+     */
+    void test_invalid() {
+        std::string out;
+        std::string text = repetitive(1000);
+        append_compressed_frame(out, MessageType::Chat, 0, 1, text.data(), text.size());
+        Received corrupt = received(out.data(), out.size());
+        corrupt.payload[corrupt.payload.size() / 2] ^= 0x55;
+        corrupt.payload.resize(corrupt.payload.size() - 3);
+        std::string payload;
+        CHECK(!test::expand(corrupt, payload));
+
+        std::string huge = repetitive(kMaxPayloadSize + 1);
+        out.clear();
+        append_compressed_frame(out, MessageType::Chat, 0, 1, huge.data(), huge.size());
+        Received bomb = received(out.data(), out.size());
+        CHECK(bomb.header.flags == kFlagCompressed && bomb.header.length < kMaxPayloadSize);
+        CHECK(!test::expand(bomb, payload));
+    }
+}
+
+int main() {
+    if (!compression_supported()) {
+        std::cerr << "Built without zlib, skipping the compression tests" << std::endl;
+        return test::result();
+    }
+    test_round_trip();
+    test_left_alone();
+    test_append();
+    test_invalid();
+    return test::result();
+}
@@ -0,0 +1,182 @@
+// Tests of federation: the duplicate filter's sliding window, two servers relaying a room's
+// messages to each other's members and to no one else, relayed sender ids that direct messages
+// cannot reach, and fan-out timing with a remote subscriber
+
+#include "Check.h"
+#include "TestClient.h"
+#include "server/Federation.h"
+#include "common/Protocol.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+using test::Received;
+using test::RunningServer;
+using test::TestClient;
+
+namespace {
+    /**
+     * New numbers are accepted once, in any order within the window; older ones count as seen
+     */
+    void test_sequence_window() {
+        SequenceWindow window;
+        CHECK(window.accept(1) && window.accept(2) && window.accept(5));
+        CHECK(!window.accept(5) && !window.accept(2));
+        CHECK(window.accept(4) && window.accept(3) && !window.accept(4));
+
+        // Moving the window forward keeps what is still inside it
+        uint64_t top = 5 + SequenceWindow::kWindow - 1;
+        CHECK(window.accept(top) && !window.accept(5) && window.accept(6));
+        CHECK(window.accept(top + 1) && !window.accept(5) && !window.accept(6));
+
+        // A jump past the whole window forgets everything, and anything behind it is too old
+        uint64_t jump = top + 10 * SequenceWindow::kWindow;
+        CHECK(window.accept(jump) && window.accept(jump - 1) && !window.accept(jump - 1));
+        CHECK(!window.accept(jump - SequenceWindow::kWindow) && window.accept(jump - SequenceWindow::kWindow + 1));
+        CHECK(!window.accept(top + 1));
+    }
+
+    /**
+     * Settings for one node of a two-node federation
+     */
+    ServerConfig node_config(ServerMode mode, uint32_t node_id, int federation_port, int peer_port) {
+        ServerConfig config;
+        config.mode = mode;
+        config.threads = 2;
+        config.node_id = node_id;
+        config.federation_port = federation_port;
+        config.peers.push_back("127.0.0.1:" + std::to_string(peer_port));
+        return config;
+    }
+
+    /**
+     * Sends probes to a room until one reaches a member on the other node, which shows the
+     * subscription arrived; the probes that made it are read
+     */
+    bool subscribed(TestClient& sender, TestClient& member, const std::string& room) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5 * test::kReceiveTimeoutMs);
+        while (std::chrono::steady_clock::now() < deadline) {
+            sender.send(MessageType::RoomMessage, encode_room_payload(room, "probe"));
+            if (!member.quiet()) {
+                sender.send(MessageType::RoomMessage, encode_room_payload(room, "probed"));
+                Received frame;
+                while (member.receive(frame)) {
+                    if (frame.payload == encode_room_payload(room, "probed")) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Room messages reach the members on the other node, stamped by their origin, and only them;
+     * each is delivered once although both nodes are linked in both directions. Relayed sender ids
+     * are marked, and a direct message to one is refused rather than given to a local client that
+     * has the same id on this node
+     */
+    void test_relay(ServerMode mode) {
+        int first_federation = test::free_port();
+        int second_federation = test::free_port();
+        RunningServer first(node_config(mode, 1, first_federation, second_federation));
+        RunningServer second(node_config(mode, 2, second_federation, first_federation));
+        auto alice = first.connect();
+        auto bob = second.connect();
+        auto carol = second.connect();
+        alice->send(MessageType::Join, "dev");
+        bob->send(MessageType::Join, "dev");
+        CHECK(alice->sync() && bob->sync());
+        CHECK(subscribed(*alice, *bob, "dev"));
+        CHECK(carol->quiet());
+
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "across"));
+        Received frame;
+        CHECK(bob->receive(frame) && frame.header.type == MessageType::RoomMessage);
+        CHECK(frame.payload == encode_room_payload("dev", "across") && (frame.header.sender_id & kRelayedSenderBit));
+        CHECK(alice->quiet() && carol->quiet());
+
+        // Alice and bob were the first clients of their nodes, so they share an id
+        bob->send(MessageType::Direct, encode_direct_payload(frame.header.sender_id, "reply"));
+        CHECK(bob->receive(frame) && frame.header.type == MessageType::Notice &&
+              frame.payload.find("another node") != std::string::npos);
+        CHECK(alice->quiet() && carol->quiet());
+
+        // Every client starts in the lobby, so both nodes subscribe to it
+        carol->send(MessageType::Chat, "lobby");
+        CHECK(alice->receive(frame) && frame.header.type == MessageType::Chat && frame.payload == "lobby");
+        CHECK(bob->receive(frame) && frame.payload == "lobby");
+        CHECK(alice->quiet() && bob->quiet() && carol->quiet());
+    }
+
+    /**
+     * Number of fan-out measurements a server has recorded so far
+     */
+    double fanout_count(RunningServer& running) {
+        const std::string name = "\nquickchat_fanout_latency_seconds_count ";
+        std::string text = running.server->metrics_text();
+        size_t line = text.find(name);
+        return line == std::string::npos ? -1 : std::stod(text.substr(line + name.size()));
+    }
+
+    /**
+     * A broadcast relayed to a subscribed peer is still measured exactly once on its origin node,
+     * however long the relay takes
+     */
+    void test_fanout_metrics(ServerMode mode) {
+        constexpr int kMessages = 20;
+        int first_federation = test::free_port();
+        int second_federation = test::free_port();
+        RunningServer first(node_config(mode, 1, first_federation, second_federation));
+        RunningServer second(node_config(mode, 2, second_federation, first_federation));
+        auto alice = first.connect();
+        auto dave = first.connect();
+        auto bob = second.connect();
+        for (auto* client : {alice.get(), dave.get(), bob.get()}) {
+            client->send(MessageType::Join, "dev");
+            CHECK(client->sync());
+        }
+        CHECK(subscribed(*alice, *bob, "dev"));
+
+        // Wait for the probes' measurements to settle before counting
+        double before = fanout_count(first);
+        for (double settled = -1; settled != before;) {
+            settled = before;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            before = fanout_count(first);
+        }
+
+        std::string timed = encode_room_payload("dev", "timed");
+        for (int i = 0; i < kMessages; ++i) {
+            alice->send(MessageType::RoomMessage, timed);
+        }
+        // Dave, local to alice, also still has the probes to read
+        Received frame;
+        int local = 0;
+        int remote = 0;
+        while (local < kMessages && dave->receive(frame)) {
+            local += frame.payload == timed;
+        }
+        while (remote < kMessages && bob->receive(frame) && frame.payload == timed) {
+            ++remote;
+        }
+        CHECK(local == kMessages && remote == kMessages);
+
+        double after = fanout_count(first);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        while (after < before + kMessages && std::chrono::steady_clock::now() < deadline) {
+            after = fanout_count(first);
+        }
+        CHECK(after == before + kMessages);
+    }
+}
+
+int main() {
+    test_sequence_window();
+    for (ServerMode mode : {ServerMode::Threaded, ServerMode::Epoll, ServerMode::Sharded}) {
+        test_relay(mode);
+        test_fanout_metrics(mode);
+    }
+    return test::result();
+}
@@ -0,0 +1,100 @@
+// Tests of the socket handoff between two server instances: clients stay connected with their ids
+// and rooms, half-received frames are completed, and the successor serves new clients and the log
+
+#include "Check.h"
+#include "TestClient.h"
+#include "common/Protocol.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+using test::Received;
+using test::RunningServer;
+using test::TestClient;
+
+namespace {
+    /**
+     * Connects a client to a port the test server took over, and waits until it was registered
+     */
+    std::unique_ptr<TestClient> connect_to(int port) {
+        auto client = std::make_unique<TestClient>(port);
+        CHECK(client->sync());
+        return client;
+    }
+
+    /**
+     * A successor started on the same handoff socket takes over the clients of a running server;
+     * they keep talking to each other as before, and sequence numbers keep increasing
+     */
+    void test_takeover(ServerMode mode) {
+        test::TemporaryDirectory directory;
+        ServerConfig config;
+        config.mode = mode;
+        config.threads = 3;
+        config.handoff_path = directory.path + "/handoff.sock";
+        config.log_directory = directory.path + "/log";
+        config.log_sync_ms = 10;
+        RunningServer previous(config);
+        auto alice = previous.connect();
+        auto bob = previous.connect();
+        alice->send(MessageType::Join, "dev");
+        bob->send(MessageType::Join, "dev");
+        CHECK(alice->sync() && bob->sync());
+
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "before"));
+        Received before;
+        CHECK(bob->receive(before) && before.payload == encode_room_payload("dev", "before"));
+
+        // Half a frame is in flight when the server changes; the rest follows afterwards
+        std::string frame;
+        std::string text = encode_room_payload("dev", "across the restart");
+        append_frame(frame, MessageType::RoomMessage, 0, 0, text.data(), text.size());
+        alice->send_raw(frame.substr(0, 9));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        RunningServer successor(config); // Returns once the previous server handed everything over
+        previous.stop();
+        alice->send_raw(frame.substr(9));
+        Received after;
+        CHECK(bob->receive(after) && after.payload == text);
+        CHECK(after.header.sender_id == before.header.sender_id && after.header.sequence > before.header.sequence);
+        CHECK(alice->quiet());
+
+        // The listening socket moved too, and the successor reopened the message log
+        auto carol = connect_to(previous.port);
+        carol->send(MessageType::Join, "dev");
+        bob->send(MessageType::RoomMessage, encode_room_payload("dev", "welcome"));
+        Received frame_received;
+        CHECK(carol->receive(frame_received) && frame_received.payload == encode_room_payload("dev", "welcome"));
+        CHECK(alice->receive(frame_received) && frame_received.payload == encode_room_payload("dev", "welcome"));
+
+        carol->send(MessageType::History, encode_history_payload("dev", 0));
+        CHECK(carol->receive(frame_received) && frame_received.payload == before.payload);
+        CHECK(frame_received.header.sequence == before.header.sequence);
+    }
+
+    /**
+     * A server whose handoff socket nobody listens on starts from scratch
+     */
+    void test_no_predecessor() {
+        test::TemporaryDirectory directory;
+        ServerConfig config;
+        config.mode = ServerMode::Epoll;
+        config.handoff_path = directory.path + "/handoff.sock";
+        RunningServer running(config);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        alice->send(MessageType::Chat, "fresh");
+        Received frame;
+        CHECK(bob->receive(frame) && frame.payload == "fresh");
+    }
+}
+
+int main() {
+    test_no_predecessor();
+    for (ServerMode mode : {ServerMode::Epoll, ServerMode::Sharded}) {
+        test_takeover(mode);
+    }
+    return test::result();
+}
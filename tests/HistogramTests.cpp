@@ -0,0 +1,106 @@
+// Tests of the latency histogram: exact small values, the relative error bound on large ones,
+// percentile ranks, batched recording, and merging the histograms of several threads
+
+#include "Check.h"
+#include "common/Histogram.h"
+#include <cstdint>
+
+namespace {
+    /**
+     * Checks that a reported value is no lower than the true one and at most ~3% above it
+     */
+    bool close_above(uint64_t reported, uint64_t actual) {
+        return reported >= actual && reported - actual <= actual / 32 + 1;
+    }
+
+    /**
+     * An empty histogram reports zeros
+     */
+    void test_empty() {
+        Histogram histogram;
+        CHECK(histogram.count() == 0 && histogram.min() == 0 && histogram.max() == 0);
+        CHECK(histogram.mean() == 0.0 && histogram.percentile(99) == 0);
+    }
+
+    /**
+     * Values below the sub-bucket count are exact; min, max and mean track the raw values
+     */
+    void test_small_values() {
+        Histogram histogram;
+        for (uint64_t value = 1; value <= 10; ++value) {
+            histogram.record(value);
+        }
+        CHECK(histogram.count() == 10 && histogram.min() == 1 && histogram.max() == 10);
+        CHECK(histogram.mean() == 5.5);
+        CHECK(histogram.percentile(50) == 5 && histogram.percentile(90) == 9 && histogram.percentile(100) == 10);
+        CHECK(histogram.percentile(0) == 1);
+    }
+
+    /**
+     * Large values land in buckets whose upper bound is within the error bound, at any magnitude,
+     * and a percentile never exceeds the largest recorded value
+     */
+    void test_relative_error() {
+        bool bounded = true;
+        for (uint64_t value = 33; value < (uint64_t(1) << 62); value = value * 3 + 7) {
+            Histogram histogram;
+            histogram.record(value);
+            histogram.record(value + value / 64);
+            bounded = bounded && close_above(histogram.percentile(50), value);
+            bounded = bounded && histogram.percentile(100) == value + value / 64;
+        }
+        CHECK(bounded);
+
+        Histogram uniform;
+        for (uint64_t value = 1; value <= 100000; ++value) {
+            uniform.record(value);
+        }
+        CHECK(close_above(uniform.percentile(50), 50000) && close_above(uniform.percentile(99), 99000));
+        CHECK(close_above(uniform.percentile(99.9), 99900) && uniform.percentile(100) == 100000);
+    }
+
+    /**
+     * Merging gives the same result as recording everything into one histogram
+     */
+    void test_merge() {
+        Histogram first;
+        Histogram second;
+        Histogram combined;
+        for (uint64_t value = 1; value <= 5000; ++value) {
+            (value % 3 == 0 ? first : second).record(value * 17);
+            combined.record(value * 17);
+        }
+        first.merge(second);
+        CHECK(first.count() == combined.count() && first.min() == combined.min() && first.max() == combined.max());
+        CHECK(first.mean() == combined.mean());
+        bool same = true;
+        for (double percentile : {1.0, 25.0, 50.0, 90.0, 99.0, 99.9}) {
+            same = same && first.percentile(percentile) == combined.percentile(percentile);
+        }
+        CHECK(same);
+    }
+
+    /**
+     * Recording a value several times at once equals recording it repeatedly
+     */
+    void test_occurrences() {
+        Histogram batched;
+        Histogram repeated;
+        batched.record(1000, 4);
+        batched.record(70, 0);
+        for (int i = 0; i < 4; ++i) {
+            repeated.record(1000);
+        }
+        CHECK(batched.count() == 4 && batched.min() == 1000 && batched.mean() == 1000.0);
+        CHECK(batched.percentile(50) == repeated.percentile(50) && batched.max() == repeated.max());
+    }
+}
+
+int main() {
+    test_empty();
+    test_small_values();
+    test_relative_error();
+    test_merge();
+    test_occurrences();
+    return test::result();
+}
@@ -0,0 +1,188 @@
+// Tests of the persistent message log: replay from a sequence number, segment rollover, recovery
+// of a cut-off last segment, and chunks that always end on frame boundaries
+
+#include "Check.h"
+#include "TestClient.h"
+#include "server/MessageLog.h"
+#include "common/Protocol.h"
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using test::TemporaryDirectory;
+
+namespace {
+    // Frames big enough that a test fills a 64 MiB segment with a few thousand of them
+    constexpr size_t kLargeText = kMaxPayloadSize - 64;
+
+    /**
+     * Encodes a frame as the server relays it to a room
+     */
+    MessageRef room_frame(const std::string& room, uint64_t sequence, const std::string& text) {
+        FrameHeader header;
+        header.type = MessageType::RoomMessage;
+        header.sender_id = 7;
+        header.sequence = sequence;
+        std::string payload = encode_room_payload(room, text);
+        return encode_frame(header, payload.data(), payload.size());
+    }
+
+    /**
+     * Takes a whole replay and returns the sequence numbers of its frames
+     * Sets aligned to false if a chunk does not consist of whole frames, or is larger than
+     * max_bytes without being a single frame
+     */
+    std::vector<uint64_t> replayed(HistoryCursor& cursor, size_t max_bytes, bool& aligned) {
+        std::vector<uint64_t> sequences;
+        while (MessageRef chunk = cursor.next(max_bytes)) {
+            size_t offset = 0;
+            size_t frames = 0;
+            while (offset + kFrameHeaderSize <= chunk.size()) {
+                sequences.push_back(read_u64(chunk.data() + offset + 12));
+                offset += kFrameHeaderSize + read_u32(chunk.data() + offset);
+                ++frames;
+            }
+            aligned = aligned && offset == chunk.size() && (chunk.size() <= max_bytes || frames == 1);
+        }
+        return sequences;
+    }
+
+    std::vector<uint64_t> range(uint64_t first, uint64_t last) {
+        std::vector<uint64_t> sequences;
+        for (uint64_t sequence = first; sequence <= last; ++sequence) {
+            sequences.push_back(sequence);
+        }
+        return sequences;
+    }
+
+    /**
+     * Checks that the end marker names the room and the last sequence number the replay covered
+     */
+    bool marks_end(const HistoryCursor& cursor, const std::string& room, uint64_t sequence) {
+        MessageRef marker = cursor.end_marker();
+        std::string payload = encode_history_payload(room, sequence);
+        return marker.size() == kFrameHeaderSize + payload.size() &&
+               static_cast<MessageType>(marker.data()[4]) == MessageType::History &&
+               std::string(marker.data() + kFrameHeaderSize, payload.size()) == payload;
+    }
+
+    /**
+     * Replays a room from any point, only with the room's own frames; the log is persisted on
+     * destruction and numbering continues after the highest stored sequence number
+     */
+    void test_replay() {
+        TemporaryDirectory directory;
+        {
+            MessageLog log(directory.path, 10);
+            CHECK(log.last_sequence() == 0);
+            for (uint64_t sequence = 1; sequence <= 300; ++sequence) {
+                log.append(room_frame(sequence % 3 == 0 ? "ops" : "dev", sequence, "message " + std::to_string(sequence)));
+            }
+
+            // Frames show up in replays once the log thread wrote them
+            std::vector<uint64_t> ops;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+            bool aligned = true;
+            while (ops.size() < 100 && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                ops = replayed(*log.replay("ops", 0), 4096, aligned);
+            }
+            CHECK(ops.size() == 100 && ops.front() == 3 && ops.back() == 300 && aligned);
+        }
+
+        MessageLog log(directory.path, 10);
+        CHECK(log.last_sequence() == 300);
+        std::vector<uint64_t> dev;
+        std::vector<uint64_t> dev_after_250;
+        for (uint64_t sequence = 1; sequence <= 300; ++sequence) {
+            if (sequence % 3 != 0) {
+                dev.push_back(sequence);
+                if (sequence > 250) {
+                    dev_after_250.push_back(sequence);
+                }
+            }
+        }
+        // The marker carries the room's own last sequence number, or since if that is higher
+        bool aligned = true;
+        auto cursor = log.replay("dev", 0);
+        CHECK(replayed(*cursor, 4096, aligned) == dev && aligned && marks_end(*cursor, "dev", 299));
+        cursor = log.replay("dev", 250);
+        CHECK(replayed(*cursor, 1, aligned) == dev_after_250 && aligned);
+        cursor = log.replay("dev", 300);
+        CHECK(replayed(*cursor, 4096, aligned).empty() && marks_end(*cursor, "dev", 300));
+        cursor = log.replay("nowhere", 5);
+        CHECK(!cursor->next(4096) && cursor->next_frame_size() == 0 && marks_end(*cursor, "nowhere", 5));
+    }
+
+    /**
+     * A frame that does not fit the current segment starts the next one; replays span both, from
+     * the start and from inside either segment, also after reopening the log
+     */
+    void test_rollover() {
+        TemporaryDirectory directory;
+        std::string text(kLargeText, 'x');
+        size_t frame_size = kFrameHeaderSize + encode_room_payload("big", text).size();
+        uint64_t frames = 64 * 1024 * 1024 / frame_size + 200;
+        {
+            MessageLog log(directory.path, 50);
+            for (uint64_t sequence = 1; sequence <= frames; ++sequence) {
+                log.append(room_frame("big", sequence, text));
+            }
+        }
+        // Room directories are named by the hex bytes of the room name
+        std::string room_directory = directory.path + "/626967/";
+        CHECK(std::filesystem::exists(room_directory + "0000000000.log"));
+        CHECK(std::filesystem::exists(room_directory + "0000000001.log"));
+        CHECK(std::filesystem::file_size(room_directory + "0000000000.log") <= 64 * 1024 * 1024);
+
+        MessageLog log(directory.path, 50);
+        CHECK(log.last_sequence() == frames);
+        bool aligned = true;
+        CHECK(replayed(*log.replay("big", 0), 64 * 1024, aligned) == range(1, frames) && aligned);
+        CHECK(replayed(*log.replay("big", 1000), 64 * 1024, aligned) == range(1001, frames) && aligned);
+        CHECK(replayed(*log.replay("big", frames - 50), 64 * 1024, aligned) == range(frames - 49, frames));
+    }
+
+    /**
+     * A write cut off by a crash is dropped when the log is opened again, and new frames follow
+     * the last complete one
+     */
+    void test_recovery() {
+        TemporaryDirectory directory;
+        {
+            MessageLog log(directory.path, 10);
+            for (uint64_t sequence = 1; sequence <= 50; ++sequence) {
+                log.append(room_frame("dev", sequence, "before"));
+            }
+        }
+        std::string segment = directory.path + "/646576/0000000000.log";
+        std::string partial = std::string(room_frame("dev", 51, "cut off").data(), kFrameHeaderSize + 3);
+        int fd = open(segment.c_str(), O_WRONLY | O_APPEND);
+        CHECK(fd >= 0 && write(fd, partial.data(), partial.size()) == static_cast<ssize_t>(partial.size()));
+        close(fd);
+
+        {
+            MessageLog log(directory.path, 10);
+            CHECK(log.last_sequence() == 50);
+            for (uint64_t sequence = 51; sequence <= 60; ++sequence) {
+                log.append(room_frame("dev", sequence, "after"));
+            }
+        }
+        MessageLog log(directory.path, 10);
+        bool aligned = true;
+        CHECK(log.last_sequence() == 60);
+        CHECK(replayed(*log.replay("dev", 0), 4096, aligned) == range(1, 60) && aligned);
+        CHECK(replayed(*log.replay("dev", 45), 4096, aligned) == range(46, 60) && aligned);
+    }
+}
+
+int main() {
+    test_replay();
+    test_rollover();
+    test_recovery();
+    return test::result();
+}
@@ -0,0 +1,163 @@
+// Tests of the server metrics: fan-out timing through the message release observer, write queue
+// gauges, the Prometheus text rendering, and the admin endpoint serving it over HTTP
+
+#include "Check.h"
+#include "TestClient.h"
+#include "server/Metrics.h"
+#include "server/ServerContext.h"
+#include "server/AdminServer.h"
+#include "server/WriteQueue.h"
+#include "common/MessageBuffer.h"
+#include "common/Protocol.h"
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace {
+    /**
+     * Finds the value of one sample line of a rendered exposition
+     * @param sample Metric name including its labels, e.g. quickchat_sent_bytes_total{shard="1"}
+     * @return The value, or -1 if the line is missing
+     */
+    double sample_value(const std::string& text, const std::string& sample) {
+        size_t start = text.find("\n" + sample + " ");
+        if (start == std::string::npos) {
+            return -1;
+        }
+        return std::stod(text.substr(start + sample.size() + 2));
+    }
+
+    /**
+     * Sends one HTTP request to a local port and returns the whole response
+     */
+    std::string http_get(int port, const std::string& path) {
+        int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        std::string response;
+        if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            std::string request = "GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+            send(socket_fd, request.data(), request.size(), MSG_NOSIGNAL);
+            char buffer[4096];
+            ssize_t received;
+            while ((received = recv(socket_fd, buffer, sizeof(buffer), 0)) > 0) {
+                response.append(buffer, static_cast<size_t>(received));
+            }
+        }
+        close(socket_fd);
+        return response;
+    }
+
+    /**
+     * A timed message is measured once, when its last handle goes, into the releasing thread's slot;
+     * untimed messages and threads without a slot are not measured
+     */
+    void test_fanout_timing() {
+        Metrics metrics(2);
+        Metrics::attach_thread(&metrics.shard(1));
+
+        MessageRef timed = MessageRef::allocate(16);
+        timed.set_origin_time(Metrics::now() - 5000000);
+        MessageRef copy = timed;
+        timed = MessageRef();
+        CHECK(metrics.render(OverloadCounters()).find("quickchat_fanout_latency_seconds_count 0\n") != std::string::npos);
+        copy = MessageRef();
+
+        MessageRef untimed = MessageRef::allocate(16);
+        untimed = MessageRef();
+        Metrics::attach_thread(nullptr);
+        MessageRef unobserved = MessageRef::allocate(16);
+        unobserved.set_origin_time(Metrics::now());
+        unobserved = MessageRef();
+
+        std::string text = metrics.render(OverloadCounters());
+        CHECK(sample_value(text, "quickchat_fanout_latency_seconds_count") == 1);
+        double seconds = sample_value(text, "quickchat_fanout_latency_seconds_sum");
+        CHECK(seconds >= 0.005 && seconds < 1.0);
+        CHECK(sample_value(text, "quickchat_fanout_latency_seconds{quantile=\"0.99\"}") >= 0.005);
+    }
+
+    /**
+     * A write queue keeps its slot's gauges equal to what it holds and counts what it sent
+     */
+    void test_write_queue_gauges() {
+        ShardMetrics slot;
+        WriteQueue queue(4, 1024 * 1024, OverflowPolicy::DropOldest, &slot);
+        FrameHeader header;
+        MessageRef frame = encode_frame(header, "gauge", 5);
+        size_t evicted;
+        for (int i = 0; i < 6; ++i) {
+            queue.push(frame, evicted);
+        }
+        CHECK(slot.queued_messages.load() == 4 && slot.queued_bytes.load() == 4 * static_cast<int64_t>(frame.size()));
+
+        queue.advance(frame.size() + 2);
+        CHECK(slot.messages_sent.load() == 1 && slot.bytes_sent.load() == frame.size() + 2);
+        CHECK(slot.queued_messages.load() == 3 && static_cast<size_t>(slot.queued_bytes.load()) == queue.bytes());
+
+        queue.clear();
+        CHECK(slot.queued_messages.load() == 0 && slot.queued_bytes.load() == 0);
+    }
+
+    /**
+     * Every family has its HELP and TYPE lines, per-shard counters carry a shard label, and the
+     * overload counters and the fan-out summary appear once for the whole server
+     */
+    void test_render() {
+        Metrics metrics(3);
+        ShardMetrics::add(metrics.shard(0).connections_accepted, 5);
+        ShardMetrics::add(metrics.shard(0).connections_closed, 2);
+        ShardMetrics::add(metrics.shard(2).bytes_received, 12345);
+        OverloadCounters overload;
+        overload.dropped_oldest = 7;
+        overload.disconnected = 1;
+
+        std::string text = metrics.render(overload);
+        CHECK(text.find("# HELP quickchat_connections_accepted_total ") != std::string::npos);
+        CHECK(text.find("# TYPE quickchat_connections_accepted_total counter\n") != std::string::npos);
+        CHECK(text.find("# TYPE quickchat_queued_bytes gauge\n") != std::string::npos);
+        CHECK(text.find("# TYPE quickchat_fanout_latency_seconds summary\n") != std::string::npos);
+        CHECK(sample_value(text, "quickchat_connections_accepted_total{shard=\"0\"}") == 5);
+        CHECK(sample_value(text, "quickchat_connections_active{shard=\"0\"}") == 3);
+        CHECK(sample_value(text, "quickchat_received_bytes_total{shard=\"2\"}") == 12345);
+        CHECK(sample_value(text, "quickchat_received_bytes_total{shard=\"1\"}") == 0);
+        CHECK(sample_value(text, "quickchat_received_bytes_total{shard=\"3\"}") == -1);
+        CHECK(sample_value(text, "quickchat_messages_dropped_total{policy=\"drop-oldest\"}") == 7);
+        CHECK(sample_value(text, "quickchat_messages_dropped_total{policy=\"drop-newest\"}") == 0);
+        CHECK(sample_value(text, "quickchat_slow_consumer_disconnects_total") == 1);
+        CHECK(sample_value(text, "quickchat_fanout_latency_seconds{quantile=\"0.999\"}") == 0);
+    }
+
+    /**
+     * The admin endpoint serves the rendered text on /metrics and / and nothing else
+     */
+    void test_admin_server() {
+        int port = test::free_port();
+        int renders = 0;
+        AdminServer admin(port, [&renders] { return "metrics " + std::to_string(++renders) + "\n"; });
+        admin.start();
+
+        std::string response = http_get(port, "/metrics");
+        CHECK(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+        CHECK(response.find("Content-Length: 10\r\n") != std::string::npos);
+        CHECK(response.size() > 10 && response.compare(response.size() - 10, 10, "metrics 1\n") == 0);
+        CHECK(http_get(port, "/").find("\r\n\r\nmetrics 2\n") != std::string::npos);
+        CHECK(http_get(port, "/secrets").compare(0, 22, "HTTP/1.0 404 Not Found") == 0 && renders == 2);
+
+        admin.stop();
+        admin.stop();
+        CHECK(http_get(port, "/metrics").empty());
+    }
+}
+
+int main() {
+    test_fanout_timing();
+    test_write_queue_gauges();
+    test_render();
+    test_admin_server();
+    return test::result();
+}
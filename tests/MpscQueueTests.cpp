@@ -0,0 +1,92 @@
+// Tests of the lock-free queue that carries work between reactor threads
+// Values must come out in push order per producer, none may be lost, and leftovers are freed
+
+#include "Check.h"
+#include "server/MpscQueue.h"
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+    /**
+     * A single producer's values come out in the order they went in
+     */
+    void test_fifo_order() {
+        MpscQueue<int> queue;
+        int value = 0;
+        CHECK(!queue.pop(value));
+
+        for (int i = 1; i <= 5; ++i) {
+            queue.push(i);
+        }
+        for (int i = 1; i <= 5; ++i) {
+            CHECK(queue.pop(value) && value == i);
+        }
+        CHECK(!queue.pop(value));
+
+        // The queue keeps working once drained
+        queue.push(6);
+        CHECK(queue.pop(value) && value == 6);
+    }
+
+    /**
+     * Several producers push while the consumer pops: every value arrives exactly once, and
+     * each producer's values keep their relative order
+     */
+    void test_concurrent_producers() {
+        constexpr int kProducers = 4;
+        constexpr int kPerProducer = 20000;
+        MpscQueue<int> queue;
+
+        std::vector<std::thread> producers;
+        for (int producer = 0; producer < kProducers; ++producer) {
+            producers.emplace_back([&queue, producer] {
+                for (int i = 0; i < kPerProducer; ++i) {
+                    queue.push(producer * kPerProducer + i);
+                }
+            });
+        }
+
+        std::vector<int> next(kProducers, 0);
+        int received = 0;
+        bool ordered = true;
+        while (received < kProducers * kPerProducer) {
+            int value;
+            if (!queue.pop(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+            int producer = value / kPerProducer;
+            ordered = ordered && value % kPerProducer == next[producer];
+            next[producer] = value % kPerProducer + 1;
+            ++received;
+        }
+        for (auto& thread : producers) {
+            thread.join();
+        }
+        CHECK(ordered);
+        int value;
+        CHECK(!queue.pop(value));
+    }
+
+    /**
+     * Values still queued when the queue is destroyed are released with it
+     */
+    void test_destroy_releases_values() {
+        auto tracked = std::make_shared<int>(42);
+        std::weak_ptr<int> watcher = tracked;
+        {
+            MpscQueue<std::shared_ptr<int>> queue;
+            queue.push(std::move(tracked));
+            queue.push(std::make_shared<int>(7));
+        }
+        CHECK(watcher.expired());
+    }
+}
+
+int main() {
+    test_fifo_order();
+    test_concurrent_producers();
+    test_destroy_releases_values();
+    return test::result();
+}
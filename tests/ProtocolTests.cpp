@@ -0,0 +1,162 @@
+// Tests of the wire protocol: header encoding, and the incremental parser over the receive ring,
+// including frames that arrive in pieces or wrap around the end of the ring
+
+#include "Check.h"
+#include "common/Protocol.h"
+#include "common/RingBuffer.h"
+#include <string>
+#include <cstring>
+
+namespace {
+    /**
+     * Copies bytes into the free space of a ring, as readv() would
+     */
+    void write_bytes(RingBuffer& ring, const std::string& bytes) {
+        struct iovec segments[2];
+        int count = ring.free_segments(segments);
+        size_t copied = 0;
+        for (int i = 0; i < count && copied < bytes.size(); ++i) {
+            size_t length = std::min(segments[i].iov_len, bytes.size() - copied);
+            memcpy(segments[i].iov_base, bytes.data() + copied, length);
+            copied += length;
+        }
+        CHECK(copied == bytes.size());
+        ring.commit(copied);
+    }
+
+    /**
+     * Encodes a Chat frame with the given payload
+     */
+    std::string chat_frame(const std::string& payload, uint32_t sender_id = 0, uint64_t sequence = 0) {
+        std::string frame;
+        append_frame(frame, MessageType::Chat, sender_id, sequence, payload.data(), payload.size());
+        return frame;
+    }
+
+    /**
+     * Every header field survives a round trip, big-endian on the wire
+     */
+    void test_header_round_trip() {
+        std::string frame = chat_frame("abc", 0x01020304, 0x0a0b0c0d0e0f1011ULL);
+        CHECK(frame.size() == kFrameHeaderSize + 3);
+        CHECK(frame.compare(0, 4, std::string("\0\0\0\x03", 4)) == 0);
+        CHECK(frame.compare(8, 4, "\x01\x02\x03\x04") == 0);
+
+        FrameHeader header;
+        CHECK(decode_frame_header(frame.data(), header));
+        CHECK(header.length == 3 && header.type == MessageType::Chat && header.flags == 0);
+        CHECK(header.sender_id == 0x01020304 && header.sequence == 0x0a0b0c0d0e0f1011ULL);
+        CHECK(frame.substr(kFrameHeaderSize) == "abc");
+    }
+
+    /**
+     * Headers with another protocol version or a nonzero reserved byte are rejected
+     */
+    void test_header_validation() {
+        FrameHeader header;
+        std::string frame = chat_frame("x");
+        frame[6] = static_cast<char>(kProtocolVersion + 1);
+        CHECK(!decode_frame_header(frame.data(), header));
+
+        frame = chat_frame("x");
+        frame[7] = 1;
+        CHECK(!decode_frame_header(frame.data(), header));
+    }
+
+    /**
+     * A frame that arrives a few bytes at a time is reported once it is complete
+     */
+    void test_partial_frames() {
+        RingBuffer ring(64);
+        FrameParser parser;
+        Frame frame;
+        std::string bytes = chat_frame("hello world");
+
+        write_bytes(ring, bytes.substr(0, 7));
+        CHECK(parser.next(ring, frame) == ParseStatus::NeedMore);
+        write_bytes(ring, bytes.substr(7, 20));
+        CHECK(parser.next(ring, frame) == ParseStatus::NeedMore);
+        write_bytes(ring, bytes.substr(27));
+        CHECK(parser.next(ring, frame) == ParseStatus::Ready);
+        CHECK(frame.payload() == "hello world" && frame.second == nullptr);
+        parser.release(ring, frame);
+        CHECK(ring.size() == 0);
+        CHECK(parser.next(ring, frame) == ParseStatus::NeedMore);
+    }
+
+    /**
+     * Several frames read at once come out one by one, never merged
+     */
+    void test_back_to_back_frames() {
+        RingBuffer ring(128);
+        FrameParser parser;
+        Frame frame;
+        write_bytes(ring, chat_frame("one") + chat_frame("") + chat_frame("three"));
+
+        for (const char* expected : {"one", "", "three"}) {
+            CHECK(parser.next(ring, frame) == ParseStatus::Ready && frame.payload() == expected);
+            parser.release(ring, frame);
+        }
+        CHECK(parser.next(ring, frame) == ParseStatus::NeedMore);
+    }
+
+    /**
+     * A header straddling the end of the ring is decoded, and a payload wrapping around it is
+     * described by two pieces without being copied
+     */
+    void test_frames_across_wrap() {
+        RingBuffer ring(128);
+        FrameParser parser;
+        Frame frame;
+
+        // 80 bytes, then a second frame from offset 80 whose payload spans offsets 100..139
+        std::string first = chat_frame(std::string(60, 'a'));
+        std::string second = chat_frame(std::string(28, 'b') + std::string(12, 'c'));
+        write_bytes(ring, first + second.substr(0, 10));
+        CHECK(parser.next(ring, frame) == ParseStatus::Ready && frame.payload_size() == 60);
+        parser.release(ring, frame);
+
+        write_bytes(ring, second.substr(10));
+        CHECK(parser.next(ring, frame) == ParseStatus::Ready);
+        CHECK(std::string(frame.first, frame.first_length) == std::string(28, 'b'));
+        CHECK(frame.second != nullptr && std::string(frame.second, frame.second_length) == std::string(12, 'c'));
+        CHECK(frame.payload() == std::string(28, 'b') + std::string(12, 'c'));
+        parser.release(ring, frame);
+
+        // Here the header itself wraps: 14 bytes at the end of the storage, 6 at the start
+        RingBuffer small(64);
+        write_bytes(small, chat_frame(std::string(30, 'd')) + chat_frame("wrapped").substr(0, 4));
+        CHECK(parser.next(small, frame) == ParseStatus::Ready);
+        parser.release(small, frame);
+        write_bytes(small, chat_frame("wrapped").substr(4));
+        CHECK(parser.next(small, frame) == ParseStatus::Ready && frame.payload() == "wrapped");
+    }
+
+    /**
+     * A payload longer than the protocol allows, or an invalid header, ends parsing for good
+     */
+    void test_invalid_frames() {
+        RingBuffer ring(64);
+        FrameParser parser;
+        Frame frame;
+        std::string oversized = chat_frame("");
+        oversized[0] = '\x01'; // 16 MB payload
+        write_bytes(ring, oversized);
+        CHECK(parser.next(ring, frame) == ParseStatus::Invalid);
+
+        RingBuffer other(64);
+        FrameParser fresh;
+        write_bytes(other, std::string(kFrameHeaderSize, '\xff'));
+        CHECK(fresh.next(other, frame) == ParseStatus::Invalid);
+    }
+}
+
+int main() {
+    test_header_round_trip();
+    test_header_validation();
+    test_partial_frames();
+    test_back_to_back_frames();
+    test_frames_across_wrap();
+    test_invalid_frames();
+    return test::result();
+}
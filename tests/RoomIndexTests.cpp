@@ -0,0 +1,116 @@
+// Tests of the room subscription index: joining and leaving, the reverse index that makes leaving
+// O(1) staying correct as members are swapped around, and rooms disappearing once empty
+
+#include "Check.h"
+#include "server/RoomIndex.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+    /**
+     * Minimal member type with the reverse index RoomIndex expects
+     */
+    struct Member {
+        std::vector<RoomMembership> rooms;
+    };
+
+    /**
+     * Checks that a room holds exactly the given members, in any order, and that every member's
+     * reverse index points at its actual position
+     */
+    bool holds(const RoomIndex<Member>& index, const std::string& name, std::vector<Member*> expected) {
+        const std::vector<Member*>* members = index.members(name);
+        if (members == nullptr) {
+            return expected.empty();
+        }
+        std::vector<Member*> actual = *members;
+        for (size_t position = 0; position < actual.size(); ++position) {
+            bool found = false;
+            for (const RoomMembership& membership : actual[position]->rooms) {
+                found = found || membership.position == position;
+            }
+            if (!found || !index.contains(*actual[position], name)) {
+                return false;
+            }
+        }
+        std::sort(actual.begin(), actual.end());
+        std::sort(expected.begin(), expected.end());
+        return actual == expected;
+    }
+
+    /**
+     * Members can join several rooms once each and are found only where they joined
+     */
+    void test_join() {
+        RoomIndex<Member> index;
+        Member alice;
+        Member bob;
+        CHECK(index.members("dev") == nullptr);
+        CHECK(index.join(alice, "dev") && index.join(bob, "dev") && index.join(alice, "ops"));
+        CHECK(!index.join(alice, "dev"));
+        CHECK(holds(index, "dev", {&alice, &bob}) && holds(index, "ops", {&alice}));
+        CHECK(index.contains(alice, "ops") && !index.contains(bob, "ops") && !index.contains(bob, "nowhere"));
+        CHECK(alice.rooms.size() == 2 && bob.rooms.size() == 1);
+    }
+
+    /**
+     * Leaving swaps the last member into the freed slot; the moved member's entry follows it
+     */
+    void test_leave() {
+        RoomIndex<Member> index;
+        Member members[5];
+        for (Member& member : members) {
+            index.join(member, "dev");
+            index.join(member, "ops");
+        }
+        CHECK(index.leave(members[1], "dev") && !index.leave(members[1], "dev"));
+        CHECK(holds(index, "dev", {&members[0], &members[2], &members[3], &members[4]}));
+        // members[4] was moved into position 1; removing it relies on the patched entry
+        CHECK(index.leave(members[4], "dev") && index.leave(members[0], "dev"));
+        CHECK(holds(index, "dev", {&members[2], &members[3]}));
+        CHECK(holds(index, "ops", {&members[0], &members[1], &members[2], &members[3], &members[4]}));
+        CHECK(!index.leave(members[0], "nowhere"));
+    }
+
+    /**
+     * A room without members is forgotten, and its id is reused for the next new room
+     */
+    void test_empty_rooms() {
+        RoomIndex<Member> index;
+        Member alice;
+        Member bob;
+        index.join(alice, "dev");
+        index.join(bob, "ops");
+        index.leave_all(alice);
+        CHECK(alice.rooms.empty() && index.members("dev") == nullptr && !index.contains(alice, "dev"));
+
+        index.join(alice, "qa");
+        CHECK(alice.rooms.size() == 1 && alice.rooms[0].room == 0);
+        CHECK(holds(index, "qa", {&alice}) && holds(index, "ops", {&bob}) && index.members("dev") == nullptr);
+    }
+
+    /**
+     * Lookups stay exact among many rooms whose names share prefixes
+     */
+    void test_many_rooms() {
+        RoomIndex<Member> index;
+        Member members[40];
+        for (int i = 0; i < 40; ++i) {
+            index.join(members[i], "room" + std::to_string(i % 20));
+        }
+        bool exact = true;
+        for (int i = 0; i < 20; ++i) {
+            exact = exact && holds(index, "room" + std::to_string(i), {&members[i], &members[i + 20]});
+        }
+        CHECK(exact && index.members("room") == nullptr && index.members("room200") == nullptr);
+    }
+}
+
+int main() {
+    test_join();
+    test_leave();
+    test_empty_rooms();
+    test_many_rooms();
+    return test::result();
+}
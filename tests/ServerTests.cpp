@@ -0,0 +1,770 @@
+// End-to-end tests of the server over loopback TCP and in-process connections
+// Cover fan-out to the other clients, rooms and direct messages, in-process connections, history
+// replay, negotiated compression, clients coming and going, metrics, admission limits, heartbeats
+// and timeouts, setup failures, held-back output with a flush delay, output that backs up behind a
+// slow reader, the overflow policies for a reader that stops, and disconnects
+
+#include "Check.h"
+#include "TestClient.h"
+#include "server/Server.h"
+#include "server/IoUring.h"
+#include "server/Reactor.h"
+#include "common/Compression.h"
+#include "common/Protocol.h"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using test::Received;
+using test::RunningServer;
+using test::TestClient;
+
+namespace {
+    /**
+     * Settings for a server of the given mode and I/O backend
+     * Sharded servers get several shards, so the kernel spreads the clients of a test over them
+     * The queues are large enough that the slow-reader test never reaches their limits
+     */
+    ServerConfig config_for(ServerMode mode, IoBackend io_backend) {
+        ServerConfig config;
+        config.mode = mode;
+        config.io_backend = io_backend;
+        config.threads = 4;
+        config.max_queued_bytes = 8 * 1024 * 1024;
+        return config;
+    }
+
+    /**
+     * Largest payload a client may send, starting with its number so reordering shows
+     */
+    std::string numbered(int i) {
+        std::string payload = std::to_string(i) + ":";
+        payload.resize(kMaxPayloadSize, 'x');
+        return payload;
+    }
+
+    /**
+     * A Chat frame reaches every other client stamped with the sender's id and one sequence number,
+     * but is not echoed back to the sender
+     */
+    void test_broadcast(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        alice->send(MessageType::Chat, "hello");
+        Received first;
+        Received second;
+        CHECK(bob->receive(first) && first.header.type == MessageType::Chat && first.payload == "hello");
+        CHECK(carol->receive(second) && second.header.type == MessageType::Chat && second.payload == "hello");
+        CHECK(first.header.sender_id != 0 && first.header.sender_id == second.header.sender_id);
+        CHECK(first.header.sequence != 0 && first.header.sequence == second.header.sequence);
+        CHECK(alice->quiet());
+
+        // Another sender gets another id, and later frames later sequence numbers
+        carol->send(MessageType::Chat, "hi alice");
+        Received reply;
+        CHECK(alice->receive(reply) && reply.payload == "hi alice");
+        CHECK(reply.header.sender_id != first.header.sender_id && reply.header.sequence > first.header.sequence);
+        CHECK(bob->receive(reply) && reply.payload == "hi alice");
+        CHECK(carol->quiet());
+    }
+
+    /**
+     * Room messages reach only the room's current members; Chat frames go to the lobby, which every
+     * client starts in; requests the server cannot honor are answered with a Notice
+     */
+    void test_rooms(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        for (TestClient* member : {alice.get(), bob.get()}) {
+            member->send(MessageType::Join, "dev");
+            CHECK(member->sync());
+        }
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "standup"));
+        Received frame;
+        CHECK(bob->receive(frame) && frame.header.type == MessageType::RoomMessage);
+        CHECK(frame.payload == encode_room_payload("dev", "standup"));
+        CHECK(carol->quiet() && alice->quiet());
+
+        // Outsiders cannot post to the room, and invalid names are refused
+        carol->send(MessageType::RoomMessage, encode_room_payload("dev", "let me in"));
+        CHECK(carol->receive(frame) && frame.header.type == MessageType::Notice);
+        carol->send(MessageType::Join, "two words");
+        CHECK(carol->receive(frame) && frame.header.type == MessageType::Notice);
+        CHECK(bob->quiet());
+
+        // After leaving, neither the room nor the lobby reaches bob any more
+        bob->send(MessageType::Leave, "dev");
+        bob->send(MessageType::Leave, std::string(kDefaultRoom));
+        CHECK(bob->sync());
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "anyone?"));
+        alice->send(MessageType::Chat, "lobby");
+        CHECK(carol->receive(frame) && frame.header.type == MessageType::Chat && frame.payload == "lobby");
+        CHECK(bob->quiet());
+    }
+
+    /**
+     * A Direct frame reaches only the user whose id it names, wherever that user is connected
+     */
+    void test_direct(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        // Ids are only learned from received frames
+        alice->send(MessageType::Chat, "who is here");
+        Received frame;
+        CHECK(bob->receive(frame) && carol->receive(frame));
+        uint32_t alice_id = frame.header.sender_id;
+
+        bob->send(MessageType::Direct, encode_direct_payload(alice_id, "psst"));
+        CHECK(alice->receive(frame) && frame.header.type == MessageType::Direct);
+        CHECK(frame.payload == encode_direct_payload(alice_id, "psst") && frame.header.sender_id != alice_id);
+        CHECK(carol->quiet() && bob->quiet());
+
+        // Nobody has this id; the frame is dropped
+        bob->send(MessageType::Direct, encode_direct_payload(alice_id ^ 0x7fff00, "lost"));
+        CHECK(alice->quiet() && carol->quiet());
+    }
+
+    /**
+     * With a log, a History request replays a room's messages after the given sequence number,
+     * then the History marker; without one the server answers with a Notice
+     */
+    void test_history(const ServerConfig& base) {
+        test::TemporaryDirectory directory;
+        ServerConfig config = base;
+        config.log_directory = directory.path;
+        config.log_sync_ms = 10;
+        RunningServer running(config);
+        auto alice = running.connect();
+        alice->send(MessageType::Join, "dev");
+        for (int i = 0; i < 20; ++i) {
+            alice->send(MessageType::RoomMessage, encode_room_payload("dev", "logged " + std::to_string(i)));
+        }
+        alice->send(MessageType::Chat, "lobby");
+        CHECK(alice->sync());
+
+        // The log thread writes in batches, so the newest messages may take a moment to appear
+        auto carol = running.connect();
+        std::vector<Received> replay;
+        Received frame;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        do {
+            replay.clear();
+            carol->send(MessageType::History, encode_history_payload("dev", 0));
+            while (carol->receive(frame) && frame.header.type != MessageType::History) {
+                replay.push_back(frame);
+            }
+        } while (replay.size() < 20 && std::chrono::steady_clock::now() < deadline);
+        bool ordered = replay.size() == 20;
+        for (size_t i = 0; ordered && i < replay.size(); ++i) {
+            ordered = replay[i].payload == encode_room_payload("dev", "logged " + std::to_string(i)) &&
+                      (i == 0 || replay[i].header.sequence > replay[i - 1].header.sequence);
+        }
+        CHECK(ordered);
+        CHECK(frame.header.type == MessageType::History &&
+              frame.payload == encode_history_payload("dev", replay.back().header.sequence));
+
+        carol->send(MessageType::History, encode_history_payload("dev", replay[14].header.sequence));
+        bool tail = true;
+        for (size_t i = 15; i < 20; ++i) {
+            tail = tail && carol->receive(frame) && frame.payload == replay[i].payload;
+        }
+        CHECK(tail && carol->receive(frame) && frame.header.type == MessageType::History);
+        CHECK(carol->quiet());
+
+        RunningServer unlogged(base);
+        auto bob = unlogged.connect();
+        bob->send(MessageType::History, encode_history_payload("dev", 0));
+        CHECK(bob->receive(frame) && frame.header.type == MessageType::Notice);
+    }
+
+    /**
+     * Clients that asked for compression get large frames deflated while the others get them
+     * plain, and compressed frames they send reach everyone else as plain text
+     */
+    void test_compression(const ServerConfig& base) {
+        RunningServer running(base);
+        auto plain = running.connect();
+        auto alice = running.connect();
+        auto bob = running.connect();
+        Received frame;
+        std::string deflate(1, static_cast<char>(CompressionMethod::Deflate));
+        for (auto* client : {alice.get(), bob.get()}) {
+            client->send(MessageType::Compression, deflate);
+            CHECK(client->receive(frame) && frame.header.type == MessageType::Compression && frame.payload == deflate);
+        }
+
+        std::string text;
+        while (text.size() < 4096) {
+            text += "message " + std::to_string(text.size() % 10) + " ";
+        }
+        plain->send(MessageType::Chat, text);
+        std::string payload;
+        for (auto* client : {alice.get(), bob.get()}) {
+            CHECK(client->receive(frame) && frame.header.flags == kFlagCompressed && frame.payload.size() < text.size());
+            CHECK(test::expand(frame, payload) && payload == text);
+        }
+
+        // Small frames are not worth compressing
+        plain->send(MessageType::Chat, "short");
+        CHECK(alice->receive(frame) && frame.header.flags == 0 && frame.payload == "short");
+        CHECK(bob->receive(frame) && frame.header.flags == 0 && frame.payload == "short");
+
+        std::string compressed;
+        append_compressed_frame(compressed, MessageType::Chat, 0, 1, text.data(), text.size());
+        alice->send_raw(compressed);
+        CHECK(plain->receive(frame) && frame.header.flags == 0 && frame.payload == text);
+        CHECK(bob->receive(frame) && test::expand(frame, payload) && payload == text);
+        CHECK(alice->quiet());
+
+        // A compressed copy is not timed itself, so each broadcast's fan-out is measured once
+        std::string metrics;
+        std::string fanout_count = "\nquickchat_fanout_latency_seconds_count 3\n";
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        do {
+            metrics = running.server->metrics_text();
+        } while (metrics.find(fanout_count) == std::string::npos && std::chrono::steady_clock::now() < deadline);
+        CHECK(metrics.find(fanout_count) != std::string::npos);
+    }
+
+    /**
+     * Clients that connect after others left take over their recycled connections (with one
+     * reactor, more closed at once than it keeps); each starts out clean, without the previous
+     * client's rooms, queued frames or partial input
+     */
+    void test_reconnects(const ServerConfig& base) {
+        constexpr int kClients = 160;
+        RunningServer running(base);
+        auto alice = running.connect();
+        alice->send(MessageType::Join, "dev");
+        CHECK(alice->sync());
+
+        std::vector<std::unique_ptr<TestClient>> visitors;
+        bool joined = true;
+        for (int i = 0; i < kClients; ++i) {
+            visitors.push_back(running.connect());
+            visitors.back()->send(MessageType::Join, "dev");
+            joined = joined && visitors.back()->sync();
+        }
+        CHECK(joined);
+        // Everyone leaves with a frame still on its way and in the middle of sending one
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "unread"));
+        for (auto& visitor : visitors) {
+            visitor->send_raw(std::string(kFrameHeaderSize / 2, '\0'));
+        }
+        visitors.clear();
+
+        for (int i = 0; i < kClients; ++i) {
+            visitors.push_back(running.connect());
+        }
+        // The lobby frame is queued behind any room frame for the same client, so it has to come first
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "members only"));
+        alice->send(MessageType::Chat, "lobby");
+        bool clean = true;
+        Received frame;
+        for (auto& visitor : visitors) {
+            clean = clean && visitor->receive(frame) && frame.header.type == MessageType::Chat && frame.payload == "lobby";
+        }
+        CHECK(clean);
+    }
+
+    /**
+     * Adds up every sample of a metric family over its shards
+     */
+    double metric_total(const std::string& text, const std::string& name) {
+        double total = 0;
+        for (size_t line = text.find("\n" + name + "{"); line != std::string::npos;
+             line = text.find("\n" + name + "{", line + 1)) {
+            total += std::stod(text.substr(text.find("} ", line) + 2));
+        }
+        return total;
+    }
+
+    /**
+     * Traffic shows up in the metrics: connections, frames both ways, and a fan-out measurement
+     * per broadcast once every recipient's write completed; the queue gauges return to zero
+     */
+    void test_metrics(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+        for (int i = 0; i < 10; ++i) {
+            alice->send(MessageType::Chat, "counted");
+        }
+        Received frame;
+        bool delivered = true;
+        for (int i = 0; i < 10; ++i) {
+            delivered = delivered && bob->receive(frame) && carol->receive(frame);
+        }
+        CHECK(delivered);
+
+        // Counters are updated right after the writes the clients saw, and a broadcast's fan-out
+        // only ends once every shard let go of it, idle ones included, so give them a moment
+        std::string text;
+        std::string fanout_count = "\nquickchat_fanout_latency_seconds_count 10\n";
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        do {
+            text = running.server->metrics_text();
+        } while ((metric_total(text, "quickchat_messages_sent_total") < 23 || text.find(fanout_count) == std::string::npos) &&
+                 std::chrono::steady_clock::now() < deadline);
+
+        // Every client synced once when connecting: one RoomMessage received and one Notice sent each
+        CHECK(metric_total(text, "quickchat_connections_accepted_total") == 3);
+        CHECK(metric_total(text, "quickchat_connections_active") == 3);
+        CHECK(metric_total(text, "quickchat_messages_received_total") == 13);
+        CHECK(metric_total(text, "quickchat_messages_sent_total") == 23);
+        CHECK(metric_total(text, "quickchat_received_bytes_total") == 10 * (kFrameHeaderSize + 7) + 3 * (kFrameHeaderSize + 5));
+        CHECK(metric_total(text, "quickchat_queued_messages") == 0 && metric_total(text, "quickchat_queued_bytes") == 0);
+        CHECK(text.find(fanout_count) != std::string::npos);
+
+        bob.reset();
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        do {
+            text = running.server->metrics_text();
+        } while (metric_total(text, "quickchat_connections_active") != 2 && std::chrono::steady_clock::now() < deadline);
+        CHECK(metric_total(text, "quickchat_connections_closed_total") == 1);
+    }
+
+    /**
+     * Fan-out timing is process-wide, so destroying another server in the same process must not
+     * stop this one's measurements
+     */
+    void test_metrics_shared(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        {
+            RunningServer other(base);
+            auto visitor = other.connect();
+            other.stop();
+        }
+
+        for (int i = 0; i < 5; ++i) {
+            alice->send(MessageType::Chat, "still timed");
+        }
+        Received frame;
+        bool delivered = true;
+        for (int i = 0; i < 5; ++i) {
+            delivered = delivered && bob->receive(frame);
+        }
+        CHECK(delivered);
+        std::string text;
+        std::string fanout_count = "\nquickchat_fanout_latency_seconds_count 5\n";
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        do {
+            text = running.server->metrics_text();
+        } while (text.find(fanout_count) == std::string::npos && std::chrono::steady_clock::now() < deadline);
+        CHECK(text.find(fanout_count) != std::string::npos);
+    }
+
+    /**
+     * Clients beyond the connection cap or their address's burst are told why and closed, and a
+     * place freed by a leaving client can be taken again
+     */
+    void test_admission(const ServerConfig& base) {
+        ServerConfig config = base;
+        config.max_connections = 2;
+        RunningServer running(config);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        TestClient refused(running.port);
+        Received frame;
+        CHECK(refused.receive(frame) && frame.header.type == MessageType::Notice);
+        CHECK(frame.payload == "Server is full, try again later" && refused.wait_for_end());
+
+        // The place is freed once the server noticed the close
+        alice.reset();
+        bool admitted = false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(test::kReceiveTimeoutMs);
+        while (!admitted && std::chrono::steady_clock::now() < deadline) {
+            TestClient carol(running.port);
+            admitted = carol.sync();
+        }
+        CHECK(admitted);
+        CHECK(metric_total(running.server->metrics_text(), "quickchat_connections_rejected_total") >= 1);
+
+        ServerConfig limited = base;
+        limited.per_ip_rate = 1;
+        limited.per_ip_burst = 2;
+        RunningServer throttled(limited);
+        auto first = throttled.connect();
+        auto second = throttled.connect();
+        TestClient third(throttled.port);
+        CHECK(third.receive(frame) && frame.header.type == MessageType::Notice);
+        CHECK(frame.payload == "Too many connections from your address, try again later" && third.wait_for_end());
+        first->send(MessageType::Chat, "still served");
+        CHECK(second->receive(frame) && frame.payload == "still served");
+    }
+
+    /**
+     * Quiet clients are pinged; a client answering only pings is dropped after a notice once it
+     * has been idle too long, one sending nothing at all once the read timeout ran out, and one
+     * whose output stopped moving once the write timeout ran out
+     */
+    void test_timeouts(const ServerConfig& base) {
+        ServerConfig config = base;
+        config.heartbeat_ms = 100;
+        config.read_timeout_ms = 600;
+        config.idle_timeout_ms = 1200;
+        RunningServer running(config);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        // Alice answers every ping and chats, bob only answers pings, carol never answers
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(3000);
+        Received frame;
+        int pings = 0;
+        bool notice = false;
+        bool bob_closed = false;
+        while (!bob_closed && std::chrono::steady_clock::now() < deadline) {
+            CHECK(alice->receive(frame) && frame.header.type == MessageType::Ping);
+            alice->send(MessageType::Pong, frame.payload);
+            alice->send(MessageType::Chat, "still here");
+            ++pings;
+            while (!bob_closed) {
+                if (!bob->receive(frame)) {
+                    bob_closed = true;
+                } else if (frame.header.type == MessageType::Ping) {
+                    bob->send(MessageType::Pong, frame.payload);
+                    break;
+                } else if (frame.header.type == MessageType::Notice) {
+                    notice = true;
+                }
+            }
+        }
+        CHECK(pings >= 4 && notice && bob->wait_for_end());
+        CHECK(carol->wait_for_end() && alice->sync());
+
+        std::string text = running.server->metrics_text();
+        CHECK(metric_total(text, "quickchat_pings_sent_total") >= 8);
+        CHECK(metric_total(text, "quickchat_connection_timeouts_total") == 2);
+
+        // A reader that stopped reading holds up its output until the write timeout drops it
+        ServerConfig writes = base;
+        writes.write_timeout_ms = 300;
+        RunningServer stalled(writes);
+        auto writer = stalled.connect();
+        auto sleeper = stalled.connect();
+        for (int i = 0; i < 1500; ++i) {
+            writer->send(MessageType::Chat, numbered(i));
+        }
+        CHECK(writer->sync());
+        std::this_thread::sleep_for(std::chrono::milliseconds(800));
+        CHECK(sleeper->wait_for_end());
+        text = stalled.server->metrics_text();
+        CHECK(metric_total(text, "quickchat_connection_timeouts_total") == 1);
+    }
+
+    /**
+     * In-process connections are served like TCP clients and share rooms with them; large frames
+     * that do not fit the ring at once arrive whole and in order. Threaded mode and io_uring
+     * refuse them
+     */
+    void test_local(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        if (base.mode == ServerMode::Threaded || base.io_backend == IoBackend::Uring) {
+            bool refused = false;
+            try {
+                running.server->connect_local();
+            } catch (const std::runtime_error&) {
+                refused = true;
+            }
+            CHECK(refused);
+            return;
+        }
+        auto bob = running.connect_local();
+        auto carol = running.connect_local();
+
+        bob->send(MessageType::Chat, "from the inside");
+        Received first;
+        Received second;
+        CHECK(alice->receive(first) && first.payload == "from the inside");
+        CHECK(carol->receive(second) && second.payload == "from the inside");
+        CHECK(first.header.sender_id == second.header.sender_id && first.header.sequence == second.header.sequence);
+        CHECK(bob->quiet());
+
+        alice->send(MessageType::Join, "dev");
+        carol->send(MessageType::Join, "dev");
+        CHECK(alice->sync() && carol->sync());
+        alice->send(MessageType::RoomMessage, encode_room_payload("dev", "over tcp"));
+        Received frame;
+        CHECK(carol->receive(frame) && frame.payload == encode_room_payload("dev", "over tcp"));
+        CHECK(bob->quiet());
+
+        carol->send(MessageType::Direct, encode_direct_payload(first.header.sender_id, "psst"));
+        CHECK(bob->receive(frame) && frame.header.type == MessageType::Direct);
+        CHECK(frame.payload == encode_direct_payload(first.header.sender_id, "psst"));
+
+        for (int i = 0; i < 20; ++i) {
+            alice->send(MessageType::Chat, numbered(i));
+        }
+        bool ordered = true;
+        for (int i = 0; i < 20; ++i) {
+            ordered = ordered && bob->receive(frame) && frame.payload == numbered(i);
+            ordered = ordered && carol->receive(frame) && frame.payload == numbered(i);
+        }
+        CHECK(ordered);
+
+        // A broken frame ends the connection as it would over TCP; stopping the server ends the rest
+        bob->send_raw(std::string(kFrameHeaderSize, '\xff'));
+        CHECK(bob->wait_for_end() && carol->sync());
+        running.stop();
+        CHECK(carol->wait_for_end() && alice->wait_for_end());
+    }
+
+    /**
+     * A server whose setup fails after its listening sockets were bound (here: the admin port is
+     * taken) closes them again, so the port can be bound right away
+     */
+    void test_failed_setup() {
+        int taken = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        CHECK(bind(taken, (struct sockaddr*)&address, sizeof(address)) == 0 &&
+              getsockname(taken, (struct sockaddr*)&address, &length) == 0 && listen(taken, 1) == 0);
+
+        ServerConfig config;
+        config.mode = ServerMode::Sharded;
+        config.threads = 4;
+        config.port = test::free_port();
+        config.admin_port = ntohs(address.sin_port);
+        bool thrown = false;
+        try {
+            Server server(config);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        close(taken);
+
+        int rebound = socket(AF_INET, SOCK_STREAM, 0);
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(static_cast<uint16_t>(config.port));
+        CHECK(bind(rebound, (struct sockaddr*)&address, sizeof(address)) == 0);
+        close(rebound);
+    }
+
+    /**
+     * Client ids name their shard in 8 bits, so a sharded server never runs more than 256 shards
+     */
+    void test_shard_cap() {
+        ServerConfig config;
+        config.mode = ServerMode::Sharded;
+        config.threads = kMaxShards + 44;
+        config.port = test::free_port();
+        Server server(config);
+        std::string text = server.metrics_text();
+        size_t shards = 0;
+        for (size_t line = text.find("\nquickchat_connections_active{"); line != std::string::npos;
+             line = text.find("\nquickchat_connections_active{", line + 1)) {
+            ++shards;
+        }
+        CHECK(shards == kMaxShards);
+    }
+
+    /**
+     * With a flush delay, small output is held back until the delay ran out and then leaves in
+     * order; output reaching the flush size is written right away
+     */
+    void test_flush_delay(const ServerConfig& base) {
+        constexpr auto kDelay = std::chrono::milliseconds(200);
+        ServerConfig config = base;
+        config.flush_delay_us = static_cast<int>(std::chrono::microseconds(kDelay).count());
+        config.flush_bytes = kMaxPayloadSize;
+        RunningServer running(config);
+        auto alice = running.connect();
+        auto bob = running.connect();
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 3; ++i) {
+            alice->send(MessageType::Chat, "held " + std::to_string(i));
+        }
+        Received frame;
+        bool ordered = true;
+        for (int i = 0; i < 3; ++i) {
+            ordered = ordered && bob->receive(frame) && frame.payload == "held " + std::to_string(i);
+        }
+        CHECK(ordered && std::chrono::steady_clock::now() - start >= kDelay * 3 / 4);
+
+        start = std::chrono::steady_clock::now();
+        alice->send(MessageType::Chat, numbered(0));
+        CHECK(bob->receive(frame) && frame.payload == numbered(0));
+        CHECK(std::chrono::steady_clock::now() - start < kDelay * 3 / 4);
+    }
+
+    /**
+     * Frames for a client that does not read stay queued in order until it does, while the
+     * other clients keep receiving; back-to-back frames are never merged or split
+     */
+    void test_slow_reader(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        // Far more than the socket buffers hold, so the server has to wait for bob to read
+        constexpr int kFrames = 64;
+        for (int i = 0; i < kFrames; ++i) {
+            alice->send(MessageType::Chat, numbered(i));
+        }
+        alice->send(MessageType::Chat, "done");
+
+        for (TestClient* reader : {carol.get(), bob.get()}) {
+            Received frame;
+            bool intact = true;
+            for (int i = 0; i < kFrames && intact; ++i) {
+                intact = reader->receive(frame) && frame.payload == numbered(i);
+            }
+            CHECK(intact && reader->receive(frame) && frame.payload == "done");
+        }
+    }
+
+    /**
+     * A client that stops reading is held to its queue limit: with DropOldest it skips ahead to the
+     * newest frames, with DropNewest it keeps the oldest ones, with Disconnect it is closed
+     */
+    void test_overflow(const ServerConfig& base, OverflowPolicy policy) {
+        ServerConfig config = base;
+        config.max_queued_messages = 16;
+        config.overflow_policy = policy;
+        RunningServer running(config);
+        auto alice = running.connect();
+        auto bob = running.connect();
+
+        // Far more than the socket buffers and the queue hold together
+        constexpr int kFrames = 1500;
+        for (int i = 0; i < kFrames; ++i) {
+            alice->send(MessageType::Chat, numbered(i));
+        }
+        alice->send(MessageType::Chat, "done");
+
+        const OverloadCounters& counters = running.server->overload_counters();
+        if (policy == OverflowPolicy::Disconnect) {
+            CHECK(bob->wait_for_end() && alice->sync());
+            CHECK(counters.disconnected.load() == 1);
+            return;
+        }
+
+        // Whatever bob gets arrives whole and in order; which frames were dropped depends on the policy
+        Received frame;
+        int received = 0;
+        int first = -1;
+        int last = -1;
+        bool ordered = true;
+        while (bob->receive(frame) && frame.payload != "done") {
+            int number = std::stoi(frame.payload);
+            ordered = ordered && number > last && frame.payload == numbered(number);
+            first = received == 0 ? number : first;
+            last = number;
+            ++received;
+        }
+        bool done = frame.payload == "done";
+        CHECK(ordered && received > 0 && received < kFrames);
+
+        // Every frame bob missed was counted by the policy that dropped it
+        uint64_t dropped = counters.dropped_oldest.load() + counters.dropped_newest.load();
+        CHECK(dropped == static_cast<uint64_t>(kFrames + 1 - received - (done ? 1 : 0)));
+        if (policy == OverflowPolicy::DropOldest) {
+            // The newest frames arrive; only with io_uring, where a send stuck on the full socket
+            // pins the whole queue, can frames that arrive meanwhile be dropped instead
+            CHECK(base.io_backend == IoBackend::Uring ||
+                  (done && last == kFrames - 1 && counters.dropped_newest.load() == 0));
+        } else {
+            // The kept backlog starts at the beginning, and new frames fit again once bob caught up
+            CHECK(first == 0 && counters.dropped_oldest.load() == 0);
+            alice->send(MessageType::Chat, "caught up");
+            CHECK(bob->receive(frame) && frame.payload == "caught up");
+        }
+    }
+
+    /**
+     * A client that goes away does not disturb the others; one that breaks the protocol is
+     * disconnected; stopping the server ends every connection
+     */
+    void test_disconnects(const ServerConfig& base) {
+        RunningServer running(base);
+        auto alice = running.connect();
+        auto bob = running.connect();
+        auto carol = running.connect();
+
+        carol.reset();
+        alice->send(MessageType::Chat, "still here");
+        Received frame;
+        CHECK(bob->receive(frame) && frame.payload == "still here");
+
+        // A header with an unknown protocol version cannot be resynchronized from
+        bob->send_raw(std::string(kFrameHeaderSize, '\xff'));
+        CHECK(bob->wait_for_end());
+
+        // Neither can a frame longer than the largest payload
+        auto dave = running.connect();
+        std::string oversized;
+        append_frame(oversized, MessageType::Chat, 0, 0, "", 0);
+        oversized[0] = '\x7f';
+        dave->send_raw(oversized);
+        CHECK(dave->wait_for_end());
+
+        auto erin = running.connect();
+        alice->send(MessageType::Chat, "welcome");
+        CHECK(erin->receive(frame) && frame.payload == "welcome");
+
+        running.stop();
+        CHECK(alice->wait_for_end());
+        CHECK(erin->wait_for_end());
+    }
+}
+
+int main() {
+    test_failed_setup();
+    test_shard_cap();
+    for (IoBackend io_backend : {IoBackend::Epoll, IoBackend::Uring}) {
+        if (io_backend == IoBackend::Uring && !IoUring::supported()) {
+            std::cerr << "io_uring is not available, skipping its tests" << std::endl;
+            continue;
+        }
+        for (ServerMode mode : {ServerMode::Threaded, ServerMode::Epoll, ServerMode::Sharded}) {
+            if (mode == ServerMode::Threaded && io_backend == IoBackend::Uring) {
+                continue; // Threaded mode does not use the reactors' I/O backend
+            }
+            ServerConfig config = config_for(mode, io_backend);
+            test_broadcast(config);
+            test_rooms(config);
+            test_direct(config);
+            test_history(config);
+            if (compression_supported()) {
+                test_compression(config);
+            }
+            test_reconnects(config);
+            test_metrics(config);
+            test_metrics_shared(config);
+            test_admission(config);
+            test_timeouts(config);
+            test_local(config);
+            if (mode != ServerMode::Threaded) {
+                test_flush_delay(config);
+            }
+            test_slow_reader(config);
+            for (OverflowPolicy policy : {OverflowPolicy::DropOldest, OverflowPolicy::DropNewest, OverflowPolicy::Disconnect}) {
+                test_overflow(config, policy);
+            }
+            test_disconnects(config);
+        }
+    }
+    return test::result();
+}
@@ -0,0 +1,119 @@
+// Tests of the slab allocator: size classes, recycling on one thread, and blocks that are freed
+// on another thread finding their way back through the shared depot
+
+#include "Check.h"
+#include "common/SlabAllocator.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+    /**
+     * Checks that a block is aligned for any fundamental type
+     */
+    bool aligned(void* block) {
+        return reinterpret_cast<uintptr_t>(block) % alignof(std::max_align_t) == 0;
+    }
+
+    /**
+     * Every size, from tiny to beyond the largest class, gets a usable aligned block
+     */
+    void test_sizes() {
+        bool usable = true;
+        for (size_t size : {size_t(1), size_t(63), size_t(64), size_t(65), size_t(1000),
+                            SlabAllocator::kMaxBlockSize, SlabAllocator::kMaxBlockSize + 1, size_t(1) << 20}) {
+            char* block = static_cast<char*>(SlabAllocator::allocate(size));
+            std::memset(block, 0x5a, size);
+            usable = usable && aligned(block) && block[size - 1] == 0x5a;
+            SlabAllocator::deallocate(block, size);
+        }
+        CHECK(usable);
+    }
+
+    /**
+     * A freed block is handed out again for any size of the same class
+     */
+    void test_reuse() {
+        void* block = SlabAllocator::allocate(100);
+        SlabAllocator::deallocate(block, 100);
+        void* again = SlabAllocator::allocate(128);
+        CHECK(again == block);
+        SlabAllocator::deallocate(again, 128);
+    }
+
+    /**
+     * Blocks live at the same time never overlap, across several batches and slabs
+     */
+    void test_distinct_blocks() {
+        constexpr size_t kSize = 256;
+        std::vector<unsigned char*> blocks;
+        for (size_t i = 0; i < 3 * SlabAllocator::kBatchBytes / kSize; ++i) {
+            blocks.push_back(static_cast<unsigned char*>(SlabAllocator::allocate(kSize)));
+            std::memset(blocks.back(), static_cast<int>(i & 0xff), kSize);
+        }
+        bool intact = true;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            intact = intact && blocks[i][0] == (i & 0xff) && blocks[i][kSize - 1] == (i & 0xff);
+        }
+        std::vector<unsigned char*> sorted = blocks;
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t i = 1; i < sorted.size(); ++i) {
+            intact = intact && sorted[i - 1] + kSize <= sorted[i];
+        }
+        CHECK(intact);
+        for (unsigned char* block : blocks) {
+            SlabAllocator::deallocate(block, kSize);
+        }
+    }
+
+    /**
+     * Blocks allocated on one thread and freed on another reach the depot, either in batches while
+     * the freeing thread runs or when it exits, and a third thread draws from them before carving
+     * new slabs
+     */
+    void test_cross_thread() {
+        // A class no other test uses, so every block in the depot comes from here
+        constexpr size_t kSize = 2048;
+        constexpr size_t kBlocks = 500;
+        std::vector<void*> blocks;
+        std::thread producer([&] {
+            for (size_t i = 0; i < kBlocks; ++i) {
+                blocks.push_back(SlabAllocator::allocate(kSize));
+            }
+        });
+        producer.join();
+
+        std::thread consumer([&] {
+            for (void* block : blocks) {
+                SlabAllocator::deallocate(block, kSize);
+            }
+        });
+        consumer.join();
+
+        std::set<void*> freed(blocks.begin(), blocks.end());
+        bool recycled = true;
+        std::thread reuser([&] {
+            std::vector<void*> again;
+            for (size_t i = 0; i < kBlocks; ++i) {
+                again.push_back(SlabAllocator::allocate(kSize));
+                recycled = recycled && freed.count(again.back()) == 1;
+            }
+            for (void* block : again) {
+                SlabAllocator::deallocate(block, kSize);
+            }
+        });
+        reuser.join();
+        CHECK(recycled);
+    }
+}
+
+int main() {
+    test_sizes();
+    test_reuse();
+    test_distinct_blocks();
+    test_cross_thread();
+    return test::result();
+}
@@ -0,0 +1,359 @@
+// TCP and in-process clients and a background server for the end-to-end tests
+// Everything blocks with a timeout, so a server that fails to answer fails the check instead of hanging
+
+#pragma once
+#include "Check.h"
+#include "server/Server.h"
+#include "common/Protocol.h"
+#include "common/Compression.h"
+#include "common/LocalTransport.h"
+#include "common/RingBuffer.h"
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace test {
+    // How long a client waits for expected data before the check fails
+    constexpr int kReceiveTimeoutMs = 2000;
+
+    // How long a client listens for data that should not arrive
+    constexpr int kQuietTimeoutMs = 100;
+
+    /**
+     * Finds a local port nothing is bound to, by letting the kernel pick one
+     * @return Port number, or 0 if none could be found
+     */
+    inline int free_port() {
+        int probe = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        int port = 0;
+        if (bind(probe, (struct sockaddr*)&address, sizeof(address)) == 0 &&
+            getsockname(probe, (struct sockaddr*)&address, &length) == 0) {
+            port = ntohs(address.sin_port);
+        }
+        close(probe);
+        return port;
+    }
+
+    /**
+     * Frame as a client received it
+     */
+    struct Received {
+        FrameHeader header;
+        std::string payload;
+    };
+
+    /**
+     * Reads a received payload the way a client that negotiated compression does
+     * @param payload Receives the payload, inflated if the frame was compressed
+     * @return false if the compressed payload is invalid
+     */
+    inline bool expand(const Received& frame, std::string& payload) {
+        std::string bytes;
+        append_frame(bytes, frame.header.type, frame.header.sender_id, frame.header.sequence,
+                     frame.payload.data(), frame.payload.size(), frame.header.flags);
+        RingBuffer ring(2 * kReceiveBufferSize);
+        struct iovec segments[2];
+        ring.free_segments(segments);
+        memcpy(segments[0].iov_base, bytes.data(), bytes.size());
+        ring.commit(bytes.size());
+
+        FrameParser parser;
+        Frame parsed;
+        Frame expanded;
+        std::string scratch;
+        if (parser.next(ring, parsed) != ParseStatus::Ready || !expand_frame(parsed, scratch, expanded)) {
+            return false;
+        }
+        payload = expanded.payload();
+        return true;
+    }
+
+    /**
+     * Client end of a connection to the server under test, sending and receiving whole frames
+     * The connection is a TCP socket or an in-process endpoint (Server::connect_local())
+     */
+    class TestClient {
+        private:
+            int socket_fd;
+
+            // In-process connection (nullptr for TCP clients)
+            std::unique_ptr<LocalEndpoint> endpoint;
+
+            // Bytes read but not yet returned
+            std::string buffer;
+
+            // Set once the server closed the connection and everything it sent was read
+            bool ended;
+
+            /**
+             * Reads what is available, waiting for it first if nothing is
+             * @return false on timeout
+             */
+            bool fill(int timeout_ms) {
+                if (endpoint) {
+                    endpoint->rearm();
+                    if (drain()) {
+                        return true;
+                    }
+                }
+                struct pollfd entry{};
+                entry.fd = endpoint ? endpoint->fd() : socket_fd;
+                entry.events = POLLIN;
+                if (poll(&entry, 1, timeout_ms) <= 0) {
+                    return false;
+                }
+                if (endpoint) {
+                    endpoint->rearm();
+                    drain();
+                    return true;
+                }
+                char scratch[16384];
+                ssize_t bytes = recv(socket_fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+                if (bytes > 0) {
+                    buffer.append(scratch, static_cast<size_t>(bytes));
+                } else if (bytes == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    ended = true;
+                }
+                return true;
+            }
+
+            /**
+             * Reads everything an in-process connection has available
+             * @return false if there was nothing to read
+             */
+            bool drain() {
+                bool progress = false;
+                char scratch[16384];
+                while (true) {
+                    struct iovec segment = {scratch, sizeof(scratch)};
+                    ssize_t bytes = endpoint->readv(&segment, 1);
+                    if (bytes <= 0) {
+                        ended = ended || bytes == 0;
+                        return progress || bytes == 0;
+                    }
+                    buffer.append(scratch, static_cast<size_t>(bytes));
+                    progress = true;
+                }
+            }
+
+        public:
+            /**
+             * Connects to 127.0.0.1, retrying while the server is not listening yet
+             * @param port Port of the server
+             */
+            explicit TestClient(int port) : socket_fd(-1), ended(false) {
+                struct sockaddr_in address{};
+                address.sin_family = AF_INET;
+                address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                address.sin_port = htons(port);
+                for (int attempt = 0; attempt < 200; ++attempt) {
+                    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+                    if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+                        // Tests send small frames back to back; Nagle would hold them for an ACK
+                        int enable = 1;
+                        setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                        return;
+                    }
+                    close(socket_fd);
+                    socket_fd = -1;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+                CHECK(!"could not connect to the server");
+            }
+
+            /**
+             * Uses the client end of an in-process connection
+             */
+            explicit TestClient(std::unique_ptr<LocalEndpoint> endpoint)
+                : socket_fd(-1), endpoint(std::move(endpoint)), ended(false) {}
+
+            ~TestClient() {
+                if (socket_fd >= 0) {
+                    close(socket_fd);
+                }
+            }
+
+            TestClient(const TestClient&) = delete;
+            TestClient& operator=(const TestClient&) = delete;
+
+            /**
+             * Sends raw bytes, valid frames or not, blocking until the kernel took all of them
+             */
+            void send_raw(const std::string& bytes) {
+                size_t sent = 0;
+                while (sent < bytes.size()) {
+                    ssize_t result;
+                    if (endpoint) {
+                        // A full ring is reported like a full socket buffer; wait for room
+                        result = endpoint->write(bytes.data() + sent, bytes.size() - sent);
+                        if (result < 0 && errno == EAGAIN) {
+                            struct pollfd entry{};
+                            entry.fd = endpoint->fd();
+                            entry.events = POLLIN;
+                            if (!CHECK(poll(&entry, 1, kReceiveTimeoutMs) == 1)) {
+                                return;
+                            }
+                            endpoint->rearm();
+                            drain(); // The wake-up may have been for data, which a later fill() needs
+                            continue;
+                        }
+                    } else {
+                        result = ::send(socket_fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+                    }
+                    if (!CHECK(result > 0)) {
+                        return;
+                    }
+                    sent += static_cast<size_t>(result);
+                }
+            }
+
+            /**
+             * Sends one frame
+             */
+            void send(MessageType type, const std::string& payload = "") {
+                std::string frame;
+                append_frame(frame, type, 0, 0, payload.data(), payload.size());
+                send_raw(frame);
+            }
+
+            /**
+             * Waits for the next frame
+             * @return false if none arrived in time or the connection ended first
+             */
+            bool receive(Received& frame) {
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kReceiveTimeoutMs);
+                while (true) {
+                    if (buffer.size() >= kFrameHeaderSize && decode_frame_header(buffer.data(), frame.header) &&
+                        buffer.size() >= kFrameHeaderSize + frame.header.length) {
+                        frame.payload = buffer.substr(kFrameHeaderSize, frame.header.length);
+                        buffer.erase(0, kFrameHeaderSize + frame.header.length);
+                        return true;
+                    }
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                    if (ended || left <= 0 || !fill(static_cast<int>(left))) {
+                        return false;
+                    }
+                }
+            }
+
+            /**
+             * Waits until the server handled everything this client sent so far
+             * A RoomMessage to a room the client is not in is answered with a Notice on the same
+             * connection, after every earlier frame; nothing else may be pending for this client
+             */
+            bool sync() {
+                send(MessageType::RoomMessage, encode_room_payload("sync", ""));
+                Received notice;
+                return receive(notice) && notice.header.type == MessageType::Notice;
+            }
+
+            /**
+             * Checks that nothing arrives for a while
+             */
+            bool quiet() {
+                if (!buffer.empty()) {
+                    return false;
+                }
+                fill(kQuietTimeoutMs);
+                return buffer.empty() && !ended;
+            }
+
+            /**
+             * Waits until the server closed the connection, discarding anything still sent
+             */
+            bool wait_for_end() {
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kReceiveTimeoutMs);
+                while (!ended) {
+                    buffer.clear();
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                    if (left <= 0 || !fill(static_cast<int>(left))) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+    };
+
+    /**
+     * Directory under /tmp that is removed with everything in it when the test ends
+     */
+    struct TemporaryDirectory {
+        std::string path;
+
+        TemporaryDirectory() {
+            char name[] = "/tmp/quickchat_test_XXXXXX";
+            path = mkdtemp(name);
+        }
+
+        ~TemporaryDirectory() {
+            std::filesystem::remove_all(path);
+        }
+    };
+
+    /**
+     * Server serving on a free port from a background thread for the duration of a test
+     */
+    struct RunningServer {
+        int port;
+        std::unique_ptr<Server> server;
+        std::thread thread;
+
+        explicit RunningServer(ServerConfig config) : port(free_port()) {
+            config.port = port;
+            server = std::make_unique<Server>(config);
+            thread = std::thread(&Server::start, server.get());
+        }
+
+        ~RunningServer() {
+            stop();
+        }
+
+        /**
+         * Connects a client and waits until the server registered it
+         * The server does not acknowledge connections, so a message sent right away could miss it
+         */
+        std::unique_ptr<TestClient> connect() {
+            auto client = std::make_unique<TestClient>(port);
+            CHECK(client->sync());
+            return client;
+        }
+
+        /**
+         * Opens an in-process connection and waits until the server registered it
+         */
+        std::unique_ptr<TestClient> connect_local() {
+            auto client = std::make_unique<TestClient>(server->connect_local());
+            CHECK(client->sync());
+            return client;
+        }
+
+        /**
+         * Stops the server and destroys it, which closes its listening socket
+         * Only call once a client was served, so the server is known to have started
+         */
+        void stop() {
+            if (server) {
+                server->stop();
+                thread.join();
+                server.reset();
+            }
+        }
+    };
+}
@@ -0,0 +1,157 @@
+// Tests of the hierarchical timing wheel: timers fire on their tick on every level, in order, and
+// can be moved, cancelled and rescheduled from the expiry callback
+
+#include "Check.h"
+#include "server/TimingWheel.h"
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace {
+    // One tick per millisecond, with times given in nanoseconds like the reactors do
+    constexpr uint64_t kTick = 1000000;
+
+    /**
+     * Timer that remembers when it fired
+     */
+    struct Timer : TimerNode {
+        int id = 0;
+        uint64_t fired_at = 0;
+    };
+
+    /**
+     * Advances one tick at a time so every timer's firing time is known exactly
+     */
+    void run_until(TimingWheel& wheel, uint64_t& now, uint64_t end, std::vector<int>& order) {
+        while (now < end) {
+            now += kTick;
+            wheel.advance(now, [&](TimerNode& node) {
+                Timer& timer = static_cast<Timer&>(node);
+                timer.fired_at = now;
+                order.push_back(timer.id);
+            });
+        }
+    }
+
+    /**
+     * Timers on every level fire exactly on their tick and in deadline order, never early
+     */
+    void test_levels() {
+        uint64_t now = 1000 * kTick;
+        TimingWheel wheel(kTick, now);
+        const uint64_t delays[] = {300000, 1, 70, 64, 4096 + 5, 63, 5000};
+        std::vector<Timer> timers(std::size(delays));
+        for (size_t i = 0; i < timers.size(); ++i) {
+            timers[i].id = static_cast<int>(i);
+            wheel.schedule(timers[i], now + delays[i] * kTick);
+        }
+        CHECK(!wheel.empty() && timers[0].timer_scheduled());
+
+        std::vector<int> order;
+        uint64_t start = now;
+        run_until(wheel, now, start + 300000 * kTick, order);
+        CHECK((order == std::vector<int>{1, 5, 3, 2, 4, 6, 0}));
+        bool exact = true;
+        for (size_t i = 0; i < timers.size(); ++i) {
+            exact = exact && timers[i].fired_at == start + delays[i] * kTick && !timers[i].timer_scheduled();
+        }
+        CHECK(exact && wheel.empty());
+    }
+
+    /**
+     * Deadlines between ticks round up, and a deadline already past fires on the next tick
+     */
+    void test_rounding() {
+        uint64_t now = 50 * kTick;
+        TimingWheel wheel(kTick, now);
+        Timer late;
+        Timer past;
+        wheel.schedule(late, now + 2 * kTick + 1);
+        wheel.schedule(past, now - 10 * kTick);
+        std::vector<int> order;
+        run_until(wheel, now, now + 5 * kTick, order);
+        CHECK(past.fired_at == 51 * kTick && late.fired_at == 53 * kTick);
+    }
+
+    /**
+     * Rescheduling moves a timer, schedule_by only ever brings it forward, and cancelled timers
+     * never fire
+     */
+    void test_moves() {
+        uint64_t now = 0;
+        TimingWheel wheel(kTick, now);
+        Timer moved;
+        Timer pulled;
+        Timer cancelled;
+        moved.id = 1;
+        pulled.id = 2;
+        cancelled.id = 3;
+        wheel.schedule(moved, 10 * kTick);
+        wheel.schedule(moved, 200 * kTick);
+        wheel.schedule(pulled, 500 * kTick);
+        wheel.schedule_by(pulled, 1000 * kTick);
+        wheel.schedule_by(pulled, 20 * kTick);
+        wheel.schedule(cancelled, 30 * kTick);
+        wheel.cancel(cancelled);
+        wheel.cancel(cancelled);
+
+        std::vector<int> order;
+        run_until(wheel, now, 1000 * kTick, order);
+        CHECK((order == std::vector<int>{2, 1}));
+        CHECK(pulled.fired_at == 20 * kTick && moved.fired_at == 200 * kTick && cancelled.fired_at == 0);
+        CHECK(wheel.empty());
+    }
+
+    /**
+     * A timer may reschedule itself from the callback (a heartbeat), and timers beyond the reach
+     * of the wheels fire early at its end so their owner can check again
+     */
+    void test_periodic() {
+        uint64_t now = 0;
+        TimingWheel wheel(kTick, now);
+        Timer beat;
+        int beats = 0;
+        wheel.schedule(beat, 100 * kTick);
+        for (int step = 0; step < 10; ++step) {
+            now += 100 * kTick;
+            wheel.advance(now, [&](TimerNode& node) {
+                ++beats;
+                wheel.schedule(node, now + 100 * kTick);
+            });
+        }
+        CHECK(beats == 10 && beat.timer_scheduled());
+        wheel.cancel(beat);
+
+        Timer distant;
+        uint64_t reach = 1ull << 24;
+        wheel.schedule(distant, now + 2 * reach * kTick);
+        bool early = false;
+        wheel.advance(now + (reach - 2) * kTick, [&](TimerNode&) { early = true; });
+        CHECK(!early);
+        wheel.advance(now + reach * kTick, [&](TimerNode&) { early = true; });
+        CHECK(early && !distant.timer_scheduled());
+    }
+
+    /**
+     * Time passing without timers is skipped in one step
+     */
+    void test_idle() {
+        uint64_t later = kTick * 1000000000000ull; // About 31 years of ticks
+        TimingWheel wheel(kTick, 0);
+        int fired = 0;
+        wheel.advance(later, [&](TimerNode&) { ++fired; });
+        Timer timer;
+        wheel.schedule(timer, later + 3 * kTick);
+        wheel.advance(later + 3 * kTick, [&](TimerNode&) { ++fired; });
+        CHECK(fired == 1);
+    }
+}
+
+int main() {
+    test_levels();
+    test_rounding();
+    test_moves();
+    test_periodic();
+    test_idle();
+    return test::result();
+}
@@ -0,0 +1,156 @@
+// Tests of the in-process transport: SpscRing wrap-around and the LocalEndpoint socket contract
+// (EAGAIN when a ring is empty or full, EOF once the peer closed and was drained, EPIPE after that)
+
+#include "Check.h"
+#include "common/SpscRing.h"
+#include "common/LocalTransport.h"
+#include <string>
+#include <cerrno>
+#include <poll.h>
+
+namespace {
+    /**
+     * Checks whether an endpoint's notification descriptor is readable right now
+     */
+    bool notified(LocalEndpoint& endpoint) {
+        struct pollfd entry{};
+        entry.fd = endpoint.fd();
+        entry.events = POLLIN;
+        return poll(&entry, 1, 0) == 1 && (entry.revents & POLLIN);
+    }
+
+    /**
+     * Reads up to length bytes from an endpoint into a string
+     * @return What readv() returned
+     */
+    ssize_t read_string(LocalEndpoint& endpoint, std::string& out, size_t length) {
+        out.assign(length, '\0');
+        struct iovec segment = {&out[0], length};
+        ssize_t bytes = endpoint.readv(&segment, 1);
+        out.resize(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+        return bytes;
+    }
+
+    /**
+     * Writes and reads across the end of the storage, in both directions split over two iovecs
+     */
+    void test_ring_wrap_around() {
+        SpscRing ring(16);
+        char scratch[16];
+        struct iovec whole = {scratch, sizeof(scratch)};
+
+        std::string first = "0123456789";
+        struct iovec segment = {&first[0], first.size()};
+        CHECK(ring.write(&segment, 1) == 10);
+        CHECK(ring.read(&whole, 1) == 10);
+        CHECK(std::string(scratch, 10) == first);
+
+        // Starts at offset 10 of 16, so both the write and the read wrap to the front of the storage
+        std::string head = "abcdefg";
+        std::string tail = "hijkl";
+        struct iovec parts[2] = {{&head[0], head.size()}, {&tail[0], tail.size()}};
+        CHECK(ring.write(parts, 2) == 12);
+        char left[5];
+        char right[16];
+        struct iovec destinations[2] = {{left, sizeof(left)}, {right, sizeof(right)}};
+        CHECK(ring.read(destinations, 2) == 12);
+        CHECK(std::string(left, 5) == "abcde");
+        CHECK(std::string(right, 7) == "fghijkl");
+    }
+
+    /**
+     * A full ring takes only what fits, and nothing more until the consumer made room
+     */
+    void test_ring_full_and_empty() {
+        SpscRing ring(16);
+        char scratch[32];
+        struct iovec whole = {scratch, sizeof(scratch)};
+        CHECK(ring.read(&whole, 1) == 0);
+
+        std::string data(20, 'x');
+        struct iovec segment = {&data[0], data.size()};
+        CHECK(ring.write(&segment, 1) == 16);
+        CHECK(ring.write(&segment, 1) == 0);
+
+        struct iovec some = {scratch, 6};
+        CHECK(ring.read(&some, 1) == 6);
+        CHECK(ring.write(&segment, 1) == 6);
+        CHECK(ring.read(&whole, 1) == 16);
+        CHECK(ring.read(&whole, 1) == 0);
+    }
+
+    /**
+     * Data and notifications flow both ways; rearm() quiets the descriptor until the next write
+     */
+    void test_endpoint_transfer() {
+        auto pair = LocalEndpoint::create_pair(64);
+        LocalEndpoint& client = *pair.first;
+        LocalEndpoint& server = *pair.second;
+        std::string text;
+
+        CHECK(read_string(server, text, 16) == -1 && errno == EAGAIN);
+        CHECK(!notified(server));
+
+        CHECK(client.write("ping", 4) == 4);
+        CHECK(notified(server));
+        server.rearm();
+        CHECK(!notified(server));
+        CHECK(read_string(server, text, 16) == 4 && text == "ping");
+        CHECK(read_string(server, text, 16) == -1 && errno == EAGAIN);
+
+        CHECK(server.write("pong", 4) == 4);
+        client.rearm();
+        CHECK(read_string(client, text, 16) == 4 && text == "pong");
+    }
+
+    /**
+     * A writer that found the ring full gets EAGAIN and is notified once the reader made room
+     */
+    void test_endpoint_full_ring() {
+        auto pair = LocalEndpoint::create_pair(16);
+        LocalEndpoint& writer = *pair.first;
+        LocalEndpoint& reader = *pair.second;
+        std::string data(20, 'y');
+        std::string text;
+
+        CHECK(writer.write(data.data(), data.size()) == 16);
+        CHECK(writer.write(data.data(), data.size()) == -1 && errno == EAGAIN);
+        writer.rearm();
+        CHECK(!notified(writer));
+
+        reader.rearm();
+        CHECK(read_string(reader, text, 8) == 8);
+        CHECK(notified(writer));
+        writer.rearm();
+        CHECK(writer.write(data.data(), data.size()) == 8);
+    }
+
+    /**
+     * Closing one end lets the other drain what was written, then read EOF, then fail with EPIPE
+     */
+    void test_endpoint_close() {
+        auto pair = LocalEndpoint::create_pair(64);
+        std::unique_ptr<LocalEndpoint> closing = std::move(pair.first);
+        LocalEndpoint& survivor = *pair.second;
+        std::string text;
+
+        CHECK(closing->write("last words", 10) == 10);
+        closing.reset();
+        CHECK(notified(survivor));
+        survivor.rearm();
+        CHECK(read_string(survivor, text, 4) == 4 && text == "last");
+        CHECK(read_string(survivor, text, 16) == 6 && text == " words");
+        CHECK(read_string(survivor, text, 16) == 0);
+        CHECK(read_string(survivor, text, 16) == 0);
+        CHECK(survivor.write("anyone?", 7) == -1 && errno == EPIPE);
+    }
+}
+
+int main() {
+    test_ring_wrap_around();
+    test_ring_full_and_empty();
+    test_endpoint_transfer();
+    test_endpoint_full_ring();
+    test_endpoint_close();
+    return test::result();
+}
@@ -0,0 +1,329 @@
+// Tests of the per-client write queue: FIFO order across slot growth, partial writes, the
+// overflow policies and the holes eviction leaves behind pinned frames, and flushing into a
+// socket that fills up or fails
+
+#include "Check.h"
+#include "server/WriteQueue.h"
+#include "common/Protocol.h"
+#include <string>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+    /**
+     * Encodes a Chat frame with the given payload
+     */
+    MessageRef frame(const std::string& payload) {
+        FrameHeader header;
+        return encode_frame(header, payload.data(), payload.size());
+    }
+
+    /**
+     * Bytes of a frame
+     */
+    std::string bytes_of(const MessageRef& message) {
+        return std::string(message.data(), message.size());
+    }
+
+    /**
+     * Concatenates what gather() describes, then unpins it again
+     */
+    std::string gathered(WriteQueue& queue) {
+        struct iovec segments[64];
+        int count = queue.gather(segments, 64);
+        std::string bytes;
+        for (int i = 0; i < count; ++i) {
+            bytes.append(static_cast<const char*>(segments[i].iov_base), segments[i].iov_len);
+        }
+        queue.advance(0);
+        return bytes;
+    }
+
+    /**
+     * Queue that only limits the frame count
+     */
+    WriteQueue counted(size_t max_messages, OverflowPolicy policy = OverflowPolicy::DropOldest) {
+        return WriteQueue(max_messages, 1024 * 1024, policy);
+    }
+
+    /**
+     * Reads everything currently available from a socket
+     */
+    std::string drain(int socket) {
+        std::string bytes;
+        char scratch[65536];
+        ssize_t length;
+        while ((length = recv(socket, scratch, sizeof(scratch), MSG_DONTWAIT)) > 0) {
+            bytes.append(scratch, static_cast<size_t>(length));
+        }
+        return bytes;
+    }
+
+    /**
+     * An encoded frame holds the header and both payload pieces; copies share one buffer
+     */
+    void test_encode_frame() {
+        FrameHeader header;
+        header.sender_id = 7;
+        header.sequence = 9;
+        MessageRef message = encode_frame(header, "split ", 6, "payload", 7);
+        FrameHeader decoded;
+        CHECK(message.size() == kFrameHeaderSize + 13 && decode_frame_header(message.data(), decoded));
+        CHECK(decoded.length == 13 && decoded.sender_id == 7 && decoded.sequence == 9);
+        CHECK(std::string(message.data() + kFrameHeaderSize, 13) == "split payload");
+
+        MessageRef copy = message;
+        CHECK(copy.data() == message.data());
+        message = MessageRef();
+        CHECK(!message && copy.size() == kFrameHeaderSize + 13);
+    }
+
+    /**
+     * Frames come out in order while the slot array wraps around and then grows
+     */
+    void test_fifo_across_growth() {
+        WriteQueue queue = counted(64);
+        std::string expected;
+        size_t evicted;
+        for (int i = 0; i < 6; ++i) {
+            MessageRef message = frame("a" + std::to_string(i));
+            expected.append(message.data(), message.size());
+            CHECK(queue.push(message, evicted) == PushResult::Queued && evicted == 0);
+        }
+        // Writing the first four moves the head forward, so the next pushes wrap around the slots
+        size_t written = 4 * (kFrameHeaderSize + 2);
+        queue.advance(written);
+        expected.erase(0, written);
+        for (int i = 0; i < 20; ++i) {
+            MessageRef message = frame("b" + std::to_string(i));
+            expected.append(message.data(), message.size());
+            CHECK(queue.push(message, evicted) == PushResult::Queued && evicted == 0);
+        }
+        CHECK(queue.size() == 22 && queue.bytes() == expected.size());
+        CHECK(gathered(queue) == expected);
+    }
+
+    /**
+     * A write that stops inside a frame is resumed from there
+     */
+    void test_partial_writes() {
+        WriteQueue queue = counted(8);
+        MessageRef first = frame("first");
+        MessageRef second = frame("second");
+        std::string expected = bytes_of(first) + bytes_of(second);
+        size_t evicted;
+        queue.push(first, evicted);
+        queue.push(second, evicted);
+
+        queue.advance(3);
+        CHECK(queue.size() == 2 && gathered(queue) == expected.substr(3));
+        queue.advance(first.size() - 3 + 4);
+        CHECK(queue.size() == 1 && gathered(queue) == expected.substr(first.size() + 4));
+        queue.advance(second.size() - 4);
+        CHECK(queue.empty() && queue.bytes() == 0);
+    }
+
+    /**
+     * DropOldest makes room by discarding the oldest frames, within both the frame and byte limits
+     */
+    void test_drop_oldest() {
+        WriteQueue queue = counted(3);
+        MessageRef frames[5];
+        size_t evicted;
+        for (int i = 0; i < 5; ++i) {
+            frames[i] = frame("frame " + std::to_string(i));
+            CHECK(queue.push(frames[i], evicted) == PushResult::Queued && evicted == (i < 3 ? 0u : 1u));
+        }
+        CHECK(queue.size() == 3 && gathered(queue) == bytes_of(frames[2]) + bytes_of(frames[3]) + bytes_of(frames[4]));
+        CHECK(queue.bytes() == 3 * frames[0].size());
+
+        // Room for two small frames by bytes: a large one evicts both
+        WriteQueue bounded(100, 2 * (kFrameHeaderSize + 4), OverflowPolicy::DropOldest);
+        bounded.push(frame("tiny"), evicted);
+        bounded.push(frame("tiny"), evicted);
+        MessageRef large = frame("eight by");
+        CHECK(bounded.push(large, evicted) == PushResult::Queued && evicted == 2);
+        CHECK(bounded.size() == 1 && gathered(bounded) == bytes_of(large));
+
+        // A frame larger than the whole byte limit can never be queued
+        CHECK(bounded.push(frame(std::string(2 * kFrameHeaderSize, 'x')), evicted) == PushResult::Dropped);
+    }
+
+    /**
+     * A partially written front frame, or frames handed out by gather(), are never evicted;
+     * the frames behind them go first and the order stays intact
+     */
+    void test_drop_oldest_keeps_started_frames() {
+        WriteQueue queue = counted(3);
+        MessageRef first = frame("first");
+        MessageRef second = frame("second");
+        MessageRef third = frame("third");
+        MessageRef fourth = frame("fourth");
+        size_t evicted;
+        queue.push(first, evicted);
+        queue.push(second, evicted);
+        queue.push(third, evicted);
+
+        queue.advance(3);
+        CHECK(queue.push(fourth, evicted) == PushResult::Queued && evicted == 1);
+        CHECK(gathered(queue) == bytes_of(first).substr(3) + bytes_of(third) + bytes_of(fourth));
+
+        // Pin the first two frames as a write in progress would; only the last one can go
+        struct iovec segments[2];
+        CHECK(queue.gather(segments, 2) == 2);
+        MessageRef fifth = frame("fifth");
+        CHECK(queue.push(fifth, evicted) == PushResult::Queued && evicted == 1);
+        queue.advance(0);
+        CHECK(gathered(queue) == bytes_of(first).substr(3) + bytes_of(third) + bytes_of(fifth));
+
+        // With everything pinned nothing can be evicted, so the new frame is dropped instead
+        WriteQueue pinned = counted(2);
+        pinned.push(first, evicted);
+        pinned.push(second, evicted);
+        CHECK(pinned.gather(segments, 2) == 2);
+        CHECK(pinned.push(third, evicted) == PushResult::Dropped && evicted == 0);
+        pinned.advance(0);
+        CHECK(pinned.push(third, evicted) == PushResult::Queued && evicted == 1);
+    }
+
+    /**
+     * Evicting behind pinned frames leaves holes instead of moving the pinned frames, which a
+     * write may still be reading; the write's advance() closes them up, partial or not
+     */
+    void test_holes_behind_pinned_frames() {
+        WriteQueue queue = counted(4);
+        MessageRef frames[6];
+        size_t evicted;
+        for (int i = 0; i < 4; ++i) {
+            frames[i] = frame("frame " + std::to_string(i));
+            queue.push(frames[i], evicted);
+        }
+        struct iovec segments[2];
+        CHECK(queue.gather(segments, 2) == 2);
+        for (int i = 4; i < 6; ++i) {
+            frames[i] = frame("frame " + std::to_string(i));
+            CHECK(queue.push(frames[i], evicted) == PushResult::Queued && evicted == 1);
+        }
+        CHECK(queue.size() == 4 && queue.bytes() == 4 * frames[0].size());
+        CHECK(segments[0].iov_base == frames[0].data() && segments[1].iov_base == frames[1].data());
+
+        // The write finished the first frame and three bytes of the second
+        queue.advance(frames[0].size() + 3);
+        CHECK(queue.size() == 3);
+        CHECK(gathered(queue) == bytes_of(frames[1]).substr(3) + bytes_of(frames[4]) + bytes_of(frames[5]));
+
+        // The same once the write covered every pinned frame
+        MessageRef sixth = frame("frame 6");
+        MessageRef seventh = frame("frame 7");
+        CHECK(queue.push(sixth, evicted) == PushResult::Queued && evicted == 0);
+        CHECK(queue.gather(segments, 1) == 1);
+        CHECK(queue.push(seventh, evicted) == PushResult::Queued && evicted == 1);
+        queue.advance(frames[1].size() - 3);
+        CHECK(queue.size() == 3 && gathered(queue) == bytes_of(frames[5]) + bytes_of(sixth) + bytes_of(seventh));
+    }
+
+    /**
+     * A pinned queue that keeps overflowing accumulates holes; growing the slot array keeps
+     * them in place, and the frames come out in order afterwards
+     */
+    void test_holes_across_growth() {
+        WriteQueue queue(1000, 3 * (kFrameHeaderSize + 3), OverflowPolicy::DropOldest);
+        MessageRef first = frame("000");
+        size_t evicted;
+        queue.push(first, evicted);
+        queue.push(frame("001"), evicted);
+        queue.push(frame("002"), evicted);
+        struct iovec segment;
+        CHECK(queue.gather(&segment, 1) == 1);
+
+        bool evicting = true;
+        MessageRef last[2];
+        for (int i = 3; i < 40; ++i) {
+            std::string text = std::to_string(i);
+            MessageRef message = frame(std::string(3 - text.size(), '0') + text);
+            evicting = evicting && queue.push(message, evicted) == PushResult::Queued && evicted == 1;
+            last[0] = last[1];
+            last[1] = message;
+        }
+        CHECK(evicting && queue.size() == 3 && std::string(first.data(), first.size()) ==
+              std::string(static_cast<const char*>(segment.iov_base), segment.iov_len));
+        queue.advance(first.size());
+        CHECK(queue.size() == 2 && gathered(queue) == bytes_of(last[0]) + bytes_of(last[1]));
+    }
+
+    /**
+     * DropNewest keeps the backlog and refuses new frames until it was written
+     */
+    void test_drop_newest() {
+        WriteQueue queue = counted(2, OverflowPolicy::DropNewest);
+        size_t evicted;
+        CHECK(queue.push(frame("one"), evicted) == PushResult::Queued);
+        CHECK(queue.push(frame("two"), evicted) == PushResult::Queued);
+        CHECK(queue.push(frame("three"), evicted) == PushResult::Dropped && evicted == 0);
+        CHECK(queue.size() == 2);
+        queue.advance(kFrameHeaderSize + 3);
+        CHECK(queue.push(frame("three"), evicted) == PushResult::Queued);
+    }
+
+    /**
+     * Disconnect reports the overflow and leaves the queue as it was
+     */
+    void test_disconnect() {
+        WriteQueue queue(100, 2 * (kFrameHeaderSize + 3), OverflowPolicy::Disconnect);
+        size_t evicted;
+        CHECK(queue.push(frame("one"), evicted) == PushResult::Queued);
+        CHECK(queue.push(frame("two"), evicted) == PushResult::Queued);
+        CHECK(queue.push(frame("six"), evicted) == PushResult::Overflow && evicted == 0);
+        CHECK(queue.size() == 2 && queue.bytes() == 2 * (kFrameHeaderSize + 3));
+    }
+
+    /**
+     * Flushing stops when the socket is full and picks up where it stopped; a closed peer is an error
+     */
+    void test_flush() {
+        int sockets[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+        int size = 4096;
+        setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+        WriteQueue queue = counted(1024);
+        std::string expected;
+        size_t evicted;
+        for (int i = 0; i < 200; ++i) {
+            MessageRef message = frame(std::string(1000, static_cast<char>('a' + i % 26)));
+            expected.append(message.data(), message.size());
+            queue.push(message, evicted);
+        }
+
+        std::string received;
+        FlushStatus status = queue.flush(sockets[0]);
+        CHECK(status == FlushStatus::Blocked && !queue.empty());
+        while (status == FlushStatus::Blocked) {
+            received += drain(sockets[1]);
+            status = queue.flush(sockets[0]);
+        }
+        received += drain(sockets[1]);
+        CHECK(status == FlushStatus::Done && queue.empty());
+        CHECK(received == expected);
+
+        close(sockets[1]);
+        queue.push(frame("nobody listens"), evicted);
+        CHECK(queue.flush(sockets[0]) == FlushStatus::Error);
+        close(sockets[0]);
+    }
+}
+
+int main() {
+    test_encode_frame();
+    test_fifo_across_growth();
+    test_partial_writes();
+    test_drop_oldest();
+    test_drop_oldest_keeps_started_frames();
+    test_holes_behind_pinned_frames();
+    test_holes_across_growth();
+    test_drop_newest();
+    test_disconnect();
+    test_flush();
+    return test::result();
+}